@@ -0,0 +1,130 @@
+/*
+ *	bulk_benchmark.cpp
+ *
+ *	Compares TrkBulkWriter with binding and executing one statement
+ *	per row, on a file database with the pragmas of the server.
+ *
+ *	Usage: trk_bulk_benchmark [rows] [batch size]
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+
+#include "bulkwriter.h"
+#include "databasepool.h"
+
+
+/* Rows the per-row autocommit loop writes at most, every row is a commit */
+static const int AUTOCOMMIT_ROW_LIMIT = 2000;
+
+/* Opens a fresh benchmark database with the file table */
+static TrkSqlite::TrkDatabasePool* OpenDatabase(const std::filesystem::path& Path)
+{
+	std::filesystem::remove(Path);
+	std::filesystem::remove(Path.string() + "-wal");
+	std::filesystem::remove(Path.string() + "-shm");
+
+	TrkSqlite::TrkDatabasePool* pool = new TrkSqlite::TrkDatabasePool(Path.string().c_str(), TrkSqlite::TrkDatabasePragmas(), 1);
+	pool->Writer()->Execute("CREATE TABLE file (id INTEGER PRIMARY KEY, path TEXT NOT NULL, revision INTEGER NOT NULL, size INTEGER NOT NULL)");
+	return pool;
+}
+
+/* Runs given writer function on a fresh database and prints rows per second */
+template <typename Function>
+static void Run(const char* Name, const std::filesystem::path& Path, int Rows, Function Write)
+{
+	TrkSqlite::TrkDatabasePool* pool = OpenDatabase(Path);
+	{
+		TrkSqlite::TrkDatabasePool::Lease database = pool->Writer();
+
+		const auto start = std::chrono::steady_clock::now();
+		Write(*database, Rows);
+		const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		TrkSqlite::TrkStatementLease count = database->Prepare("SELECT count(*) FROM file");
+		count->ExecuteStep();
+		if (count->GetColumnView(0).GetInt() != Rows)
+		{
+			std::cerr << Name << ": wrote " << count->GetColumnView(0).GetInt() << " of " << Rows << " rows" << std::endl;
+		}
+
+		std::cout << Name << ": " << Rows << " rows in " << elapsed * 1000.0 << " ms, "
+			<< static_cast<int64_t>(Rows / elapsed) << " rows/s" << std::endl;
+	}
+	delete pool;
+}
+
+/* Returns the path of the row */
+static TrkString GetPath(int Row)
+{
+	TrkString path = "//depot/project/src/file";
+	path << Row << ".cpp";
+	return path;
+}
+
+static const char* INSERT_QUERY = "INSERT INTO file (path, revision, size) VALUES (?, ?, ?)";
+
+
+int main(int argc, char** argv)
+{
+	const int rows = argc > 1 ? std::atoi(argv[1]) : 50000;
+	const int batch_size = argc > 2 ? std::atoi(argv[2]) : static_cast<int>(TrkSqlite::DEFAULT_BULK_BATCH_SIZE);
+
+	if (rows <= 0 || batch_size <= 0)
+	{
+		std::cerr << "Usage: " << argv[0] << " [rows] [batch size]" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	const std::filesystem::path path = std::filesystem::temp_directory_path() / "trk_bulk_benchmark.db";
+	std::cout << rows << " rows, batches of " << batch_size << std::endl;
+
+	Run("Row per commit  ", path, rows < AUTOCOMMIT_ROW_LIMIT ? rows : AUTOCOMMIT_ROW_LIMIT, [](TrkSqlite::TrkDatabase& Database, int Rows)
+	{
+		for (int i = 0; i < Rows; i++)
+		{
+			TrkSqlite::TrkStatement insert(Database, INSERT_QUERY);
+			insert.BindAll(GetPath(i), i % 7 + 1, int64_t(i) * 13);
+			insert.Execute();
+		}
+	});
+
+	Run("Row per execute ", path, rows, [](TrkSqlite::TrkDatabase& Database, int Rows)
+	{
+		TrkSqlite::TrkTransaction transaction(Database);
+		for (int i = 0; i < Rows; i++)
+		{
+			TrkSqlite::TrkStatement insert(Database, INSERT_QUERY);
+			insert.BindAll(GetPath(i), i % 7 + 1, int64_t(i) * 13);
+			insert.Execute();
+		}
+		transaction.Commit();
+	});
+
+	Run("Bulk, repeated  ", path, rows, [batch_size](TrkSqlite::TrkDatabase& Database, int Rows)
+	{
+		TrkSqlite::TrkBulkWriter writer(Database, INSERT_QUERY, batch_size, TrkSqlite::TrkBulkMode::Repeated);
+		for (int i = 0; i < Rows; i++)
+		{
+			writer.Add(GetPath(i), i % 7 + 1, int64_t(i) * 13);
+		}
+		writer.Flush();
+	});
+
+	Run("Bulk, multi-row ", path, rows, [batch_size](TrkSqlite::TrkDatabase& Database, int Rows)
+	{
+		TrkSqlite::TrkBulkWriter writer(Database, INSERT_QUERY, batch_size, TrkSqlite::TrkBulkMode::MultiRow);
+		for (int i = 0; i < Rows; i++)
+		{
+			writer.Add(GetPath(i), i % 7 + 1, int64_t(i) * 13);
+		}
+		writer.Flush();
+	});
+
+	std::filesystem::remove(path);
+	std::filesystem::remove(path.string() + "-wal");
+	std::filesystem::remove(path.string() + "-shm");
+	return EXIT_SUCCESS;
+}
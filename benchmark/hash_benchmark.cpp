@@ -0,0 +1,100 @@
+/*
+ *	hash_benchmark.cpp
+ *
+ *	Compares the password hash chain kernel with the per-round
+ *	TrkString implementation it replaced.
+ *
+ *	Usage: trk_hash_benchmark [iterations] [repeats]
+ */
+
+#define OPENSSL_SUPPRESS_DEPRECATED
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <openssl/sha.h>
+
+#include "crypto.h"
+
+
+/* SHA-256 as TrkCryptoHelper::SHA256 calculated it before the EVP kernel */
+static TrkString LegacySHA256(const TrkString& Str)
+{
+	unsigned char hash[SHA256_DIGEST_LENGTH];
+	SHA256_CTX sha256;
+	SHA256_Init(&sha256);
+	SHA256_Update(&sha256, (const char*)Str, Str.size());
+	SHA256_Final(hash, &sha256);
+
+	TrkString hashString;
+	char hex[3];
+	for (int i = 0; i < SHA256_DIGEST_LENGTH; i++)
+	{
+		sprintf(hex, "%02x", hash[i]);
+		hashString << hex;
+	}
+
+	return hashString;
+}
+
+/* Password hash chain as it was calculated before SHA256Chain */
+static TrkString LegacyChain(TrkString Value, const TrkString& Salt, int Iterations)
+{
+	for (int i = 0; i < Iterations; i++)
+	{
+		Value = LegacySHA256(Value + "::" + Salt);
+	}
+	return Value;
+}
+
+/* Runs given chain function and prints microseconds per login and nanoseconds per round */
+template <typename Function>
+static TrkString Run(const char* Name, Function Chain, int Iterations, int Repeats)
+{
+	const TrkString password = TrkCryptoHelper::SHA256("benchmark password");
+	const TrkString salt = "q1w2e3r4t5y6u7i8";
+	TrkString result;
+
+	// Warm up, the first call creates the digest context of this thread
+	result = Chain(password, salt, Iterations);
+
+	const auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < Repeats; i++)
+	{
+		result = Chain(password, salt, Iterations);
+	}
+	const double elapsed_ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+
+	std::cout << Name << ": "
+		<< elapsed_ns / Repeats / 1000.0 << " us per login, "
+		<< elapsed_ns / (static_cast<double>(Repeats) * Iterations) << " ns per round" << std::endl;
+
+	return result;
+}
+
+
+int main(int argc, char** argv)
+{
+	const int iterations = argc > 1 ? std::atoi(argv[1]) : 10000;
+	const int repeats = argc > 2 ? std::atoi(argv[2]) : 20;
+
+	if (iterations <= 0 || repeats <= 0)
+	{
+		std::cerr << "Usage: " << argv[0] << " [iterations] [repeats]" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::cout << iterations << " iterations, " << repeats << " repeats" << std::endl;
+
+	const TrkString legacy = Run("TrkString chain ", LegacyChain, iterations, repeats);
+	const TrkString kernel = Run("SHA256Chain     ", TrkCryptoHelper::SHA256Chain, iterations, repeats);
+
+	if (legacy != kernel)
+	{
+		std::cerr << "Results differ: " << legacy << " != " << kernel << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,292 @@
+/*
+ *	lsm_benchmark.cpp
+ *
+ *	Compares TrkLsmStore with a SQLite depot table on the metadata mix
+ *	of the server: batched inserts of file revisions in no particular
+ *	path order, point lookups, directory prefix scans, and inserts
+ *	interleaved with scans.
+ *
+ *	Usage: trk_lsm_benchmark [rows] [batch size]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <string>
+
+#include "databasepool.h"
+#include "lsmstore.h"
+
+
+/* Directories the rows are spread over */
+static const int DIRECTORIES = 1000;
+
+/* Lookups and scans each read phase runs */
+static const int LOOKUPS = 100000;
+static const int SCANS = 2000;
+
+/* Rows inserted between two scans of the mixed phase */
+static const int MIX_ROWS_PER_SCAN = 100;
+
+static const char* INSERT_QUERY = "INSERT OR REPLACE INTO file (path, revision, change, size) VALUES (?, ?, ?, ?)";
+static const char* LOOKUP_QUERY = "SELECT revision, change, size FROM file WHERE path = ?";
+static const char* SCAN_QUERY = "SELECT path, revision, change, size FROM file WHERE path >= ? AND path < ?";
+
+
+/* Metadata of a row, the value of the store */
+struct FileRecord
+{
+	int64_t revision;
+	int64_t change;
+	int64_t size;
+};
+
+/* Returns a pseudo-random number of an index, so both engines see the same sequence */
+static uint64_t Mix(uint64_t Index)
+{
+	Index ^= Index >> 33;
+	Index *= 0xff51afd7ed558ccdull;
+	Index ^= Index >> 33;
+	return Index;
+}
+
+/* Returns the directory prefix of a directory */
+static std::string GetDirectory(uint64_t Directory)
+{
+	return "//depot/project/dir" + std::to_string(Directory % DIRECTORIES) + "/";
+}
+
+/* Returns the path of a row, rows land in directories out of order */
+static std::string GetPath(int Row)
+{
+	return GetDirectory(Mix(Row)) + "file" + std::to_string(Row) + ".cpp";
+}
+
+/* Returns the record of a row */
+static FileRecord GetRecord(int Row)
+{
+	return FileRecord{ Row % 7 + 1, Row / 10 + 1, static_cast<int64_t>(Row) * 13 };
+}
+
+/* Runs given function and prints operations per second */
+static void Measure(const char* Engine, const char* Phase, int Operations, const std::function<int64_t()>& Function)
+{
+	const auto start = std::chrono::steady_clock::now();
+	const int64_t result = Function();
+	const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::cout << Engine << " " << Phase << ": " << Operations << " in " << elapsed * 1000.0 << " ms, "
+		<< static_cast<int64_t>(Operations / elapsed) << " ops/s (" << result << ")" << std::endl;
+}
+
+/* Removes a database or store from an earlier run */
+static void RemovePath(const std::filesystem::path& Path)
+{
+	std::filesystem::remove_all(Path);
+	std::filesystem::remove(Path.string() + "-wal");
+	std::filesystem::remove(Path.string() + "-shm");
+}
+
+
+static void RunSqlite(const std::filesystem::path& Path, int Rows, int BatchSize)
+{
+	RemovePath(Path);
+	TrkSqlite::TrkDatabasePool pool(Path.string().c_str(), TrkSqlite::TrkDatabasePragmas(), 1);
+	pool.Writer()->Execute("CREATE TABLE file (path TEXT NOT NULL PRIMARY KEY, revision INTEGER NOT NULL, change INTEGER NOT NULL, size INTEGER NOT NULL) WITHOUT ROWID");
+
+	auto insert = [&pool](int First, int Count)
+	{
+		TrkSqlite::TrkDatabasePool::Lease database = pool.Writer();
+		TrkSqlite::TrkTransaction transaction(*database);
+		for (int row = First; row < First + Count; row++)
+		{
+			const FileRecord record = GetRecord(row);
+			const std::string path = GetPath(row);
+			TrkSqlite::TrkStatementLease query = database->Prepare(INSERT_QUERY);
+			query->BindAll(std::string_view(path), record.revision, record.change, record.size);
+			query->Execute();
+		}
+		transaction.Commit();
+	};
+
+	auto scan = [&pool](uint64_t Directory)
+	{
+		std::string lower = GetDirectory(Directory), upper = lower;
+		upper.back() = static_cast<char>(upper.back() + 1);
+
+		TrkSqlite::TrkDatabasePool::Lease database = pool.Reader();
+		TrkSqlite::TrkStatementLease query = database->Prepare(SCAN_QUERY);
+		query->BindAll(std::string_view(lower), std::string_view(upper));
+
+		int64_t rows = 0;
+		while (query->ExecuteStep())
+		{
+			rows += query->GetColumnView(1).GetInt64() > 0 ? 1 : 0;
+		}
+		return rows;
+	};
+
+	Measure("SQLite", "insert     ", Rows, [&]()
+	{
+		for (int row = 0; row < Rows; row += BatchSize)
+		{
+			insert(row, std::min(BatchSize, Rows - row));
+		}
+		return static_cast<int64_t>(Rows);
+	});
+
+	Measure("SQLite", "lookup     ", LOOKUPS, [&]()
+	{
+		TrkSqlite::TrkDatabasePool::Lease database = pool.Reader();
+		int64_t found = 0;
+		for (int i = 0; i < LOOKUPS; i++)
+		{
+			const std::string path = GetPath(static_cast<int>(Mix(i + 1) % Rows));
+			TrkSqlite::TrkStatementLease query = database->Prepare(LOOKUP_QUERY);
+			query->BindAll(std::string_view(path));
+			found += query->ExecuteStep() ? 1 : 0;
+		}
+		return found;
+	});
+
+	Measure("SQLite", "prefix scan", SCANS, [&]()
+	{
+		int64_t rows = 0;
+		for (int i = 0; i < SCANS; i++)
+		{
+			rows += scan(Mix(i + 7));
+		}
+		return rows;
+	});
+
+	Measure("SQLite", "insert+scan", Rows, [&]()
+	{
+		int64_t rows = 0;
+		for (int row = 0; row < Rows; row += MIX_ROWS_PER_SCAN)
+		{
+			insert(Rows + row, std::min(MIX_ROWS_PER_SCAN, Rows - row));
+			rows += scan(Mix(row));
+		}
+		return rows;
+	});
+}
+
+static void RunLsm(const std::filesystem::path& Path, int Rows, int BatchSize)
+{
+	RemovePath(Path);
+	TrkLsmStore store;
+	if (!store.Open(Path.string().c_str()))
+	{
+		std::cerr << "LSM store could not be opened at " << Path.string() << std::endl;
+		return;
+	}
+
+	auto insert = [&store](int First, int Count)
+	{
+		TrkLsmBatch batch;
+		for (int row = First; row < First + Count; row++)
+		{
+			const FileRecord record = GetRecord(row);
+			batch.Put(GetPath(row), std::string_view(reinterpret_cast<const char*>(&record), sizeof(record)));
+		}
+		store.Write(batch);
+	};
+
+	auto scan = [&store](uint64_t Directory)
+	{
+		int64_t rows = 0;
+		store.Scan(GetDirectory(Directory), [&rows](std::string_view, std::string_view Value)
+		{
+			FileRecord record;
+			std::memcpy(&record, Value.data(), sizeof(record));
+			rows += record.revision > 0 ? 1 : 0;
+			return true;
+		});
+		return rows;
+	};
+
+	Measure("LSM   ", "insert     ", Rows, [&]()
+	{
+		for (int row = 0; row < Rows; row += BatchSize)
+		{
+			insert(row, std::min(BatchSize, Rows - row));
+		}
+		return static_cast<int64_t>(Rows);
+	});
+
+	Measure("LSM   ", "flush      ", 1, [&]()
+	{
+		store.Flush();
+		return static_cast<int64_t>(store.compactions.Get());
+	});
+
+	Measure("LSM   ", "lookup     ", LOOKUPS, [&]()
+	{
+		int64_t found = 0;
+		std::string value;
+		for (int i = 0; i < LOOKUPS; i++)
+		{
+			found += store.Get(GetPath(static_cast<int>(Mix(i + 1) % Rows)), value) ? 1 : 0;
+		}
+		return found;
+	});
+
+	Measure("LSM   ", "prefix scan", SCANS, [&]()
+	{
+		int64_t rows = 0;
+		for (int i = 0; i < SCANS; i++)
+		{
+			rows += scan(Mix(i + 7));
+		}
+		return rows;
+	});
+
+	Measure("LSM   ", "insert+scan", Rows, [&]()
+	{
+		int64_t rows = 0;
+		for (int row = 0; row < Rows; row += MIX_ROWS_PER_SCAN)
+		{
+			insert(Rows + row, std::min(MIX_ROWS_PER_SCAN, Rows - row));
+			rows += scan(Mix(row));
+		}
+		return rows;
+	});
+
+	std::cout << "LSM    levels:";
+	for (const size_t runs : store.GetLevelRuns())
+	{
+		std::cout << " " << runs;
+	}
+	std::cout << ", " << store.flushes.Get() << " flushes, " << store.compactions.Get() << " merges, "
+		<< store.bloom_skips.Get() << " bloom skips" << std::endl;
+}
+
+
+int main(int argc, char** argv)
+{
+	const int rows = argc > 1 ? std::atoi(argv[1]) : 200000;
+	const int batch_size = argc > 2 ? std::atoi(argv[2]) : 1000;
+
+	if (rows <= 0 || batch_size <= 0)
+	{
+		std::cerr << "Usage: " << argv[0] << " [rows] [batch size]" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::cout << rows << " rows in " << DIRECTORIES << " directories, batches of " << batch_size << std::endl;
+
+	const std::filesystem::path sqlite_path = std::filesystem::temp_directory_path() / "trk_lsm_benchmark.db";
+	const std::filesystem::path lsm_path = std::filesystem::temp_directory_path() / "trk_lsm_benchmark";
+
+	RunSqlite(sqlite_path, rows, batch_size);
+	RunLsm(lsm_path, rows, batch_size);
+
+	RemovePath(sqlite_path);
+	RemovePath(lsm_path);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,110 @@
+/*
+ *	chunker_test.cpp
+ */
+
+#include <chunker.h>
+#include <set>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include "memory_leak.h"
+
+
+namespace TrkCpp
+{
+
+	/* Returns pseudo-random bytes that do not repeat */
+	static std::string GetTestData(size_t Length, uint64_t Seed)
+	{
+		std::string data(Length, '\0');
+		uint64_t state = Seed;
+		for (size_t i = 0; i < Length; i++)
+		{
+			state = state * 6364136223846793005ull + 1442695040888963407ull;
+			data[i] = static_cast<char>(state >> 56);
+		}
+		return data;
+	}
+
+	/* Cuts data into chunks */
+	static std::vector<std::string> CutAll(const std::string& Data)
+	{
+		std::vector<std::string> chunks;
+		const uint8_t* data = reinterpret_cast<const uint8_t*>(Data.data());
+		for (size_t offset = 0; offset < Data.size(); )
+		{
+			const size_t length = TrkChunker::Cut(data + offset, Data.size() - offset);
+			chunks.push_back(Data.substr(offset, length));
+			offset += length;
+		}
+		return chunks;
+	}
+
+
+	/*
+	 *
+	 *	TrkChunker Tests
+	 *
+	 */
+
+
+	TEST(Chunker, ChunksStayWithinBounds)
+	{
+		MemoryLeakDetector leakDetector;
+
+		const std::string data = GetTestData(16 * 1024 * 1024, 1);
+		const std::vector<std::string> chunks = CutAll(data);
+
+		std::string joined;
+		for (size_t i = 0; i < chunks.size(); i++)
+		{
+			EXPECT_LE(chunks[i].size(), static_cast<size_t>(TRK_CHUNK_MAX_SIZE));
+			if (i + 1 < chunks.size())
+			{
+				EXPECT_GT(chunks[i].size(), static_cast<size_t>(TRK_CHUNK_MIN_SIZE));
+			}
+			joined += chunks[i];
+		}
+		EXPECT_EQ(data, joined);
+
+		// Normalized chunking keeps most chunks around the average
+		const size_t average = data.size() / chunks.size();
+		EXPECT_GT(average, static_cast<size_t>(TRK_CHUNK_AVG_SIZE / 2));
+		EXPECT_LT(average, static_cast<size_t>(TRK_CHUNK_AVG_SIZE * 2));
+
+		// Short data is one chunk
+		const uint8_t byte = 0;
+		EXPECT_EQ(0u, TrkChunker::Cut(&byte, 0));
+		EXPECT_EQ(1u, TrkChunker::Cut(&byte, 1));
+		EXPECT_EQ(static_cast<size_t>(TRK_CHUNK_MIN_SIZE), TrkChunker::Cut(reinterpret_cast<const uint8_t*>(data.data()), TRK_CHUNK_MIN_SIZE));
+
+		// Without a boundary the chunk ends at the maximum
+		const std::string zeros(TRK_CHUNK_MAX_SIZE * 2, '\0');
+		EXPECT_EQ(static_cast<size_t>(TRK_CHUNK_MAX_SIZE), TrkChunker::Cut(reinterpret_cast<const uint8_t*>(zeros.data()), zeros.size()));
+	}
+
+	TEST(Chunker, InsertOnlyChangesNearbyChunks)
+	{
+		MemoryLeakDetector leakDetector;
+
+		const std::string data = GetTestData(8 * 1024 * 1024, 2);
+		std::string edited = data;
+		edited.insert(1000, "x");
+		edited.erase(5 * 1024 * 1024, 10);
+
+		const std::vector<std::string> before = CutAll(data);
+		const std::vector<std::string> after = CutAll(edited);
+		const std::set<std::string> known(before.begin(), before.end());
+
+		size_t changed = 0;
+		for (const std::string& chunk : after)
+		{
+			changed += known.count(chunk) == 0 ? 1 : 0;
+		}
+
+		// Each edit changes the chunk it falls in, and at most the one after when it moves a boundary
+		EXPECT_GE(changed, 2u);
+		EXPECT_LE(changed, 4u);
+		EXPECT_GT(after.size(), 50u);
+	}
+}
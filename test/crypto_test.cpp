@@ -0,0 +1,130 @@
+/*
+ *	crypto_test.cpp
+ */
+
+#include <crypto.h>
+#include <cstring>
+#include <string>
+#include <gtest/gtest.h>
+#include "memory_leak.h"
+
+
+namespace TrkCpp
+{
+
+	/* Password hash chain as it was calculated before SHA256Chain */
+	static TrkString LegacyChain(TrkString Value, const TrkString& Salt, int Iterations)
+	{
+		for (int i = 0; i < Iterations; i++)
+		{
+			Value = TrkCryptoHelper::SHA256(Value + "::" + Salt);
+		}
+		return Value;
+	}
+
+
+	/*
+	 *
+	 *	TrkCryptoHelper Tests
+	 *
+	 */
+
+
+	TEST(Crypto, SHA256KnownValue)
+	{
+		EXPECT_STREQ(TrkCryptoHelper::SHA256("abc").c_str(), "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+		EXPECT_STREQ(TrkCryptoHelper::SHA256("").c_str(), "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+	}
+
+	TEST(Crypto, SHA256Seperator)
+	{
+		const TrkString hash = TrkCryptoHelper::SHA256("abc", ":");
+		EXPECT_EQ(hash.size(), 64 + 31);
+		EXPECT_EQ(std::string(hash.c_str()).rfind("ba:78:16:bf:", 0), 0);
+		EXPECT_EQ(std::string(hash.c_str()).substr(hash.size() - 5), "15:ad");
+	}
+
+	TEST(Crypto, HexEncode)
+	{
+		const unsigned char data[] = { 0x00, 0x0F, 0xA5, 0xFF };
+		char hex[9] = { 0 };
+		TrkCryptoHelper::HexEncode(data, sizeof(data), hex);
+		EXPECT_STREQ(hex, "000fa5ff");
+	}
+
+	TEST(Crypto, SHA256ChainMatchesLegacyChain)
+	{
+		const TrkString password = TrkCryptoHelper::SHA256("secret");
+		const TrkString salt = "q1w2e3r4t5y6u7i8";
+
+		for (int iterations : { 1, 2, 3, 17 })
+		{
+			EXPECT_EQ(TrkCryptoHelper::SHA256Chain(password, salt, iterations), LegacyChain(password, salt, iterations));
+		}
+	}
+
+	TEST(Crypto, SHA256ChainLongSalt)
+	{
+		const TrkString password = "password";
+		const TrkString salt = std::string(300, 's').c_str();
+		EXPECT_EQ(TrkCryptoHelper::SHA256Chain(password, salt, 5), LegacyChain(password, salt, 5));
+	}
+
+	TEST(Crypto, SHA256ChainWithoutIterations)
+	{
+		EXPECT_EQ(TrkCryptoHelper::SHA256Chain("value", "salt", 0), TrkString("value"));
+	}
+
+	TEST(Crypto, HMACSHA256KnownVector)
+	{
+		// RFC 4231 test case 1
+		unsigned char key[20];
+		std::memset(key, 0x0b, sizeof(key));
+		EXPECT_EQ(TrkCryptoHelper::HMACSHA256(key, sizeof(key), "Hi There"), TrkString("b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7"));
+	}
+
+	TEST(Crypto, ConstantTimeEquals)
+	{
+		EXPECT_TRUE(TrkCryptoHelper::ConstantTimeEquals("abcdef", "abcdef"));
+		EXPECT_FALSE(TrkCryptoHelper::ConstantTimeEquals("abcdef", "abcdeg"));
+		EXPECT_FALSE(TrkCryptoHelper::ConstantTimeEquals("abcdef", "abcde"));
+	}
+
+	TEST(Crypto, SHA256StreamMatchesOneShot)
+	{
+		TrkSHA256Stream stream;
+		EXPECT_TRUE(stream.Update("hello ", 6));
+		EXPECT_TRUE(stream.Update("world", 5));
+		EXPECT_EQ(stream.Final(), TrkCryptoHelper::SHA256("hello world"));
+
+		// Starts over after Init
+		EXPECT_TRUE(stream.Init());
+		EXPECT_EQ(stream.Final(), TrkString("e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"));
+	}
+
+	TEST(Crypto, Base64RoundTrip)
+	{
+		EXPECT_EQ(TrkCryptoHelper::Base64Encode(reinterpret_cast<const unsigned char*>("foobar"), 6), TrkString("Zm9vYmFy"));
+		EXPECT_EQ(TrkCryptoHelper::Base64Encode(reinterpret_cast<const unsigned char*>("fo"), 2), TrkString("Zm8="));
+		EXPECT_EQ(TrkCryptoHelper::Base64Encode(nullptr, 0), TrkString(""));
+
+		// Binary data with zero bytes, every length of padding
+		for (size_t length = 0; length < 8; length++)
+		{
+			std::string data(length, '\0');
+			for (size_t i = 0; i < length; i++)
+			{
+				data[i] = static_cast<char>(i * 97);
+			}
+
+			std::string decoded;
+			ASSERT_TRUE(TrkCryptoHelper::Base64Decode(TrkCryptoHelper::Base64Encode(reinterpret_cast<const unsigned char*>(data.data()), data.size()), decoded));
+			EXPECT_EQ(data, decoded);
+		}
+
+		std::string decoded;
+		EXPECT_FALSE(TrkCryptoHelper::Base64Decode("Zm9", decoded));
+		EXPECT_FALSE(TrkCryptoHelper::Base64Decode("Zm9?", decoded));
+	}
+
+}
@@ -3,11 +3,23 @@
  */
 
 #include <sqlite3.h>
+#include <databasepool.h>
+#include <databasewriter.h>
+#include <bulkwriter.h>
+#include <atomic>
 #include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <filesystem>
+#include <thread>
+#include <vector>
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 #include <gtest/gtest.h>
 #include "memory_leak.h"
+#include "test_helpers.h"
 
 using namespace TrkSqlite;
 namespace fs = std::filesystem;
@@ -987,6 +999,255 @@ namespace TrkCpp
 		}
 	}
 
+	TEST(Statement, GetColumnView)
+	{
+		MemoryLeakDetector leakDetector;
+
+		{
+			TrkDatabase db(":memory:", TrkSqlite::OPEN_READWRITE | TrkSqlite::OPEN_CREATE);
+			EXPECT_EQ(0, db.Execute("CREATE TABLE test (id INTEGER PRIMARY KEY, msg TEXT, blob BLOB, int INTEGER, double REAL)"));
+
+			const char buffer[] = "bl\0b";
+			TrkStatement insert(db, "INSERT INTO test VALUES (NULL, ?, ?, ?, ?)");
+			insert.Bind(1, "first");
+			insert.Bind(2, buffer, sizeof(buffer));
+			insert.Bind(3, 123);
+			insert.Bind(4, 0.123);
+			EXPECT_EQ(1, insert.Execute());
+			EXPECT_EQ(1, db.Execute("INSERT INTO test VALUES (NULL, NULL, NULL, NULL, NULL)"));
+
+			TrkStatement query(db, "SELECT msg, blob, int, double FROM test ORDER BY id");
+			EXPECT_THROW(query.GetColumnView(0), TrkDatabaseException);
+
+			ASSERT_TRUE(query.ExecuteStep());
+			EXPECT_THROW(query.GetColumnView(4), TrkDatabaseException);
+			EXPECT_THROW(query.GetColumnView("unknown"), TrkDatabaseException);
+
+			const TrkColumn msg = query.GetColumnView("msg");
+			EXPECT_EQ(TrkSqlite::TEXT, msg.GetType());
+			EXPECT_EQ(std::string_view("first"), msg.GetStringView());
+			EXPECT_EQ(5, msg.GetBytes());
+
+			const TrkBlobView blob = query.GetColumnView(1).GetBlobView();
+			ASSERT_EQ(sizeof(buffer), blob.size);
+			EXPECT_EQ(0, memcmp(buffer, blob.data, blob.size));
+
+			EXPECT_EQ(123, query.GetColumnView(2).GetInt());
+			EXPECT_EQ(123, query.GetColumnView(2).GetInt64());
+			EXPECT_DOUBLE_EQ(0.123, query.GetColumnView(3).GetDouble());
+
+			// Views of TrkValue point into the same row
+			EXPECT_EQ(msg.GetStringView().data(), query.GetColumn(0).GetStringView().data());
+
+			ASSERT_TRUE(query.ExecuteStep());
+			EXPECT_TRUE(query.GetColumnView(0).IsNull());
+			EXPECT_TRUE(query.GetColumnView(0).GetStringView().empty());
+			EXPECT_TRUE(query.GetColumnView(1).GetBlobView().empty());
+			EXPECT_EQ(nullptr, query.GetColumnView(1).GetBlobView().data);
+		}
+	}
+
+	TEST(Statement, TypedRows)
+	{
+		MemoryLeakDetector leakDetector;
+
+		{
+			TrkDatabase db(":memory:", TrkSqlite::OPEN_READWRITE | TrkSqlite::OPEN_CREATE);
+			EXPECT_EQ(0, db.Execute("CREATE TABLE test (id INTEGER PRIMARY KEY, msg TEXT, size INTEGER, ratio REAL)"));
+
+			TrkStatement insert(db, "INSERT INTO test VALUES (?, ?, ?, ?)");
+			insert.BindAll(1, "first", int64_t(10000000000), 0.5);
+			EXPECT_EQ(1, insert.Execute());
+			insert.Reset();
+			insert.BindAll(2, std::string_view("second"), std::optional<int64_t>(), nullptr);
+			EXPECT_EQ(1, insert.Execute());
+			insert.Reset();
+			EXPECT_THROW(insert.BindAll(3, "third"), TrkDatabaseException);
+
+			TrkStatement query(db, "SELECT id, msg, size, ratio FROM test ORDER BY id");
+			EXPECT_THROW((query.Rows<int, std::string_view>()), TrkDatabaseException);
+
+			std::vector<TrkString> messages;
+			int64_t total = 0;
+			int nulls = 0;
+			for (const auto& [id, msg, size, ratio] : query.Rows<int, std::string_view, std::optional<int64_t>, double>())
+			{
+				messages.push_back(TrkString(msg.data(), msg.data() + msg.size()));
+				total += id;
+				if (!size.has_value())
+				{
+					nulls++;
+				}
+				else
+				{
+					EXPECT_EQ(10000000000, *size);
+					EXPECT_DOUBLE_EQ(0.5, ratio);
+				}
+			}
+			ASSERT_EQ(2u, messages.size());
+			EXPECT_EQ(TrkString("first"), messages[0]);
+			EXPECT_EQ(TrkString("second"), messages[1]);
+			EXPECT_EQ(3, total);
+			EXPECT_EQ(1, nulls);
+		}
+	}
+
+	TEST(Statement, TypedRowsIntoStruct)
+	{
+		MemoryLeakDetector leakDetector;
+
+		{
+			TrkDatabase db(":memory:", TrkSqlite::OPEN_READWRITE | TrkSqlite::OPEN_CREATE);
+			EXPECT_EQ(0, db.Execute("CREATE TABLE test (id INTEGER PRIMARY KEY, msg TEXT)"));
+			EXPECT_EQ(1, db.Execute("INSERT INTO test VALUES (7, \"seven\")"));
+
+			struct Entry
+			{
+				int64_t id;
+				TrkString msg;
+			};
+
+			TrkStatement query(db, "SELECT id, msg FROM test WHERE id = ?");
+			query.BindAll(7);
+			int count = 0;
+			for (const Entry& entry : query.RowsAs<Entry, int64_t, TrkString>())
+			{
+				EXPECT_EQ(7, entry.id);
+				EXPECT_EQ(TrkString("seven"), entry.msg);
+				count++;
+			}
+			EXPECT_EQ(1, count);
+
+			query.Reset();
+			EXPECT_THROW((query.GetRow<int64_t, TrkString>()), TrkDatabaseException);
+			ASSERT_TRUE(query.ExecuteStep());
+			const auto [id, msg] = query.GetRow<int64_t, TrkString>();
+			EXPECT_EQ(7, id);
+			EXPECT_EQ(TrkString("seven"), msg);
+		}
+	}
+
+	TEST(Statement, NoThrowResults)
+	{
+		MemoryLeakDetector leakDetector;
+
+		{
+			TrkDatabase db(":memory:", TrkSqlite::OPEN_READWRITE | TrkSqlite::OPEN_CREATE);
+			EXPECT_EQ(0, db.Execute("CREATE TABLE test (id INTEGER PRIMARY KEY, msg TEXT UNIQUE)"));
+
+			TrkStatement insert(db, "INSERT INTO test VALUES (NULL, ?)");
+			insert.Bind(1, "first");
+			const TrkResult<int> inserted = insert.TryExecute();
+			ASSERT_TRUE(inserted.HasValue());
+			EXPECT_EQ(1, *inserted);
+
+			insert.Reset();
+			const TrkResult<int> duplicate = insert.TryExecute();
+			EXPECT_FALSE(duplicate);
+			EXPECT_EQ(TrkSqlite::CODE_CONSTRAINT, duplicate.GetErrorCode());
+			EXPECT_EQ(-1, duplicate.ValueOr(-1));
+			EXPECT_THROW(duplicate.Value(), TrkDatabaseException);
+
+			TrkStatement query(db, "SELECT id, msg FROM test WHERE msg = ?");
+			EXPECT_EQ(TrkSqlite::CODE_MISUSE, query.TryGetColumn(0).GetErrorCode());
+			EXPECT_EQ(TrkSqlite::CODE_MISUSE, (query.TryGetRow<int64_t, std::string_view>().GetErrorCode()));
+
+			query.Bind(1, "first");
+			TrkResult<bool> step = query.TryStep();
+			ASSERT_TRUE(step.HasValue());
+			EXPECT_TRUE(*step);
+			EXPECT_EQ(1, query.TryGetColumn("id")->GetInt());
+			EXPECT_EQ(TrkSqlite::CODE_RANGE, query.TryGetColumn(2).GetErrorCode());
+			EXPECT_EQ(TrkSqlite::CODE_RANGE, query.TryGetColumn("unknown").GetErrorCode());
+			EXPECT_EQ(TrkSqlite::CODE_RANGE, query.TryGetRow<int64_t>().GetErrorCode());
+			const auto row = query.TryGetRow<int64_t, std::string_view>();
+			ASSERT_TRUE(row.HasValue());
+			EXPECT_EQ(std::string_view("first"), std::get<1>(*row));
+
+			// No row is a value, not an error
+			query.Reset();
+			query.Bind(1, "unknown");
+			step = query.TryStep();
+			ASSERT_TRUE(step.HasValue());
+			EXPECT_FALSE(*step);
+			EXPECT_EQ(TrkSqlite::CODE_MISUSE, query.TryStep().GetErrorCode());
+		}
+	}
+
+	TEST(Database, CloseWithLiveStatement)
+	{
+		MemoryLeakDetector leakDetector;
+
+		{
+			std::unique_ptr<TrkDatabase> db(new TrkDatabase(":memory:", TrkSqlite::OPEN_READWRITE | TrkSqlite::OPEN_CREATE));
+			std::unique_ptr<TrkStatement> query(new TrkStatement(*db, "SELECT 1"));
+
+			// The connection is closed once the statement is finalized
+			EXPECT_NO_THROW(db.reset());
+			query.reset();
+		}
+	}
+
+	TEST(Statement, ColumnNameIndex)
+	{
+		MemoryLeakDetector leakDetector;
+
+		{
+			TrkDatabase db(":memory:", TrkSqlite::OPEN_READWRITE | TrkSqlite::OPEN_CREATE);
+
+			TrkString select = "SELECT 1 AS dup, 2 AS dup";
+			for (int i = 0; i < 40; i++)
+			{
+				select << ", " << i << " AS column" << i;
+			}
+
+			const TrkStatement* prepared = nullptr;
+			{
+				TrkStatementLease first = db.Prepare(select);
+				EXPECT_EQ(42, first->GetColumnCount());
+				EXPECT_EQ(1, first->GetColumnIndex("dup"));
+				EXPECT_EQ(41, first->GetColumnIndex(TrkString("column39")));
+				EXPECT_THROW(first->GetColumnIndex("column40"), TrkDatabaseException);
+				EXPECT_THROW(first->GetColumnIndex(""), TrkDatabaseException);
+				prepared = &*first;
+			}
+
+			// The cached statement comes back with its index
+			TrkStatementLease second = db.Prepare(select);
+			EXPECT_EQ(prepared, &*second);
+			EXPECT_EQ(2, second->GetColumnIndex("column0"));
+		}
+
+		{
+			TrkDatabase db(":memory:", TrkSqlite::OPEN_READWRITE | TrkSqlite::OPEN_CREATE);
+			TrkStatement query(db, "SELECT 1 AS a, 2 AS b, 3 AS c");
+			ASSERT_TRUE(query.ExecuteStep());
+
+			// Built when prepared, lookups from many threads only read it
+			std::vector<std::thread> threads;
+			std::atomic<int> mismatches(0);
+			for (int t = 0; t < 4; t++)
+			{
+				threads.emplace_back([&query, &mismatches]()
+				{
+					for (int i = 0; i < 1000; i++)
+					{
+						if (query.GetColumnIndex("c") != 2 || query.GetColumnIndex("a") != 0)
+						{
+							mismatches++;
+						}
+					}
+				});
+			}
+			for (std::thread& thread : threads)
+			{
+				thread.join();
+			}
+			EXPECT_EQ(0, mismatches.load());
+			EXPECT_EQ(2, query.GetColumnView("b").GetInt());
+		}
+	}
+
 	TEST(Statement, GetName)
 	{
 		MemoryLeakDetector leakDetector;
@@ -1005,6 +1266,471 @@ namespace TrkCpp
 		}
 	}
 
+	/*
+	 *
+	 *	TrkStatementCache Tests
+	 *
+	 */
+
+	TEST(StatementCache, ReusesResetStatements)
+	{
+		MemoryLeakDetector leakDetector;
+
+		{
+			TrkDatabase db(":memory:", TrkSqlite::OPEN_READWRITE | TrkSqlite::OPEN_CREATE);
+			EXPECT_EQ(0, db.Execute("CREATE TABLE test (id INTEGER PRIMARY KEY, value TEXT)"));
+			EXPECT_EQ(1, db.Execute("INSERT INTO test VALUES (1, \"first\")"));
+			EXPECT_EQ(1, db.Execute("INSERT INTO test VALUES (2, \"second\")"));
+
+			const TrkSqlite::TrkStatement* first_statement;
+			{
+				TrkStatementLease query = db.Prepare("SELECT value FROM test WHERE id = ?");
+				first_statement = &*query;
+				query->Bind(1, 1);
+				EXPECT_TRUE(query->ExecuteStep());
+				EXPECT_STREQ("first", query->GetColumn(0).GetString());
+			}
+			EXPECT_EQ(0, db.GetStatementCacheHits());
+			EXPECT_EQ(1, db.GetStatementCacheMisses());
+
+			{
+				// Returned statement is reset and its bindings are cleared
+				TrkStatementLease query = db.Prepare("SELECT value FROM test WHERE id = ?");
+				EXPECT_EQ(first_statement, &*query);
+				EXPECT_FALSE(query->HasRow());
+				EXPECT_FALSE(query->ExecuteStep());
+
+				query->Reset();
+				query->Bind(1, 2);
+				EXPECT_TRUE(query->ExecuteStep());
+				EXPECT_STREQ("second", query->GetColumn(0).GetString());
+			}
+			EXPECT_EQ(1, db.GetStatementCacheHits());
+			EXPECT_EQ(1, db.GetStatementCacheMisses());
+		}
+	}
+
+	TEST(StatementCache, ConcurrentLeasesOfSameQuery)
+	{
+		MemoryLeakDetector leakDetector;
+
+		{
+			TrkDatabase db(":memory:", TrkSqlite::OPEN_READWRITE | TrkSqlite::OPEN_CREATE);
+
+			TrkStatementLease first = db.Prepare("SELECT 1");
+			TrkStatementLease second = db.Prepare("SELECT 1");
+			EXPECT_NE(&*first, &*second);
+			EXPECT_EQ(2, db.GetStatementCacheMisses());
+
+			TrkStatementLease moved = std::move(first);
+			EXPECT_TRUE(moved->ExecuteStep());
+			EXPECT_EQ(1, moved->GetColumn(0).GetInt());
+		}
+	}
+
+	TEST(StatementCache, EvictsLeastRecentlyUsed)
+	{
+		MemoryLeakDetector leakDetector;
+
+		{
+			TrkDatabase db(":memory:", TrkSqlite::OPEN_READWRITE | TrkSqlite::OPEN_CREATE);
+			db.SetStatementCacheSize(2);
+
+			(void)db.Prepare("SELECT 1");
+			(void)db.Prepare("SELECT 2");
+			(void)db.Prepare("SELECT 3");
+			EXPECT_EQ(3, db.GetStatementCacheMisses());
+
+			// "SELECT 1" was the least recently used one
+			(void)db.Prepare("SELECT 3");
+			(void)db.Prepare("SELECT 2");
+			EXPECT_EQ(2, db.GetStatementCacheHits());
+
+			(void)db.Prepare("SELECT 1");
+			EXPECT_EQ(4, db.GetStatementCacheMisses());
+
+			db.SetStatementCacheSize(0);
+			(void)db.Prepare("SELECT 2");
+			EXPECT_EQ(5, db.GetStatementCacheMisses());
+		}
+	}
+
+	/*
+	 *
+	 *	TrkStatementProfiler Tests
+	 *
+	 */
+
+	/* Returns the profiler counters of given query */
+	static TrkStatementStatsSnapshot FindStatementStats(const char* Query)
+	{
+		for (const TrkStatementStatsSnapshot& snapshot : TrkStatementProfiler::Get().Snapshot())
+		{
+			if (snapshot.query == Query)
+			{
+				return snapshot;
+			}
+		}
+		return TrkStatementStatsSnapshot{ "", 0, 0, 0, 0, 0, 0 };
+	}
+
+	// The profiler keeps its counters for the process, these tests do not check for leaks
+	TEST(StatementProfiler, CountsExecutionsAndRows)
+	{
+		TrkStatementProfiler& profiler = TrkStatementProfiler::Get();
+		profiler.SetEnabled(true);
+		profiler.Reset();
+
+		const char* query = "SELECT id FROM test WHERE id >= ? /* profiler */";
+		{
+			TrkDatabase db(":memory:", TrkSqlite::OPEN_READWRITE | TrkSqlite::OPEN_CREATE);
+			db.Execute("CREATE TABLE test (id INTEGER PRIMARY KEY)");
+			db.Execute("WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < 10) INSERT INTO test SELECT i FROM n");
+
+			{
+				TrkStatementLease statement = db.Prepare(query);
+				statement->Bind(1, 1);
+				int rows = 0;
+				while (statement->ExecuteStep())
+				{
+					rows++;
+				}
+				EXPECT_EQ(10, rows);
+			}
+			{
+				// Returning the lease ends an execution whose rows were not all fetched
+				TrkStatementLease statement = db.Prepare(query);
+				statement->Bind(1, 5);
+				EXPECT_TRUE(statement->ExecuteStep());
+			}
+			{
+				TrkStatement statement(db, query);
+				statement.Bind(1, 8);
+				EXPECT_TRUE(statement.ExecuteStep());
+				statement.Reset();
+				EXPECT_TRUE(statement.ExecuteStep());
+			}
+		}
+
+		const TrkStatementStatsSnapshot stats = FindStatementStats(query);
+		EXPECT_EQ(4, stats.calls);
+		EXPECT_EQ(13, stats.rows);
+		EXPECT_GE(stats.total_time, stats.max_time);
+		EXPECT_EQ(0, stats.slow);
+
+		profiler.SetEnabled(false);
+	}
+
+	TEST(StatementProfiler, SlowStatementLog)
+	{
+		TrkStatementProfiler& profiler = TrkStatementProfiler::Get();
+		profiler.SetEnabled(true);
+		profiler.Reset();
+		profiler.SetSlowThreshold(1);
+
+		std::vector<TrkString> handled;
+		profiler.SetSlowStatementHandler([&handled](const TrkSlowStatement& Statement) { handled.push_back(Statement.query); });
+
+		const char* query = "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < ?) SELECT count(*) FROM n";
+		{
+			TrkDatabase db(":memory:", TrkSqlite::OPEN_READWRITE | TrkSqlite::OPEN_CREATE);
+			TrkStatement statement(db, query);
+			statement.Bind(1, 200000);
+			EXPECT_TRUE(statement.ExecuteStep());
+			EXPECT_EQ(200000, statement.GetColumnView(0).GetInt());
+			EXPECT_FALSE(statement.ExecuteStep());
+		}
+
+		profiler.SetSlowStatementHandler(nullptr);
+		profiler.SetSlowThreshold(0);
+		profiler.SetEnabled(false);
+
+		EXPECT_EQ(1, FindStatementStats(query).slow);
+
+		const std::vector<TrkSlowStatement> slow = profiler.GetSlowStatements();
+		ASSERT_EQ(1u, slow.size());
+		EXPECT_GE(slow[0].duration, 1);
+		// Bound values are not recorded
+		EXPECT_EQ(TrkString(query), slow[0].query);
+		ASSERT_EQ(1u, handled.size());
+		EXPECT_EQ(slow[0].query, handled[0]);
+	}
+
+	TEST(StatementProfiler, CountsBusyRetries)
+	{
+		const fs::path path = fs::path(GetTestPath("busy.db").c_str());
+		std::remove(path.string().c_str());
+
+		TrkStatementProfiler& profiler = TrkStatementProfiler::Get();
+		profiler.SetEnabled(true);
+		profiler.Reset();
+
+		const char* query = "INSERT INTO test VALUES (2) /* profiler */";
+		{
+			TrkDatabase holder(path.string().c_str(), TrkSqlite::OPEN_READWRITE | TrkSqlite::OPEN_CREATE);
+			holder.Execute("CREATE TABLE test (id INTEGER PRIMARY KEY)");
+			holder.Execute("BEGIN IMMEDIATE");
+			holder.Execute("INSERT INTO test VALUES (1)");
+
+			TrkDatabase waiter(path.string().c_str(), TrkSqlite::OPEN_READWRITE);
+			waiter.SetBusyTimeout(50);
+			TrkStatement insert(waiter, query);
+			const TrkResult<int> result = insert.TryExecute();
+			EXPECT_FALSE(result.HasValue());
+			EXPECT_EQ(TrkSqlite::BUSY, result.GetErrorCode());
+
+			holder.Execute("COMMIT");
+		}
+
+		const TrkStatementStatsSnapshot stats = FindStatementStats(query);
+		EXPECT_EQ(1, stats.calls);
+		EXPECT_GT(stats.busy_retries, 0);
+		EXPECT_GE(profiler.busy_retries.load(), stats.busy_retries);
+		EXPECT_GE(stats.total_time, 40000);
+
+		profiler.SetEnabled(false);
+		std::remove(path.string().c_str());
+	}
+
+	/*
+	 *
+	 *	TrkDatabasePool Tests
+	 *
+	 */
+
+	/* Removes a pool test database with its WAL files */
+	static void RemovePoolDatabase(const fs::path& Path)
+	{
+		fs::remove(Path);
+		fs::remove(Path.string() + "-wal");
+		fs::remove(Path.string() + "-shm");
+	}
+
+	TEST(DatabasePool, WalAndCheckout)
+	{
+		const fs::path path = fs::path(GetTestPath("checkout.db").c_str());
+		RemovePoolDatabase(path);
+		{
+			TrkDatabasePool pool(path.string().c_str(), TrkDatabasePragmas(), 2);
+			EXPECT_EQ(2, pool.GetReaderCount());
+			EXPECT_STREQ("wal", pool.GetJournalMode());
+
+			{
+				TrkDatabasePool::Lease writer = pool.Writer();
+				writer->Execute("CREATE TABLE test (id INTEGER PRIMARY KEY, value TEXT)");
+
+				// Reads of the thread holding the writer go through it
+				TrkDatabasePool::Lease reader = pool.Reader();
+				EXPECT_EQ(&*writer, &*reader);
+			}
+
+			{
+				TrkDatabasePool::Lease reader = pool.Reader();
+				TrkDatabasePool::Lease nested = pool.Reader();
+				EXPECT_EQ(&*reader, &*nested);
+
+				// Readers can not write
+				EXPECT_THROW(reader->Execute("INSERT INTO test VALUES (1, \"first\")"), TrkDatabaseException);
+				EXPECT_TRUE(reader->TableExists("test"));
+			}
+
+			pool.Writer()->Execute("INSERT INTO test VALUES (1, \"first\")");
+
+			TrkDatabasePool::Lease reader = pool.Reader();
+			TrkStatementLease query = reader->Prepare("SELECT value FROM test WHERE id = 1");
+			EXPECT_TRUE(query->ExecuteStep());
+			EXPECT_STREQ("first", query->GetColumn(0).GetString());
+		}
+		RemovePoolDatabase(path);
+	}
+
+	TEST(DatabasePool, ConcurrentReaders)
+	{
+		const fs::path path = fs::path(GetTestPath("concurrent.db").c_str());
+		RemovePoolDatabase(path);
+		{
+			TrkDatabasePool pool(path.string().c_str(), TrkDatabasePragmas(), 2);
+			pool.Writer()->Execute("CREATE TABLE test (id INTEGER PRIMARY KEY, value INTEGER);"
+				"INSERT INTO test VALUES (1, 10), (2, 20), (3, 30);");
+
+			// More threads than readers, they have to wait for each other
+			std::vector<std::thread> threads;
+			std::vector<int64_t> sums(6, 0);
+			for (size_t t = 0; t < sums.size(); t++)
+			{
+				threads.emplace_back([&pool, &sums, t]()
+				{
+					for (int i = 0; i < 50; i++)
+					{
+						TrkDatabasePool::Lease reader = pool.Reader();
+						TrkStatementLease query = reader->Prepare("SELECT sum(value) FROM test");
+						query->ExecuteStep();
+						sums[t] += query->GetColumn(0).GetInt64();
+					}
+				});
+			}
+
+			for (std::thread& thread : threads)
+			{
+				thread.join();
+			}
+
+			for (int64_t sum : sums)
+			{
+				EXPECT_EQ(50 * 60, sum);
+			}
+		}
+		RemovePoolDatabase(path);
+	}
+
+	TEST(DatabasePool, InvalidPragmas)
+	{
+		const fs::path path = fs::path(GetTestPath("pragmas.db").c_str());
+		RemovePoolDatabase(path);
+		{
+			TrkDatabasePragmas pragmas;
+			pragmas.journal_mode = "WAL; DROP TABLE test";
+			EXPECT_THROW(TrkDatabasePool(path.string().c_str(), pragmas, 1), TrkDatabaseException);
+
+			pragmas.journal_mode = "delete";
+			pragmas.synchronous = "SOMETIMES";
+			EXPECT_THROW(TrkDatabasePool(path.string().c_str(), pragmas, 1), TrkDatabaseException);
+
+			pragmas.synchronous = "full";
+			TrkDatabasePool pool(path.string().c_str(), pragmas, 1);
+			EXPECT_STREQ("delete", pool.GetJournalMode());
+		}
+		RemovePoolDatabase(path);
+	}
+
+	/*
+	 *
+	 *	TrkDatabaseWriter Tests
+	 *
+	 */
+
+	TEST(DatabaseWriter, GroupCommit)
+	{
+		const fs::path path = fs::path(GetTestPath("group.db").c_str());
+		RemovePoolDatabase(path);
+		{
+			TrkDatabasePool pool(path.string().c_str(), TrkDatabasePragmas(), 1);
+			pool.Writer()->Execute("CREATE TABLE test (id INTEGER PRIMARY KEY, value INTEGER)");
+
+			// A long window makes all mutations queued below share one commit
+			TrkDatabaseWriter writer(pool, std::chrono::milliseconds(200));
+			std::vector<std::future<int>> results;
+			for (int i = 0; i < 10; i++)
+			{
+				results.push_back(writer.Submit([i](TrkDatabase& Database)
+				{
+					TrkStatementLease insert = Database.Prepare("INSERT INTO test VALUES (?, ?)");
+					insert->Bind(1, i);
+					insert->Bind(2, i * 10);
+					return insert->Execute();
+				}));
+			}
+
+			for (std::future<int>& result : results)
+			{
+				EXPECT_EQ(1, result.get());
+			}
+
+			EXPECT_EQ(10, writer.committed.Get());
+			EXPECT_EQ(1u, writer.batch_size.Snapshot().count);
+			EXPECT_EQ(10u, writer.batch_size.Snapshot().max);
+
+			TrkDatabasePool::Lease reader = pool.Reader();
+			TrkStatementLease query = reader->Prepare("SELECT count(*) FROM test");
+			query->ExecuteStep();
+			EXPECT_EQ(10, query->GetColumn(0).GetInt());
+		}
+		RemovePoolDatabase(path);
+	}
+
+	TEST(DatabaseWriter, FailingMutationIsRolledBackAlone)
+	{
+		const fs::path path = fs::path(GetTestPath("failure.db").c_str());
+		RemovePoolDatabase(path);
+		{
+			TrkDatabasePool pool(path.string().c_str(), TrkDatabasePragmas(), 1);
+			pool.Writer()->Execute("CREATE TABLE test (id INTEGER PRIMARY KEY, value INTEGER)");
+
+			TrkDatabaseWriter writer(pool, std::chrono::milliseconds(200));
+			std::future<int> first = writer.Submit([](TrkDatabase& Database) { return Database.Execute("INSERT INTO test VALUES (1, 10)"); });
+			std::future<int> failing = writer.Submit([](TrkDatabase& Database)
+			{
+				Database.Execute("INSERT INTO test VALUES (2, 20)");
+				return Database.Execute("INSERT INTO test VALUES (1, 30)");
+			});
+			std::future<int> last = writer.Submit([](TrkDatabase& Database) { return Database.Execute("INSERT INTO test VALUES (3, 30)"); });
+
+			EXPECT_EQ(1, first.get());
+			EXPECT_THROW(failing.get(), TrkDatabaseException);
+			EXPECT_EQ(1, last.get());
+			EXPECT_EQ(1, writer.failed.Get());
+
+			TrkDatabasePool::Lease reader = pool.Reader();
+			TrkStatementLease query = reader->Prepare("SELECT group_concat(id) FROM test");
+			query->ExecuteStep();
+			EXPECT_STREQ("1,3", query->GetColumn(0).GetString());
+		}
+		RemovePoolDatabase(path);
+	}
+
+	TEST(DatabaseWriter, DrainsQueueOnDestruction)
+	{
+		const fs::path path = fs::path(GetTestPath("drain.db").c_str());
+		RemovePoolDatabase(path);
+		{
+			TrkDatabasePool pool(path.string().c_str(), TrkDatabasePragmas(), 1);
+			pool.Writer()->Execute("CREATE TABLE test (id INTEGER PRIMARY KEY)");
+
+			std::future<int> result;
+			{
+				TrkDatabaseWriter writer(pool, std::chrono::seconds(10));
+				result = writer.Submit([](TrkDatabase& Database) { return Database.Execute("INSERT INTO test VALUES (1)"); });
+			}
+			EXPECT_EQ(1, result.get());
+		}
+		RemovePoolDatabase(path);
+	}
+
+#ifndef _WIN32
+	TEST(DatabaseWriter, WritesAfterFork)
+	{
+		const fs::path path = fs::path(GetTestPath("fork.db").c_str());
+		RemovePoolDatabase(path);
+		{
+			TrkDatabasePool pool(path.string().c_str(), TrkDatabasePragmas(), 1);
+			pool.Writer()->Execute("CREATE TABLE test (id INTEGER PRIMARY KEY)");
+
+			// Created before the fork like the server's writers, used only in the child
+			TrkDatabaseWriter writer(pool, std::chrono::milliseconds(1));
+
+			const pid_t pid = fork();
+			ASSERT_NE(-1, pid);
+			if (pid == 0)
+			{
+				alarm(10);
+				const int changes = writer.Execute([](TrkDatabase& Database) { return Database.Execute("INSERT INTO test VALUES (1)"); });
+				_exit(changes == 1 ? 0 : 1);
+			}
+
+			int status = 0;
+			ASSERT_EQ(pid, waitpid(pid, &status, 0));
+			ASSERT_TRUE(WIFEXITED(status));
+			EXPECT_EQ(0, WEXITSTATUS(status));
+
+			TrkDatabasePool::Lease reader = pool.Reader();
+			TrkStatementLease query = reader->Prepare("SELECT count(*) FROM test");
+			query->ExecuteStep();
+			EXPECT_EQ(1, query->GetColumn(0).GetInt());
+		}
+		RemovePoolDatabase(path);
+	}
+#endif
+
 	/*
 	 *
 	 *	TrkTransaction Tests
@@ -1076,4 +1802,157 @@ namespace TrkCpp
 			EXPECT_EQ(1, nbRows);
 		}
 	}
+
+	TEST(DatabasePool, OnlineBackupAndCheckpoint)
+	{
+		const fs::path path = fs::path(GetTestPath("backup.db").c_str());
+		const fs::path copy = fs::path(GetTestPath("backup_copy.db").c_str());
+		RemovePoolDatabase(path);
+		RemovePoolDatabase(copy);
+		{
+			TrkDatabasePool pool(path.string().c_str(), TrkDatabasePragmas(), 1);
+			EXPECT_EQ(TrkString(path.string().c_str()), pool.GetFilename());
+			pool.Writer()->Execute("CREATE TABLE test (id INTEGER PRIMARY KEY, msg TEXT)");
+			{
+				TrkBulkWriter writer(*pool.Writer(), "INSERT INTO test (msg) VALUES (?)");
+				for (int i = 0; i < 2000; i++)
+				{
+					writer.Add("some text to fill a few pages of the database");
+				}
+				writer.Flush();
+			}
+
+			{
+				TrkDatabase destination(copy.string().c_str(), TrkSqlite::OPEN_READWRITE | TrkSqlite::OPEN_CREATE);
+				std::unique_ptr<TrkBackup> backup;
+				int ret = TrkSqlite::OK;
+				int steps = 0;
+				while (ret != TrkSqlite::DONE)
+				{
+					// Writes through the source connection between steps are carried into the copy
+					TrkDatabasePool::Lease source = pool.Writer();
+					if (backup == nullptr)
+					{
+						backup.reset(new TrkBackup(destination, *source));
+					}
+					ret = backup->ExecuteStep(4);
+					if (steps++ == 1)
+					{
+						source->Execute("INSERT INTO test (msg) VALUES ('during backup')");
+					}
+				}
+				EXPECT_GT(steps, 2);
+				EXPECT_EQ(0, backup->GetRemainingPages());
+				EXPECT_GT(backup->GetTotalPages(), 4);
+				backup.reset();
+
+				TrkStatement count(destination, "SELECT count(*) FROM test");
+				ASSERT_TRUE(count.ExecuteStep());
+				EXPECT_EQ(2001, count.GetColumnView(0).GetInt());
+			}
+
+			// A connection opens the log with its first read
+			TrkDatabase checkpointer(path.string().c_str(), TrkSqlite::OPEN_READWRITE);
+			EXPECT_TRUE(checkpointer.TableExists("test"));
+			const TrkCheckpointResult passive = checkpointer.Checkpoint();
+			EXPECT_EQ(TrkSqlite::OK, passive.code);
+			EXPECT_GT(passive.log_frames, 0);
+			EXPECT_EQ(passive.log_frames, passive.checkpointed_frames);
+
+			const TrkCheckpointResult truncate = checkpointer.Checkpoint(TrkSqlite::CHECKPOINT_TRUNCATE);
+			EXPECT_EQ(TrkSqlite::OK, truncate.code);
+			EXPECT_EQ(0, truncate.log_frames);
+		}
+		RemovePoolDatabase(path);
+		RemovePoolDatabase(copy);
+	}
+
+	/*
+	 *
+	 *	TrkBulkWriter Tests
+	 *
+	 */
+
+
+	TEST(BulkWriter, MultiRowInsert)
+	{
+		MemoryLeakDetector leakDetector;
+
+		{
+			TrkDatabase db(":memory:", TrkSqlite::OPEN_READWRITE | TrkSqlite::OPEN_CREATE);
+			EXPECT_EQ(0, db.Execute("CREATE TABLE file (id INTEGER PRIMARY KEY, path TEXT, size INTEGER, data BLOB)"));
+
+			TrkBulkWriter writer(db, "INSERT INTO file (path, size, data) VALUES (?, ?, ?);", 64);
+			EXPECT_EQ(TrkBulkMode::MultiRow, writer.GetMode());
+			EXPECT_EQ(3, writer.GetColumnCount());
+			EXPECT_THROW(writer.Add("missing"), TrkDatabaseException);
+
+			const unsigned char blob[] = { 0, 1, 2 };
+			for (int i = 0; i < 1000; i++)
+			{
+				TrkString path = "file";
+				path << i;
+				if (i % 2 == 0)
+				{
+					writer.Add(path, int64_t(i), TrkBlobView{ blob, sizeof(blob) });
+				}
+				else
+				{
+					writer.Add(path, i, nullptr);
+				}
+			}
+
+			// 15 full batches went out, the rest waits for Flush()
+			EXPECT_EQ(40u, writer.GetPendingRows());
+			EXPECT_EQ(960, writer.GetWrittenRows());
+			EXPECT_EQ(40, writer.Flush());
+			EXPECT_EQ(1000, writer.GetWrittenRows());
+			EXPECT_EQ(0, writer.Flush());
+
+			TrkStatement query(db, "SELECT count(*), sum(size), count(data), sum(length(data)) FROM file");
+			ASSERT_TRUE(query.ExecuteStep());
+			const auto [count, total, blobs, bytes] = query.GetRow<int, int64_t, int, int64_t>();
+			EXPECT_EQ(1000, count);
+			EXPECT_EQ(499500, total);
+			EXPECT_EQ(500, blobs);
+			EXPECT_EQ(1500, bytes);
+
+			TrkStatement last(db, "SELECT path FROM file WHERE size = 999");
+			ASSERT_TRUE(last.ExecuteStep());
+			EXPECT_EQ(std::string_view("file999"), last.GetColumnView(0).GetStringView());
+		}
+	}
+
+	TEST(BulkWriter, RepeatedUpdateJoinsTransaction)
+	{
+		MemoryLeakDetector leakDetector;
+
+		{
+			TrkDatabase db(":memory:", TrkSqlite::OPEN_READWRITE | TrkSqlite::OPEN_CREATE);
+			EXPECT_EQ(0, db.Execute("CREATE TABLE file (id INTEGER PRIMARY KEY, size INTEGER)"));
+			db.Execute("WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < 100) INSERT INTO file SELECT i, 0 FROM n");
+
+			EXPECT_THROW(TrkBulkWriter(db, "UPDATE file SET size = ? WHERE id = ?", 10, TrkBulkMode::MultiRow), TrkDatabaseException);
+
+			{
+				TrkTransaction transaction(db);
+				TrkBulkWriter writer(db, "UPDATE file SET size = ? WHERE id = ?", 10);
+				EXPECT_EQ(TrkBulkMode::Repeated, writer.GetMode());
+				for (int i = 1; i <= 105; i++)
+				{
+					writer.Add(i * 2, i);
+				}
+				EXPECT_EQ(100, writer.GetWrittenRows());
+				EXPECT_EQ(0, writer.Flush());
+				EXPECT_EQ(105, writer.GetWrittenRows());
+
+				// Batches joined the open transaction, it is rolled back here
+				EXPECT_TRUE(db.InTransaction());
+			}
+
+			TrkStatement query(db, "SELECT sum(size) FROM file");
+			ASSERT_TRUE(query.ExecuteStep());
+			EXPECT_EQ(0, query.GetColumnView(0).GetInt64());
+		}
+	}
 }
\ No newline at end of file
@@ -0,0 +1,117 @@
+/*
+ *	delta_test.cpp
+ */
+
+#include <delta.h>
+#include <string>
+#include <gtest/gtest.h>
+#include "memory_leak.h"
+
+
+namespace TrkCpp
+{
+
+	/* Returns a source file of given number of lines */
+	static std::string GetTestSource(int Lines)
+	{
+		std::string source;
+		for (int i = 0; i < Lines; i++)
+		{
+			source += "\tint value" + std::to_string(i) + " = Compute(" + std::to_string(i * 7) + ");\n";
+		}
+		return source;
+	}
+
+
+	/*
+	 *
+	 *	TrkDelta Tests
+	 *
+	 */
+
+
+	TEST(Delta, RoundTrip)
+	{
+		MemoryLeakDetector leakDetector;
+
+		const std::string base = GetTestSource(200);
+		const std::string targets[] = {
+			base,
+			"",
+			"short",
+			base.substr(0, base.size() / 2),
+			"header\n" + base,
+			base + "footer\n",
+			base.substr(base.size() / 3) + base.substr(0, base.size() / 3),
+			GetTestSource(400),
+		};
+
+		for (const std::string& target : targets)
+		{
+			std::string delta, result;
+			ASSERT_TRUE(TrkDelta::Encode(base, target, delta, SIZE_MAX));
+			ASSERT_TRUE(TrkDelta::Apply(base, delta, result));
+			EXPECT_EQ(target, result);
+		}
+
+		// Against an empty base everything is inserted
+		std::string delta, result;
+		ASSERT_TRUE(TrkDelta::Encode("", base, delta, SIZE_MAX));
+		ASSERT_TRUE(TrkDelta::Apply("", delta, result));
+		EXPECT_EQ(base, result);
+	}
+
+	TEST(Delta, SmallEditsMakeSmallDeltas)
+	{
+		MemoryLeakDetector leakDetector;
+
+		const std::string base = GetTestSource(1000);
+		std::string target = base;
+		target.replace(target.size() / 2, 10, "\tEdited();\n");
+		target.insert(100, "\t// New comment\n");
+
+		std::string delta, result;
+		ASSERT_TRUE(TrkDelta::Encode(base, target, delta, SIZE_MAX));
+		EXPECT_LT(delta.size(), 100u);
+		ASSERT_TRUE(TrkDelta::Apply(base, delta, result));
+		EXPECT_EQ(target, result);
+
+		// Unrelated contents do not fit in half of their size
+		EXPECT_FALSE(TrkDelta::Encode(base, std::string(4096, 'x'), delta, 2048));
+	}
+
+	TEST(Delta, RejectsMalformedDeltas)
+	{
+		MemoryLeakDetector leakDetector;
+
+		const std::string base = GetTestSource(100);
+		std::string target = base;
+		target.insert(50, "inserted");
+
+		std::string delta, result;
+		ASSERT_TRUE(TrkDelta::Encode(base, target, delta, SIZE_MAX));
+
+		// Made for another base
+		EXPECT_FALSE(TrkDelta::Apply(base.substr(1), delta, result));
+
+		// Truncated
+		for (size_t length = 0; length < delta.size(); length++)
+		{
+			EXPECT_FALSE(TrkDelta::Apply(base, delta.substr(0, length), result)) << length;
+		}
+
+		// Unknown instruction
+		EXPECT_FALSE(TrkDelta::Apply(base, delta + '\x07', result));
+
+		// A copy past the end of the base
+		std::string copy;
+		copy += static_cast<char>((base.size() & 0x7F) | 0x80);
+		copy += static_cast<char>(base.size() >> 7);
+		copy += '\x10';
+		copy += '\x01';
+		copy += static_cast<char>((base.size() & 0x7F) | 0x80);
+		copy += static_cast<char>(base.size() >> 7);
+		copy += '\x10';
+		EXPECT_FALSE(TrkDelta::Apply(base, copy, result));
+	}
+}
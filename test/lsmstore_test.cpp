@@ -0,0 +1,285 @@
+/*
+ *	lsmstore_test.cpp
+ */
+
+#include <lsmstore.h>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include "memory_leak.h"
+#include "test_helpers.h"
+
+
+namespace TrkCpp
+{
+
+	/* Returns the key of a test record, the depot path of its first revision */
+	static std::string GetRevisionKey(int Index)
+	{
+		return GetTestKey(Index) + "#1";
+	}
+
+	/* Returns the store settings that flush and merge after a few records */
+	static TrkLsmOptions GetSmallOptions()
+	{
+		TrkLsmOptions options;
+		options.memtable_size = 4 * 1024;
+		options.level0_runs = 2;
+		options.level1_size = 16 * 1024;
+		options.level_ratio = 4;
+		return options;
+	}
+
+	/* Returns every record under a prefix */
+	static std::map<std::string, std::string> ScanAll(const TrkLsmStore& Store, std::string_view Prefix)
+	{
+		std::map<std::string, std::string> records;
+		Store.Scan(Prefix, [&records](std::string_view Key, std::string_view Value)
+		{
+			records.emplace(std::string(Key), std::string(Value));
+			return true;
+		});
+		return records;
+	}
+
+
+	/*
+	 *
+	 *	TrkLsmStore Tests
+	 *
+	 */
+
+
+	TEST(LsmStore, PutGetDelete)
+	{
+		MemoryLeakDetector leakDetector;
+
+		const TrkString path = GetTestPath("basic");
+		{
+			TrkLsmStore store;
+			ASSERT_TRUE(store.Open(path));
+
+			std::string value;
+			EXPECT_FALSE(store.Get("//depot/a", value));
+
+			EXPECT_TRUE(store.Put("//depot/a", "1"));
+			EXPECT_TRUE(store.Put("//depot/b", "2"));
+			EXPECT_TRUE(store.Get("//depot/a", value));
+			EXPECT_EQ("1", value);
+
+			// Overwrites and deletes in the memtable
+			EXPECT_TRUE(store.Put("//depot/a", "3"));
+			EXPECT_TRUE(store.Delete("//depot/b"));
+			EXPECT_TRUE(store.Get("//depot/a", value));
+			EXPECT_EQ("3", value);
+			EXPECT_FALSE(store.Get("//depot/b", value));
+
+			// The same answers from a run on level 0
+			ASSERT_TRUE(store.Flush());
+			EXPECT_EQ(1u, store.GetLevelRuns()[0]);
+			EXPECT_TRUE(store.Get("//depot/a", value));
+			EXPECT_EQ("3", value);
+			EXPECT_FALSE(store.Get("//depot/b", value));
+
+			// A newer memtable entry shadows the run
+			EXPECT_TRUE(store.Delete("//depot/a"));
+			EXPECT_TRUE(store.Put("//depot/b", "4"));
+			EXPECT_FALSE(store.Get("//depot/a", value));
+			EXPECT_TRUE(store.Get("//depot/b", value));
+			EXPECT_EQ("4", value);
+
+			TrkLsmBatch batch;
+			batch.Put("//depot/c", "");
+			batch.Put("//depot/d", "5");
+			batch.Delete("//depot/d");
+			EXPECT_TRUE(store.Write(batch));
+			EXPECT_TRUE(store.Get("//depot/c", value));
+			EXPECT_EQ("", value);
+			EXPECT_FALSE(store.Get("//depot/d", value));
+		}
+		std::filesystem::remove_all(path.c_str());
+	}
+
+	TEST(LsmStore, ScanMergesLevels)
+	{
+		MemoryLeakDetector leakDetector;
+
+		const TrkString path = GetTestPath("scan");
+		{
+			TrkLsmStore store;
+			ASSERT_TRUE(store.Open(path));
+
+			EXPECT_TRUE(store.Put("//depot/x/1", "old"));
+			EXPECT_TRUE(store.Put("//depot/x/2", "old"));
+			EXPECT_TRUE(store.Put("//depot/x/3", "old"));
+			EXPECT_TRUE(store.Put("//depot/y/1", "old"));
+			ASSERT_TRUE(store.Flush());
+
+			EXPECT_TRUE(store.Put("//depot/x/2", "new"));
+			EXPECT_TRUE(store.Delete("//depot/x/3"));
+			ASSERT_TRUE(store.Flush());
+
+			EXPECT_TRUE(store.Put("//depot/x/0", "memtable"));
+			EXPECT_TRUE(store.Put("//depot/x/1", "memtable"));
+
+			const std::map<std::string, std::string> expected = {
+				{ "//depot/x/0", "memtable" },
+				{ "//depot/x/1", "memtable" },
+				{ "//depot/x/2", "new" },
+			};
+			EXPECT_EQ(expected, ScanAll(store, "//depot/x/"));
+			EXPECT_EQ(4u, ScanAll(store, "").size());
+			EXPECT_TRUE(ScanAll(store, "//depot/z/").empty());
+
+			// The function ends a scan early
+			size_t visited = 0;
+			store.Scan("//depot/", [&visited](std::string_view, std::string_view)
+			{
+				return ++visited < 2;
+			});
+			EXPECT_EQ(2u, visited);
+		}
+		std::filesystem::remove_all(path.c_str());
+	}
+
+	TEST(LsmStore, CompactionKeepsNewestValues)
+	{
+		MemoryLeakDetector leakDetector;
+
+		const TrkString path = GetTestPath("compaction");
+		{
+			TrkLsmStore store;
+			ASSERT_TRUE(store.Open(path, GetSmallOptions()));
+
+			std::map<std::string, std::string> expected;
+			for (int round = 0; round < 3; round++)
+			{
+				for (int i = 0; i < 2000; i++)
+				{
+					const std::string key = GetRevisionKey(i);
+					if ((i + round) % 5 == 0)
+					{
+						ASSERT_TRUE(store.Delete(key));
+						expected.erase(key);
+					}
+					else
+					{
+						const std::string value = "round" + std::to_string(round) + "-" + std::to_string(i);
+						ASSERT_TRUE(store.Put(key, value));
+						expected[key] = value;
+					}
+				}
+			}
+			ASSERT_TRUE(store.Flush());
+
+			EXPECT_GT(store.flushes.Get(), 2);
+			EXPECT_GT(store.compactions.Get(), 0);
+			const std::vector<size_t> runs = store.GetLevelRuns();
+			ASSERT_GE(runs.size(), 2u);
+			EXPECT_LT(runs[0], 2u);
+
+			std::string value;
+			for (int i = 0; i < 2000; i++)
+			{
+				const std::string key = GetRevisionKey(i);
+				const auto it = expected.find(key);
+				ASSERT_EQ(it != expected.end(), store.Get(key, value)) << key;
+				if (it != expected.end())
+				{
+					EXPECT_EQ(it->second, value);
+				}
+			}
+			EXPECT_FALSE(store.Get("//depot/missing", value));
+			EXPECT_EQ(expected, ScanAll(store, ""));
+
+			std::map<std::string, std::string> directory;
+			for (const auto& [key, record] : expected)
+			{
+				if (key.compare(0, 14, "//depot/dir03/") == 0)
+				{
+					directory.emplace(key, record);
+				}
+			}
+			EXPECT_EQ(directory, ScanAll(store, "//depot/dir03/"));
+		}
+		std::filesystem::remove_all(path.c_str());
+	}
+
+	TEST(LsmStore, ReopenRecoversLogAndRuns)
+	{
+		MemoryLeakDetector leakDetector;
+
+		const TrkString path = GetTestPath("reopen");
+		{
+			{
+				TrkLsmStore store;
+				ASSERT_TRUE(store.Open(path, GetSmallOptions()));
+				for (int i = 0; i < 500; i++)
+				{
+					ASSERT_TRUE(store.Put(GetRevisionKey(i), std::to_string(i)));
+				}
+				ASSERT_TRUE(store.Flush());
+
+				// Left in the log only
+				ASSERT_TRUE(store.Put(GetRevisionKey(1), "logged"));
+				ASSERT_TRUE(store.Delete(GetRevisionKey(2)));
+			}
+
+			TrkLsmStore store;
+			ASSERT_TRUE(store.Open(path, GetSmallOptions()));
+
+			std::string value;
+			ASSERT_TRUE(store.Get(GetRevisionKey(0), value));
+			EXPECT_EQ("0", value);
+			ASSERT_TRUE(store.Get(GetRevisionKey(1), value));
+			EXPECT_EQ("logged", value);
+			EXPECT_FALSE(store.Get(GetRevisionKey(2), value));
+			ASSERT_TRUE(store.Get(GetRevisionKey(499), value));
+			EXPECT_EQ("499", value);
+			EXPECT_EQ(499u, ScanAll(store, "").size());
+		}
+		std::filesystem::remove_all(path.c_str());
+	}
+
+	TEST(LsmStore, TornLogTailIsIgnored)
+	{
+		MemoryLeakDetector leakDetector;
+
+		const TrkString path = GetTestPath("torn");
+		{
+			{
+				TrkLsmStore store;
+				ASSERT_TRUE(store.Open(path));
+				ASSERT_TRUE(store.Put("//depot/a", "1"));
+				ASSERT_TRUE(store.Put("//depot/b", "2"));
+			}
+
+			// Half of a frame, as a crash in the middle of a write leaves it
+			{
+				std::ofstream log((std::filesystem::path(path.c_str()) / "log-1").string(), std::ios::binary | std::ios::app);
+				log.write("\x20\x00\x00\x00\x01\x02", 6);
+			}
+
+			TrkLsmStore store;
+			ASSERT_TRUE(store.Open(path));
+
+			std::string value;
+			ASSERT_TRUE(store.Get("//depot/a", value));
+			EXPECT_EQ("1", value);
+			ASSERT_TRUE(store.Get("//depot/b", value));
+			EXPECT_EQ("2", value);
+
+			// New writes go to a new log after the torn one
+			ASSERT_TRUE(store.Put("//depot/c", "3"));
+			store.Close();
+			ASSERT_TRUE(store.Open(path));
+			ASSERT_TRUE(store.Get("//depot/c", value));
+			EXPECT_EQ("3", value);
+		}
+		std::filesystem::remove_all(path.c_str());
+	}
+}
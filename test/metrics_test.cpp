@@ -0,0 +1,132 @@
+/*
+ *	metrics_test.cpp
+ */
+
+#include <metrics.h>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include "memory_leak.h"
+
+
+namespace TrkCpp
+{
+
+	/*
+	 *
+	 *	TrkCounter Tests
+	 *
+	 */
+
+
+	TEST(Counter, AddAndGet)
+	{
+		MemoryLeakDetector leakDetector;
+
+		TrkCounter counter;
+		EXPECT_EQ(counter.Get(), 0);
+
+		counter.Increment();
+		counter.Add(10);
+		counter.Decrement();
+		EXPECT_EQ(counter.Get(), 10);
+	}
+
+	TEST(Counter, ConcurrentIncrements)
+	{
+		TrkCounter counter;
+		std::vector<std::thread> threads;
+
+		for (int t = 0; t < 4; t++)
+		{
+			threads.emplace_back([&counter]() {
+				for (int i = 0; i < 10000; i++)
+				{
+					counter.Increment();
+				}
+			});
+		}
+
+		for (std::thread& thread : threads)
+		{
+			thread.join();
+		}
+
+		EXPECT_EQ(counter.Get(), 40000);
+	}
+
+
+	/*
+	 *
+	 *	TrkHistogram Tests
+	 *
+	 */
+
+
+	TEST(Histogram, BucketBoundaries)
+	{
+		MemoryLeakDetector leakDetector;
+
+		// Small values have their own buckets
+		for (uint64_t value = 0; value < 64; value++)
+		{
+			EXPECT_EQ(TrkHistogram::GetBucketIndex(value), value);
+			EXPECT_EQ(TrkHistogram::GetBucketHighestValue(value), value);
+		}
+
+		// Every value falls into a bucket whose highest value is not lower than itself
+		for (uint64_t value = 64; value < 1000000; value = value * 3 / 2)
+		{
+			const uint64_t highest = TrkHistogram::GetBucketHighestValue(TrkHistogram::GetBucketIndex(value));
+			EXPECT_GE(highest, value);
+			EXPECT_LE(highest - value, value / 32);
+		}
+	}
+
+	TEST(Histogram, Empty)
+	{
+		MemoryLeakDetector leakDetector;
+
+		TrkHistogram histogram;
+		const TrkHistogramSnapshot snapshot = histogram.Snapshot();
+		EXPECT_EQ(snapshot.count, 0);
+		EXPECT_EQ(snapshot.GetPercentile(99.0), 0);
+		EXPECT_EQ(snapshot.GetMean(), 0.0);
+	}
+
+	TEST(Histogram, Percentiles)
+	{
+		MemoryLeakDetector leakDetector;
+
+		TrkHistogram histogram;
+		for (uint64_t value = 1; value <= 1000; value++)
+		{
+			histogram.Record(value);
+		}
+
+		const TrkHistogramSnapshot snapshot = histogram.Snapshot();
+		EXPECT_EQ(snapshot.count, 1000);
+		EXPECT_EQ(snapshot.sum, 500500);
+		EXPECT_EQ(snapshot.max, 1000);
+		EXPECT_DOUBLE_EQ(snapshot.GetMean(), 500.5);
+
+		// Reported percentiles stay within bucket precision
+		EXPECT_NEAR(static_cast<double>(snapshot.GetPercentile(50.0)), 500.0, 500.0 / 32);
+		EXPECT_NEAR(static_cast<double>(snapshot.GetPercentile(99.0)), 990.0, 990.0 / 32);
+		EXPECT_EQ(snapshot.GetPercentile(100.0), 1000);
+	}
+
+	TEST(Histogram, LargeValuesAreClamped)
+	{
+		MemoryLeakDetector leakDetector;
+
+		TrkHistogram histogram;
+		histogram.Record(UINT64_MAX);
+
+		const TrkHistogramSnapshot snapshot = histogram.Snapshot();
+		EXPECT_EQ(snapshot.count, 1);
+		EXPECT_EQ(snapshot.max, UINT64_MAX);
+		EXPECT_EQ(snapshot.GetPercentile(50.0), UINT64_MAX);
+	}
+
+}
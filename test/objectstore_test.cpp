@@ -0,0 +1,584 @@
+/*
+ *	objectstore_test.cpp
+ */
+
+#include <objectstore.h>
+#include <crypto.h>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include "memory_leak.h"
+#include "test_helpers.h"
+
+
+namespace TrkCpp
+{
+
+	/* Returns contents larger than one stream buffer */
+	static std::string GetTestContents(size_t Length, char Seed)
+	{
+		std::string contents(Length, '\0');
+		for (size_t i = 0; i < Length; i++)
+		{
+			contents[i] = static_cast<char>(Seed + i * 31 % 251);
+		}
+		return contents;
+	}
+
+	/* Reads an object in small pieces */
+	static std::string ReadAll(const TrkObjectStore& Store, const TrkString& Digest)
+	{
+		TrkObjectReader reader;
+		if (!Store.Open(Digest, reader))
+		{
+			return "<missing>";
+		}
+
+		std::string contents;
+		char buffer[1000];
+		size_t read;
+		while ((read = reader.Read(buffer, sizeof(buffer))) > 0)
+		{
+			contents.append(buffer, read);
+		}
+		return contents;
+	}
+
+	/* Returns the number of files left in the temporary directory of a store */
+	static size_t CountTempFiles(const TrkString& Root)
+	{
+		const std::filesystem::path temp = std::filesystem::path(Root.c_str()) / "tmp";
+		return static_cast<size_t>(std::distance(std::filesystem::directory_iterator(temp), std::filesystem::directory_iterator()));
+	}
+
+
+	/*
+	 *
+	 *	TrkObjectStore Tests
+	 *
+	 */
+
+
+	TEST(ObjectStore, StreamedPutAndGet)
+	{
+		MemoryLeakDetector leakDetector;
+
+		const TrkString root = GetTestPath("stream");
+		{
+			TrkObjectStore store;
+			ASSERT_TRUE(store.Open(root));
+
+			const std::string contents = GetTestContents(3 * TRK_OBJECT_BUFFER_SIZE + 17, 'a');
+
+			TrkObjectWriter writer;
+			ASSERT_TRUE(store.BeginWrite(writer));
+			for (size_t offset = 0; offset < contents.size(); offset += 4096)
+			{
+				const size_t length = std::min<size_t>(4096, contents.size() - offset);
+				ASSERT_TRUE(writer.Write(contents.data() + offset, length));
+			}
+			EXPECT_EQ(contents.size(), writer.GetSize());
+
+			TrkString digest;
+			ASSERT_TRUE(writer.Commit(digest));
+			EXPECT_TRUE(TrkObjectStore::IsValidDigest(digest));
+			EXPECT_TRUE(digest == TrkCryptoHelper::SHA256(TrkString(contents.data(), contents.data() + contents.size())));
+
+			// Fanned out by the first two pairs of digits
+			const std::string hex = digest.c_str();
+			EXPECT_TRUE(std::filesystem::is_regular_file(std::filesystem::path(root.c_str()) / hex.substr(0, 2) / hex.substr(2, 2) / hex));
+
+			EXPECT_TRUE(store.Contains(digest));
+			uint64_t size = 0;
+			ASSERT_TRUE(store.GetSize(digest, size));
+			EXPECT_EQ(contents.size(), size);
+			EXPECT_EQ(contents, ReadAll(store, digest));
+
+			// Streams and files go through the same writer
+			std::istringstream input(contents);
+			TrkString stream_digest;
+			ASSERT_TRUE(store.Put(input, stream_digest));
+			EXPECT_TRUE(stream_digest == digest);
+
+			EXPECT_EQ(0u, CountTempFiles(root));
+		}
+		std::filesystem::remove_all(root.c_str());
+	}
+
+	TEST(ObjectStore, IdenticalContentsAreStoredOnce)
+	{
+		MemoryLeakDetector leakDetector;
+
+		const TrkString root = GetTestPath("dedup");
+		{
+			TrkObjectStore store;
+			ASSERT_TRUE(store.Open(root));
+
+			const std::filesystem::path file = std::filesystem::path(root.c_str()).concat(".input");
+			{
+				std::ofstream output(file, std::ios::binary);
+				output << "int main() { return 0; }\n";
+			}
+
+			TrkString first, second, other;
+			ASSERT_TRUE(store.PutFile(file.string().c_str(), first));
+			ASSERT_TRUE(store.PutFile(file.string().c_str(), second));
+			std::istringstream input("int main() { return 1; }\n");
+			ASSERT_TRUE(store.Put(input, other));
+
+			EXPECT_TRUE(first == second);
+			EXPECT_TRUE(first != other);
+			EXPECT_EQ(2, store.objects_written.Get());
+			EXPECT_EQ(1, store.objects_deduplicated.Get());
+			EXPECT_EQ(25, store.bytes_deduplicated.Get());
+			EXPECT_EQ(0u, CountTempFiles(root));
+
+			// Empty contents are an object too
+			std::istringstream empty("");
+			TrkString empty_digest;
+			ASSERT_TRUE(store.Put(empty, empty_digest));
+			EXPECT_TRUE(empty_digest == "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+			EXPECT_EQ("", ReadAll(store, empty_digest));
+
+			EXPECT_TRUE(store.Remove(other));
+			EXPECT_FALSE(store.Contains(other));
+			EXPECT_FALSE(store.Remove(other));
+
+			std::filesystem::remove(file);
+		}
+		std::filesystem::remove_all(root.c_str());
+	}
+
+	TEST(ObjectStore, AbortAndMismatchLeaveNothing)
+	{
+		MemoryLeakDetector leakDetector;
+
+		const TrkString root = GetTestPath("abort");
+		{
+			TrkObjectStore store;
+			ASSERT_TRUE(store.Open(root));
+
+			{
+				TrkObjectWriter writer;
+				ASSERT_TRUE(store.BeginWrite(writer));
+				ASSERT_TRUE(writer.Write("partial", 7));
+				EXPECT_EQ(1u, CountTempFiles(root));
+			}
+			EXPECT_EQ(0u, CountTempFiles(root));
+
+			// A client sent contents that are not the ones it named
+			TrkObjectWriter writer;
+			ASSERT_TRUE(store.BeginWrite(writer));
+			ASSERT_TRUE(writer.Write("abc", 3));
+			TrkString digest;
+			EXPECT_FALSE(writer.Commit(digest, "0000000000000000000000000000000000000000000000000000000000000000"));
+			EXPECT_TRUE(digest == "");
+			EXPECT_EQ(0u, CountTempFiles(root));
+			EXPECT_EQ(0, store.objects_written.Get());
+
+			// A writer is done after its commit
+			EXPECT_FALSE(writer.Write("abc", 3));
+
+			// Left over by a run that stopped in the middle of a write
+			{
+				std::ofstream leftover(std::filesystem::path(root.c_str()) / "tmp" / "leftover", std::ios::binary);
+				leftover << "partial";
+			}
+			TrkObjectStore reopened;
+			ASSERT_TRUE(reopened.Open(root));
+			EXPECT_EQ(0u, CountTempFiles(root));
+		}
+		std::filesystem::remove_all(root.c_str());
+	}
+
+	TEST(ObjectStore, RejectsInvalidDigests)
+	{
+		MemoryLeakDetector leakDetector;
+
+		const TrkString root = GetTestPath("digest");
+		{
+			TrkObjectStore store;
+			ASSERT_TRUE(store.Open(root));
+
+			EXPECT_FALSE(TrkObjectStore::IsValidDigest(""));
+			EXPECT_FALSE(TrkObjectStore::IsValidDigest("e3b0c442"));
+			EXPECT_FALSE(TrkObjectStore::IsValidDigest("E3B0C44298FC1C149AFBF4C8996FB92427AE41E4649B934CA495991B7852B855"));
+			EXPECT_FALSE(TrkObjectStore::IsValidDigest("../../../../../../../../../../../../../../../../../../etc/passwd"));
+
+			TrkObjectReader reader;
+			EXPECT_FALSE(store.Open("../tmp", reader));
+			EXPECT_FALSE(store.Open("e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855", reader));
+			EXPECT_FALSE(reader.IsOpen());
+			EXPECT_FALSE(store.Contains("../tmp"));
+		}
+		std::filesystem::remove_all(root.c_str());
+	}
+
+	TEST(ObjectStore, RepackRollsLooseObjectsIntoPacks)
+	{
+		MemoryLeakDetector leakDetector;
+
+		const TrkString root = GetTestPath("repack");
+		{
+			std::vector<TrkString> digests;
+			std::vector<std::string> contents;
+			{
+				TrkObjectStore store;
+				ASSERT_TRUE(store.Open(root));
+
+				for (int i = 0; i < 50; i++)
+				{
+					contents.push_back(GetTestContents(100 + i * 10, static_cast<char>('a' + i)));
+					std::istringstream input(contents.back());
+					TrkString digest;
+					ASSERT_TRUE(store.Put(input, digest));
+					digests.push_back(digest);
+				}
+
+				// Too large for a pack, stays loose
+				contents.push_back(GetTestContents(4096, 'z'));
+				std::istringstream large(contents.back());
+				TrkString large_digest;
+				ASSERT_TRUE(store.Put(large, large_digest));
+				digests.push_back(large_digest);
+
+				ASSERT_TRUE(store.Repack(1024));
+				EXPECT_EQ(1u, store.GetPackCount());
+				EXPECT_EQ(50, store.objects_packed.Get());
+
+				for (size_t i = 0; i < digests.size(); i++)
+				{
+					EXPECT_TRUE(store.Contains(digests[i]));
+					uint64_t size = 0;
+					ASSERT_TRUE(store.GetSize(digests[i], size));
+					EXPECT_EQ(contents[i].size(), size);
+					EXPECT_EQ(contents[i], ReadAll(store, digests[i]));
+				}
+
+				// Only the large object is left as a file
+				const std::string hex = digests[0].c_str();
+				EXPECT_FALSE(std::filesystem::exists(std::filesystem::path(root.c_str()) / hex.substr(0, 2) / hex.substr(2, 2) / hex));
+				const std::string large_hex = large_digest.c_str();
+				EXPECT_TRUE(std::filesystem::exists(std::filesystem::path(root.c_str()) / large_hex.substr(0, 2) / large_hex.substr(2, 2) / large_hex));
+
+				// Packed objects are not written again
+				std::istringstream again(contents[0]);
+				TrkString digest;
+				ASSERT_TRUE(store.Put(again, digest));
+				EXPECT_EQ(1, store.objects_deduplicated.Get());
+
+				// Nothing loose to pack
+				ASSERT_TRUE(store.Repack(1024));
+				EXPECT_EQ(1, store.repacks.Get());
+			}
+
+			// Packs are found again after a restart
+			TrkObjectStore store;
+			ASSERT_TRUE(store.Open(root));
+			EXPECT_EQ(1u, store.GetPackCount());
+			EXPECT_EQ(contents[7], ReadAll(store, digests[7]));
+		}
+		std::filesystem::remove_all(root.c_str());
+	}
+
+	TEST(ObjectStore, RepackMergesPacks)
+	{
+		MemoryLeakDetector leakDetector;
+
+		const TrkString root = GetTestPath("merge");
+		{
+			TrkObjectStore store;
+			ASSERT_TRUE(store.Open(root));
+
+			std::vector<TrkString> digests;
+			for (int round = 0; round < 4; round++)
+			{
+				for (int i = 0; i < 5; i++)
+				{
+					std::istringstream input("round " + std::to_string(round) + " object " + std::to_string(i));
+					TrkString digest;
+					ASSERT_TRUE(store.Put(input, digest));
+					digests.push_back(digest);
+				}
+				ASSERT_TRUE(store.Repack(TRK_OBJECT_PACK_MAX_SIZE, 3));
+			}
+
+			// The fourth repack found three packs and merged them with its objects
+			EXPECT_EQ(1u, store.GetPackCount());
+			for (size_t i = 0; i < digests.size(); i++)
+			{
+				EXPECT_EQ("round " + std::to_string(i / 5) + " object " + std::to_string(i % 5), ReadAll(store, digests[i]));
+			}
+
+			size_t files = 0;
+			for (const auto& file : std::filesystem::directory_iterator(std::filesystem::path(root.c_str()) / "pack"))
+			{
+				(void)file;
+				files++;
+			}
+			EXPECT_EQ(2u, files);
+		}
+		std::filesystem::remove_all(root.c_str());
+	}
+
+	TEST(ObjectStore, RepackStoresRevisionsAsDeltas)
+	{
+		MemoryLeakDetector leakDetector;
+
+		const TrkString root = GetTestPath("delta");
+		{
+			std::vector<TrkString> digests;
+			std::vector<std::string> revisions;
+			{
+				TrkObjectStore store;
+				ASSERT_TRUE(store.Open(root));
+
+				// Revisions of one file, each a small edit of the one before
+				std::string contents = GetTestContents(8192, 'r');
+				for (int i = 0; i < 25; i++)
+				{
+					contents.replace(static_cast<size_t>(i) * 300, 5, "edit" + std::to_string(i % 10));
+					revisions.push_back(contents);
+					std::istringstream input(contents);
+					TrkString digest;
+					ASSERT_TRUE(store.Put(input, digest));
+					if (!digests.empty())
+					{
+						store.SetDeltaBase(digest, digests.back());
+					}
+					digests.push_back(digest);
+				}
+
+				// Revisions larger than a pack holds are packed as deltas only
+				ASSERT_TRUE(store.Repack(4096));
+				EXPECT_EQ(1u, store.GetPackCount());
+
+				// Every tenth revision is left whole so chains stay short
+				EXPECT_EQ(22, store.objects_deltified.Get());
+				EXPECT_GT(store.delta_bytes_saved.Get(), 22 * 8000);
+				for (size_t i = 0; i < digests.size(); i++)
+				{
+					const std::string hex = digests[i].c_str();
+					EXPECT_EQ(i % 11 == 0, std::filesystem::exists(std::filesystem::path(root.c_str()) / hex.substr(0, 2) / hex.substr(2, 2) / hex)) << i;
+				}
+
+				for (size_t i = 0; i < digests.size(); i++)
+				{
+					uint64_t size = 0;
+					ASSERT_TRUE(store.GetSize(digests[i], size));
+					EXPECT_EQ(revisions[i].size(), size);
+					EXPECT_EQ(revisions[i], ReadAll(store, digests[i])) << i;
+				}
+
+				// Bases were reconstructed once and then served from the cache
+				const int64_t misses = store.cache_misses.Get();
+				EXPECT_EQ(revisions[20], ReadAll(store, digests[20]));
+				EXPECT_EQ(misses, store.cache_misses.Get());
+				EXPECT_GT(store.cache_hits.Get(), 0);
+
+				// Deltas are kept when their packs are merged
+				std::istringstream input("another object");
+				TrkString digest;
+				ASSERT_TRUE(store.Put(input, digest));
+				ASSERT_TRUE(store.Repack(4096));
+				ASSERT_TRUE(store.Repack(4096, 2));
+				EXPECT_EQ(1u, store.GetPackCount());
+			}
+
+			// Without a cache after a restart
+			TrkObjectStore store;
+			ASSERT_TRUE(store.Open(root));
+			store.SetCacheSize(0);
+			for (size_t i = 0; i < digests.size(); i++)
+			{
+				EXPECT_EQ(revisions[i], ReadAll(store, digests[i])) << i;
+			}
+			EXPECT_EQ(0, store.cache_hits.Get());
+		}
+		std::filesystem::remove_all(root.c_str());
+	}
+
+	TEST(ObjectStore, RepackIgnoresBadDeltaBases)
+	{
+		MemoryLeakDetector leakDetector;
+
+		const TrkString root = GetTestPath("delta_bases");
+		{
+			TrkObjectStore store;
+			ASSERT_TRUE(store.Open(root));
+
+			const std::string first = GetTestContents(2000, 'a');
+			const std::string second = first + "appended";
+			const std::string third(2000, 'x');
+			TrkString first_digest, second_digest, third_digest;
+			std::istringstream first_input(first), second_input(second), third_input(third);
+			ASSERT_TRUE(store.Put(first_input, first_digest));
+			ASSERT_TRUE(store.Put(second_input, second_digest));
+			ASSERT_TRUE(store.Put(third_input, third_digest));
+
+			// Missing bases, invalid digests and the object itself are skipped
+			store.SetDeltaBase(third_digest, "0000000000000000000000000000000000000000000000000000000000000000");
+			store.SetDeltaBase("../tmp", first_digest);
+			store.SetDeltaBase(first_digest, first_digest);
+			// Each names the other, one of them has to stay whole
+			store.SetDeltaBase(first_digest, second_digest);
+			store.SetDeltaBase(second_digest, first_digest);
+
+			ASSERT_TRUE(store.Repack(1024));
+			EXPECT_EQ(1, store.objects_deltified.Get());
+			EXPECT_EQ(first, ReadAll(store, first_digest));
+			EXPECT_EQ(second, ReadAll(store, second_digest));
+			EXPECT_EQ(third, ReadAll(store, third_digest));
+
+			// Contents that share nothing with their base are left whole
+			store.SetDeltaBase(third_digest, first_digest);
+			ASSERT_TRUE(store.Repack(1024));
+			EXPECT_EQ(1, store.objects_deltified.Get());
+			EXPECT_EQ(third, ReadAll(store, third_digest));
+		}
+		std::filesystem::remove_all(root.c_str());
+	}
+
+	TEST(ObjectStore, RepackLeavesLargeObjectsWhole)
+	{
+		MemoryLeakDetector leakDetector;
+
+		const TrkString root = GetTestPath("delta_limit");
+		{
+			TrkObjectStore store;
+			ASSERT_TRUE(store.Open(root));
+
+			// Deltas are encoded in memory, objects over the limit stay loose even with a base
+			const std::string base = GetTestContents(TRK_OBJECT_DELTA_MAX_SIZE - 100, 'a');
+			const std::string large = base + std::string(200, 'x');
+			TrkString base_digest, large_digest;
+			std::istringstream base_input(base), large_input(large);
+			ASSERT_TRUE(store.Put(base_input, base_digest));
+			ASSERT_TRUE(store.Put(large_input, large_digest));
+
+			store.SetDeltaBase(large_digest, base_digest);
+			ASSERT_TRUE(store.Repack(1024));
+			EXPECT_EQ(0, store.objects_deltified.Get());
+			const std::string hex = large_digest.c_str();
+			EXPECT_TRUE(std::filesystem::exists(std::filesystem::path(root.c_str()) / hex.substr(0, 2) / hex.substr(2, 2) / hex));
+			EXPECT_EQ(large, ReadAll(store, large_digest));
+		}
+		std::filesystem::remove_all(root.c_str());
+	}
+
+	TEST(ObjectStore, LargeFilesAreChunkLists)
+	{
+		MemoryLeakDetector leakDetector;
+
+		const TrkString root = GetTestPath("chunked");
+		{
+			TrkObjectStore store;
+			ASSERT_TRUE(store.Open(root));
+
+			std::string contents(TRK_OBJECT_CHUNKED_MIN_SIZE + 12345, '\0');
+			uint64_t state = 3;
+			for (char& c : contents)
+			{
+				state = state * 6364136223846793005ull + 1442695040888963407ull;
+				c = static_cast<char>(state >> 56);
+			}
+
+			const std::filesystem::path file = std::filesystem::path(root.c_str()).concat(".input");
+			{
+				std::ofstream output(file, std::ios::binary);
+				output.write(contents.data(), contents.size());
+			}
+
+			TrkString digest;
+			ASSERT_TRUE(store.PutFile(file.string().c_str(), digest));
+			EXPECT_TRUE(digest == TrkCryptoHelper::SHA256(TrkString(contents.data(), contents.data() + contents.size())));
+			EXPECT_EQ(1, store.chunk_lists_written.Get());
+
+			// Stored as a list next to where the whole object would be
+			const std::string hex = digest.c_str();
+			const std::filesystem::path path = std::filesystem::path(root.c_str()) / hex.substr(0, 2) / hex.substr(2, 2) / hex;
+			EXPECT_FALSE(std::filesystem::exists(path));
+			EXPECT_TRUE(std::filesystem::exists(std::filesystem::path(path).concat(".chunks")));
+
+			uint64_t size = 0;
+			ASSERT_TRUE(store.GetSize(digest, size));
+			EXPECT_EQ(contents.size(), size);
+			EXPECT_EQ(contents, ReadAll(store, digest));
+
+			// An edit in the middle stores only the chunks around it
+			const int64_t written = store.objects_written.Get();
+			std::string edited = contents;
+			edited.insert(contents.size() / 2, "edited");
+			std::istringstream input(edited);
+			TrkString edited_digest;
+			ASSERT_TRUE(store.PutChunked(input, edited_digest));
+			EXPECT_LE(store.objects_written.Get() - written, 2);
+			EXPECT_EQ(edited, ReadAll(store, edited_digest));
+
+			// Chunks are packed like any small object, lists stay in place
+			ASSERT_TRUE(store.Repack());
+			EXPECT_EQ(contents, ReadAll(store, digest));
+			EXPECT_EQ(edited, ReadAll(store, edited_digest));
+
+			EXPECT_TRUE(store.Remove(edited_digest));
+			EXPECT_FALSE(store.Contains(edited_digest));
+			EXPECT_TRUE(store.Contains(digest));
+
+			std::filesystem::remove(file);
+		}
+		std::filesystem::remove_all(root.c_str());
+	}
+
+	TEST(ObjectStore, ChunkListsAreChecked)
+	{
+		MemoryLeakDetector leakDetector;
+
+		const TrkString root = GetTestPath("chunk_list");
+		{
+			TrkObjectStore store;
+			ASSERT_TRUE(store.Open(root));
+
+			// Chunks uploaded one by one
+			const std::string parts[] = { GetTestContents(3000, 'a'), GetTestContents(5000, 'b'), "" };
+			std::vector<TrkString> chunks;
+			for (const std::string& part : parts)
+			{
+				std::istringstream input(part);
+				TrkString digest;
+				ASSERT_TRUE(store.Put(input, digest));
+				chunks.push_back(digest);
+			}
+			const std::string whole = parts[0] + parts[1];
+			const TrkString digest = TrkCryptoHelper::SHA256(TrkString(whole.data(), whole.data() + whole.size()));
+
+			// Out of order, or with a chunk the store does not have
+			EXPECT_FALSE(store.PutChunkList({ chunks[1], chunks[0] }, digest));
+			EXPECT_FALSE(store.PutChunkList({ chunks[0], "0000000000000000000000000000000000000000000000000000000000000000", chunks[1] }, digest));
+			EXPECT_FALSE(store.PutChunkList(chunks, "../tmp"));
+			EXPECT_FALSE(store.Contains(digest));
+
+			ASSERT_TRUE(store.PutChunkList(chunks, digest));
+			EXPECT_EQ(whole, ReadAll(store, digest));
+
+			// A list can not be a chunk of another
+			const std::string twice = whole + whole;
+			EXPECT_FALSE(store.PutChunkList({ digest, digest }, TrkCryptoHelper::SHA256(TrkString(twice.data(), twice.data() + twice.size()))));
+
+			// A list of one chunk names the chunk itself, which is already stored
+			EXPECT_TRUE(store.PutChunkList({ chunks[0] }, chunks[0]));
+			EXPECT_EQ(1, store.chunk_lists_written.Get());
+
+			// A truncated list is not read
+			const std::string hex = digest.c_str();
+			const std::filesystem::path list = std::filesystem::path(root.c_str()) / hex.substr(0, 2) / hex.substr(2, 2) / (hex + ".chunks");
+			std::filesystem::resize_file(list, std::filesystem::file_size(list) - 1);
+			TrkObjectReader reader;
+			EXPECT_FALSE(store.Open(digest, reader));
+			EXPECT_FALSE(reader.IsOpen());
+		}
+		std::filesystem::remove_all(root.c_str());
+	}
+}
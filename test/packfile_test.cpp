@@ -0,0 +1,194 @@
+/*
+ *	packfile_test.cpp
+ */
+
+#include <packfile.h>
+#include <crypto.h>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include "memory_leak.h"
+#include "test_helpers.h"
+
+
+namespace TrkCpp
+{
+
+	/* Returns the contents of a test object */
+	static std::string GetTestObject(int Index)
+	{
+		return "object " + std::to_string(Index) + std::string(Index % 7, '#');
+	}
+
+	/* Returns the digest of a test object */
+	static void GetTestDigest(int Index, uint8_t* Digest)
+	{
+		const std::string contents = GetTestObject(Index);
+		TrkPackFile::ParseDigest(TrkCryptoHelper::SHA256(TrkString(contents.data(), contents.data() + contents.size())), Digest);
+	}
+
+	/* Writes a pack of test objects, returns its path without extension */
+	static TrkString WriteTestPack(const TrkString& Directory, int Count)
+	{
+		TrkPackWriter writer;
+		if (!writer.Open((std::string(Directory.c_str()) + "/writing").c_str()))
+		{
+			return "";
+		}
+
+		for (int i = 0; i < Count; i++)
+		{
+			const std::string contents = GetTestObject(i);
+			uint8_t digest[TRK_PACK_DIGEST_SIZE];
+			GetTestDigest(i, digest);
+			if (!writer.BeginObject(digest, contents.size()) || !writer.Write(contents.data(), contents.size()) || !writer.EndObject())
+			{
+				return "";
+			}
+		}
+
+		TrkString path;
+		return writer.Finish(Directory, path) ? path : TrkString("");
+	}
+
+
+	/*
+	 *
+	 *	TrkPackFile Tests
+	 *
+	 */
+
+
+	TEST(PackFile, FindAndRead)
+	{
+		MemoryLeakDetector leakDetector;
+
+		const TrkString directory = GetTestDirectory("find");
+		{
+			const TrkString path = WriteTestPack(directory, 1000);
+			ASSERT_FALSE(path == "");
+			EXPECT_FALSE(std::filesystem::exists((std::string(directory.c_str()) + "/writing").c_str()));
+
+			TrkPackFile pack;
+			ASSERT_TRUE(pack.Open(path));
+			EXPECT_EQ(1000u, pack.GetCount());
+
+			for (int i = 0; i < 1000; i++)
+			{
+				uint8_t digest[TRK_PACK_DIGEST_SIZE];
+				GetTestDigest(i, digest);
+
+				TrkPackEntry entry;
+				ASSERT_TRUE(pack.Find(digest, entry)) << i;
+				EXPECT_EQ(static_cast<uint32_t>(TrkPackCodec::STORED), entry.codec);
+
+				const std::string expected = GetTestObject(i);
+				ASSERT_EQ(expected.size(), entry.length);
+				ASSERT_EQ(expected.size(), entry.size);
+
+				std::string contents(entry.length, '\0');
+				ASSERT_EQ(entry.length, pack.Read(entry.offset, &contents[0], contents.size()));
+				EXPECT_EQ(expected, contents);
+			}
+
+			// Entries are in digest order
+			for (uint64_t i = 1; i < pack.GetCount(); i++)
+			{
+				EXPECT_LT(std::memcmp(pack.GetEntry(i - 1).digest, pack.GetEntry(i).digest, TRK_PACK_DIGEST_SIZE), 0);
+			}
+
+			uint8_t missing[TRK_PACK_DIGEST_SIZE];
+			GetTestDigest(1000, missing);
+			TrkPackEntry entry;
+			EXPECT_FALSE(pack.Find(missing, entry));
+
+			// Reads stop at the end of the pack
+			char buffer[16];
+			EXPECT_EQ(0u, pack.Read(1u << 30, buffer, sizeof(buffer)));
+		}
+		std::filesystem::remove_all(directory.c_str());
+	}
+
+	TEST(PackFile, SameObjectsNameTheSamePack)
+	{
+		MemoryLeakDetector leakDetector;
+
+		const TrkString directory = GetTestDirectory("name");
+		{
+			const TrkString first = WriteTestPack(directory, 10);
+			const TrkString second = WriteTestPack(directory, 10);
+			const TrkString other = WriteTestPack(directory, 11);
+			ASSERT_FALSE(first == "");
+			EXPECT_TRUE(first == second);
+			EXPECT_TRUE(first != other);
+
+			size_t files = 0;
+			for (const auto& file : std::filesystem::directory_iterator(directory.c_str()))
+			{
+				(void)file;
+				files++;
+			}
+			EXPECT_EQ(4u, files);
+
+			// Digests are read and written as lowercase hex
+			uint8_t digest[TRK_PACK_DIGEST_SIZE];
+			const TrkString hex = "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855";
+			ASSERT_TRUE(TrkPackFile::ParseDigest(hex, digest));
+			EXPECT_EQ(0xe3, digest[0]);
+			EXPECT_EQ(0x55, digest[31]);
+			EXPECT_TRUE(TrkPackFile::FormatDigest(digest) == hex);
+			EXPECT_FALSE(TrkPackFile::ParseDigest("e3b0", digest));
+		}
+		std::filesystem::remove_all(directory.c_str());
+	}
+
+	TEST(PackFile, RejectsMalformedIndex)
+	{
+		MemoryLeakDetector leakDetector;
+
+		const TrkString directory = GetTestDirectory("malformed");
+		{
+			const TrkString path = WriteTestPack(directory, 100);
+			ASSERT_FALSE(path == "");
+			const std::string index_path = std::string(path.c_str()) + ".idx";
+
+			std::string index;
+			{
+				std::ifstream input(index_path, std::ios::binary);
+				index.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+			}
+
+			auto write_index = [&index_path](const std::string& Contents)
+			{
+				std::ofstream output(index_path, std::ios::binary | std::ios::trunc);
+				output.write(Contents.data(), Contents.size());
+			};
+
+			TrkPackFile pack;
+
+			// An entry pointing past the end of the pack
+			std::string corrupted = index;
+			const size_t entries = sizeof(TrkPackIndexHeader) + TRK_PACK_FANOUT_SIZE * sizeof(uint32_t);
+			const uint64_t offset = 1ull << 40;
+			std::memcpy(&corrupted[entries + offsetof(TrkPackEntry, offset)], &offset, sizeof(offset));
+			write_index(corrupted);
+			EXPECT_FALSE(pack.Open(path));
+
+			// A truncated index
+			write_index(index.substr(0, index.size() - 1));
+			EXPECT_FALSE(pack.Open(path));
+
+			write_index(index);
+			EXPECT_TRUE(pack.Open(path));
+
+			// The pack without its index
+			pack.Close();
+			std::filesystem::remove(index_path);
+			EXPECT_FALSE(pack.Open(path));
+		}
+		std::filesystem::remove_all(directory.c_str());
+	}
+}
@@ -0,0 +1,184 @@
+/*
+ *	sessionstore_test.cpp
+ */
+
+#include <sessionstore.h>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include "memory_leak.h"
+#include "test_helpers.h"
+
+
+namespace TrkCpp
+{
+
+
+	/*
+	 *
+	 *	TrkSessionStore Tests
+	 *
+	 */
+
+
+	TEST(SessionStore, PutGetRemove)
+	{
+		MemoryLeakDetector leakDetector;
+
+		const TrkString path = GetTestPath("basic");
+		{
+			TrkSessionStore store(path);
+			ASSERT_TRUE(store.IsOpen());
+
+			TrkString ticket;
+			EXPECT_FALSE(store.Get("localhost:5566", ticket));
+
+			EXPECT_TRUE(store.Put("localhost:5566", "ticket1"));
+			EXPECT_TRUE(store.Get("localhost:5566", ticket));
+			EXPECT_EQ(ticket, TrkString("ticket1"));
+
+			EXPECT_TRUE(store.Put("localhost:5566", "ticket2"));
+			EXPECT_TRUE(store.Get("localhost:5566", ticket));
+			EXPECT_EQ(ticket, TrkString("ticket2"));
+
+			EXPECT_TRUE(store.Remove("localhost:5566"));
+			EXPECT_FALSE(store.Get("localhost:5566", ticket));
+		}
+		std::filesystem::remove(path.c_str());
+	}
+
+	TEST(SessionStore, PersistsAcrossOpens)
+	{
+		const TrkString path = GetTestPath("persist");
+		{
+			TrkSessionStore store(path);
+			EXPECT_TRUE(store.Put("example.com:5566", "persisted"));
+		}
+		{
+			TrkSessionStore store(path);
+			TrkString ticket;
+			EXPECT_TRUE(store.Get("example.com:5566", ticket));
+			EXPECT_EQ(ticket, TrkString("persisted"));
+		}
+		std::filesystem::remove(path.c_str());
+	}
+
+	TEST(SessionStore, GrowsAndReusesDeletedSlots)
+	{
+		const TrkString path = GetTestPath("grow");
+		{
+			TrkSessionStore store(path);
+			for (int i = 0; i < 200; i++)
+			{
+				TrkString url = "server";
+				url << i;
+				TrkString ticket = "ticket";
+				ticket << i;
+				ASSERT_TRUE(store.Put(url, ticket));
+			}
+
+			for (int i = 0; i < 200; i += 2)
+			{
+				TrkString url = "server";
+				url << i;
+				EXPECT_TRUE(store.Remove(url));
+			}
+
+			for (int i = 0; i < 200; i++)
+			{
+				TrkString url = "server";
+				url << i;
+				TrkString ticket;
+				if (i % 2 == 0)
+				{
+					EXPECT_FALSE(store.Get(url, ticket));
+				}
+				else
+				{
+					TrkString expected = "ticket";
+					expected << i;
+					EXPECT_TRUE(store.Get(url, ticket));
+					EXPECT_EQ(ticket, expected);
+				}
+			}
+		}
+		std::filesystem::remove(path.c_str());
+	}
+
+	TEST(SessionStore, RefusesOversizedEntries)
+	{
+		const TrkString path = GetTestPath("oversized");
+		{
+			TrkSessionStore store(path);
+			const TrkString long_value = std::string(TRK_SESSION_TICKET_SIZE + 1, 'x').c_str();
+			EXPECT_FALSE(store.Put("localhost:5566", long_value));
+			EXPECT_FALSE(store.Put(long_value, "ticket"));
+			EXPECT_FALSE(store.Put("", "ticket"));
+		}
+		std::filesystem::remove(path.c_str());
+	}
+
+	TEST(SessionStore, ConvertsTextSessionFile)
+	{
+		const TrkString path = GetTestPath("text");
+		{
+			std::ofstream text(path.c_str());
+			text << "first:5566=ticketA" << std::endl;
+			text << "second:5566=ticketB" << std::endl;
+			text << "first:5566=duplicate" << std::endl;
+		}
+		{
+			TrkSessionStore store(path);
+			TrkString ticket;
+			EXPECT_TRUE(store.Get("first:5566", ticket));
+			EXPECT_EQ(ticket, TrkString("ticketA"));
+			EXPECT_TRUE(store.Get("second:5566", ticket));
+			EXPECT_EQ(ticket, TrkString("ticketB"));
+		}
+		std::filesystem::remove(path.c_str());
+	}
+
+	TEST(SessionStore, ConcurrentWriters)
+	{
+		const TrkString path = GetTestPath("concurrent");
+		std::vector<std::thread> threads;
+
+		// Every thread opens its own store, like separate trk processes would
+		for (int t = 0; t < 4; t++)
+		{
+			threads.emplace_back([&path, t]()
+			{
+				TrkSessionStore store(path);
+				for (int i = 0; i < 50; i++)
+				{
+					TrkString url = "server";
+					url << t << "_" << i;
+					store.Put(url, url);
+				}
+			});
+		}
+
+		for (std::thread& thread : threads)
+		{
+			thread.join();
+		}
+
+		TrkSessionStore store(path);
+		for (int t = 0; t < 4; t++)
+		{
+			for (int i = 0; i < 50; i++)
+			{
+				TrkString url = "server";
+				url << t << "_" << i;
+				TrkString ticket;
+				EXPECT_TRUE(store.Get(url, ticket));
+				EXPECT_EQ(ticket, url);
+			}
+		}
+		std::filesystem::remove(path.c_str());
+	}
+
+}
@@ -0,0 +1,242 @@
+/*
+ *	sortedtable_test.cpp
+ */
+
+#include <sortedtable.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include "memory_leak.h"
+#include "test_helpers.h"
+
+
+namespace TrkCpp
+{
+
+	/* Fixed width value of the test tables */
+	struct TestValue
+	{
+		int64_t revision;
+		int32_t action;
+		int32_t padding;
+	};
+
+
+	/*
+	 *
+	 *	TrkSortedTable Tests
+	 *
+	 */
+
+
+	TEST(SortedTable, FindEveryKey)
+	{
+		MemoryLeakDetector leakDetector;
+
+		const TrkString path = GetTestPath("find");
+		{
+			std::vector<std::string> keys;
+			for (int i = 0; i < 1000; i++)
+			{
+				keys.push_back(GetTestKey(i));
+			}
+			std::sort(keys.begin(), keys.end());
+
+			TrkSortedTableWriter writer(path, sizeof(TestValue), 8);
+			for (size_t i = 0; i < keys.size(); i++)
+			{
+				const TestValue value = { static_cast<int64_t>(i) * 3, static_cast<int32_t>(i % 4), 0 };
+				ASSERT_TRUE(writer.Add(keys[i], &value));
+			}
+			ASSERT_TRUE(writer.Commit());
+			EXPECT_FALSE(std::filesystem::exists(std::string(path.c_str()) + ".tmp"));
+			EXPECT_FALSE(std::filesystem::exists(std::string(path.c_str()) + ".keys.tmp"));
+
+			TrkSortedTable table;
+			ASSERT_TRUE(table.Open(path));
+			EXPECT_EQ(1000u, table.GetRecordCount());
+			EXPECT_EQ(sizeof(TestValue), table.GetValueSize());
+
+			for (size_t i = 0; i < keys.size(); i++)
+			{
+				const void* found = table.Find(keys[i]);
+				ASSERT_NE(nullptr, found) << keys[i];
+
+				TestValue value;
+				std::memcpy(&value, found, sizeof(value));
+				EXPECT_EQ(static_cast<int64_t>(i) * 3, value.revision);
+				EXPECT_EQ(static_cast<int32_t>(i % 4), value.action);
+			}
+
+			EXPECT_EQ(nullptr, table.Find(""));
+			EXPECT_EQ(nullptr, table.Find("//depot/dir00/file00000.cp"));
+			EXPECT_EQ(nullptr, table.Find("//depot/dir00/file00000.cppx"));
+			EXPECT_EQ(nullptr, table.Find("~"));
+		}
+		std::filesystem::remove(path.c_str());
+	}
+
+	TEST(SortedTable, SeekAndScanPrefix)
+	{
+		MemoryLeakDetector leakDetector;
+
+		const TrkString path = GetTestPath("scan");
+		{
+			TrkSortedTableWriter writer(path, sizeof(TestValue), 4);
+			const char* keys[] = { "//depot/a", "//depot/a/b", "//depot/a/c", "//depot/ab", "//depot/b/x", "//depot/b/y", "//depot/c" };
+			for (const char* key : keys)
+			{
+				const TestValue value = { 1, 0, 0 };
+				ASSERT_TRUE(writer.Add(key, &value));
+			}
+			ASSERT_TRUE(writer.Commit());
+
+			TrkSortedTable table;
+			ASSERT_TRUE(table.Open(path));
+
+			std::vector<std::string> found;
+			for (TrkSortedTable::Iterator it = table.Seek("//depot/a/"); it.Valid() && it.Key().substr(0, 10) == "//depot/a/"; it.Next())
+			{
+				found.emplace_back(it.Key());
+			}
+			ASSERT_EQ(2u, found.size());
+			EXPECT_EQ("//depot/a/b", found[0]);
+			EXPECT_EQ("//depot/a/c", found[1]);
+
+			// A prefix crossing into the next block
+			found.clear();
+			for (TrkSortedTable::Iterator it = table.Seek("//depot/b/"); it.Valid() && it.Key().substr(0, 10) == "//depot/b/"; it.Next())
+			{
+				found.emplace_back(it.Key());
+			}
+			ASSERT_EQ(2u, found.size());
+			EXPECT_EQ("//depot/b/x", found[0]);
+			EXPECT_EQ("//depot/b/y", found[1]);
+
+			EXPECT_EQ("//depot/a", std::string(table.Seek("").Key()));
+			EXPECT_FALSE(table.Seek("//depot/d").Valid());
+
+			size_t count = 0;
+			for (TrkSortedTable::Iterator it = table.Begin(); it.Valid(); it.Next())
+			{
+				count++;
+			}
+			EXPECT_EQ(7u, count);
+		}
+		std::filesystem::remove(path.c_str());
+	}
+
+	TEST(SortedTable, RejectsUnsortedKeys)
+	{
+		MemoryLeakDetector leakDetector;
+
+		const TrkString path = GetTestPath("unsorted");
+		{
+			TrkSortedTableWriter writer(path, sizeof(TestValue));
+			const TestValue value = { 1, 0, 0 };
+			EXPECT_TRUE(writer.Add("//depot/b", &value));
+			EXPECT_FALSE(writer.Add("//depot/a", &value));
+			EXPECT_FALSE(writer.Add("//depot/b", &value));
+			EXPECT_TRUE(writer.Add("//depot/c", &value));
+			EXPECT_EQ(2u, writer.GetRecordCount());
+		}
+
+		// A writer that is not committed leaves nothing behind
+		EXPECT_FALSE(std::filesystem::exists(path.c_str()));
+		EXPECT_FALSE(std::filesystem::exists(std::string(path.c_str()) + ".tmp"));
+		EXPECT_FALSE(std::filesystem::exists(std::string(path.c_str()) + ".keys.tmp"));
+	}
+
+	TEST(SortedTable, StreamsLargeTables)
+	{
+		MemoryLeakDetector leakDetector;
+
+		// More values and keys than the writer buffers at once
+		const TrkString path = GetTestPath("large");
+		const int count = 200000;
+		{
+			std::vector<std::string> keys;
+			for (int i = 0; i < count; i++)
+			{
+				keys.push_back(GetTestKey(i));
+			}
+			std::sort(keys.begin(), keys.end());
+
+			TrkSortedTableWriter writer(path, sizeof(TestValue));
+			for (size_t i = 0; i < keys.size(); i++)
+			{
+				const TestValue value = { static_cast<int64_t>(i), 0, 0 };
+				ASSERT_TRUE(writer.Add(keys[i], &value));
+			}
+			ASSERT_TRUE(writer.Commit());
+
+			TrkSortedTable table;
+			ASSERT_TRUE(table.Open(path));
+			EXPECT_EQ(static_cast<uint64_t>(count), table.GetRecordCount());
+
+			size_t index = 0;
+			for (TrkSortedTable::Iterator it = table.Begin(); it.Valid(); it.Next(), index++)
+			{
+				ASSERT_EQ(keys[index], std::string(it.Key()));
+
+				TestValue value;
+				std::memcpy(&value, it.Value(), sizeof(value));
+				ASSERT_EQ(static_cast<int64_t>(index), value.revision);
+			}
+			EXPECT_EQ(keys.size(), index);
+			EXPECT_NE(nullptr, table.Find(keys[count / 2]));
+		}
+		std::filesystem::remove(path.c_str());
+	}
+
+	TEST(SortedTable, EmptyTable)
+	{
+		MemoryLeakDetector leakDetector;
+
+		const TrkString path = GetTestPath("empty");
+		{
+			TrkSortedTableWriter writer(path, sizeof(TestValue));
+			ASSERT_TRUE(writer.Commit());
+
+			TrkSortedTable table;
+			ASSERT_TRUE(table.Open(path));
+			EXPECT_EQ(0u, table.GetRecordCount());
+			EXPECT_EQ(nullptr, table.Find("//depot/a"));
+			EXPECT_FALSE(table.Begin().Valid());
+		}
+		std::filesystem::remove(path.c_str());
+	}
+
+	TEST(SortedTable, RejectsMalformedFiles)
+	{
+		MemoryLeakDetector leakDetector;
+
+		const TrkString path = GetTestPath("malformed");
+		{
+			TrkSortedTable table;
+			EXPECT_FALSE(table.Open(path));
+
+			{
+				std::ofstream output(path.c_str(), std::ios::binary);
+				output << "not a sorted table, just some text that is long enough for a header of the sorted table";
+			}
+			EXPECT_FALSE(table.Open(path));
+			EXPECT_FALSE(table.IsOpen());
+
+			TrkSortedTableWriter writer(path, sizeof(TestValue));
+			const TestValue value = { 1, 0, 0 };
+			ASSERT_TRUE(writer.Add("//depot/a", &value));
+			ASSERT_TRUE(writer.Commit());
+
+			// Cut off the index
+			std::filesystem::resize_file(path.c_str(), std::filesystem::file_size(path.c_str()) - 4);
+			EXPECT_FALSE(table.Open(path));
+		}
+		std::filesystem::remove(path.c_str());
+	}
+}
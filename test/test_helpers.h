@@ -0,0 +1,67 @@
+/*
+ *	test_helpers.h
+ */
+
+#ifndef TRK_TEST_HELPERS_H
+#define TRK_TEST_HELPERS_H
+
+#include <trkstring.h>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <gtest/gtest.h>
+
+#ifdef _WIN32
+#include <process.h>
+#define TRK_TEST_GETPID _getpid
+#else
+#include <unistd.h>
+#define TRK_TEST_GETPID getpid
+#endif
+
+
+namespace TrkCpp
+{
+
+	/*
+	 *	Returns a path in the temp directory that nothing else uses
+	 *
+	 *	The name carries the process and the running test, parallel test
+	 *	runs never share a file. Whatever an earlier run left there is
+	 *	removed first.
+	 */
+	inline TrkString GetTestPath(const char* Name)
+	{
+		std::string name = "trk_test_" + std::to_string(TRK_TEST_GETPID());
+
+		const ::testing::TestInfo* test = ::testing::UnitTest::GetInstance()->current_test_info();
+		if (test != nullptr)
+		{
+			name += std::string("_") + test->test_suite_name() + "_" + test->name();
+		}
+		name += std::string("_") + Name;
+
+		const std::filesystem::path path = std::filesystem::temp_directory_path() / name;
+		std::filesystem::remove_all(path);
+		return path.string().c_str();
+	}
+
+	/* Returns a created, empty directory from GetTestPath */
+	inline TrkString GetTestDirectory(const char* Name)
+	{
+		const TrkString path = GetTestPath(Name);
+		std::filesystem::create_directories(path.c_str());
+		return path;
+	}
+
+	/* Returns the depot path of a test record, spread over ten directories */
+	inline std::string GetTestKey(int Index)
+	{
+		char key[64];
+		std::snprintf(key, sizeof(key), "//depot/dir%02d/file%05d.cpp", Index % 10, Index);
+		return key;
+	}
+}
+
+
+#endif /* TRK_TEST_HELPERS_H */
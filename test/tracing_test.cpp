@@ -0,0 +1,118 @@
+/*
+ *	tracing_test.cpp
+ */
+
+#include <tracing.h>
+#include <string>
+#include <thread>
+#include <gtest/gtest.h>
+#include "memory_leak.h"
+
+
+namespace TrkCpp
+{
+
+	/*
+	 *
+	 *	Request ID Tests
+	 *
+	 */
+
+
+	TEST(Tracing, RequestIdRoundTrip)
+	{
+		const uint64_t id = TrkTracer::NewRequestId();
+		EXPECT_NE(id, 0);
+		EXPECT_NE(id, TrkTracer::NewRequestId());
+
+		const TrkString formatted = TrkTracer::FormatRequestId(id);
+		EXPECT_EQ(formatted.size(), 16);
+		EXPECT_EQ(TrkTracer::ParseRequestId(formatted), id);
+	}
+
+	TEST(Tracing, ParseInvalidRequestId)
+	{
+		EXPECT_EQ(TrkTracer::ParseRequestId(""), 0);
+		EXPECT_EQ(TrkTracer::ParseRequestId("xyz"), 0);
+		EXPECT_EQ(TrkTracer::ParseRequestId("-1"), 0);
+		EXPECT_EQ(TrkTracer::ParseRequestId("0123456789abcdef0"), 0);
+		EXPECT_EQ(TrkTracer::ParseRequestId("00000000000000FF"), 255);
+	}
+
+	TEST(Tracing, RequestScopeRestoresPrevious)
+	{
+		TrkTracer::SetCurrentRequest(0);
+		{
+			TrkTraceRequestScope outer(42);
+			EXPECT_EQ(TrkTracer::GetCurrentRequest(), 42);
+			{
+				TrkTraceRequestScope inner(43);
+				EXPECT_EQ(TrkTracer::GetCurrentRequest(), 43);
+			}
+			EXPECT_EQ(TrkTracer::GetCurrentRequest(), 42);
+		}
+		EXPECT_EQ(TrkTracer::GetCurrentRequest(), 0);
+	}
+
+
+	/*
+	 *
+	 *	Span Tests
+	 *
+	 */
+
+
+	TEST(Tracing, DisabledSpansAreNotRecorded)
+	{
+		TrkTracer::Get().SetEnabled(false);
+		{
+			TrkTraceSpan span("TracingTestDisabledSpan");
+		}
+
+		const std::string json(TrkTracer::Get().DumpChromeJson().c_str());
+		EXPECT_EQ(json.find("TracingTestDisabledSpan"), std::string::npos);
+	}
+
+	TEST(Tracing, ChromeJsonContainsSpans)
+	{
+		TrkTracer::Get().SetEnabled(true);
+
+		std::thread worker([]() {
+			TrkTraceRequestScope request(0xABCDEF);
+			TrkTraceSpan span("TracingTestWorkerSpan", "detail");
+		});
+		worker.join();
+
+		{
+			TrkTraceSpan span("TracingTestMainSpan");
+		}
+
+		TrkTracer::Get().SetEnabled(false);
+
+		const std::string json(TrkTracer::Get().DumpChromeJson().c_str());
+		EXPECT_EQ(json.rfind("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", 0), 0);
+		EXPECT_EQ(json.back(), '}');
+		EXPECT_NE(json.find("\"name\":\"TracingTestWorkerSpan\""), std::string::npos);
+		EXPECT_NE(json.find("\"name\":\"TracingTestMainSpan\""), std::string::npos);
+		EXPECT_NE(json.find("\"request\":\"0000000000abcdef\",\"detail\":\"detail\""), std::string::npos);
+		EXPECT_NE(json.find("\"ph\":\"X\""), std::string::npos);
+	}
+
+	TEST(Tracing, DumpLimitKeepsMostRecent)
+	{
+		TrkTracer::Get().SetEnabled(true);
+		{
+			TrkTraceSpan span("TracingTestOlderSpan");
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		{
+			TrkTraceSpan span("TracingTestNewestSpan");
+		}
+		TrkTracer::Get().SetEnabled(false);
+
+		const std::string json(TrkTracer::Get().DumpChromeJson(1).c_str());
+		EXPECT_NE(json.find("TracingTestNewestSpan"), std::string::npos);
+		EXPECT_EQ(json.find("TracingTestOlderSpan"), std::string::npos);
+	}
+
+}
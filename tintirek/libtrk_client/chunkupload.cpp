@@ -0,0 +1,176 @@
+/*
+ *	chunkupload.cpp
+ *
+ *	Tintirek's client-side uploads of file contents
+ */
+
+
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <unordered_set>
+#include <vector>
+
+#include "chunker.h"
+#include "cmdline.h"
+#include "connect.h"
+#include "crypto.h"
+#include "mappedfile.h"
+#include "objectstore.h"
+#include "tracing.h"
+#include "chunkupload.h"
+
+namespace fs = std::filesystem;
+
+
+/* Chunk of the file being uploaded */
+struct TrkUploadChunk
+{
+	size_t offset;
+	size_t length;
+	std::string digest;
+};
+
+
+/* Sends the chunks the server lacks and then the list of all chunks, returns false if it stopped before the list was stored */
+static bool UploadChunks(TrkCliClientOptionResults& opt_result, const TrkMappedFile& File, const std::vector<TrkUploadChunk>& Chunks, TrkUploadResult& Result, TrkString& ErrorStr)
+{
+	// The server names the chunks it lacks, chunks it acknowledged in an earlier attempt are not among them
+	std::unordered_set<std::string> lacking;
+	const size_t batches = (Chunks.size() + TRK_UPLOAD_QUERY_BATCH - 1) / TRK_UPLOAD_QUERY_BATCH;
+	if (batches > 0 && !TrkConnectHelper::SendCommandSequence(opt_result, batches,
+		[&Chunks](size_t Batch)
+		{
+			std::string command = "MissingChunks";
+			for (size_t i = Batch * TRK_UPLOAD_QUERY_BATCH; i < Chunks.size() && i < (Batch + 1) * TRK_UPLOAD_QUERY_BATCH; i++)
+			{
+				command += "?" + Chunks[i].digest;
+			}
+			return TrkString(command.c_str());
+		},
+		[&lacking](size_t, const TrkString& Reply)
+		{
+			const std::string reply = Reply.c_str();
+			size_t start = 0, end;
+			while ((end = reply.find('\n', start)) != std::string::npos)
+			{
+				lacking.insert(reply.substr(start, end - start));
+				start = end + 1;
+			}
+		},
+		ErrorStr))
+	{
+		return false;
+	}
+
+	// A chunk repeated within the file is sent once
+	std::vector<size_t> missing;
+	for (size_t i = 0; i < Chunks.size(); i++)
+	{
+		if (lacking.erase(Chunks[i].digest) > 0)
+		{
+			missing.push_back(i);
+		}
+	}
+
+	// Every chunk is a command of its own, the list comes last once they are all acknowledged; a file sent whole has no list
+	const bool whole = Chunks.size() == 1 && Chunks[0].digest == Result.digest.c_str();
+	const size_t commands = missing.size() + (whole ? 0 : 1);
+	if (commands == 0)
+	{
+		return true;
+	}
+	return TrkConnectHelper::SendCommandSequence(opt_result, commands,
+		[&File, &Chunks, &missing, &Result](size_t Index)
+		{
+			std::string command;
+			if (Index < missing.size())
+			{
+				const TrkUploadChunk& chunk = Chunks[missing[Index]];
+				command = "PutChunk?" + chunk.digest + "?" + TrkCryptoHelper::Base64Encode(File.GetData() + chunk.offset, chunk.length).c_str();
+			}
+			else
+			{
+				command = std::string("PutChunkList?") + Result.digest.c_str();
+				for (const TrkUploadChunk& chunk : Chunks)
+				{
+					command += "?" + chunk.digest;
+				}
+			}
+			return TrkString(command.c_str());
+		},
+		[&Chunks, &missing, &Result](size_t Index, const TrkString&)
+		{
+			if (Index < missing.size())
+			{
+				Result.chunks_sent++;
+				Result.bytes_sent += Chunks[missing[Index]].length;
+			}
+		},
+		ErrorStr);
+}
+
+
+bool TrkUploadHelper::UploadFile(TrkCliClientOptionResults& opt_result, const TrkString& Path, TrkUploadResult& Result, TrkString& ErrorStr)
+{
+	TrkTraceSpan span("UploadFile");
+	Result = TrkUploadResult();
+
+	// An empty file can not be mapped, it is stored as a list of no chunks
+	std::error_code error;
+	const uintmax_t size = fs::file_size(fs::path((const char*)Path), error);
+	TrkMappedFile file;
+	if (error || (size > 0 && !file.Open(Path)))
+	{
+		ErrorStr << "Unable to read " << Path;
+		return false;
+	}
+
+	// A file below the chunking size is sent whole, as the one chunk that is the file itself
+	std::vector<TrkUploadChunk> chunks;
+	TrkSHA256Stream file_hash, chunk_hash;
+	for (size_t offset = 0; offset < file.GetSize() && file.GetSize() >= TRK_OBJECT_CHUNKED_MIN_SIZE; )
+	{
+		const size_t length = TrkChunker::Cut(file.GetData() + offset, file.GetSize() - offset);
+		if (!chunk_hash.Init() || !chunk_hash.Update(file.GetData() + offset, length) || !file_hash.Update(file.GetData() + offset, length))
+		{
+			ErrorStr << "Unable to hash " << Path;
+			return false;
+		}
+
+		chunks.push_back(TrkUploadChunk{ offset, length, chunk_hash.Final().c_str() });
+		offset += length;
+	}
+
+	if (file.GetSize() > 0 && file.GetSize() < TRK_OBJECT_CHUNKED_MIN_SIZE)
+	{
+		if (!file_hash.Update(file.GetData(), file.GetSize()))
+		{
+			ErrorStr << "Unable to hash " << Path;
+			return false;
+		}
+		Result.digest = file_hash.Final();
+		chunks.push_back(TrkUploadChunk{ 0, file.GetSize(), Result.digest.c_str() });
+	}
+	else
+	{
+		Result.digest = file_hash.Final();
+	}
+	Result.size = file.GetSize();
+	Result.chunks = chunks.size();
+
+	// A failed attempt is picked up by the next one from the chunks the server acknowledged
+	for (int attempt = 1; ; attempt++)
+	{
+		TrkString attempt_error;
+		if (UploadChunks(opt_result, file, chunks, Result, attempt_error))
+		{
+			return true;
+		}
+		if (attempt >= TRK_UPLOAD_ATTEMPTS)
+		{
+			ErrorStr << attempt_error;
+			return false;
+		}
+	}
+}
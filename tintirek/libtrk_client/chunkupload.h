@@ -0,0 +1,65 @@
+/*
+ *	chunkupload.h
+ *
+ *	Tintirek's client-side uploads of file contents
+ */
+
+
+#ifndef TRK_CHUNKUPLOAD_H
+#define TRK_CHUNKUPLOAD_H
+
+
+#include "trkstring.h"
+
+#include <cstddef>
+#include <cstdint>
+
+
+/* Chunk digests asked about in one MissingChunks command */
+#define TRK_UPLOAD_QUERY_BATCH 256
+
+/* Times an upload asks the server again and goes on after a failure */
+#define TRK_UPLOAD_ATTEMPTS 3
+
+
+/* Outcome of an upload */
+struct TrkUploadResult
+{
+	/* Digest the server stores the file under */
+	TrkString digest;
+	/* Bytes of the file */
+	uint64_t size = 0;
+	/* Chunks of the file, and those the server did not have */
+	size_t chunks = 0;
+	size_t chunks_sent = 0;
+	/* Bytes of the chunks sent */
+	uint64_t bytes_sent = 0;
+};
+
+
+/*
+ *	Upload Helper Class
+ *
+ *	Cuts a file into content-defined chunks and asks the server which
+ *	ones it lacks; only those are sent, then the list of all chunks
+ *	that makes them the file. An edit in a large file only sends the
+ *	chunks around it. A file below TRK_OBJECT_CHUNKED_MIN_SIZE is sent
+ *	whole as a single chunk and stored as one object, without a list.
+ *
+ *	Chunks travel base64-encoded in the 1 KiB packets of the protocol,
+ *	about a third larger than the file.
+ *
+ *	The server acknowledges every chunk once it is stored. When the
+ *	connection drops, the upload asks again and goes on with the
+ *	chunks that were not acknowledged, and so does running it again
+ *	after it gave up.
+ */
+class TrkUploadHelper
+{
+public:
+	/* Uploads the contents of a file, returns false if they could not be read or sent */
+	static bool UploadFile(class TrkCliClientOptionResults& opt_result, const TrkString& Path, TrkUploadResult& Result, TrkString& ErrorStr);
+};
+
+
+#endif /* TRK_CHUNKUPLOAD_H */
@@ -9,6 +9,7 @@
 #include <chrono>
 #include <thread>
 #include <regex>
+#include <cstring>
 
 #ifdef _WIN32
 #include <WinSock2.h>
@@ -27,10 +28,15 @@
 #include "cmdline.h"
 #include "connect.h"
 #include "passwd.h"
+#include "tracing.h"
 
 
 bool TrkConnectHelper::SendCommand(TrkCliClientOptionResults& opt_result, const TrkString Command, TrkString& ErrorStr, TrkString& Returned)
 {
+	TrkTraceRequestScope request_scope;
+	TrkTraceSpan span("SendCommand");
+	opt_result.last_request_id = TrkTracer::GetCurrentRequest();
+
 	int client_socket;
 	TrkSSLCTX* ssl_context = nullptr;
 	TrkSSL* ssl_connection = nullptr;
@@ -79,6 +85,7 @@ bool TrkConnectHelper::SendCommand(TrkCliClientOptionResults& opt_result, const
 			{
 				ErrorStr = message.substr(firstNewlinePos + 1);
 			}
+			ErrorStr << " (Request: " << TrkTracer::FormatRequestId(opt_result.last_request_id) << ")";
 			return false;
 		}
 
@@ -95,6 +102,10 @@ bool TrkConnectHelper::SendCommand(TrkCliClientOptionResults& opt_result, const
 
 bool TrkConnectHelper::SendCommandMultiple(class TrkCliClientOptionResults& opt_result, class TrkCommandQueue* Commands, TrkString& ErrorStr, TrkString& Returned)
 {
+	TrkTraceRequestScope request_scope;
+	TrkTraceSpan span("SendCommandMultiple");
+	opt_result.last_request_id = TrkTracer::GetCurrentRequest();
+
 	int client_socket;
 	TrkSSLCTX* ssl_context;
 	TrkSSL* ssl_connection;
@@ -146,36 +157,93 @@ bool TrkConnectHelper::SendCommandMultiple(class TrkCliClientOptionResults& opt_
 	return true;
 }
 
+bool TrkConnectHelper::SendCommandSequence(class TrkCliClientOptionResults& opt_result, size_t Count, const std::function<TrkString(size_t)>& Next, const std::function<void(size_t, const TrkString&)>& Reply, TrkString& ErrorStr)
+{
+	TrkTraceRequestScope request_scope;
+	TrkTraceSpan span("SendCommandSequence");
+	opt_result.last_request_id = TrkTracer::GetCurrentRequest();
+
+	int client_socket;
+	TrkSSLCTX* ssl_context = nullptr;
+	TrkSSL* ssl_connection = nullptr;
+	if (!Connect_Internal(opt_result, ssl_context, ssl_connection, client_socket, ErrorStr))
+	{
+		return false;
+	}
+
+	if (!Authenticate_Internal(&opt_result, ssl_connection, client_socket, ErrorStr))
+	{
+		Disconnect_Internal(ssl_context, ssl_connection, client_socket, ErrorStr);
+		return false;
+	}
+
+	// The server answers the announcement first and then every command on its own
+	TrkString command;
+	command << "MultipleCommands?" << static_cast<int64_t>(Count);
+	for (size_t i = 0; i <= Count; i++)
+	{
+		if (i > 0)
+		{
+			command = Next(i - 1);
+		}
+
+		TrkString message;
+		if (!SendPacket(ssl_connection, client_socket, command, ErrorStr) || !ReceivePacket(ssl_connection, client_socket, message, ErrorStr))
+		{
+			Disconnect_Internal(ssl_context, ssl_connection, client_socket, ErrorStr);
+			return false;
+		}
+
+		size_t firstNewlinePos = message.find("\n");
+		TrkString firstLine = (firstNewlinePos != TrkString::npos) ? message.substr(0, firstNewlinePos) : message;
+		TrkString body = (firstNewlinePos != TrkString::npos) ? message.substr(firstNewlinePos + 1) : TrkString("");
+
+		if (firstLine != "OK")
+		{
+			// The error of a command ends the whole sequence and comes wrapped in its error
+			if (std::strncmp(body, "ERROR\n", 6) == 0)
+			{
+				body = body.substr(6);
+			}
+			ErrorStr = body;
+			ErrorStr << " (Request: " << TrkTracer::FormatRequestId(opt_result.last_request_id) << ")";
+			Disconnect_Internal(ssl_context, ssl_connection, client_socket, ErrorStr);
+			return false;
+		}
+
+		if (i > 0)
+		{
+			Reply(i - 1, body);
+		}
+	}
+
+	// End of the sequence
+	TrkString message, error_msg;
+	ReceivePacket(ssl_connection, client_socket, message, error_msg);
+	Disconnect_Internal(ssl_context, ssl_connection, client_socket, error_msg);
+	return true;
+}
+
 bool TrkConnectHelper::SendPacket(class TrkSSL* ssl_connection, int client_socket, const TrkString message, TrkString& error_msg)
 {
+	TrkTraceSpan span("SendPacket");
 	int totalSent = 0;
+	// Peers read chunks into 1 KiB buffers, a larger chunk would overrun them
 	int chunkSize = 1024;
 
+	// Chunks go out back to back, each header in the same write as its body
 	while (totalSent < message.size())
 	{
-		std::chrono::milliseconds sleeptime(1);
-		std::this_thread::sleep_for(sleeptime);
 		int remaining = message.size() - totalSent;
 		int sendSize = std::min<int>(chunkSize, remaining);
 
-		TrkString chunkHeader;
 		char hexString[4];
 		std::sprintf(hexString, "%03X", sendSize);
-		chunkHeader << hexString << "\r\n";
-		if (Send(ssl_connection, client_socket, chunkHeader, chunkHeader.size()) <= 0)
-		{
-			error_msg << "Send Failed! (errno: "
-#ifdef _WIN32
-				<< WSAGetLastError()
-#else
-				<< errno
-#endif
-				<< ")";
-			return false;
-		}
+		std::string chunkData = std::string(hexString) + "\r\n";
+		chunkData.append(message.begin() + totalSent, sendSize);
 
-		TrkString chunkBody(message.begin() + totalSent, message.begin() + totalSent + sendSize);
-		if (Send(ssl_connection, client_socket, chunkBody, chunkBody.size()) <= 0)
+		TrkString chunk(chunkData.data(), chunkData.data() + chunkData.size());
+		if (Send(ssl_connection, client_socket, chunk, chunk.size()) <= 0)
 		{
 			error_msg << "Send Failed! (errno: "
 #ifdef _WIN32
@@ -207,7 +275,10 @@ bool TrkConnectHelper::SendPacket(class TrkSSL* ssl_connection, int client_socke
 
 bool TrkConnectHelper::ReceivePacket(class TrkSSL* ssl_connection, int client_socket, TrkString& message, TrkString& error_msg)
 {
-	TrkString buffer, receivedData;
+	TrkTraceSpan span("ReceivePacket");
+	// Chunks are appended to a std::string, appending to a TrkString copies all of it every time
+	TrkString buffer;
+	std::string receivedData;
 	bool readingChunkHeader = true;
 	int chunkSize = 5, bytesRead = 0;
 
@@ -217,8 +288,6 @@ bool TrkConnectHelper::ReceivePacket(class TrkSSL* ssl_connection, int client_so
 		buffer = "";
 		while (chunkSize > bytesRead)
 		{
-			std::chrono::milliseconds sleeptime(1);
-			std::this_thread::sleep_for(sleeptime);
 			TrkString newBuffer;
 			int newBytesRead = Recv(ssl_connection, client_socket, newBuffer, chunkSize - bytesRead);
 			if (newBytesRead < 0)
@@ -229,6 +298,9 @@ bool TrkConnectHelper::ReceivePacket(class TrkSSL* ssl_connection, int client_so
 			}
 			else if (newBytesRead == 0)
 			{
+				// Nothing arrived yet, waits a moment before asking again
+				std::chrono::milliseconds sleeptime(1);
+				std::this_thread::sleep_for(sleeptime);
 				continue;
 			}
 			bytesRead += newBytesRead;
@@ -241,14 +313,14 @@ bool TrkConnectHelper::ReceivePacket(class TrkSSL* ssl_connection, int client_so
 			chunkSize = TrkString::stoi(chunkSizeStr, 16);
 			if (chunkSize == 0)
 			{
-				message = receivedData;
+				message = TrkString(receivedData.data(), receivedData.data() + receivedData.size());
 				return true;
 			}
 			readingChunkHeader = false;
 		}
 		else
 		{
-			receivedData << TrkString(buffer.begin(), buffer.begin() + chunkSize);
+			receivedData.append(buffer.begin(), chunkSize);
 			chunkSize = 5;
 			readingChunkHeader = true;
 		}
@@ -259,6 +331,7 @@ bool TrkConnectHelper::ReceivePacket(class TrkSSL* ssl_connection, int client_so
 
 bool TrkConnectHelper::Connect_Internal(TrkCliClientOptionResults& opt_result, TrkSSLCTX*& ssl_context, TrkSSL*& ssl_connection, int& client_socket, TrkString& ErrorStr )
 {
+	TrkTraceSpan span("Connect");
 	struct addrinfo *result = nullptr, *ptr = nullptr, hints;
 
 #ifdef _WIN32
@@ -459,9 +532,14 @@ bool TrkConnectHelper::Disconnect_Internal(TrkSSLCTX* ssl_context, TrkSSL* ssl_c
 
 bool TrkConnectHelper::Authenticate_Internal(class TrkCliClientOptionResults* opt_result, TrkSSL* ssl_connection, int client_socket, TrkString& error_msg, bool retry)
 {
+	TrkTraceSpan span("Authenticate");
+
 	TrkString auth = "", ticket = "", errmsg, result;
 	auth << "Username="
 		<< opt_result->username
+		<< ";"
+		<< "Request="
+		<< TrkTracer::FormatRequestId(TrkTracer::GetCurrentRequest())
 		<< ";";
 
 	if (TrkPasswdHelper::CheckSessionFileExists())
@@ -12,6 +12,9 @@
 #include "trk_string.h"
 #include "crypto.h"
 
+#include <cstddef>
+#include <functional>
+
 
  /* Connection Helper Class */
 class TrkConnectHelper
@@ -21,6 +24,8 @@ public:
 	static bool SendCommand(class TrkCliClientOptionResults& opt_result, const TrkString Command, TrkString& ErrorStr, TrkString& Returned);
 	/* Send multiple commands to server */
 	static bool SendCommandMultiple(class TrkCliClientOptionResults& opt_result, class TrkCommandQueue* Commands, TrkString& ErrorStr, TrkString& Returned);
+	/* Send Count commands over one connection, Next gives the command at an index and Reply gets its answer; stops at the first error */
+	static bool SendCommandSequence(class TrkCliClientOptionResults& opt_result, size_t Count, const std::function<TrkString(size_t)>& Next, const std::function<void(size_t, const TrkString&)>& Reply, TrkString& ErrorStr);
 
 protected:
 	/* Sends packet to client as chunked data */
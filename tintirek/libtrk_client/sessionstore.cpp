@@ -0,0 +1,622 @@
+/*
+ *	sessionstore.cpp
+ *
+ *	Client's session ticket store
+ */
+
+
+#include "sessionstore.h"
+
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+/* Magic bytes at the start of a session store */
+#define TRK_SESSION_MAGIC "TRKSESS1"
+
+/* Layout version of the session store */
+#define TRK_SESSION_VERSION 1
+
+
+/* Header of the session store file */
+struct TrkSessionHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t slot_count;
+	uint32_t used_count;
+	uint32_t deleted_count;
+	uint32_t reserved[10];
+};
+
+/* State of a slot */
+enum TrkSessionSlotState : uint32_t
+{
+	TRK_SESSION_SLOT_EMPTY = 0,
+	TRK_SESSION_SLOT_USED = 1,
+	TRK_SESSION_SLOT_DELETED = 2,
+};
+
+/* A server url and its ticket */
+struct TrkSessionSlot
+{
+	uint32_t state;
+	uint32_t hash;
+	uint16_t url_length;
+	uint16_t ticket_length;
+	char url[TRK_SESSION_URL_SIZE];
+	char ticket[TRK_SESSION_TICKET_SIZE];
+};
+
+static_assert(sizeof(TrkSessionHeader) == 64, "Session store header layout changed");
+static_assert(sizeof(TrkSessionSlot) == 12 + TRK_SESSION_URL_SIZE + TRK_SESSION_TICKET_SIZE, "Session store slot layout changed");
+
+/* Entries moved into a new table */
+typedef std::vector<std::pair<std::string, std::string>> TrkSessionEntries;
+
+
+/* FNV-1a hash of given bytes */
+static uint32_t HashUrl(const char* Data, size_t Length)
+{
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < Length; i++)
+	{
+		hash ^= static_cast<unsigned char>(Data[i]);
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/* Returns the file size of a table with given slot count */
+static size_t GetTableSize(uint32_t SlotCount)
+{
+	return sizeof(TrkSessionHeader) + static_cast<size_t>(SlotCount) * sizeof(TrkSessionSlot);
+}
+
+/* Returns true if the mapping holds a complete table */
+static bool IsValidTable(const void* Mapping, size_t Size)
+{
+	if (Size < sizeof(TrkSessionHeader))
+	{
+		return false;
+	}
+
+	const TrkSessionHeader* header = static_cast<const TrkSessionHeader*>(Mapping);
+	return std::memcmp(header->magic, TRK_SESSION_MAGIC, sizeof(header->magic)) == 0
+		&& header->version == TRK_SESSION_VERSION
+		&& header->slot_count > 0
+		&& GetTableSize(header->slot_count) == Size;
+}
+
+/* Returns the slots following the header */
+static TrkSessionSlot* GetSlots(void* Mapping)
+{
+	return reinterpret_cast<TrkSessionSlot*>(static_cast<char*>(Mapping) + sizeof(TrkSessionHeader));
+}
+
+/* Finds the slot of given url, or the slot it can be inserted into when it is not found */
+static TrkSessionSlot* FindSlot(void* Mapping, const char* Url, size_t UrlLength, uint32_t Hash, bool& Found)
+{
+	const TrkSessionHeader* header = static_cast<const TrkSessionHeader*>(Mapping);
+	TrkSessionSlot* slots = GetSlots(Mapping);
+	TrkSessionSlot* insert_slot = nullptr;
+	Found = false;
+
+	for (uint32_t probe = 0; probe < header->slot_count; probe++)
+	{
+		TrkSessionSlot* slot = &slots[(Hash + probe) % header->slot_count];
+
+		if (slot->state == TRK_SESSION_SLOT_EMPTY)
+		{
+			return insert_slot != nullptr ? insert_slot : slot;
+		}
+
+		if (slot->state == TRK_SESSION_SLOT_DELETED)
+		{
+			if (insert_slot == nullptr)
+			{
+				insert_slot = slot;
+			}
+		}
+		else if (slot->hash == Hash && slot->url_length == UrlLength && std::memcmp(slot->url, Url, UrlLength) == 0)
+		{
+			Found = true;
+			return slot;
+		}
+	}
+
+	return insert_slot;
+}
+
+/* Writes the ticket into a slot, the length is written last */
+static void WriteTicket(TrkSessionSlot* Slot, const char* Ticket, size_t TicketLength)
+{
+	std::memcpy(Slot->ticket, Ticket, TicketLength);
+	std::memset(Slot->ticket + TicketLength, 0, TRK_SESSION_TICKET_SIZE - TicketLength);
+	Slot->ticket_length = static_cast<uint16_t>(TicketLength);
+}
+
+/* Inserts an entry into a table known to have room for it */
+static void InsertEntry(void* Mapping, const std::string& Url, const std::string& Ticket)
+{
+	TrkSessionHeader* header = static_cast<TrkSessionHeader*>(Mapping);
+	const uint32_t hash = HashUrl(Url.data(), Url.size());
+
+	bool found;
+	TrkSessionSlot* slot = FindSlot(Mapping, Url.data(), Url.size(), hash, found);
+	if (found)
+	{
+		// First entry wins, as it did for the text file
+		return;
+	}
+
+	if (slot->state == TRK_SESSION_SLOT_DELETED)
+	{
+		header->deleted_count--;
+	}
+
+	slot->hash = hash;
+	slot->url_length = static_cast<uint16_t>(Url.size());
+	std::memcpy(slot->url, Url.data(), Url.size());
+	WriteTicket(slot, Ticket.data(), Ticket.size());
+	slot->state = TRK_SESSION_SLOT_USED;
+	header->used_count++;
+}
+
+/* Returns true if the url and the ticket fit into a slot */
+static bool FitsSlot(size_t UrlLength, size_t TicketLength)
+{
+	return UrlLength > 0 && UrlLength <= TRK_SESSION_URL_SIZE && TicketLength <= TRK_SESSION_TICKET_SIZE;
+}
+
+
+TrkSessionStore::TrkSessionStore(const TrkString& Path)
+{
+#ifdef _WIN32
+	const std::wstring path = std::filesystem::u8path(Path.c_str()).wstring();
+	HANDLE handle = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	file_handle = handle != INVALID_HANDLE_VALUE ? handle : nullptr;
+#else
+	file_descriptor = open(Path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+#endif
+}
+
+TrkSessionStore::~TrkSessionStore()
+{
+#ifdef _WIN32
+	if (file_handle != nullptr)
+	{
+		CloseHandle(file_handle);
+	}
+#else
+	if (file_descriptor >= 0)
+	{
+		close(file_descriptor);
+	}
+#endif
+}
+
+bool TrkSessionStore::IsOpen() const
+{
+#ifdef _WIN32
+	return file_handle != nullptr;
+#else
+	return file_descriptor >= 0;
+#endif
+}
+
+bool TrkSessionStore::Get(const TrkString& ServerUrl, TrkString& Ticket)
+{
+	return Run(Operation::GET, ServerUrl, nullptr, &Ticket);
+}
+
+bool TrkSessionStore::Put(const TrkString& ServerUrl, const TrkString& Ticket)
+{
+	if (!FitsSlot(ServerUrl.size(), Ticket.size()))
+	{
+		return false;
+	}
+
+	return Run(Operation::PUT, ServerUrl, &Ticket, nullptr);
+}
+
+bool TrkSessionStore::Remove(const TrkString& ServerUrl)
+{
+	return Run(Operation::REMOVE, ServerUrl, nullptr, nullptr);
+}
+
+bool TrkSessionStore::Run(Operation Op, const TrkString& ServerUrl, const TrkString* Input, TrkString* Output)
+{
+	if (!IsOpen() || ServerUrl.size() > TRK_SESSION_URL_SIZE)
+	{
+		return false;
+	}
+
+	// Readers share the lock, it is only taken exclusively to change the file
+	bool exclusive = Op != Operation::GET;
+	if (!LockStore(exclusive))
+	{
+		return false;
+	}
+
+	size_t size = 0;
+	void* mapping = nullptr;
+	bool initialized = false;
+
+	while (true)
+	{
+		if (!GetStoreSize(size))
+		{
+			UnlockStore();
+			return false;
+		}
+
+		mapping = size > 0 ? Map(size) : nullptr;
+		if (mapping != nullptr && IsValidTable(mapping, size))
+		{
+			break;
+		}
+
+		if (mapping != nullptr)
+		{
+			Unmap(mapping, size);
+			mapping = nullptr;
+		}
+
+		if (exclusive)
+		{
+			if (initialized || !Initialize())
+			{
+				UnlockStore();
+				return false;
+			}
+			initialized = true;
+			continue;
+		}
+
+		// The file is new or in the text format, convert it under the exclusive lock
+		UnlockStore();
+		exclusive = true;
+		if (!LockStore(true))
+		{
+			return false;
+		}
+	}
+
+	TrkSessionHeader* header = static_cast<TrkSessionHeader*>(mapping);
+	const uint32_t hash = HashUrl(ServerUrl.c_str(), ServerUrl.size());
+	bool found = false;
+	TrkSessionSlot* slot = FindSlot(mapping, ServerUrl.c_str(), ServerUrl.size(), hash, found);
+	bool result = true;
+
+	switch (Op)
+	{
+	case Operation::GET:
+		result = found;
+		if (found)
+		{
+			*Output = TrkString(slot->ticket, slot->ticket + slot->ticket_length);
+		}
+		break;
+
+	case Operation::PUT:
+		if (found)
+		{
+			WriteTicket(slot, Input->c_str(), Input->size());
+			break;
+		}
+
+		if (slot == nullptr || (header->used_count + header->deleted_count + 1) * 4 > header->slot_count * 3)
+		{
+			// Table is getting full, rebuild it with room for the new entry
+			TrkSessionEntries entries;
+			TrkSessionSlot* slots = GetSlots(mapping);
+			for (uint32_t i = 0; i < header->slot_count; i++)
+			{
+				if (slots[i].state == TRK_SESSION_SLOT_USED)
+				{
+					entries.emplace_back(std::string(slots[i].url, slots[i].url_length), std::string(slots[i].ticket, slots[i].ticket_length));
+				}
+			}
+			entries.emplace_back(std::string(ServerUrl.c_str(), ServerUrl.size()), std::string(Input->c_str(), Input->size()));
+
+			uint32_t slot_count = TRK_SESSION_INITIAL_SLOTS;
+			while (entries.size() * 2 > slot_count)
+			{
+				slot_count *= 2;
+			}
+
+			Unmap(mapping, size);
+			mapping = nullptr;
+
+			const size_t new_size = GetTableSize(slot_count);
+			const size_t mapped_size = size > new_size ? size : new_size;
+			result = ResizeStore(mapped_size);
+			if (result)
+			{
+				mapping = Map(mapped_size);
+				result = mapping != nullptr;
+			}
+
+			if (result)
+			{
+				// The magic is written last, an interrupted rebuild leaves no valid table behind
+				std::memset(mapping, 0, mapped_size);
+				TrkSessionHeader* new_header = static_cast<TrkSessionHeader*>(mapping);
+				new_header->version = TRK_SESSION_VERSION;
+				new_header->slot_count = slot_count;
+				for (const auto& entry : entries)
+				{
+					InsertEntry(mapping, entry.first, entry.second);
+				}
+				std::memcpy(new_header->magic, TRK_SESSION_MAGIC, sizeof(new_header->magic));
+
+				Unmap(mapping, mapped_size);
+				mapping = nullptr;
+				result = ResizeStore(new_size);
+			}
+			break;
+		}
+
+		InsertEntry(mapping, std::string(ServerUrl.c_str(), ServerUrl.size()), std::string(Input->c_str(), Input->size()));
+		break;
+
+	case Operation::REMOVE:
+		if (found)
+		{
+			slot->state = TRK_SESSION_SLOT_DELETED;
+			std::memset(slot->ticket, 0, TRK_SESSION_TICKET_SIZE);
+			slot->ticket_length = 0;
+			header->used_count--;
+			header->deleted_count++;
+		}
+		break;
+	}
+
+	if (mapping != nullptr)
+	{
+		Unmap(mapping, size);
+	}
+
+	UnlockStore();
+	return result;
+}
+
+bool TrkSessionStore::Initialize()
+{
+	// Move the entries of a text session file, "<url>=<ticket>" lines
+	std::string content;
+	if (!ReadAll(content))
+	{
+		return false;
+	}
+
+	TrkSessionEntries entries;
+	size_t line_start = 0;
+	while (line_start < content.size())
+	{
+		size_t line_end = content.find('\n', line_start);
+		if (line_end == std::string::npos)
+		{
+			line_end = content.size();
+		}
+
+		std::string line = content.substr(line_start, line_end - line_start);
+		line_start = line_end + 1;
+
+		if (!line.empty() && line.back() == '\r')
+		{
+			line.pop_back();
+		}
+
+		const size_t delimiter = line.find('=');
+		if (delimiter == std::string::npos || line.find('\0') != std::string::npos)
+		{
+			continue;
+		}
+
+		std::string url = line.substr(0, delimiter);
+		std::string ticket = line.substr(delimiter + 1);
+		if (FitsSlot(url.size(), ticket.size()))
+		{
+			entries.emplace_back(std::move(url), std::move(ticket));
+		}
+	}
+
+	uint32_t slot_count = TRK_SESSION_INITIAL_SLOTS;
+	while (entries.size() * 2 > slot_count)
+	{
+		slot_count *= 2;
+	}
+
+	const size_t size = GetTableSize(slot_count);
+	const size_t mapped_size = size > content.size() ? size : content.size();
+	if (!ResizeStore(mapped_size))
+	{
+		return false;
+	}
+
+	void* mapping = Map(mapped_size);
+	if (mapping == nullptr)
+	{
+		return false;
+	}
+
+	std::memset(mapping, 0, mapped_size);
+	TrkSessionHeader* header = static_cast<TrkSessionHeader*>(mapping);
+	header->version = TRK_SESSION_VERSION;
+	header->slot_count = slot_count;
+	for (const auto& entry : entries)
+	{
+		InsertEntry(mapping, entry.first, entry.second);
+	}
+	std::memcpy(header->magic, TRK_SESSION_MAGIC, sizeof(header->magic));
+
+	Unmap(mapping, mapped_size);
+	return ResizeStore(size);
+}
+
+#ifdef _WIN32
+
+bool TrkSessionStore::LockStore(bool Exclusive)
+{
+	OVERLAPPED overlapped = { 0 };
+	return LockFileEx(file_handle, Exclusive ? LOCKFILE_EXCLUSIVE_LOCK : 0, 0, MAXDWORD, MAXDWORD, &overlapped) != FALSE;
+}
+
+void TrkSessionStore::UnlockStore()
+{
+	OVERLAPPED overlapped = { 0 };
+	UnlockFileEx(file_handle, 0, MAXDWORD, MAXDWORD, &overlapped);
+}
+
+bool TrkSessionStore::GetStoreSize(size_t& Size)
+{
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file_handle, &size))
+	{
+		return false;
+	}
+
+	Size = static_cast<size_t>(size.QuadPart);
+	return true;
+}
+
+bool TrkSessionStore::ResizeStore(size_t Size)
+{
+	LARGE_INTEGER position;
+	position.QuadPart = static_cast<LONGLONG>(Size);
+	return SetFilePointerEx(file_handle, position, NULL, FILE_BEGIN) && SetEndOfFile(file_handle);
+}
+
+void* TrkSessionStore::Map(size_t Size)
+{
+	HANDLE mapping = CreateFileMappingW(file_handle, NULL, PAGE_READWRITE, 0, 0, NULL);
+	if (mapping == NULL)
+	{
+		return nullptr;
+	}
+
+	// The view keeps the mapping object alive
+	void* address = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, Size);
+	CloseHandle(mapping);
+	return address;
+}
+
+void TrkSessionStore::Unmap(void* Address, size_t Size)
+{
+	UnmapViewOfFile(Address);
+}
+
+bool TrkSessionStore::ReadAll(std::string& Content)
+{
+	size_t size;
+	LARGE_INTEGER position = { 0 };
+	if (!GetStoreSize(size) || !SetFilePointerEx(file_handle, position, NULL, FILE_BEGIN))
+	{
+		return false;
+	}
+
+	Content.resize(size);
+	size_t offset = 0;
+	while (offset < size)
+	{
+		DWORD read = 0;
+		if (!ReadFile(file_handle, &Content[offset], static_cast<DWORD>(size - offset), &read, NULL) || read == 0)
+		{
+			return false;
+		}
+		offset += read;
+	}
+
+	return true;
+}
+
+#else
+
+bool TrkSessionStore::LockStore(bool Exclusive)
+{
+	while (flock(file_descriptor, Exclusive ? LOCK_EX : LOCK_SH) != 0)
+	{
+		if (errno != EINTR)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void TrkSessionStore::UnlockStore()
+{
+	flock(file_descriptor, LOCK_UN);
+}
+
+bool TrkSessionStore::GetStoreSize(size_t& Size)
+{
+	struct stat info;
+	if (fstat(file_descriptor, &info) != 0)
+	{
+		return false;
+	}
+
+	Size = static_cast<size_t>(info.st_size);
+	return true;
+}
+
+bool TrkSessionStore::ResizeStore(size_t Size)
+{
+	return ftruncate(file_descriptor, static_cast<off_t>(Size)) == 0;
+}
+
+void* TrkSessionStore::Map(size_t Size)
+{
+	void* address = mmap(nullptr, Size, PROT_READ | PROT_WRITE, MAP_SHARED, file_descriptor, 0);
+	return address != MAP_FAILED ? address : nullptr;
+}
+
+void TrkSessionStore::Unmap(void* Address, size_t Size)
+{
+	munmap(Address, Size);
+}
+
+bool TrkSessionStore::ReadAll(std::string& Content)
+{
+	size_t size;
+	if (!GetStoreSize(size))
+	{
+		return false;
+	}
+
+	Content.resize(size);
+	size_t offset = 0;
+	while (offset < size)
+	{
+		const ssize_t read = pread(file_descriptor, &Content[offset], size - offset, static_cast<off_t>(offset));
+		if (read < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (read <= 0)
+		{
+			return false;
+		}
+		offset += static_cast<size_t>(read);
+	}
+
+	return true;
+}
+
+#endif
@@ -0,0 +1,91 @@
+/*
+ *	sessionstore.h
+ *
+ *	Client's session ticket store
+ */
+
+
+#ifndef TRK_SESSIONSTORE_H
+#define TRK_SESSIONSTORE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "trkstring.h"
+
+
+/* Maximum length of a server url kept in the store */
+#define TRK_SESSION_URL_SIZE 256
+
+/* Maximum length of a ticket kept in the store */
+#define TRK_SESSION_TICKET_SIZE 256
+
+/* Number of slots of a newly created store */
+#define TRK_SESSION_INITIAL_SLOTS 16
+
+
+/*
+ *	Session store
+ *
+ *	Keeps the session tickets of every server in a file made of a small
+ *	header and an open addressing table of fixed size slots hashed by
+ *	server url. The file is memory-mapped for every operation and guarded
+ *	by an advisory file lock, readers share it while writers update the
+ *	slot in place, so parallel trk processes neither rewrite the whole
+ *	file nor see it half written. A session file in the old text format
+ *	is converted on first open.
+ */
+class TrkSessionStore
+{
+public:
+	/* Opens the store at given path, creating it if needed */
+	TrkSessionStore(const TrkString& Path);
+	~TrkSessionStore();
+
+	TrkSessionStore(const TrkSessionStore&) = delete;
+	TrkSessionStore& operator=(const TrkSessionStore&) = delete;
+
+	/* Returns true if the store was opened */
+	bool IsOpen() const;
+
+	/* Finds the ticket of given server, returns false if there is none */
+	bool Get(const TrkString& ServerUrl, TrkString& Ticket);
+	/* Adds or replaces the ticket of given server */
+	bool Put(const TrkString& ServerUrl, const TrkString& Ticket);
+	/* Removes the ticket of given server, returns true if nothing is left for it */
+	bool Remove(const TrkString& ServerUrl);
+
+private:
+	/* Operation run with the mapped file */
+	enum class Operation { GET, PUT, REMOVE };
+
+	/* Locks, maps and validates the file, then runs the operation */
+	bool Run(Operation Op, const TrkString& ServerUrl, const TrkString* Input, TrkString* Output);
+	/* Writes an empty table, moving the entries of a text session file into it */
+	bool Initialize();
+
+	/* Takes the file lock */
+	bool LockStore(bool Exclusive);
+	/* Releases the file lock */
+	void UnlockStore();
+	/* Returns the size of the file */
+	bool GetStoreSize(size_t& Size);
+	/* Changes the size of the file, new bytes are zero */
+	bool ResizeStore(size_t Size);
+	/* Maps given number of bytes of the file */
+	void* Map(size_t Size);
+	/* Unmaps a mapping returned by Map */
+	void Unmap(void* Address, size_t Size);
+	/* Reads the whole file */
+	bool ReadAll(std::string& Content);
+
+#ifdef _WIN32
+	void* file_handle;
+#else
+	int file_descriptor;
+#endif
+};
+
+
+#endif /* TRK_SESSIONSTORE_H */
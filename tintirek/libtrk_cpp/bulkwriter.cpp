@@ -0,0 +1,279 @@
+/*
+ *	bulkwriter.cpp
+ *
+ *	Tintirek's batched SQLite writer
+ */
+
+
+#include "bulkwriter.h"
+
+#include <cctype>
+
+
+/* Keyword a multi-row query repeats the tuple after */
+static const char VALUES_KEYWORD[] = "VALUES";
+static const long VALUES_KEYWORD_LENGTH = sizeof(VALUES_KEYWORD) - 1;
+
+
+/* Returns the position of the last VALUES keyword of a query, -1 if there is none */
+static long FindLastValues(const TrkString& Query)
+{
+	const char* text = Query.c_str();
+	const long length = static_cast<long>(Query.size());
+
+	for (long i = length - VALUES_KEYWORD_LENGTH; i >= 0; i--)
+	{
+		bool match = true;
+		for (long j = 0; j < VALUES_KEYWORD_LENGTH && match; j++)
+		{
+			match = std::toupper(static_cast<unsigned char>(text[i + j])) == VALUES_KEYWORD[j];
+		}
+		if (match)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* Returns the number of parameters in a "(?, ?, ...)" tail, 0 if the tail is anything else */
+static int CountTupleParameters(const char* Tail)
+{
+	const char* p = Tail;
+	while (std::isspace(static_cast<unsigned char>(*p))) p++;
+	if (*p++ != '(')
+	{
+		return 0;
+	}
+
+	int parameters = 0;
+	while (true)
+	{
+		while (std::isspace(static_cast<unsigned char>(*p))) p++;
+		if (*p++ != '?')
+		{
+			return 0;
+		}
+		parameters++;
+
+		while (std::isspace(static_cast<unsigned char>(*p))) p++;
+		if (*p == ',')
+		{
+			p++;
+			continue;
+		}
+		if (*p++ != ')')
+		{
+			return 0;
+		}
+		break;
+	}
+
+	while (std::isspace(static_cast<unsigned char>(*p)) || *p == ';') p++;
+	return *p == '\0' ? parameters : 0;
+}
+
+
+TrkSqlite::TrkBulkWriter::TrkBulkWriter(TrkDatabase& Database, const TrkString Query, size_t BatchSize, TrkBulkMode Mode)
+	: database(Database)
+	, query(Query)
+	, mode(Mode)
+	, batch_size(BatchSize > 0 ? BatchSize : 1)
+{
+	{
+		TrkStatementLease statement = database.Prepare(query);
+		column_count = statement->GetParameterCount();
+	}
+
+	if (mode == TrkBulkMode::Repeated)
+	{
+		return;
+	}
+
+	const long values = FindLastValues(query);
+	const bool widenable = column_count > 0 && values >= 0
+		&& CountTupleParameters(query.c_str() + values + VALUES_KEYWORD_LENGTH) == column_count;
+
+	if (!widenable)
+	{
+		if (mode == TrkBulkMode::MultiRow)
+		{
+			throw TrkDatabaseException(TrkString("Query does not end with its VALUES tuple: ") + query);
+		}
+		mode = TrkBulkMode::Repeated;
+		return;
+	}
+
+	mode = TrkBulkMode::MultiRow;
+
+	multi_row_tuple = ", (?";
+	for (int i = 1; i < column_count; i++)
+	{
+		multi_row_tuple << ", ?";
+	}
+	multi_row_tuple << ")";
+
+	const size_t limit = static_cast<size_t>(database.GetParameterLimit() / column_count);
+	rows_per_statement = batch_size < limit ? batch_size : limit;
+	if (rows_per_statement == 0)
+	{
+		rows_per_statement = 1;
+	}
+	multi_row_query = GetMultiRowQuery(rows_per_statement);
+}
+
+int TrkSqlite::TrkBulkWriter::Flush()
+{
+	if (pending_rows == 0)
+	{
+		return 0;
+	}
+
+	int changes = 0;
+	try
+	{
+		changes = WriteRows();
+	}
+	catch (...)
+	{
+		// The batch is dropped with its transaction, the next one starts clean
+		values.clear();
+		arena.clear();
+		pending_rows = 0;
+		throw;
+	}
+
+	written_rows += static_cast<int64_t>(pending_rows);
+	values.clear();
+	arena.clear();
+	pending_rows = 0;
+	return changes;
+}
+
+void TrkSqlite::TrkBulkWriter::Push(const double Value)
+{
+	values.push_back(BufferedValue{ FLOAT, 0, Value, 0, 0 });
+}
+
+void TrkSqlite::TrkBulkWriter::Push(std::nullptr_t)
+{
+	values.push_back(BufferedValue{ Null, 0, 0.0, 0, 0 });
+}
+
+void TrkSqlite::TrkBulkWriter::PushInteger(int64_t Value)
+{
+	values.push_back(BufferedValue{ INTEGER, Value, 0.0, 0, 0 });
+}
+
+void TrkSqlite::TrkBulkWriter::PushBytes(int Type, const void* Data, size_t Size)
+{
+	values.push_back(BufferedValue{ Type, 0, 0.0, arena.size(), Size });
+	if (Size > 0)
+	{
+		arena.append(static_cast<const char*>(Data), Size);
+	}
+}
+
+void TrkSqlite::TrkBulkWriter::CheckRow(size_t Count) const
+{
+	if (Count != static_cast<size_t>(column_count))
+	{
+		TrkString message = "Row has ";
+		message << static_cast<int>(Count) << " values, the query has " << column_count << " parameters";
+		throw TrkDatabaseException(message);
+	}
+}
+
+void TrkSqlite::TrkBulkWriter::EndRow()
+{
+	if (++pending_rows >= batch_size)
+	{
+		Flush();
+	}
+}
+
+TrkString TrkSqlite::TrkBulkWriter::GetMultiRowQuery(size_t Rows) const
+{
+	// A trailing semicolon would end the statement before the other tuples
+	const char* end = query.c_str() + query.size();
+	while (end > query.c_str() && (end[-1] == ';' || std::isspace(static_cast<unsigned char>(end[-1]))))
+	{
+		end--;
+	}
+
+	TrkString multi_row(query.c_str(), end);
+
+	for (size_t i = 1; i < Rows; i++)
+	{
+		multi_row << multi_row_tuple;
+	}
+	return multi_row;
+}
+
+void TrkSqlite::TrkBulkWriter::BindRows(TrkStatement& Statement, size_t First, size_t Rows) const
+{
+	const size_t first_value = First * column_count;
+	const size_t count = Rows * column_count;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		const BufferedValue& value = values[first_value + i];
+		const int parameter = static_cast<int>(i) + 1;
+
+		switch (value.type)
+		{
+		case INTEGER:
+			Statement.Bind(parameter, value.integer);
+			break;
+		case FLOAT:
+			Statement.Bind(parameter, value.real);
+			break;
+		case TEXT:
+			Statement.BindText(parameter, arena.data() + value.offset, static_cast<int>(value.size));
+			break;
+		case BLOB:
+			Statement.Bind(parameter, static_cast<const void*>(arena.data() + value.offset), static_cast<int>(value.size));
+			break;
+		default:
+			Statement.Bind(parameter);
+			break;
+		}
+	}
+}
+
+int TrkSqlite::TrkBulkWriter::WriteRows()
+{
+	std::optional<TrkTransaction> transaction;
+	if (!database.InTransaction())
+	{
+		transaction.emplace(database);
+	}
+
+	int changes = 0;
+	if (mode == TrkBulkMode::MultiRow)
+	{
+		for (size_t row = 0; row < pending_rows; row += rows_per_statement)
+		{
+			const size_t rows = pending_rows - row < rows_per_statement ? pending_rows - row : rows_per_statement;
+			TrkStatementLease statement = database.Prepare(rows == rows_per_statement ? multi_row_query : GetMultiRowQuery(rows));
+			BindRows(*statement, row, rows);
+			changes += statement->Execute();
+		}
+	}
+	else
+	{
+		TrkStatementLease statement = database.Prepare(query);
+		for (size_t row = 0; row < pending_rows; row++)
+		{
+			BindRows(*statement, row, 1);
+			changes += statement->Execute();
+			statement->Reset();
+		}
+	}
+
+	if (transaction.has_value())
+	{
+		transaction->Commit();
+	}
+	return changes;
+}
@@ -0,0 +1,148 @@
+/*
+ *	bulkwriter.h
+ *
+ *	Tintirek's batched SQLite writer
+ */
+
+#ifndef TRK_BULKWRITER_H
+#define TRK_BULKWRITER_H
+
+#include "sqlite3.h"
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+namespace TrkSqlite
+{
+	/* Default number of rows written together */
+	const size_t DEFAULT_BULK_BATCH_SIZE = 500;
+
+	/* How a bulk writer sends its rows */
+	enum class TrkBulkMode
+	{
+		/* Multi-row INSERT when the query allows it, repeated otherwise */
+		Auto,
+		/* One INSERT ... VALUES (...), (...) statement for many rows */
+		MultiRow,
+		/* The single-row statement executed once per row */
+		Repeated
+	};
+
+	/*
+	 *	Tintirek's Bulk Writer Class
+	 *
+	 *	Collects rows for a single-row statement such as
+	 *	"INSERT INTO file (path, size) VALUES (?, ?)" or an UPDATE, and
+	 *	writes them every BatchSize rows. A statement ending with its
+	 *	VALUES tuple is widened to a multi-row INSERT, as many rows per
+	 *	statement as the parameter limit allows; any other statement is
+	 *	executed once per row. Both are prepared once through the
+	 *	statement cache of the database.
+	 *
+	 *	A batch runs in its own transaction when the connection is in
+	 *	autocommit mode, otherwise it joins the transaction of the caller.
+	 *	Rows that are not flushed when the writer is destroyed are
+	 *	discarded, call Flush() after the last row.
+	 */
+	class TrkBulkWriter
+	{
+	public:
+		TrkBulkWriter(TrkDatabase& Database, const TrkString Query, size_t BatchSize = DEFAULT_BULK_BATCH_SIZE, TrkBulkMode Mode = TrkBulkMode::Auto);
+
+		/* Disables copy and move */
+		TrkBulkWriter(const TrkBulkWriter&) = delete;
+		TrkBulkWriter& operator=(const TrkBulkWriter&) = delete;
+
+		/* Adds a row, one value per parameter of the query; writes the batch when it is full */
+		template <typename... Args>
+		void Add(const Args&... Values);
+		/* Writes the pending rows, returns the number of changes */
+		int Flush();
+
+		/* Returns the mode the writer settled on */
+		TrkBulkMode GetMode() const { return mode; }
+		/* Returns the number of parameters of a row */
+		int GetColumnCount() const { return column_count; }
+		/* Returns the number of rows a multi-row statement carries */
+		size_t GetRowsPerStatement() const { return rows_per_statement; }
+		/* Returns the number of rows waiting for a flush */
+		size_t GetPendingRows() const { return pending_rows; }
+		/* Returns the number of rows written so far */
+		int64_t GetWrittenRows() const { return written_rows; }
+
+	private:
+		/* A buffered parameter, text and blobs live in the arena */
+		struct BufferedValue
+		{
+			int type;
+			int64_t integer;
+			double real;
+			size_t offset;
+			size_t size;
+		};
+
+		/* Buffer one value of Add() */
+		void Push(const int32_t Value) { PushInteger(Value); }
+		void Push(const uint32_t Value) { PushInteger(Value); }
+		void Push(const int64_t Value) { PushInteger(Value); }
+		void Push(const double Value);
+		void Push(const TrkString& Value) { PushBytes(TEXT, Value.c_str(), Value.size()); }
+		void Push(const char* Value) { Push(std::string_view(Value)); }
+		void Push(std::string_view Value) { PushBytes(TEXT, Value.data(), Value.size()); }
+		void Push(const TrkBlobView& Value) { PushBytes(BLOB, Value.data, Value.size); }
+		void Push(std::nullptr_t);
+		template <typename T>
+		void Push(const std::optional<T>& Value)
+		{
+			if (Value.has_value())
+			{
+				Push(*Value);
+			}
+			else
+			{
+				Push(nullptr);
+			}
+		}
+
+		void PushInteger(int64_t Value);
+		void PushBytes(int Type, const void* Data, size_t Size);
+		/* Checks the value count of a row before it is buffered */
+		void CheckRow(size_t Count) const;
+		/* Counts the buffered row and flushes a full batch */
+		void EndRow();
+
+		/* Returns the multi-row statement text carrying given number of rows */
+		TrkString GetMultiRowQuery(size_t Rows) const;
+		/* Binds the buffered rows starting at First to a statement, Rows of them */
+		void BindRows(TrkStatement& Statement, size_t First, size_t Rows) const;
+		/* Writes the buffered rows, returns the number of changes */
+		int WriteRows();
+
+		TrkDatabase& database;
+		TrkString query;					// Single-row statement
+		TrkString multi_row_tuple;			// ", (?, ...)" appended for every other row
+		TrkString multi_row_query;			// Statement carrying rows_per_statement rows
+		TrkBulkMode mode;
+		int column_count = 0;
+		size_t batch_size;
+		size_t rows_per_statement = 1;
+
+		std::vector<BufferedValue> values;			// Buffered parameters, row after row
+		std::string arena;					// Bytes of the buffered text and blobs
+		size_t pending_rows = 0;
+		int64_t written_rows = 0;
+	};
+
+	template <typename... Args>
+	void TrkBulkWriter::Add(const Args&... Values)
+	{
+		CheckRow(sizeof...(Args));
+		(Push(Values), ...);
+		EndRow();
+	}
+}
+
+#endif /* TRK_BULKWRITER_H */
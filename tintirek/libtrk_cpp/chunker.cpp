@@ -0,0 +1,70 @@
+/*
+ *	chunker.cpp
+ *
+ *	Tintirek's content-defined chunking of large files
+ */
+
+
+#include "chunker.h"
+
+#include <array>
+
+
+/* Seed of the gear table, changing it moves every chunk boundary */
+#define TRK_CHUNK_GEAR_SEED 0x54524B4348554E4Bull
+
+/* Zero bits a boundary needs before and after the average size, around log2 of the average */
+#define TRK_CHUNK_MASK_SMALL (((1ull << 18) - 1) << (64 - 18))
+#define TRK_CHUNK_MASK_LARGE (((1ull << 14) - 1) << (64 - 14))
+
+
+/* Fills the gear table with splitmix64 numbers */
+static constexpr std::array<uint64_t, 256> MakeGearTable()
+{
+	std::array<uint64_t, 256> table{};
+	uint64_t state = TRK_CHUNK_GEAR_SEED;
+	for (size_t i = 0; i < table.size(); i++)
+	{
+		state += 0x9E3779B97F4A7C15ull;
+		uint64_t value = state;
+		value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+		value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+		table[i] = value ^ (value >> 31);
+	}
+	return table;
+}
+
+static constexpr std::array<uint64_t, 256> gear_table = MakeGearTable();
+
+
+size_t TrkChunker::Cut(const uint8_t* Data, size_t Length)
+{
+	if (Length <= TRK_CHUNK_MIN_SIZE)
+	{
+		return Length;
+	}
+
+	const size_t limit = Length < TRK_CHUNK_MAX_SIZE ? Length : TRK_CHUNK_MAX_SIZE;
+	const size_t normal = limit < TRK_CHUNK_AVG_SIZE ? limit : TRK_CHUNK_AVG_SIZE;
+
+	uint64_t hash = 0;
+	size_t position = TRK_CHUNK_MIN_SIZE;
+	for (; position < normal; position++)
+	{
+		hash = (hash << 1) + gear_table[Data[position]];
+		if ((hash & TRK_CHUNK_MASK_SMALL) == 0)
+		{
+			return position + 1;
+		}
+	}
+	for (; position < limit; position++)
+	{
+		hash = (hash << 1) + gear_table[Data[position]];
+		if ((hash & TRK_CHUNK_MASK_LARGE) == 0)
+		{
+			return position + 1;
+		}
+	}
+
+	return limit;
+}
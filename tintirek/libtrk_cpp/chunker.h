@@ -0,0 +1,44 @@
+/*
+ *	chunker.h
+ *
+ *	Tintirek's content-defined chunking of large files
+ */
+
+#ifndef TRK_CHUNKER_H
+#define TRK_CHUNKER_H
+
+#include <cstddef>
+#include <cstdint>
+
+
+/* Chunks are cut at the first boundary past the minimum, and at the maximum if none is found */
+#define TRK_CHUNK_MIN_SIZE (16 * 1024)
+#define TRK_CHUNK_AVG_SIZE (64 * 1024)
+#define TRK_CHUNK_MAX_SIZE (256 * 1024)
+
+
+/*
+ *	Content-defined chunker
+ *
+ *	FastCDC: a gear hash rolls over the bytes, and a chunk ends where
+ *	its top bits are zero. The hash only depends on the last 64 bytes,
+ *	so boundaries follow the contents instead of their offsets; an
+ *	insert near the start of a file changes the chunks around it and
+ *	leaves every other chunk as it was.
+ *
+ *	Before the average size a boundary needs more zero bits than
+ *	after it, which keeps most chunks close to the average. The first
+ *	TRK_CHUNK_MIN_SIZE bytes of a chunk are not hashed at all.
+ *
+ *	The gear table is fixed, clients and servers cut the same file
+ *	into the same chunks.
+ */
+class TrkChunker
+{
+public:
+	/* Returns the length of the chunk at the start of Data, Length if it is the last one */
+	static size_t Cut(const uint8_t* Data, size_t Length);
+};
+
+
+#endif /* TRK_CHUNKER_H */
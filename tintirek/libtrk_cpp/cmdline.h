@@ -97,6 +97,11 @@ public:
     TrkString server_uptime = "";
     /* Server-side time info */
     TrkString server_time = "";
+
+    /* If not empty, client-side spans are written to this file as Chrome trace-event JSON */
+    TrkString trace_path = "";
+    /* ID of the last request sent to the server, the server records spans under the same ID */
+    uint64_t last_request_id = 0;
 };
 
 /* Results of server-side */
@@ -121,8 +126,65 @@ public:
     /* Log file destination */
     TrkString log_path = "";
 
+    /* Writes log output as structured JSON lines */
+    bool structured_log = false;
+
+    /* Issues HMAC signed session tickets instead of storing them in the user database */
+    bool signed_tickets = false;
+
+    /* Comma separated users allowed to run administration commands, nobody when empty */
+    TrkString admin_users = "";
+
     /* Server running port */
     uint16_t port_number = 5566;
+
+    /* Number of database reader connections, 0 picks one per core */
+    int db_readers = 0;
+
+    /* Database journal mode */
+    TrkString db_journal_mode = "WAL";
+
+    /* Database synchronous mode */
+    TrkString db_synchronous = "NORMAL";
+
+    /* Database memory-mapped I/O size in bytes */
+    int64_t db_mmap_size = 268435456;
+
+    /* Database page cache size, pages when positive, KiB when negative */
+    int64_t db_cache_size = -16384;
+
+    /* Milliseconds to wait for a locked database */
+    int db_busy_timeout = 5000;
+
+    /* Microseconds a database write waits for others to share its commit */
+    int db_commit_window = 2000;
+
+    /* Seconds between scheduled WAL checkpoints, 0 disables them */
+    int db_checkpoint_interval = 60;
+
+    /* Seconds between scheduled online backups, 0 disables them */
+    int db_backup_interval = 0;
+
+    /* Backup destination directory, "backup" under the running root when empty */
+    TrkString db_backup_dir = "";
+
+    /* Pages an online backup copies per step */
+    int db_backup_pages = 64;
+
+    /* Milliseconds an online backup sleeps between steps */
+    int db_backup_pause = 10;
+
+    /* Backups kept of each database, older ones are removed once a backup completes, 0 keeps every backup */
+    int db_backup_keep = 7;
+
+    /* Milliseconds a database statement may run before it is logged as slow, 0 disables the slow statement log */
+    int db_slow_query = 100;
+
+    /* Seconds between rebuilds of the head revision snapshot, 0 disables the snapshot */
+    int db_head_snapshot_interval = 300;
+
+    /* Seconds between repacks of small loose objects, 0 disables them */
+    int object_repack_interval = 600;
 };
 
 
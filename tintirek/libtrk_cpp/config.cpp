@@ -9,6 +9,7 @@
 #include <filesystem>
 #include <string>
 #include <cstdlib>
+#include <utility>
 
 #ifdef _WIN32
 #include <Windows.h>
@@ -41,8 +42,118 @@ static bool FindAndLoadConfig(const fs::path& currentPath, const char* configFil
     return false;
 }
 
+/* Applies a database setting of the server, returns false if the key is not one */
+static bool LoadServerDatabaseConfig(TrkCliServerOptionResults* ServerResults, const TrkString& Key, const char* Value)
+{
+    if (Key == TRK_CONFIG_SERVER_DBREADERS)
+    {
+        ServerResults->db_readers = std::atoi(Value);
+    }
+    else if (Key == TRK_CONFIG_SERVER_DBJOURNALMODE)
+    {
+        ServerResults->db_journal_mode = Value;
+    }
+    else if (Key == TRK_CONFIG_SERVER_DBSYNCHRONOUS)
+    {
+        ServerResults->db_synchronous = Value;
+    }
+    else if (Key == TRK_CONFIG_SERVER_DBMMAPSIZE)
+    {
+        ServerResults->db_mmap_size = std::atoll(Value);
+    }
+    else if (Key == TRK_CONFIG_SERVER_DBCACHESIZE)
+    {
+        ServerResults->db_cache_size = std::atoll(Value);
+    }
+    else if (Key == TRK_CONFIG_SERVER_DBBUSYTIMEOUT)
+    {
+        ServerResults->db_busy_timeout = std::atoi(Value);
+    }
+    else if (Key == TRK_CONFIG_SERVER_DBCOMMITWINDOW)
+    {
+        ServerResults->db_commit_window = std::atoi(Value);
+    }
+    else if (Key == TRK_CONFIG_SERVER_DBCHECKPOINT)
+    {
+        ServerResults->db_checkpoint_interval = std::atoi(Value);
+    }
+    else if (Key == TRK_CONFIG_SERVER_DBBACKUP)
+    {
+        ServerResults->db_backup_interval = std::atoi(Value);
+    }
+    else if (Key == TRK_CONFIG_SERVER_DBBACKUPDIR)
+    {
+        ServerResults->db_backup_dir = Value;
+    }
+    else if (Key == TRK_CONFIG_SERVER_DBBACKUPPAGES)
+    {
+        ServerResults->db_backup_pages = std::atoi(Value);
+    }
+    else if (Key == TRK_CONFIG_SERVER_DBBACKUPPAUSE)
+    {
+        ServerResults->db_backup_pause = std::atoi(Value);
+    }
+    else if (Key == TRK_CONFIG_SERVER_DBBACKUPKEEP)
+    {
+        ServerResults->db_backup_keep = std::atoi(Value);
+    }
+    else if (Key == TRK_CONFIG_SERVER_DBSLOWQUERY)
+    {
+        ServerResults->db_slow_query = std::atoi(Value);
+    }
+    else if (Key == TRK_CONFIG_SERVER_DBHEADSNAPSHOT)
+    {
+        ServerResults->db_head_snapshot_interval = std::atoi(Value);
+    }
+    else if (Key == TRK_CONFIG_SERVER_OBJECTREPACK)
+    {
+        ServerResults->object_repack_interval = std::atoi(Value);
+    }
+    else if (Key == TRK_CONFIG_SERVER_ADMINS)
+    {
+        ServerResults->admin_users = Value;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
 bool TrkConfig::LoadConfig(TrkCliOptionResults* Results)
 {
+    TrkCliServerOptionResults* serverResults = dynamic_cast<TrkCliServerOptionResults*>(Results);
+    if (serverResults)
+    {
+        // Environment comes first, the config file overrides it
+        const std::pair<const char*, const char*> serverEnvs[] = {
+            { TRK_CONFIG_SERVER_DBREADERS, TRK_ENV_SERVER_DBREADERS },
+            { TRK_CONFIG_SERVER_DBJOURNALMODE, TRK_ENV_SERVER_DBJOURNALMODE },
+            { TRK_CONFIG_SERVER_DBSYNCHRONOUS, TRK_ENV_SERVER_DBSYNCHRONOUS },
+            { TRK_CONFIG_SERVER_DBMMAPSIZE, TRK_ENV_SERVER_DBMMAPSIZE },
+            { TRK_CONFIG_SERVER_DBCACHESIZE, TRK_ENV_SERVER_DBCACHESIZE },
+            { TRK_CONFIG_SERVER_DBBUSYTIMEOUT, TRK_ENV_SERVER_DBBUSYTIMEOUT },
+            { TRK_CONFIG_SERVER_DBCOMMITWINDOW, TRK_ENV_SERVER_DBCOMMITWINDOW },
+            { TRK_CONFIG_SERVER_DBCHECKPOINT, TRK_ENV_SERVER_DBCHECKPOINT },
+            { TRK_CONFIG_SERVER_DBBACKUP, TRK_ENV_SERVER_DBBACKUP },
+            { TRK_CONFIG_SERVER_DBBACKUPDIR, TRK_ENV_SERVER_DBBACKUPDIR },
+            { TRK_CONFIG_SERVER_DBBACKUPPAGES, TRK_ENV_SERVER_DBBACKUPPAGES },
+            { TRK_CONFIG_SERVER_DBBACKUPPAUSE, TRK_ENV_SERVER_DBBACKUPPAUSE },
+            { TRK_CONFIG_SERVER_DBBACKUPKEEP, TRK_ENV_SERVER_DBBACKUPKEEP },
+            { TRK_CONFIG_SERVER_DBSLOWQUERY, TRK_ENV_SERVER_DBSLOWQUERY },
+            { TRK_CONFIG_SERVER_DBHEADSNAPSHOT, TRK_ENV_SERVER_DBHEADSNAPSHOT },
+            { TRK_CONFIG_SERVER_OBJECTREPACK, TRK_ENV_SERVER_OBJECTREPACK },
+            { TRK_CONFIG_SERVER_ADMINS, TRK_ENV_SERVER_ADMINS },
+        };
+        for (const auto& env : serverEnvs)
+        {
+            if (std::getenv(env.second) != nullptr)
+            {
+                LoadServerDatabaseConfig(serverResults, env.first, std::getenv(env.second));
+            }
+        }
+    }
+
     TrkString valid_path;
     if (FindAndLoadConfig(fs::current_path(), ".trkconfig", valid_path))
     {
@@ -78,6 +189,15 @@ bool TrkConfig::LoadConfig(TrkCliOptionResults* Results)
                     {
                         clientResults->username = value;
                     }
+                    else if (key == TRK_CONFIG_CLIENT_TRACE)
+                    {
+                        clientResults->trace_path = value;
+                    }
+                }
+
+                if (serverResults)
+                {
+                    LoadServerDatabaseConfig(serverResults, key, value);
                 }
             }
         }
@@ -126,6 +246,10 @@ bool TrkConfig::LoadConfig(TrkCliOptionResults* Results)
 #endif
             }
         }
+        if (clientResults->trace_path == "" && std::getenv(TRK_ENV_CLIENT_TRACE) != nullptr)
+        {
+            clientResults->trace_path = std::getenv(TRK_ENV_CLIENT_TRACE);
+        }
     }
 
     return true;
@@ -24,23 +24,59 @@
 #define TRK_CONFIG_CLIENT_SERVERURL				"SERVERURL"
 #define TRK_CONFIG_CLIENT_USER					"USER"
 #define TRK_CONFIG_CLIENT_PASSWORD				"PASSWORD"
+#define TRK_CONFIG_CLIENT_TRACE					"TRACE"
 
 #define TRK_CONFIG_SERVER_LOG					"LOG"
 #define TRK_CONFIG_SERVER_PORT					"PORT"
 #define TRK_CONFIG_SERVER_ROOT					"ROOT"
 #define TRK_CONFIG_SERVER_NAME					"NAME"
 #define TRK_CONFIG_SERVER_SSLKEY				"SSLKEY"
+#define TRK_CONFIG_SERVER_ADMINS				"ADMINS"
+#define TRK_CONFIG_SERVER_DBREADERS				"DBREADERS"
+#define TRK_CONFIG_SERVER_DBJOURNALMODE			"DBJOURNALMODE"
+#define TRK_CONFIG_SERVER_DBSYNCHRONOUS			"DBSYNCHRONOUS"
+#define TRK_CONFIG_SERVER_DBMMAPSIZE			"DBMMAPSIZE"
+#define TRK_CONFIG_SERVER_DBCACHESIZE			"DBCACHESIZE"
+#define TRK_CONFIG_SERVER_DBBUSYTIMEOUT			"DBBUSYTIMEOUT"
+#define TRK_CONFIG_SERVER_DBCOMMITWINDOW		"DBCOMMITWINDOW"
+#define TRK_CONFIG_SERVER_DBCHECKPOINT			"DBCHECKPOINT"
+#define TRK_CONFIG_SERVER_DBBACKUP				"DBBACKUP"
+#define TRK_CONFIG_SERVER_DBBACKUPDIR			"DBBACKUPDIR"
+#define TRK_CONFIG_SERVER_DBBACKUPPAGES			"DBBACKUPPAGES"
+#define TRK_CONFIG_SERVER_DBBACKUPPAUSE			"DBBACKUPPAUSE"
+#define TRK_CONFIG_SERVER_DBBACKUPKEEP			"DBBACKUPKEEP"
+#define TRK_CONFIG_SERVER_DBSLOWQUERY			"DBSLOWQUERY"
+#define TRK_CONFIG_SERVER_DBHEADSNAPSHOT		"DBHEADSNAPSHOT"
+#define TRK_CONFIG_SERVER_OBJECTREPACK			"OBJECTREPACK"
 
 
 #define TRK_ENV_CLIENT_SERVERURL				"TRK" TRK_CONFIG_CLIENT_SERVERURL
 #define TRK_ENV_CLIENT_USER						"TRK" TRK_CONFIG_CLIENT_USER
 #define TRK_ENV_CLIENT_PASSWORD					"TRK" TRK_CONFIG_CLIENT_PASSWORD
+#define TRK_ENV_CLIENT_TRACE					"TRK" TRK_CONFIG_CLIENT_TRACE
 
 #define TRK_ENV_SERVER_LOG						"TRK" TRK_CONFIG_SERVER_LOG
 #define TRK_ENV_SERVER_PORT						"TRK" TRK_CONFIG_SERVER_PORT
 #define TRK_ENV_SERVER_ROOT						"TRK" TRK_CONFIG_SERVER_ROOT
 #define TRK_ENV_SERVER_NAME						"TRK" TRK_CONFIG_SERVER_NAME
 #define TRK_ENV_SERVER_SSLKEY					"TRK" TRK_CONFIG_SERVER_SSLKEY
+#define TRK_ENV_SERVER_ADMINS					"TRK" TRK_CONFIG_SERVER_ADMINS
+#define TRK_ENV_SERVER_DBREADERS				"TRK" TRK_CONFIG_SERVER_DBREADERS
+#define TRK_ENV_SERVER_DBJOURNALMODE			"TRK" TRK_CONFIG_SERVER_DBJOURNALMODE
+#define TRK_ENV_SERVER_DBSYNCHRONOUS			"TRK" TRK_CONFIG_SERVER_DBSYNCHRONOUS
+#define TRK_ENV_SERVER_DBMMAPSIZE				"TRK" TRK_CONFIG_SERVER_DBMMAPSIZE
+#define TRK_ENV_SERVER_DBCACHESIZE				"TRK" TRK_CONFIG_SERVER_DBCACHESIZE
+#define TRK_ENV_SERVER_DBBUSYTIMEOUT			"TRK" TRK_CONFIG_SERVER_DBBUSYTIMEOUT
+#define TRK_ENV_SERVER_DBCOMMITWINDOW			"TRK" TRK_CONFIG_SERVER_DBCOMMITWINDOW
+#define TRK_ENV_SERVER_DBCHECKPOINT				"TRK" TRK_CONFIG_SERVER_DBCHECKPOINT
+#define TRK_ENV_SERVER_DBBACKUP					"TRK" TRK_CONFIG_SERVER_DBBACKUP
+#define TRK_ENV_SERVER_DBBACKUPDIR				"TRK" TRK_CONFIG_SERVER_DBBACKUPDIR
+#define TRK_ENV_SERVER_DBBACKUPPAGES			"TRK" TRK_CONFIG_SERVER_DBBACKUPPAGES
+#define TRK_ENV_SERVER_DBBACKUPPAUSE			"TRK" TRK_CONFIG_SERVER_DBBACKUPPAUSE
+#define TRK_ENV_SERVER_DBBACKUPKEEP				"TRK" TRK_CONFIG_SERVER_DBBACKUPKEEP
+#define TRK_ENV_SERVER_DBSLOWQUERY				"TRK" TRK_CONFIG_SERVER_DBSLOWQUERY
+#define TRK_ENV_SERVER_DBHEADSNAPSHOT			"TRK" TRK_CONFIG_SERVER_DBHEADSNAPSHOT
+#define TRK_ENV_SERVER_OBJECTREPACK				"TRK" TRK_CONFIG_SERVER_OBJECTREPACK
 
 
 /* Configuration utilities */
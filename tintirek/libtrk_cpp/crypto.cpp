@@ -13,10 +13,14 @@
 #include <openssl/pem.h>
 #include <openssl/rsa.h>
 #include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/crypto.h>
 #include <openssl/sha.h>
 #include <openssl/rand.h>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <string>
 
 #include "cmdline.h"
 #include "trk_types.h"
@@ -191,28 +195,252 @@ int ClientVerifyCallback(int preverify, struct x509_store_ctx_st* x509_ctx)
 { return 0; }
 #endif
 
+/* Digits used by the hex encoder */
+static const char hex_digits[] = "0123456789abcdef";
+
+/* Length of a SHA-256 digest written as hex digits */
+static constexpr size_t sha256_hex_length = SHA256_DIGEST_LENGTH * 2;
+
+/* Size of the stack buffer a hash chain round is built in */
+static constexpr size_t hash_chain_block_size = 256;
+
+
+/* Returns the SHA-256 implementation, fetched once because implicit fetches are slow on OpenSSL 3 */
+static const EVP_MD* GetSHA256Digest()
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	static EVP_MD* digest = EVP_MD_fetch(nullptr, "SHA256", nullptr);
+	return digest != nullptr ? digest : EVP_sha256();
+#else
+	return EVP_sha256();
+#endif
+}
+
+/* Digest context reused by every hash calculated on a thread */
+class TrkDigestContext
+{
+public:
+	TrkDigestContext()
+		: context(EVP_MD_CTX_new())
+	{ }
+
+	~TrkDigestContext()
+	{
+		EVP_MD_CTX_free(context);
+	}
+
+	EVP_MD_CTX* context;
+};
+
+/* Returns the digest context of the calling thread */
+static EVP_MD_CTX* GetThreadDigestContext()
+{
+	thread_local TrkDigestContext digest_context;
+	return digest_context.context;
+}
+
+
+TrkSHA256Stream::TrkSHA256Stream()
+	: context(EVP_MD_CTX_new())
+{
+	Init();
+}
+
+TrkSHA256Stream::~TrkSHA256Stream()
+{
+	EVP_MD_CTX_free(context);
+}
+
+bool TrkSHA256Stream::Init()
+{
+	return context != nullptr && EVP_DigestInit_ex(context, GetSHA256Digest(), nullptr) == 1;
+}
+
+bool TrkSHA256Stream::Update(const void* Data, size_t Length)
+{
+	return context != nullptr && EVP_DigestUpdate(context, Data, Length) == 1;
+}
+
+TrkString TrkSHA256Stream::Final()
+{
+	unsigned char hash[SHA256_DIGEST_LENGTH];
+	if (context == nullptr || EVP_DigestFinal_ex(context, hash, nullptr) != 1)
+	{
+		return "";
+	}
+
+	char hex[sha256_hex_length + 1];
+	TrkCryptoHelper::HexEncode(hash, SHA256_DIGEST_LENGTH, hex);
+	hex[sha256_hex_length] = '\0';
+	return TrkString(hex);
+}
+
+
 TrkString TrkCryptoHelper::SHA256(const TrkString& Str, const TrkString& Seperator)
 {
+	EVP_MD_CTX* context = GetThreadDigestContext();
 	unsigned char hash[SHA256_DIGEST_LENGTH];
-	SHA256_CTX sha256;
-	SHA256_Init(&sha256);
-	SHA256_Update(&sha256, (const char*)Str, Str.size());
-	SHA256_Final(hash, &sha256);
+	if (context == nullptr
+		|| EVP_DigestInit_ex(context, GetSHA256Digest(), nullptr) != 1
+		|| EVP_DigestUpdate(context, (const char*)Str, Str.size()) != 1
+		|| EVP_DigestFinal_ex(context, hash, nullptr) != 1)
+	{
+		return "";
+	}
 
-	TrkString hashString;
-	char hex[3];
+	char hex[sha256_hex_length + 1];
+	HexEncode(hash, SHA256_DIGEST_LENGTH, hex);
+	hex[sha256_hex_length] = '\0';
+
+	if (Seperator == "")
+	{
+		return TrkString(hex);
+	}
+
+	std::string hashString;
+	hashString.reserve(sha256_hex_length + (SHA256_DIGEST_LENGTH - 1) * Seperator.size());
 	for (int i = 0; i < SHA256_DIGEST_LENGTH; i++)
 	{
-		sprintf(hex, "%02x", hash[i]);
-		hashString << hex;
+		hashString.append(hex + i * 2, 2);
+
+		if (i < SHA256_DIGEST_LENGTH - 1)
+		{
+			hashString.append((const char*)Seperator, Seperator.size());
+		}
+	}
+
+	return TrkString(hashString.c_str());
+}
+
+TrkString TrkCryptoHelper::SHA256Chain(const TrkString& Str, const TrkString& Salt, int Iterations)
+{
+	if (Iterations <= 0)
+	{
+		return Str;
+	}
+
+	EVP_MD_CTX* context = GetThreadDigestContext();
+	const EVP_MD* digest = GetSHA256Digest();
+	if (context == nullptr)
+	{
+		return "";
+	}
+
+	// Every round hashes "<hex digits of previous round>::<salt>". The salt is
+	// copied next to the digits once, long salts are hashed from their own buffer.
+	const size_t salt_length = Salt.size();
+	const bool contiguous = salt_length <= hash_chain_block_size - sha256_hex_length - 2;
+
+	char block[hash_chain_block_size];
+	std::memcpy(block + sha256_hex_length, "::", 2);
+	if (contiguous)
+	{
+		std::memcpy(block + sha256_hex_length + 2, (const char*)Salt, salt_length);
+	}
+
+	const size_t suffix_length = contiguous ? 2 + salt_length : 2;
+	unsigned char hash[SHA256_DIGEST_LENGTH];
+
+	for (int i = 0; i < Iterations; i++)
+	{
+		bool ok = EVP_DigestInit_ex(context, digest, nullptr) == 1;
+		if (i == 0)
+		{
+			ok = ok && EVP_DigestUpdate(context, (const char*)Str, Str.size()) == 1
+				&& EVP_DigestUpdate(context, block + sha256_hex_length, suffix_length) == 1;
+		}
+		else
+		{
+			ok = ok && EVP_DigestUpdate(context, block, sha256_hex_length + suffix_length) == 1;
+		}
+
+		if (!contiguous)
+		{
+			ok = ok && EVP_DigestUpdate(context, (const char*)Salt, salt_length) == 1;
+		}
 
-		if (Seperator != "" && i < SHA256_DIGEST_LENGTH - 1)
+		if (!ok || EVP_DigestFinal_ex(context, hash, nullptr) != 1)
 		{
-			hashString << Seperator;
+			return "";
 		}
+
+		HexEncode(hash, SHA256_DIGEST_LENGTH, block);
+	}
+
+	block[sha256_hex_length] = '\0';
+	return TrkString(block);
+}
+
+void TrkCryptoHelper::HexEncode(const unsigned char* Data, size_t Length, char* Output)
+{
+	for (size_t i = 0; i < Length; i++)
+	{
+		Output[i * 2] = hex_digits[Data[i] >> 4];
+		Output[i * 2 + 1] = hex_digits[Data[i] & 0x0F];
 	}
+}
+
+TrkString TrkCryptoHelper::Base64Encode(const unsigned char* Data, size_t Length)
+{
+	std::string text((Length + 2) / 3 * 4, '\0');
+	if (Length > 0 && EVP_EncodeBlock(reinterpret_cast<unsigned char*>(&text[0]), Data, static_cast<int>(Length)) != static_cast<int>(text.size()))
+	{
+		return "";
+	}
+	return text.c_str();
+}
 
-	return hashString;
+bool TrkCryptoHelper::Base64Decode(const TrkString& Str, std::string& Output)
+{
+	const size_t length = Str.size();
+	if (length % 4 != 0)
+	{
+		return false;
+	}
+
+	Output.assign(length / 4 * 3, '\0');
+	if (length > 0 && EVP_DecodeBlock(reinterpret_cast<unsigned char*>(&Output[0]), reinterpret_cast<const unsigned char*>((const char*)Str), static_cast<int>(length)) != static_cast<int>(Output.size()))
+	{
+		return false;
+	}
+
+	// Decoded padding comes out as zero bytes
+	const char* text = Str;
+	for (size_t i = length; i > 0 && i + 2 > length && text[i - 1] == '='; i--)
+	{
+		Output.pop_back();
+	}
+	return true;
+}
+
+TrkString TrkCryptoHelper::HMACSHA256(const unsigned char* Key, size_t KeyLength, const TrkString& Str)
+{
+	unsigned char mac[EVP_MAX_MD_SIZE];
+	unsigned int length = 0;
+	if (HMAC(GetSHA256Digest(), Key, static_cast<int>(KeyLength), reinterpret_cast<const unsigned char*>((const char*)Str), Str.size(), mac, &length) == nullptr)
+	{
+		return "";
+	}
+
+	char hex[EVP_MAX_MD_SIZE * 2 + 1];
+	HexEncode(mac, length, hex);
+	hex[length * 2] = '\0';
+	return TrkString(hex);
+}
+
+bool TrkCryptoHelper::ConstantTimeEquals(const TrkString& First, const TrkString& Second)
+{
+	if (First.size() != Second.size())
+	{
+		return false;
+	}
+
+	return CRYPTO_memcmp((const char*)First, (const char*)Second, First.size()) == 0;
+}
+
+bool TrkCryptoHelper::RandomBytes(unsigned char* Buffer, size_t Length)
+{
+	return RAND_bytes(Buffer, static_cast<int>(Length)) == 1;
 }
 
 TrkString TrkCryptoHelper::GenerateSalt()
@@ -10,6 +10,7 @@
 
 #include "trk_types.h"
 #include "trkstring.h"
+#include <string>
 
 
 /* Implementation class for SSL */
@@ -79,12 +80,60 @@ public:
 	static int ClientVerifyCallback(int preverify, struct x509_store_ctx_st* x509_ctx);
 };
 
+/*
+ *	Incremental SHA-256
+ *
+ *	Hashes data given in any number of pieces, for contents that are
+ *	streamed instead of held in memory. Init() starts over, so one
+ *	object can hash many streams.
+ */
+class TrkSHA256Stream
+{
+public:
+	TrkSHA256Stream();
+	~TrkSHA256Stream();
+
+	/* Disables copy */
+	TrkSHA256Stream(const TrkSHA256Stream&) = delete;
+	TrkSHA256Stream& operator=(const TrkSHA256Stream&) = delete;
+
+	/* Starts a new hash, returns false if the digest could not be set up */
+	bool Init();
+	/* Hashes the next piece of data */
+	bool Update(const void* Data, size_t Length);
+	/* Finishes the hash and returns its 64 lowercase hex digits, empty on failure */
+	TrkString Final();
+
+private:
+	struct evp_md_ctx_st* context;
+};
+
 /* Helper class foR Cryptography */
 class TrkCryptoHelper
 {
 public:
 	/* Calculate the SHA-256 hash of the input daha */
 	static TrkString SHA256(const TrkString& Str, const TrkString& Seperator = "");
+	/*
+	 *	Calculates the password hash chain, same as running
+	 *	Str = SHA256(Str + "::" + Salt) for given iterations.
+	 *
+	 *	Every round works on a stack buffer, nothing is allocated
+	 *	after the first call on a thread.
+	 */
+	static TrkString SHA256Chain(const TrkString& Str, const TrkString& Salt, int Iterations);
+	/* Writes lowercase hex digits of given bytes into Output, which must hold 2 * Length characters */
+	static void HexEncode(const unsigned char* Data, size_t Length, char* Output);
+	/* Returns the base64 text of given bytes, for binary data in commands */
+	static TrkString Base64Encode(const unsigned char* Data, size_t Length);
+	/* Decodes base64 text into Output, returns false if it is not base64 */
+	static bool Base64Decode(const TrkString& Str, std::string& Output);
+	/* Calculate the HMAC-SHA-256 of the input data as hex digits */
+	static TrkString HMACSHA256(const unsigned char* Key, size_t KeyLength, const TrkString& Str);
+	/* Compares two strings in time independent of their contents */
+	static bool ConstantTimeEquals(const TrkString& First, const TrkString& Second);
+	/* Fills given buffer with cryptographically secure random bytes */
+	static bool RandomBytes(unsigned char* Buffer, size_t Length);
 	/* Cenerates a 16 bytes length random salt, which is a random string of characters */
 	static TrkString GenerateSalt();
 };
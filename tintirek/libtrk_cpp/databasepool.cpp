@@ -0,0 +1,243 @@
+/*
+ *	databasepool.cpp
+ *
+ *	Tintirek's SQLite connection pool
+ */
+
+
+#include "databasepool.h"
+
+#include <initializer_list>
+#include <thread>
+
+
+/* A connection checked out by the current thread */
+struct TrkPoolCheckout
+{
+	const TrkSqlite::TrkDatabasePool* pool;
+	TrkSqlite::TrkDatabase* database;
+	bool writer;
+	int depth;
+};
+
+/* Connections checked out by the current thread, there are rarely more than two */
+static thread_local std::vector<TrkPoolCheckout> checkouts;
+
+
+/* Finds a checkout of the current thread, writer checkouts are preferred unless only writers are wanted */
+static TrkPoolCheckout* FindCheckout(const TrkSqlite::TrkDatabasePool* Pool, bool WriterOnly)
+{
+	TrkPoolCheckout* found = nullptr;
+	for (TrkPoolCheckout& checkout : checkouts)
+	{
+		if (checkout.pool != Pool)
+		{
+			continue;
+		}
+
+		if (checkout.writer)
+		{
+			return &checkout;
+		}
+
+		if (!WriterOnly)
+		{
+			found = &checkout;
+		}
+	}
+	return found;
+}
+
+/* Returns true if value is one of the allowed pragma values, compared case insensitively */
+static bool IsAllowedPragmaValue(TrkString Value, std::initializer_list<const char*> Allowed)
+{
+	Value.ToUpper();
+	for (const char* allowed : Allowed)
+	{
+		if (Value == allowed)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+
+TrkSqlite::TrkDatabasePool::TrkDatabasePool(const TrkString Filename, const TrkDatabasePragmas& Pragmas, int ReaderCount)
+	: filename(Filename)
+{
+	if (ReaderCount <= 0)
+	{
+		const unsigned int cores = std::thread::hardware_concurrency();
+		ReaderCount = cores > 2 ? static_cast<int>(cores) : 2;
+	}
+
+	// Writer goes first, it creates the database and switches the journal mode
+	writer.reset(new TrkDatabase(Filename, TrkSqlite::OPEN_READWRITE | TrkSqlite::OPEN_CREATE | TrkSqlite::OPEN_NOMUTEX));
+	ApplyPragmas(*writer, Pragmas, true);
+
+	for (int i = 0; i < ReaderCount; i++)
+	{
+		readers.emplace_back(new TrkDatabase(Filename, TrkSqlite::OPEN_READWRITE | TrkSqlite::OPEN_NOMUTEX));
+		ApplyPragmas(*readers.back(), Pragmas, false);
+		free_readers.push_back(readers.back().get());
+	}
+}
+
+TrkSqlite::TrkDatabasePool::~TrkDatabasePool() = default;
+
+TrkSqlite::TrkDatabasePool::Lease TrkSqlite::TrkDatabasePool::Reader()
+{
+	TrkPoolCheckout* checkout = FindCheckout(this, false);
+	if (checkout != nullptr)
+	{
+		checkout->depth++;
+		return Lease(this, checkout->database);
+	}
+
+	TrkDatabase* database;
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		released_cv.wait(lock, [this]() { return !free_readers.empty(); });
+		database = free_readers.back();
+		free_readers.pop_back();
+	}
+
+	checkouts.push_back(TrkPoolCheckout{ this, database, false, 1 });
+	return Lease(this, database);
+}
+
+TrkSqlite::TrkDatabasePool::Lease TrkSqlite::TrkDatabasePool::Writer()
+{
+	TrkPoolCheckout* checkout = FindCheckout(this, true);
+	if (checkout != nullptr)
+	{
+		checkout->depth++;
+		return Lease(this, checkout->database);
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		released_cv.wait(lock, [this]() { return writer_free; });
+		writer_free = false;
+	}
+
+	checkouts.push_back(TrkPoolCheckout{ this, writer.get(), true, 1 });
+	return Lease(this, writer.get());
+}
+
+int TrkSqlite::TrkDatabasePool::GetReaderCount() const
+{
+	return static_cast<int>(readers.size());
+}
+
+TrkString TrkSqlite::TrkDatabasePool::GetJournalMode()
+{
+	Lease database = Reader();
+	TrkStatementLease query = database->Prepare("PRAGMA journal_mode");
+	query->ExecuteStep();
+	return query->GetColumn(0).GetString();
+}
+
+int64_t TrkSqlite::TrkDatabasePool::GetStatementCacheHits() const
+{
+	int64_t hits = writer->GetStatementCacheHits();
+	for (const auto& reader : readers)
+	{
+		hits += reader->GetStatementCacheHits();
+	}
+	return hits;
+}
+
+int64_t TrkSqlite::TrkDatabasePool::GetStatementCacheMisses() const
+{
+	int64_t misses = writer->GetStatementCacheMisses();
+	for (const auto& reader : readers)
+	{
+		misses += reader->GetStatementCacheMisses();
+	}
+	return misses;
+}
+
+void TrkSqlite::TrkDatabasePool::ApplyPragmas(TrkDatabase& Database, const TrkDatabasePragmas& Pragmas, bool Writer)
+{
+	// Values are pasted into the statements, only known keywords are accepted
+	if (!IsAllowedPragmaValue(Pragmas.journal_mode, { "DELETE", "TRUNCATE", "PERSIST", "MEMORY", "WAL", "OFF" }))
+	{
+		throw TrkDatabaseException(TrkString("Invalid journal_mode: ") + Pragmas.journal_mode);
+	}
+	if (!IsAllowedPragmaValue(Pragmas.synchronous, { "OFF", "NORMAL", "FULL", "EXTRA" }))
+	{
+		throw TrkDatabaseException(TrkString("Invalid synchronous: ") + Pragmas.synchronous);
+	}
+
+	// A busy handler of our own instead of busy_timeout, so lock waits are counted per statement
+	Database.SetBusyTimeout(Pragmas.busy_timeout);
+
+	TrkString pragmas;
+	if (Writer)
+	{
+		// Journal mode is persistent, readers pick it up from the database
+		pragmas << "PRAGMA journal_mode = " << Pragmas.journal_mode << ";";
+	}
+	pragmas << "PRAGMA synchronous = " << Pragmas.synchronous << ";"
+		<< "PRAGMA mmap_size = " << Pragmas.mmap_size << ";"
+		<< "PRAGMA cache_size = " << Pragmas.cache_size << ";";
+	if (!Writer)
+	{
+		pragmas << "PRAGMA query_only = 1;";
+	}
+
+	Database.Execute(pragmas);
+}
+
+void TrkSqlite::TrkDatabasePool::Release(TrkDatabase* Database)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (Database == writer.get())
+		{
+			writer_free = true;
+		}
+		else
+		{
+			free_readers.push_back(Database);
+		}
+	}
+	released_cv.notify_all();
+}
+
+TrkSqlite::TrkDatabasePool::Lease::Lease(TrkDatabasePool* Pool, TrkDatabase* Database)
+	: pool(Pool)
+	, database(Database)
+{ }
+
+TrkSqlite::TrkDatabasePool::Lease::~Lease()
+{
+	if (database == nullptr)
+	{
+		return;
+	}
+
+	for (auto it = checkouts.begin(); it != checkouts.end(); ++it)
+	{
+		if (it->pool == pool && it->database == database)
+		{
+			if (--it->depth > 0)
+			{
+				return;
+			}
+			checkouts.erase(it);
+			break;
+		}
+	}
+
+	pool->Release(database);
+}
+
+TrkSqlite::TrkDatabasePool::Lease::Lease(Lease&& Other) noexcept
+	: pool(Other.pool)
+	, database(Other.database)
+{
+	Other.database = nullptr;
+}
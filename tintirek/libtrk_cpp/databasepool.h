@@ -0,0 +1,112 @@
+/*
+ *	databasepool.h
+ *
+ *	Tintirek's SQLite connection pool
+ */
+
+#ifndef TRK_DATABASEPOOL_H
+#define TRK_DATABASEPOOL_H
+
+#include "sqlite3.h"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+namespace TrkSqlite
+{
+	/* Pragmas applied to every connection of a pool */
+	struct TrkDatabasePragmas
+	{
+		/* journal_mode, one of DELETE, TRUNCATE, PERSIST, MEMORY, WAL or OFF */
+		TrkString journal_mode = "WAL";
+		/* synchronous, one of OFF, NORMAL, FULL or EXTRA */
+		TrkString synchronous = "NORMAL";
+		/* mmap_size in bytes, 0 disables memory-mapped I/O */
+		int64_t mmap_size = 268435456;
+		/* cache_size, pages when positive, KiB when negative */
+		int64_t cache_size = -16384;
+		/* busy_timeout in milliseconds */
+		int busy_timeout = 5000;
+	};
+
+	/*
+	 *	Tintirek's Database Pool Class
+	 *
+	 *	Owns one writer and a fixed number of reader connections to the
+	 *	same database, opened with OPEN_NOMUTEX so SQLite does not
+	 *	serialize them on its connection mutex; the pool guarantees a
+	 *	connection is used by one thread at a time instead. Connections
+	 *	are checked out per thread: asking again while holding a lease
+	 *	returns the same connection, and a thread holding the writer
+	 *	reads through it so it sees its own uncommitted changes.
+	 */
+	class TrkDatabasePool
+	{
+	public:
+		/* Opens the writer and the readers, reader count 0 picks one per core */
+		TrkDatabasePool(const TrkString Filename, const TrkDatabasePragmas& Pragmas = TrkDatabasePragmas(), int ReaderCount = 0);
+		~TrkDatabasePool();
+
+		/* Disables copy and move */
+		TrkDatabasePool(const TrkDatabasePool&) = delete;
+		TrkDatabasePool& operator=(const TrkDatabasePool&) = delete;
+
+		/* Checked out connection, returned to the pool when the last lease of the thread is destroyed */
+		class Lease
+		{
+		public:
+			Lease(TrkDatabasePool* Pool, TrkDatabase* Database);
+			~Lease();
+
+			/* Disables copy, allows move */
+			Lease(const Lease&) = delete;
+			Lease& operator=(const Lease&) = delete;
+			Lease(Lease&& Other) noexcept;
+			Lease& operator=(Lease&& Other) = delete;
+
+			/* Access to the leased connection */
+			TrkDatabase* operator->() const { return database; }
+			TrkDatabase& operator*() const { return *database; }
+
+		private:
+			TrkDatabasePool* pool;
+			TrkDatabase* database;
+		};
+
+		/* Checks out a read-only connection, waits if every reader is in use */
+		Lease Reader();
+		/* Checks out the writer connection, waits if another thread holds it */
+		Lease Writer();
+
+		/* Returns the number of reader connections */
+		int GetReaderCount() const;
+		/* Returns the file name of the database */
+		const TrkString& GetFilename() const { return filename; }
+		/* Returns the journal mode the database is in */
+		TrkString GetJournalMode();
+		/* Returns the statement cache hits of all connections */
+		int64_t GetStatementCacheHits() const;
+		/* Returns the statement cache misses of all connections */
+		int64_t GetStatementCacheMisses() const;
+
+	private:
+		/* Applies the pragmas to a newly opened connection */
+		static void ApplyPragmas(TrkDatabase& Database, const TrkDatabasePragmas& Pragmas, bool Writer);
+		/* Returns a connection whose last lease of the thread was destroyed */
+		void Release(TrkDatabase* Database);
+
+		TrkString filename;
+		std::unique_ptr<TrkDatabase> writer;
+		std::vector<std::unique_ptr<TrkDatabase>> readers;
+
+		std::mutex mutex;
+		std::condition_variable released_cv;
+		bool writer_free = true;
+		std::vector<TrkDatabase*> free_readers;
+	};
+}
+
+#endif /* TRK_DATABASEPOOL_H */
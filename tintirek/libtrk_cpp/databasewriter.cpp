@@ -0,0 +1,151 @@
+/*
+ *	databasewriter.cpp
+ *
+ *	Tintirek's single-writer database executor
+ */
+
+
+#include "databasewriter.h"
+
+#include <exception>
+#include <vector>
+
+#include "tracing.h"
+
+
+TrkSqlite::TrkDatabaseWriter::TrkDatabaseWriter(TrkDatabasePool& Pool, std::chrono::microseconds Window, size_t MaxBatchSize)
+	: pool(Pool)
+	, window(Window)
+	, max_batch_size(MaxBatchSize > 0 ? MaxBatchSize : 1)
+{
+}
+
+TrkSqlite::TrkDatabaseWriter::~TrkDatabaseWriter()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		running = false;
+	}
+	task_cv.notify_all();
+
+	if (writer_thread.joinable())
+	{
+		writer_thread.join();
+	}
+}
+
+std::future<int> TrkSqlite::TrkDatabaseWriter::Submit(TrkMutation Mutation)
+{
+	std::future<int> result;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!writer_thread.joinable())
+		{
+			writer_thread = std::thread(&TrkDatabaseWriter::WriterLoop, this);
+		}
+		tasks.push_back(Task{ std::move(Mutation), std::promise<int>(), std::chrono::steady_clock::now() });
+		result = tasks.back().result.get_future();
+	}
+
+	task_cv.notify_one();
+	return result;
+}
+
+void TrkSqlite::TrkDatabaseWriter::WriterLoop()
+{
+	while (true)
+	{
+		std::deque<Task> batch;
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			task_cv.wait(lock, [this]() { return !running || !tasks.empty(); });
+
+			if (tasks.empty())
+			{
+				// Stopped and nothing left to commit
+				return;
+			}
+
+			// Give other writers the rest of the window to join this commit
+			task_cv.wait_until(lock, tasks.front().queued_at + window, [this]() { return !running || tasks.size() >= max_batch_size; });
+
+			const size_t count = tasks.size() < max_batch_size ? tasks.size() : max_batch_size;
+			for (size_t i = 0; i < count; i++)
+			{
+				batch.push_back(std::move(tasks.front()));
+				tasks.pop_front();
+			}
+		}
+
+		CommitBatch(batch);
+	}
+}
+
+void TrkSqlite::TrkDatabaseWriter::CommitBatch(std::deque<Task>& Batch)
+{
+	TrkTraceSpan span("GroupCommit");
+	const auto start = std::chrono::steady_clock::now();
+
+	for (const Task& task : Batch)
+	{
+		wait_time.Record(TrkElapsedMicroseconds(task.queued_at, start));
+	}
+
+	std::vector<int> changes(Batch.size(), 0);
+	std::vector<std::exception_ptr> errors(Batch.size());
+
+	try
+	{
+		TrkDatabasePool::Lease database = pool.Writer();
+		TrkTransaction transaction(*database);
+
+		for (size_t i = 0; i < Batch.size(); i++)
+		{
+			database->Execute("SAVEPOINT trk_mutation");
+			try
+			{
+				changes[i] = Batch[i].mutation(*database);
+				database->Execute("RELEASE trk_mutation");
+			}
+			catch (...)
+			{
+				// Undo only this mutation, the rest of the batch still commits
+				errors[i] = std::current_exception();
+				database->TryExecute("ROLLBACK TO trk_mutation");
+				database->TryExecute("RELEASE trk_mutation");
+			}
+		}
+
+		transaction.Commit();
+	}
+	catch (...)
+	{
+		// Nothing of the batch was stored
+		for (std::exception_ptr& error : errors)
+		{
+			if (!error)
+			{
+				error = std::current_exception();
+			}
+		}
+	}
+
+	commit_time.Record(TrkElapsedMicroseconds(start));
+	batch_size.Record(Batch.size());
+
+	for (size_t i = 0; i < Batch.size(); i++)
+	{
+		if (errors[i])
+		{
+			failed.Increment();
+			Batch[i].result.set_exception(errors[i]);
+		}
+		else
+		{
+			committed.Increment();
+			Batch[i].result.set_value(changes[i]);
+		}
+	}
+}
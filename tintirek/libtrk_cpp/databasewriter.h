@@ -0,0 +1,104 @@
+/*
+ *	databasewriter.h
+ *
+ *	Tintirek's single-writer database executor
+ */
+
+#ifndef TRK_DATABASEWRITER_H
+#define TRK_DATABASEWRITER_H
+
+#include "databasepool.h"
+#include "metrics.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+
+
+namespace TrkSqlite
+{
+	/* Default time a batch waits for more mutations after the first one */
+	const std::chrono::microseconds DEFAULT_GROUP_COMMIT_WINDOW(2000);
+
+	/* Default maximum number of mutations committed together */
+	const size_t DEFAULT_GROUP_COMMIT_SIZE = 128;
+
+	/* A mutation run on the write connection, returns the number of changes */
+	using TrkMutation = std::function<int(TrkDatabase&)>;
+
+	/*
+	 *	Tintirek's Database Writer Class
+	 *
+	 *	Owns the writes of a database pool: a single thread drains the
+	 *	queued mutations and runs every batch that arrives within the
+	 *	group commit window in one transaction, so concurrent writers
+	 *	share one commit (and one fsync) instead of queueing on SQLite's
+	 *	write lock. Each mutation runs in its own savepoint; one that
+	 *	throws is rolled back alone and only its caller sees the error.
+	 *	Futures complete after the transaction is committed.
+	 *
+	 *	The thread starts with the first mutation, a writer created
+	 *	before a fork() still drains its queue in the child.
+	 *
+	 *	A thread must not wait on a mutation while it holds the writer
+	 *	of the pool, the executor could never check it out.
+	 */
+	class TrkDatabaseWriter
+	{
+	public:
+		TrkDatabaseWriter(TrkDatabasePool& Pool, std::chrono::microseconds Window = DEFAULT_GROUP_COMMIT_WINDOW, size_t MaxBatchSize = DEFAULT_GROUP_COMMIT_SIZE);
+		/* Runs the queued mutations and stops the writer thread */
+		~TrkDatabaseWriter();
+
+		/* Disables copy and move */
+		TrkDatabaseWriter(const TrkDatabaseWriter&) = delete;
+		TrkDatabaseWriter& operator=(const TrkDatabaseWriter&) = delete;
+
+		/* Queues a mutation, the future has its number of changes once it is committed */
+		std::future<int> Submit(TrkMutation Mutation);
+		/* Queues a mutation and waits for its commit */
+		int Execute(TrkMutation Mutation) { return Submit(std::move(Mutation)).get(); }
+
+		/* Number of mutations in each committed batch */
+		TrkHistogram batch_size;
+		/* Time from BEGIN to the end of COMMIT of each batch, in microseconds */
+		TrkHistogram commit_time;
+		/* Time mutations waited in the queue, in microseconds */
+		TrkHistogram wait_time;
+		/* Mutations committed */
+		TrkCounter committed;
+		/* Mutations that failed or whose transaction failed */
+		TrkCounter failed;
+
+	private:
+		/* A queued mutation */
+		struct Task
+		{
+			TrkMutation mutation;
+			std::promise<int> result;
+			std::chrono::steady_clock::time_point queued_at;
+		};
+
+		/* Writer thread loop */
+		void WriterLoop();
+		/* Runs a batch in one transaction */
+		void CommitBatch(std::deque<Task>& Batch);
+
+		TrkDatabasePool& pool;
+		const std::chrono::microseconds window;
+		const size_t max_batch_size;
+
+		std::mutex mutex;
+		std::condition_variable task_cv;
+		std::deque<Task> tasks;
+		bool running = true;
+
+		std::thread writer_thread;
+	};
+}
+
+#endif /* TRK_DATABASEWRITER_H */
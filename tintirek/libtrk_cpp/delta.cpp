@@ -0,0 +1,213 @@
+/*
+ *	delta.cpp
+ *
+ *	Tintirek's binary deltas between revisions
+ */
+
+
+#include "delta.h"
+
+#include <cstring>
+#include <vector>
+
+
+/* Instructions of a delta */
+#define TRK_DELTA_INSERT 0
+#define TRK_DELTA_COPY 1
+
+/* Multiplier of the rolling hash */
+#define TRK_DELTA_HASH_MULTIPLIER 0x01000193u
+
+/* Empty slot of the block table */
+#define TRK_DELTA_NO_BLOCK 0xFFFFFFFFu
+
+
+/* Appends an unsigned LEB128 number */
+static void AppendVarint(std::string& Output, uint64_t Value)
+{
+	while (Value >= 0x80)
+	{
+		Output.push_back(static_cast<char>((Value & 0x7F) | 0x80));
+		Value >>= 7;
+	}
+	Output.push_back(static_cast<char>(Value));
+}
+
+/* Reads an unsigned LEB128 number, returns false if it runs past the end */
+static bool ReadVarint(std::string_view& Input, uint64_t& Value)
+{
+	Value = 0;
+	for (int shift = 0; !Input.empty() && shift < 64; shift += 7)
+	{
+		const uint8_t byte = static_cast<uint8_t>(Input.front());
+		Input.remove_prefix(1);
+		Value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Returns the hash of a block */
+static uint32_t HashBlock(const char* Block)
+{
+	uint32_t hash = 0;
+	for (size_t i = 0; i < TRK_DELTA_BLOCK_SIZE; i++)
+	{
+		hash = hash * TRK_DELTA_HASH_MULTIPLIER + static_cast<uint8_t>(Block[i]);
+	}
+	return hash;
+}
+
+/* Returns the factor of the byte leaving the rolling hash */
+static uint32_t GetOutgoingFactor()
+{
+	uint32_t factor = 1;
+	for (size_t i = 1; i < TRK_DELTA_BLOCK_SIZE; i++)
+	{
+		factor *= TRK_DELTA_HASH_MULTIPLIER;
+	}
+	return factor;
+}
+
+/* Appends an insert of given bytes */
+static void AppendInsert(std::string& Delta, const char* Data, size_t Length)
+{
+	if (Length > 0)
+	{
+		Delta.push_back(static_cast<char>(TRK_DELTA_INSERT));
+		AppendVarint(Delta, Length);
+		Delta.append(Data, Length);
+	}
+}
+
+
+bool TrkDelta::Encode(std::string_view Base, std::string_view Target, std::string& Delta, size_t MaxSize)
+{
+	Delta.clear();
+	AppendVarint(Delta, Base.size());
+	AppendVarint(Delta, Target.size());
+
+	// Offsets are kept in 32 bits, a larger base is not indexed and the target is inserted whole
+	const size_t blocks = Base.size() < TRK_DELTA_NO_BLOCK ? Base.size() / TRK_DELTA_BLOCK_SIZE : 0;
+	size_t table_size = 16;
+	while (table_size < blocks * 2)
+	{
+		table_size *= 2;
+	}
+	const size_t mask = table_size - 1;
+
+	std::vector<uint32_t> table(blocks > 0 ? table_size : 0, TRK_DELTA_NO_BLOCK);
+	for (size_t block = 0; block < blocks; block++)
+	{
+		const size_t offset = block * TRK_DELTA_BLOCK_SIZE;
+		uint32_t& slot = table[HashBlock(Base.data() + offset) & mask];
+		if (slot == TRK_DELTA_NO_BLOCK)
+		{
+			slot = static_cast<uint32_t>(offset);
+		}
+	}
+
+	const uint32_t outgoing = GetOutgoingFactor();
+	size_t pending = 0;
+	size_t position = 0;
+	uint32_t hash = blocks > 0 && Target.size() >= TRK_DELTA_BLOCK_SIZE ? HashBlock(Target.data()) : 0;
+
+	while (blocks > 0 && position + TRK_DELTA_BLOCK_SIZE <= Target.size())
+	{
+		const uint32_t candidate = table[hash & mask];
+		if (candidate != TRK_DELTA_NO_BLOCK && std::memcmp(Base.data() + candidate, Target.data() + position, TRK_DELTA_BLOCK_SIZE) == 0)
+		{
+			// Grows the match over the bytes both sides share around the block
+			size_t target_start = position, base_start = candidate;
+			while (target_start > pending && base_start > 0 && Target[target_start - 1] == Base[base_start - 1])
+			{
+				target_start--;
+				base_start--;
+			}
+			size_t target_end = position + TRK_DELTA_BLOCK_SIZE, base_end = candidate + TRK_DELTA_BLOCK_SIZE;
+			while (target_end < Target.size() && base_end < Base.size() && Target[target_end] == Base[base_end])
+			{
+				target_end++;
+				base_end++;
+			}
+
+			AppendInsert(Delta, Target.data() + pending, target_start - pending);
+			Delta.push_back(static_cast<char>(TRK_DELTA_COPY));
+			AppendVarint(Delta, base_start);
+			AppendVarint(Delta, target_end - target_start);
+			if (Delta.size() > MaxSize)
+			{
+				return false;
+			}
+
+			position = pending = target_end;
+			if (position + TRK_DELTA_BLOCK_SIZE <= Target.size())
+			{
+				hash = HashBlock(Target.data() + position);
+			}
+			continue;
+		}
+
+		if (position + TRK_DELTA_BLOCK_SIZE < Target.size())
+		{
+			hash = (hash - static_cast<uint8_t>(Target[position]) * outgoing) * TRK_DELTA_HASH_MULTIPLIER
+				+ static_cast<uint8_t>(Target[position + TRK_DELTA_BLOCK_SIZE]);
+		}
+		position++;
+
+		if (Delta.size() + (position - pending) > MaxSize)
+		{
+			return false;
+		}
+	}
+
+	AppendInsert(Delta, Target.data() + pending, Target.size() - pending);
+	return Delta.size() <= MaxSize;
+}
+
+bool TrkDelta::Apply(std::string_view Base, std::string_view Delta, std::string& Target)
+{
+	uint64_t base_size, target_size;
+	if (!ReadVarint(Delta, base_size) || !ReadVarint(Delta, target_size) || base_size != Base.size())
+	{
+		return false;
+	}
+
+	Target.clear();
+	Target.reserve(static_cast<size_t>(target_size < Base.size() + Delta.size() ? target_size : Base.size() + Delta.size()));
+
+	while (!Delta.empty())
+	{
+		const uint8_t instruction = static_cast<uint8_t>(Delta.front());
+		Delta.remove_prefix(1);
+
+		uint64_t offset = 0, length;
+		if (instruction == TRK_DELTA_INSERT)
+		{
+			if (!ReadVarint(Delta, length) || length > Delta.size() || length > target_size - Target.size())
+			{
+				return false;
+			}
+			Target.append(Delta.data(), static_cast<size_t>(length));
+			Delta.remove_prefix(static_cast<size_t>(length));
+		}
+		else if (instruction == TRK_DELTA_COPY)
+		{
+			if (!ReadVarint(Delta, offset) || !ReadVarint(Delta, length)
+				|| offset > Base.size() || length > Base.size() - offset || length > target_size - Target.size())
+			{
+				return false;
+			}
+			Target.append(Base.data() + offset, static_cast<size_t>(length));
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	return Target.size() == target_size;
+}
@@ -0,0 +1,42 @@
+/*
+ *	delta.h
+ *
+ *	Tintirek's binary deltas between revisions
+ */
+
+#ifndef TRK_DELTA_H
+#define TRK_DELTA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+
+/* Bytes of the blocks of a base that a delta may copy, shorter matches are inserted */
+#define TRK_DELTA_BLOCK_SIZE 16
+
+
+/*
+ *	Delta encoding
+ *
+ *	A delta turns a base into a target with two instructions: copy a
+ *	range of the base, or insert new bytes. Every block of the base is
+ *	hashed into a table; a rolling hash over the target finds blocks it
+ *	shares with the base, and a match is extended in both directions
+ *	as far as the bytes agree.
+ *
+ *	The delta starts with the sizes of the base and the target, both
+ *	checked when it is applied.
+ */
+class TrkDelta
+{
+public:
+	/* Builds the delta from Base to Target, returns false if it would be larger than MaxSize */
+	static bool Encode(std::string_view Base, std::string_view Target, std::string& Delta, size_t MaxSize);
+	/* Applies a delta to its base, returns false if it is malformed or made for another base */
+	static bool Apply(std::string_view Base, std::string_view Delta, std::string& Target);
+};
+
+
+#endif /* TRK_DELTA_H */
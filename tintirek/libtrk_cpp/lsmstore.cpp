@@ -0,0 +1,1210 @@
+/*
+ *	lsmstore.cpp
+ *
+ *	Tintirek's log-structured merge key-value store
+ */
+
+
+#include "lsmstore.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <system_error>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+
+/* Record types of the log and batches */
+#define TRK_LSM_PUT 1
+#define TRK_LSM_DELETE 2
+
+/* Last bytes of a run's data file */
+#define TRK_LSM_DATA_MAGIC 0x4D534C54u	// "TLSM"
+
+/* Name of the manifest in the store directory */
+#define TRK_LSM_MANIFEST "MANIFEST"
+
+
+/* Value of a key in a run, points into the data file */
+struct TrkLsmValueRef
+{
+	uint64_t offset;
+	uint32_t size;
+	uint32_t deleted;
+};
+
+/* Trailer of a run's data file, after the values and the bloom filter */
+struct TrkLsmDataFooter
+{
+	uint64_t bloom_offset;
+	uint64_t bloom_bits;
+	uint32_t bloom_hashes;
+	uint32_t magic;
+};
+
+/* Header of a log frame, followed by length bytes of records */
+struct TrkLsmLogFrame
+{
+	uint32_t length;
+	uint32_t checksum;
+};
+
+
+/* FNV-1a hash, stable across builds as it is stored in bloom filters */
+static uint64_t HashKey(std::string_view Key)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (const char character : Key)
+	{
+		hash ^= static_cast<uint8_t>(character);
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+/* Checksum of a log frame */
+static uint32_t Checksum(std::string_view Data)
+{
+	const uint64_t hash = HashKey(Data);
+	return static_cast<uint32_t>(hash ^ (hash >> 32));
+}
+
+/* Appends an unsigned LEB128 number */
+static void AppendVarint(std::string& Output, uint64_t Value)
+{
+	while (Value >= 0x80)
+	{
+		Output.push_back(static_cast<char>((Value & 0x7F) | 0x80));
+		Value >>= 7;
+	}
+	Output.push_back(static_cast<char>(Value));
+}
+
+/* Reads an unsigned LEB128 number, returns false if it runs past the end */
+static bool ReadVarint(std::string_view& Input, uint64_t& Value)
+{
+	Value = 0;
+	for (int shift = 0; !Input.empty() && shift < 64; shift += 7)
+	{
+		const uint8_t byte = static_cast<uint8_t>(Input.front());
+		Input.remove_prefix(1);
+		Value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Reads a length-prefixed string, returns false if it runs past the end */
+static bool ReadString(std::string_view& Input, std::string_view& Value)
+{
+	uint64_t length;
+	if (!ReadVarint(Input, length) || length > Input.size())
+	{
+		return false;
+	}
+	Value = Input.substr(0, static_cast<size_t>(length));
+	Input.remove_prefix(static_cast<size_t>(length));
+	return true;
+}
+
+/* Returns the path of a file in the store directory */
+static fs::path GetStorePath(const TrkString& Directory, const std::string& Name)
+{
+	return fs::path(Directory.c_str()) / Name;
+}
+
+/* Opens a file with a fopen mode */
+static std::FILE* OpenFile(const fs::path& Path, const char* Mode, const wchar_t* WideMode)
+{
+#ifdef _WIN32
+	(void)Mode;
+	return _wfopen(Path.wstring().c_str(), WideMode);
+#else
+	(void)WideMode;
+	return std::fopen(Path.string().c_str(), Mode);
+#endif
+}
+
+/* Flushes a file to disk, returns false if it could not be synced */
+static bool SyncFile(std::FILE* File)
+{
+	if (std::fflush(File) != 0)
+	{
+		return false;
+	}
+#ifdef _WIN32
+	return _commit(_fileno(File)) == 0;
+#else
+	return fsync(fileno(File)) == 0;
+#endif
+}
+
+/* Syncs the entries of a directory to disk, names renamed into it survive a crash; Windows has no directory sync */
+static bool SyncDirectory(const TrkString& Directory)
+{
+#ifdef _WIN32
+	(void)Directory;
+	return true;
+#else
+	const int descriptor = open(Directory.c_str(), O_RDONLY | O_CLOEXEC);
+	if (descriptor < 0)
+	{
+		return false;
+	}
+	const bool synced = fsync(descriptor) == 0;
+	close(descriptor);
+	return synced;
+#endif
+}
+
+/* Returns the file name of a log */
+static std::string GetLogName(uint64_t Sequence)
+{
+	return "log-" + std::to_string(Sequence);
+}
+
+
+void TrkLsmBatch::Put(std::string_view Key, std::string_view Value)
+{
+	records.push_back(static_cast<char>(TRK_LSM_PUT));
+	AppendVarint(records, Key.size());
+	records.append(Key.data(), Key.size());
+	AppendVarint(records, Value.size());
+	records.append(Value.data(), Value.size());
+	count++;
+}
+
+void TrkLsmBatch::Delete(std::string_view Key)
+{
+	records.push_back(static_cast<char>(TRK_LSM_DELETE));
+	AppendVarint(records, Key.size());
+	records.append(Key.data(), Key.size());
+	count++;
+}
+
+
+/* Position in a memtable or a run, for merging */
+class TrkLsmStore::Cursor
+{
+public:
+	virtual ~Cursor() = default;
+
+	virtual bool Valid() const = 0;
+	virtual std::string_view Key() const = 0;
+	virtual std::string_view Value() const = 0;
+	virtual bool Deleted() const = 0;
+	virtual void Next() = 0;
+};
+
+/* Cursor over a memtable, the memtable must outlive it */
+class TrkLsmStore::MemCursor : public TrkLsmStore::Cursor
+{
+public:
+	using Iterator = MemTable::const_iterator;
+
+	MemCursor(Iterator Begin, Iterator End) : it(Begin), end(End) { }
+
+	bool Valid() const override { return it != end; }
+	std::string_view Key() const override { return it->first; }
+	std::string_view Value() const override { return it->second.value; }
+	bool Deleted() const override { return it->second.deleted; }
+	void Next() override { ++it; }
+
+private:
+	Iterator it;
+	Iterator end;
+};
+
+/* Cursor over a run, holds the run while it is open */
+class TrkLsmStore::RunCursor : public TrkLsmStore::Cursor
+{
+public:
+	RunCursor(std::shared_ptr<const Run> Run, std::string_view Key)
+		: run(std::move(Run))
+		, it(run->table.Seek(Key))
+	{
+		Load();
+	}
+
+	bool Valid() const override { return it.Valid(); }
+	std::string_view Key() const override { return it.Key(); }
+	std::string_view Value() const override { return value; }
+	bool Deleted() const override { return ref.deleted != 0; }
+	void Next() override { it.Next(); Load(); }
+
+private:
+	/* Reads the value reference of the current record */
+	void Load()
+	{
+		if (!it.Valid())
+		{
+			return;
+		}
+
+		std::memcpy(&ref, it.Value(), sizeof(ref));
+		if (ref.offset + ref.size > run->data.GetSize())
+		{
+			// A reference past the data file, treated as deleted
+			ref.size = 0;
+			ref.deleted = 1;
+			value = std::string_view();
+			return;
+		}
+		value = std::string_view(reinterpret_cast<const char*>(run->data.GetData() + ref.offset), ref.size);
+	}
+
+	std::shared_ptr<const Run> run;
+	TrkSortedTable::Iterator it;
+	TrkLsmValueRef ref = { 0, 0, 0 };
+	std::string_view value;
+};
+
+template <typename Function>
+void TrkLsmStore::MergeCursors(std::vector<std::unique_ptr<Cursor>>& Cursors, std::string_view Prefix, Function Visit)
+{
+	auto in_prefix = [Prefix](const Cursor& Cursor)
+	{
+		return Cursor.Valid() && Cursor.Key().compare(0, Prefix.size(), Prefix) == 0;
+	};
+
+	while (true)
+	{
+		Cursor* newest = nullptr;
+		for (const std::unique_ptr<Cursor>& cursor : Cursors)
+		{
+			if (in_prefix(*cursor) && (newest == nullptr || cursor->Key() < newest->Key()))
+			{
+				newest = cursor.get();
+			}
+		}
+		if (newest == nullptr)
+		{
+			return;
+		}
+
+		if (!Visit(newest->Key(), newest->Value(), newest->Deleted()))
+		{
+			return;
+		}
+
+		// Older entries of the key are skipped, the newest one moves last as the key points into it
+		for (const std::unique_ptr<Cursor>& cursor : Cursors)
+		{
+			if (cursor.get() != newest && in_prefix(*cursor) && cursor->Key() == newest->Key())
+			{
+				cursor->Next();
+			}
+		}
+		newest->Next();
+	}
+}
+
+
+TrkLsmStore::Run::~Run()
+{
+	table.Close();
+	data.Close();
+
+	if (obsolete)
+	{
+		std::error_code error;
+		fs::remove(GetStorePath(directory, std::to_string(id) + ".sst"), error);
+		fs::remove(GetStorePath(directory, std::to_string(id) + ".dat"), error);
+	}
+}
+
+bool TrkLsmStore::Run::MayContain(std::string_view Key) const
+{
+	if (bloom_bits == 0)
+	{
+		return true;
+	}
+
+	const uint64_t hash = HashKey(Key);
+	const uint64_t delta = (hash >> 33) | (hash << 31);
+	uint64_t bit = hash;
+	for (uint32_t i = 0; i < bloom_hashes; i++)
+	{
+		const uint64_t position = bit % bloom_bits;
+		if ((bloom[position / 8] & (1u << (position % 8))) == 0)
+		{
+			return false;
+		}
+		bit += delta;
+	}
+	return true;
+}
+
+
+TrkLsmStore::~TrkLsmStore()
+{
+	Close();
+}
+
+bool TrkLsmStore::Open(const TrkString& Directory, const TrkLsmOptions& Options)
+{
+	Close();
+
+	directory = Directory;
+	options = Options;
+
+	std::error_code error;
+	fs::create_directories(directory.c_str(), error);
+	if (error)
+	{
+		return false;
+	}
+
+	// Runs and the first log still needed, an empty store has neither
+	std::shared_ptr<Version> current = std::make_shared<Version>();
+	uint64_t first_log = 1;
+	next_run_id = 1;
+
+	std::vector<uint64_t> live;
+	std::ifstream manifest(GetStorePath(directory, TRK_LSM_MANIFEST));
+	std::string line;
+	while (std::getline(manifest, line))
+	{
+		std::istringstream fields(line);
+		std::string name;
+		uint64_t level, id;
+		fields >> name;
+
+		if (name == "next")
+		{
+			fields >> next_run_id;
+		}
+		else if (name == "log")
+		{
+			fields >> first_log;
+		}
+		else if (name == "run" && (fields >> level >> id))
+		{
+			RunPtr run = OpenRun(id);
+			if (run == nullptr)
+			{
+				return false;
+			}
+			live.push_back(id);
+
+			if (level == 0)
+			{
+				current->level0.push_back(run);
+			}
+			else
+			{
+				if (current->levels.size() < level)
+				{
+					current->levels.resize(level);
+				}
+				current->levels[level - 1] = run;
+			}
+		}
+	}
+
+	// Runs a flush or merge left behind when it stopped before or after writing the manifest
+	for (const fs::directory_entry& entry : fs::directory_iterator(directory.c_str(), error))
+	{
+		const std::string name = entry.path().filename().string();
+		const std::string extension = entry.path().extension().string();
+		const bool is_run = name != TRK_LSM_MANIFEST ".tmp" && (extension == ".sst" || extension == ".dat" || extension == ".tmp");
+		if (is_run && std::find(live.begin(), live.end(), std::strtoull(name.c_str(), nullptr, 10)) == live.end())
+		{
+			fs::remove(entry.path(), error);
+		}
+	}
+
+	version = current;
+	if (!Recover(first_log))
+	{
+		Close();
+		return false;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(background_mutex);
+		stopping = false;
+		pending = false;
+	}
+	background_thread = std::thread(&TrkLsmStore::BackgroundLoop, this);
+	return true;
+}
+
+void TrkLsmStore::Close()
+{
+	// Each waiter checks the flag under its own mutex, they are taken one after the other
+	{
+		std::unique_lock<std::shared_mutex> lock(mutex);
+		stopping = true;
+	}
+	frozen_cv.notify_all();
+	{
+		std::lock_guard<std::mutex> lock(background_mutex);
+	}
+	background_cv.notify_all();
+
+	if (background_thread.joinable())
+	{
+		background_thread.join();
+	}
+
+	std::unique_lock<std::shared_mutex> lock(mutex);
+	if (log != nullptr)
+	{
+		std::fclose(log);
+		log = nullptr;
+	}
+	memtable.clear();
+	memtable_bytes = 0;
+	frozen.reset();
+	version.reset();
+}
+
+bool TrkLsmStore::Put(std::string_view Key, std::string_view Value)
+{
+	TrkLsmBatch batch;
+	batch.Put(Key, Value);
+	return Write(batch);
+}
+
+bool TrkLsmStore::Delete(std::string_view Key)
+{
+	TrkLsmBatch batch;
+	batch.Delete(Key);
+	return Write(batch);
+}
+
+bool TrkLsmStore::Write(const TrkLsmBatch& Batch)
+{
+	if (Batch.IsEmpty())
+	{
+		return true;
+	}
+
+	std::unique_lock<std::shared_mutex> lock(mutex);
+	if (log == nullptr)
+	{
+		return false;
+	}
+
+	const TrkLsmLogFrame frame = { static_cast<uint32_t>(Batch.records.size()), Checksum(Batch.records) };
+	bool written = std::fwrite(&frame, sizeof(frame), 1, log) == 1
+		&& std::fwrite(Batch.records.data(), 1, Batch.records.size(), log) == Batch.records.size()
+		&& std::fflush(log) == 0;
+
+	if (written && options.sync_log)
+	{
+#ifdef _WIN32
+		written = _commit(_fileno(log)) == 0;
+#else
+		written = fsync(fileno(log)) == 0;
+#endif
+	}
+	if (!written)
+	{
+		return false;
+	}
+
+	Apply(Batch.records, memtable, memtable_bytes);
+
+	if (memtable_bytes >= options.memtable_size)
+	{
+		return Freeze(lock);
+	}
+	return true;
+}
+
+bool TrkLsmStore::Get(std::string_view Key, std::string& Value) const
+{
+	std::shared_ptr<const Version> current;
+	{
+		std::shared_lock<std::shared_mutex> lock(mutex);
+		const MemTable* tables[] = { &memtable, frozen.get() };
+		for (const MemTable* table : tables)
+		{
+			if (table == nullptr)
+			{
+				continue;
+			}
+
+			const auto it = table->find(Key);
+			if (it != table->end())
+			{
+				if (it->second.deleted)
+				{
+					return false;
+				}
+				Value = it->second.value;
+				return true;
+			}
+		}
+		current = version;
+	}
+
+	if (current == nullptr)
+	{
+		return false;
+	}
+
+	// Newest run first, the first entry of the key decides
+	auto find = [this, Key, &Value](const RunPtr& Run, bool& Found)
+	{
+		if (Run == nullptr)
+		{
+			return false;
+		}
+		if (!Run->MayContain(Key))
+		{
+			bloom_skips.Increment();
+			return false;
+		}
+
+		const void* found = Run->table.Find(Key);
+		if (found == nullptr)
+		{
+			return false;
+		}
+
+		TrkLsmValueRef ref;
+		std::memcpy(&ref, found, sizeof(ref));
+		Found = ref.deleted == 0 && ref.offset + ref.size <= Run->data.GetSize();
+		if (Found)
+		{
+			Value.assign(reinterpret_cast<const char*>(Run->data.GetData() + ref.offset), ref.size);
+		}
+		return true;
+	};
+
+	bool found = false;
+	for (const RunPtr& run : current->level0)
+	{
+		if (find(run, found))
+		{
+			return found;
+		}
+	}
+	for (const RunPtr& run : current->levels)
+	{
+		if (find(run, found))
+		{
+			return found;
+		}
+	}
+	return false;
+}
+
+void TrkLsmStore::Scan(std::string_view Prefix, const std::function<bool(std::string_view, std::string_view)>& Function) const
+{
+	// The memtable changes under writers, its part under the prefix is copied
+	MemTable active;
+	std::shared_ptr<const MemTable> frozen_table;
+	std::shared_ptr<const Version> current;
+	{
+		std::shared_lock<std::shared_mutex> lock(mutex);
+		for (auto it = memtable.lower_bound(Prefix); it != memtable.end() && std::string_view(it->first).compare(0, Prefix.size(), Prefix) == 0; ++it)
+		{
+			active.emplace_hint(active.end(), *it);
+		}
+		frozen_table = frozen;
+		current = version;
+	}
+
+	std::vector<std::unique_ptr<Cursor>> cursors;
+	cursors.emplace_back(new MemCursor(active.begin(), active.end()));
+	if (frozen_table != nullptr)
+	{
+		cursors.emplace_back(new MemCursor(frozen_table->lower_bound(Prefix), frozen_table->end()));
+	}
+	if (current != nullptr)
+	{
+		for (const RunPtr& run : current->level0)
+		{
+			cursors.emplace_back(new RunCursor(run, Prefix));
+		}
+		for (const RunPtr& run : current->levels)
+		{
+			if (run != nullptr)
+			{
+				cursors.emplace_back(new RunCursor(run, Prefix));
+			}
+		}
+	}
+
+	MergeCursors(cursors, Prefix, [&Function](std::string_view Key, std::string_view Value, bool Deleted)
+	{
+		return Deleted || Function(Key, Value);
+	});
+}
+
+bool TrkLsmStore::Flush()
+{
+	{
+		std::unique_lock<std::shared_mutex> lock(mutex);
+		if (log == nullptr)
+		{
+			return false;
+		}
+		if (!memtable.empty() && !Freeze(lock))
+		{
+			return false;
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(compaction_mutex);
+	FlushFrozen();
+	while (CompactOnce()) { }
+
+	std::shared_lock<std::shared_mutex> frozen_lock(mutex);
+	return frozen == nullptr;
+}
+
+std::vector<size_t> TrkLsmStore::GetLevelRuns() const
+{
+	const std::shared_ptr<const Version> current = GetVersion();
+	std::vector<size_t> runs;
+	if (current == nullptr)
+	{
+		return runs;
+	}
+
+	runs.push_back(current->level0.size());
+	for (const RunPtr& run : current->levels)
+	{
+		runs.push_back(run != nullptr ? 1 : 0);
+	}
+	return runs;
+}
+
+bool TrkLsmStore::Freeze(std::unique_lock<std::shared_mutex>& Lock)
+{
+	// One memtable is flushed at a time, writers wait for it instead of piling up memtables
+	frozen_cv.wait(Lock, [this]() { return frozen == nullptr || stopping.load(); });
+	if (frozen != nullptr || memtable.empty())
+	{
+		return frozen == nullptr;
+	}
+
+	const uint64_t first_log = memtable_log;
+	if (!OpenLog(log_sequence + 1))
+	{
+		return false;
+	}
+
+	frozen = std::make_shared<const MemTable>(std::move(memtable));
+	frozen_log = first_log;
+	memtable.clear();
+	memtable_bytes = 0;
+	memtable_log = log_sequence;
+
+	{
+		std::lock_guard<std::mutex> lock(background_mutex);
+		pending = true;
+	}
+	background_cv.notify_one();
+	return true;
+}
+
+bool TrkLsmStore::Apply(std::string_view Records, MemTable& Table, size_t& Bytes)
+{
+	while (!Records.empty())
+	{
+		const uint8_t type = static_cast<uint8_t>(Records.front());
+		Records.remove_prefix(1);
+
+		std::string_view key, value;
+		if (!ReadString(Records, key) || (type == TRK_LSM_PUT && !ReadString(Records, value)) || (type != TRK_LSM_PUT && type != TRK_LSM_DELETE))
+		{
+			return false;
+		}
+
+		auto it = Table.find(key);
+		if (it == Table.end())
+		{
+			it = Table.emplace(std::string(key), MemEntry()).first;
+			Bytes += key.size() + sizeof(MemEntry);
+		}
+		Bytes = Bytes - it->second.value.size() + value.size();
+		it->second.value.assign(value.data(), value.size());
+		it->second.deleted = type == TRK_LSM_DELETE;
+	}
+	return true;
+}
+
+bool TrkLsmStore::OpenLog(uint64_t Sequence)
+{
+	std::FILE* opened_log = nullptr;
+#ifdef _WIN32
+	opened_log = _wfopen(GetStorePath(directory, GetLogName(Sequence)).wstring().c_str(), L"ab");
+#else
+	opened_log = std::fopen(GetStorePath(directory, GetLogName(Sequence)).string().c_str(), "ab");
+#endif
+	if (opened_log == nullptr)
+	{
+		return false;
+	}
+
+	if (log != nullptr)
+	{
+		std::fclose(log);
+	}
+	log = opened_log;
+	log_sequence = Sequence;
+	return true;
+}
+
+bool TrkLsmStore::Recover(uint64_t FirstLog)
+{
+	std::vector<uint64_t> sequences;
+	std::error_code error;
+	for (const fs::directory_entry& entry : fs::directory_iterator(directory.c_str(), error))
+	{
+		const std::string name = entry.path().filename().string();
+		if (name.rfind("log-", 0) == 0)
+		{
+			const uint64_t sequence = std::strtoull(name.c_str() + 4, nullptr, 10);
+			if (sequence >= FirstLog)
+			{
+				sequences.push_back(sequence);
+			}
+			else
+			{
+				fs::remove(entry.path(), error);
+			}
+		}
+	}
+	std::sort(sequences.begin(), sequences.end());
+
+	for (const uint64_t sequence : sequences)
+	{
+		std::ifstream input(GetStorePath(directory, GetLogName(sequence)), std::ios::binary);
+		if (!input)
+		{
+			return false;
+		}
+
+		// A frame cut off by a crash ends the log, it was never acknowledged
+		TrkLsmLogFrame frame;
+		std::string records;
+		while (input.read(reinterpret_cast<char*>(&frame), sizeof(frame)))
+		{
+			records.resize(frame.length);
+			if (!input.read(&records[0], frame.length) || Checksum(records) != frame.checksum)
+			{
+				break;
+			}
+			Apply(records, memtable, memtable_bytes);
+		}
+	}
+
+	memtable_log = FirstLog;
+	return OpenLog(sequences.empty() ? FirstLog : sequences.back() + 1);
+}
+
+bool TrkLsmStore::WriteRun(std::vector<std::unique_ptr<Cursor>>& Cursors, bool DropTombstones, RunPtr& Result)
+{
+	const uint64_t id = next_run_id++;
+	const fs::path table_path = GetStorePath(directory, std::to_string(id) + ".sst");
+	const fs::path data_path = GetStorePath(directory, std::to_string(id) + ".dat");
+	const fs::path partial = data_path.string() + ".tmp";
+
+	// Values are streamed to the data file and keys to the table writer, neither is held whole
+	TrkSortedTableWriter writer(table_path.string().c_str(), sizeof(TrkLsmValueRef));
+	std::FILE* data = OpenFile(partial, "wb", L"wb");
+	bool written = data != nullptr;
+	uint64_t offset = 0;
+
+	if (written)
+	{
+		MergeCursors(Cursors, std::string_view(), [&](std::string_view Key, std::string_view Value, bool Deleted)
+		{
+			if (Deleted && DropTombstones)
+			{
+				return true;
+			}
+
+			const TrkLsmValueRef ref = { offset, static_cast<uint32_t>(Deleted ? 0 : Value.size()), Deleted ? 1u : 0u };
+			if (!Deleted && !Value.empty())
+			{
+				written = std::fwrite(Value.data(), 1, Value.size(), data) == Value.size();
+				offset += Value.size();
+			}
+			written = written && writer.Add(Key, &ref);
+			return written;
+		});
+	}
+
+	std::error_code error;
+	if (!written || writer.GetRecordCount() == 0)
+	{
+		writer.Abort();
+		if (data != nullptr)
+		{
+			std::fclose(data);
+		}
+		fs::remove(partial, error);
+		Result.reset();
+		return written;
+	}
+
+	if (!writer.Commit())
+	{
+		std::fclose(data);
+		fs::remove(partial, error);
+		return false;
+	}
+
+	// Bloom filter of every key, probed with double hashing; the keys are read back from the table
+	TrkLsmDataFooter footer;
+	footer.bloom_offset = offset;
+	footer.bloom_bits = std::max<uint64_t>(64, writer.GetRecordCount() * options.bloom_bits_per_key);
+	footer.bloom_hashes = std::min<uint32_t>(30, std::max<uint32_t>(1, options.bloom_bits_per_key * 69 / 100));
+	footer.magic = TRK_LSM_DATA_MAGIC;
+
+	std::vector<uint8_t> bloom(static_cast<size_t>((footer.bloom_bits + 7) / 8), 0);
+	{
+		TrkSortedTable table;
+		written = table.Open(table_path.string().c_str());
+		for (TrkSortedTable::Iterator it = table.Begin(); written && it.Valid(); it.Next())
+		{
+			const uint64_t hash = HashKey(it.Key());
+			const uint64_t delta = (hash >> 33) | (hash << 31);
+			uint64_t bit = hash;
+			for (uint32_t i = 0; i < footer.bloom_hashes; i++)
+			{
+				const uint64_t position = bit % footer.bloom_bits;
+				bloom[position / 8] |= static_cast<uint8_t>(1u << (position % 8));
+				bit += delta;
+			}
+		}
+	}
+
+	// The data file is on disk before the manifest names it
+	written = written
+		&& std::fwrite(bloom.data(), 1, bloom.size(), data) == bloom.size()
+		&& std::fwrite(&footer, sizeof(footer), 1, data) == 1
+		&& SyncFile(data);
+	written = std::fclose(data) == 0 && written;
+
+	if (written)
+	{
+		fs::rename(partial, data_path, error);
+	}
+	if (!written || error)
+	{
+		fs::remove(partial, error);
+		fs::remove(table_path, error);
+		return false;
+	}
+
+	Result = OpenRun(id);
+	return Result != nullptr;
+}
+
+TrkLsmStore::RunPtr TrkLsmStore::OpenRun(uint64_t Id) const
+{
+	RunPtr run = std::make_shared<Run>();
+	run->id = Id;
+	run->directory = directory;
+
+	const fs::path table_path = GetStorePath(directory, std::to_string(Id) + ".sst");
+	const fs::path data_path = GetStorePath(directory, std::to_string(Id) + ".dat");
+	if (!run->table.Open(table_path.string().c_str()) || !run->data.Open(data_path.string().c_str())
+		|| run->table.GetValueSize() != sizeof(TrkLsmValueRef) || run->data.GetSize() < sizeof(TrkLsmDataFooter))
+	{
+		return nullptr;
+	}
+
+	TrkLsmDataFooter footer;
+	std::memcpy(&footer, run->data.GetData() + run->data.GetSize() - sizeof(footer), sizeof(footer));
+	if (footer.magic != TRK_LSM_DATA_MAGIC || footer.bloom_hashes == 0
+		|| footer.bloom_offset > run->data.GetSize() - sizeof(footer)
+		|| (footer.bloom_bits + 7) / 8 > run->data.GetSize() - sizeof(footer) - footer.bloom_offset)
+	{
+		return nullptr;
+	}
+
+	run->bloom = run->data.GetData() + footer.bloom_offset;
+	run->bloom_bits = footer.bloom_bits;
+	run->bloom_hashes = footer.bloom_hashes;
+
+	std::error_code error;
+	run->size = run->data.GetSize() + fs::file_size(table_path, error);
+	return run;
+}
+
+bool TrkLsmStore::WriteManifest(const Version& Current, uint64_t FirstLog)
+{
+	const fs::path path = GetStorePath(directory, TRK_LSM_MANIFEST);
+	const fs::path partial = path.string() + ".tmp";
+
+	std::ostringstream output;
+	output << "next " << next_run_id << "\n" << "log " << FirstLog << "\n";
+	for (const RunPtr& run : Current.level0)
+	{
+		output << "run 0 " << run->id << "\n";
+	}
+	for (size_t level = 0; level < Current.levels.size(); level++)
+	{
+		if (Current.levels[level] != nullptr)
+		{
+			output << "run " << level + 1 << " " << Current.levels[level]->id << "\n";
+		}
+	}
+
+	const std::string manifest = output.str();
+	std::FILE* file = OpenFile(partial, "wb", L"wb");
+	if (file == nullptr)
+	{
+		return false;
+	}
+	bool written = std::fwrite(manifest.data(), 1, manifest.size(), file) == manifest.size() && SyncFile(file);
+	written = std::fclose(file) == 0 && written;
+
+	// Renamed runs are durable before the manifest names them, the manifest before the logs go
+	std::error_code error;
+	if (!written || !SyncDirectory(directory))
+	{
+		fs::remove(partial, error);
+		return false;
+	}
+	fs::rename(partial, path, error);
+	if (error || !SyncDirectory(directory))
+	{
+		return false;
+	}
+
+	for (const fs::directory_entry& entry : fs::directory_iterator(directory.c_str(), error))
+	{
+		const std::string name = entry.path().filename().string();
+		if (name.rfind("log-", 0) == 0 && std::strtoull(name.c_str() + 4, nullptr, 10) < FirstLog)
+		{
+			fs::remove(entry.path(), error);
+		}
+	}
+	return true;
+}
+
+std::shared_ptr<const TrkLsmStore::Version> TrkLsmStore::GetVersion() const
+{
+	std::shared_lock<std::shared_mutex> lock(mutex);
+	return version;
+}
+
+void TrkLsmStore::BackgroundLoop()
+{
+	std::unique_lock<std::mutex> lock(background_mutex);
+	while (!stopping)
+	{
+		background_cv.wait(lock, [this]() { return pending || stopping.load(); });
+		if (stopping)
+		{
+			break;
+		}
+		pending = false;
+		lock.unlock();
+
+		bool flushed;
+		{
+			std::lock_guard<std::mutex> compaction_lock(compaction_mutex);
+			flushed = FlushFrozen();
+			while (!stopping && CompactOnce()) { }
+		}
+
+		// A flush that failed is retried, writers wait for it
+		bool retry = false;
+		if (!flushed)
+		{
+			std::shared_lock<std::shared_mutex> frozen_lock(mutex);
+			retry = frozen != nullptr;
+		}
+
+		lock.lock();
+		if (retry && !stopping)
+		{
+			pending = true;
+			background_cv.wait_for(lock, std::chrono::seconds(1), [this]() { return stopping.load(); });
+		}
+	}
+}
+
+bool TrkLsmStore::FlushFrozen()
+{
+	std::shared_ptr<const MemTable> table;
+	std::shared_ptr<const Version> current;
+	uint64_t first_log;
+	{
+		std::shared_lock<std::shared_mutex> lock(mutex);
+		table = frozen;
+		current = version;
+		first_log = memtable_log;
+	}
+	if (table == nullptr || current == nullptr)
+	{
+		return false;
+	}
+
+	std::vector<std::unique_ptr<Cursor>> cursors;
+	cursors.emplace_back(new MemCursor(table->begin(), table->end()));
+
+	RunPtr run;
+	if (!WriteRun(cursors, false, run))
+	{
+		return false;
+	}
+
+	std::shared_ptr<Version> next = std::make_shared<Version>(*current);
+	if (run != nullptr)
+	{
+		next->level0.insert(next->level0.begin(), run);
+	}
+	if (!WriteManifest(*next, first_log))
+	{
+		if (run != nullptr)
+		{
+			run->obsolete = true;
+		}
+		return false;
+	}
+
+	{
+		std::unique_lock<std::shared_mutex> lock(mutex);
+		version = next;
+		frozen.reset();
+	}
+	frozen_cv.notify_all();
+	flushes.Increment();
+	return true;
+}
+
+bool TrkLsmStore::CompactOnce()
+{
+	const std::shared_ptr<const Version> current = GetVersion();
+	if (current == nullptr)
+	{
+		return false;
+	}
+
+	// Level 0 goes into level 1 once it has enough runs, a level over its budget into the next one
+	size_t target = 0;
+	bool from_level0 = false;
+	std::vector<RunPtr> inputs;
+	if (current->level0.size() >= std::max<size_t>(options.level0_runs, 1))
+	{
+		inputs = current->level0;
+		target = 1;
+		from_level0 = true;
+	}
+	else
+	{
+		for (size_t level = 1; level <= current->levels.size(); level++)
+		{
+			const RunPtr& run = current->levels[level - 1];
+			if (run != nullptr && run->size > GetLevelBudget(level))
+			{
+				inputs.push_back(run);
+				target = level + 1;
+				break;
+			}
+		}
+	}
+	if (target == 0)
+	{
+		return false;
+	}
+	if (target <= current->levels.size() && current->levels[target - 1] != nullptr)
+	{
+		inputs.push_back(current->levels[target - 1]);
+	}
+
+	// Tombstones are only needed while an older run below might still hold the key
+	bool bottom = true;
+	for (size_t level = target + 1; level <= current->levels.size(); level++)
+	{
+		bottom = bottom && current->levels[level - 1] == nullptr;
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	std::vector<std::unique_ptr<Cursor>> cursors;
+	for (const RunPtr& run : inputs)
+	{
+		cursors.emplace_back(new RunCursor(run, std::string_view()));
+	}
+
+	RunPtr run;
+	if (!WriteRun(cursors, bottom, run))
+	{
+		return false;
+	}
+	cursors.clear();
+
+	std::shared_ptr<Version> next = std::make_shared<Version>(*current);
+	if (from_level0)
+	{
+		next->level0.clear();
+	}
+	else
+	{
+		next->levels[target - 2] = nullptr;
+	}
+	if (next->levels.size() < target)
+	{
+		next->levels.resize(target);
+	}
+	next->levels[target - 1] = run;
+	while (!next->levels.empty() && next->levels.back() == nullptr)
+	{
+		next->levels.pop_back();
+	}
+
+	uint64_t first_log;
+	{
+		std::shared_lock<std::shared_mutex> lock(mutex);
+		first_log = frozen != nullptr ? frozen_log : memtable_log;
+	}
+	if (!WriteManifest(*next, first_log))
+	{
+		if (run != nullptr)
+		{
+			run->obsolete = true;
+		}
+		return false;
+	}
+
+	{
+		std::unique_lock<std::shared_mutex> lock(mutex);
+		version = next;
+	}
+	for (const RunPtr& input : inputs)
+	{
+		input->obsolete = true;
+	}
+
+	compactions.Increment();
+	compaction_bytes.Add(run != nullptr ? static_cast<int64_t>(run->size) : 0);
+	compaction_time.Record(TrkElapsedMicroseconds(start));
+	return true;
+}
+
+uint64_t TrkLsmStore::GetLevelBudget(size_t Level) const
+{
+	uint64_t budget = options.level1_size;
+	for (size_t level = 1; level < Level; level++)
+	{
+		budget *= std::max<uint64_t>(options.level_ratio, 2);
+	}
+	return budget;
+}
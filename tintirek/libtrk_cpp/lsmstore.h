@@ -0,0 +1,239 @@
+/*
+ *	lsmstore.h
+ *
+ *	Tintirek's log-structured merge key-value store
+ */
+
+#ifndef TRK_LSMSTORE_H
+#define TRK_LSMSTORE_H
+
+#include "mappedfile.h"
+#include "metrics.h"
+#include "sortedtable.h"
+#include "trkstring.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+
+/* Settings of a store */
+struct TrkLsmOptions
+{
+	/* Bytes of keys and values the memtable holds before it is flushed to level 0 */
+	size_t memtable_size = 4 * 1024 * 1024;
+	/* Runs on level 0 before they are merged into level 1 */
+	size_t level0_runs = 4;
+	/* Bytes of level 1, every further level may grow level_ratio times larger */
+	uint64_t level1_size = 16 * 1024 * 1024;
+	uint64_t level_ratio = 10;
+	/* Bloom filter bits per key of a run */
+	uint32_t bloom_bits_per_key = 10;
+	/* Syncs the log to disk on every write, otherwise it is only flushed to the operating system */
+	bool sync_log = false;
+};
+
+/* Writes applied together, with one log record */
+class TrkLsmBatch
+{
+public:
+	/* Sets a key */
+	void Put(std::string_view Key, std::string_view Value);
+	/* Deletes a key */
+	void Delete(std::string_view Key);
+
+	/* Returns true if nothing was added */
+	bool IsEmpty() const { return count == 0; }
+
+private:
+	friend class TrkLsmStore;
+
+	std::string records;	// Encoded like the log
+	size_t count = 0;
+};
+
+
+/*
+ *	Log-structured merge store
+ *
+ *	Writes go to a log and an in-memory memtable. A full memtable is
+ *	frozen and written to a sorted run on level 0 by a background
+ *	thread while writes continue in a new memtable and log. Level 0
+ *	runs may overlap; once there are level0_runs of them they are
+ *	merged with level 1, and a level larger than its budget is merged
+ *	into the next one. Every level above 0 is a single sorted run.
+ *
+ *	Runs are TrkSortedTable files mapping keys to value references,
+ *	next to a data file holding the values and a bloom filter of the
+ *	keys, so a lookup of a missing key rarely decodes a block. Readers
+ *	hold the set of runs they started with; runs replaced by a merge
+ *	are removed once their last reader is done.
+ *
+ *	The manifest names the live runs and the oldest log still needed;
+ *	it is rewritten and renamed into place after every flush and merge,
+ *	once the runs it names and then the manifest itself are synced to
+ *	disk, and only then are older logs removed. Opening a store replays
+ *	the logs the manifest still needs.
+ *
+ *	A merge streams its keys and values to disk; what it keeps in memory
+ *	is the bloom filter, bloom_bits_per_key bits per key, and the sparse
+ *	index of the sorted table. A merge into a level rewrites that level's
+ *	whole run, so a write ends up rewritten about level_ratio times per
+ *	level; this suits stores of up to a few million keys, larger ones
+ *	would need levels split into key ranges.
+ */
+class TrkLsmStore
+{
+public:
+	TrkLsmStore() = default;
+	~TrkLsmStore();
+
+	/* Disables copy */
+	TrkLsmStore(const TrkLsmStore&) = delete;
+	TrkLsmStore& operator=(const TrkLsmStore&) = delete;
+
+	/* Opens or creates a store in given directory, returns false if it can not be read or written */
+	bool Open(const TrkString& Directory, const TrkLsmOptions& Options = TrkLsmOptions());
+	/* Stops the background thread and closes the store, the memtable stays in its log */
+	void Close();
+
+	/* Sets a key, returns false if the log could not be written */
+	bool Put(std::string_view Key, std::string_view Value);
+	/* Deletes a key, returns false if the log could not be written */
+	bool Delete(std::string_view Key);
+	/* Applies a batch, returns false if the log could not be written */
+	bool Write(const TrkLsmBatch& Batch);
+
+	/* Finds the value of a key, returns false if it is not set */
+	bool Get(std::string_view Key, std::string& Value) const;
+	/* Calls given function for the keys starting with a prefix in key order until it returns false */
+	void Scan(std::string_view Prefix, const std::function<bool(std::string_view, std::string_view)>& Function) const;
+
+	/* Writes the memtable to level 0 and runs every merge due, returns when they are done */
+	bool Flush();
+
+	/* Returns the number of runs on each level */
+	std::vector<size_t> GetLevelRuns() const;
+
+	/* Memtables written to level 0 */
+	TrkCounter flushes;
+	/* Merges of runs */
+	TrkCounter compactions;
+	/* Bytes written by merges */
+	TrkCounter compaction_bytes;
+	/* Runs skipped by their bloom filter */
+	mutable TrkCounter bloom_skips;
+	/* Time of each merge, in microseconds */
+	TrkHistogram compaction_time;
+
+private:
+	/* Entry of a memtable, a tombstone when deleted */
+	struct MemEntry
+	{
+		std::string value;
+		bool deleted = false;
+	};
+	using MemTable = std::map<std::string, MemEntry, std::less<>>;
+
+	/* A sorted run and its data file */
+	struct Run
+	{
+		~Run();
+
+		/* Returns true if the key may be in the run */
+		bool MayContain(std::string_view Key) const;
+
+		uint64_t id = 0;
+		uint64_t size = 0;
+		TrkSortedTable table;
+		TrkMappedFile data;
+		const uint8_t* bloom = nullptr;
+		uint64_t bloom_bits = 0;
+		uint32_t bloom_hashes = 0;
+		TrkString directory;
+		/* Set once a merge replaced the run, its files are removed with it */
+		std::atomic<bool> obsolete{ false };
+	};
+	using RunPtr = std::shared_ptr<Run>;
+
+	/* Runs of the store, replaced as a whole by flushes and merges */
+	struct Version
+	{
+		std::vector<RunPtr> level0;		// Newest first
+		std::vector<RunPtr> levels;		// Level 1 and below, null when empty
+	};
+
+	/* Position in a memtable or a run, for merging */
+	class Cursor;
+	class MemCursor;
+	class RunCursor;
+
+	/* Merges cursors ordered newest first, calls Visit(key, value, deleted) once per key under a prefix until it returns false */
+	template <typename Function>
+	static void MergeCursors(std::vector<std::unique_ptr<Cursor>>& Cursors, std::string_view Prefix, Function Visit);
+
+	/* Freezes the memtable and starts a new log, waits while the last frozen memtable is being flushed */
+	bool Freeze(std::unique_lock<std::shared_mutex>& Lock);
+	/* Applies encoded records to a memtable, returns false if they are malformed */
+	static bool Apply(std::string_view Records, MemTable& Table, size_t& Bytes);
+	/* Opens the log of given sequence for appending */
+	bool OpenLog(uint64_t Sequence);
+	/* Replays the logs from given sequence, returns false if one can not be read */
+	bool Recover(uint64_t FirstLog);
+	/* Writes a run from merged cursors, Result is null if nothing was left to write */
+	bool WriteRun(std::vector<std::unique_ptr<Cursor>>& Cursors, bool DropTombstones, RunPtr& Result);
+	/* Opens the files of a run */
+	RunPtr OpenRun(uint64_t Id) const;
+	/* Writes the manifest of given version and removes the logs before FirstLog */
+	bool WriteManifest(const Version& Current, uint64_t FirstLog);
+	/* Returns the current version */
+	std::shared_ptr<const Version> GetVersion() const;
+
+	/* Background thread loop */
+	void BackgroundLoop();
+	/* Writes the frozen memtable to level 0 */
+	bool FlushFrozen();
+	/* Runs one merge if one is due, returns false if none was */
+	bool CompactOnce();
+	/* Returns the byte budget of a level */
+	uint64_t GetLevelBudget(size_t Level) const;
+
+	TrkString directory;
+	TrkLsmOptions options;
+
+	/* Guards the memtables, the version and the log */
+	mutable std::shared_mutex mutex;
+	/* Signalled when the frozen memtable has been flushed */
+	std::condition_variable_any frozen_cv;
+	MemTable memtable;
+	size_t memtable_bytes = 0;
+	uint64_t memtable_log = 0;		// First log with records of the memtable
+	std::shared_ptr<const MemTable> frozen;
+	uint64_t frozen_log = 0;		// First log with records of the frozen memtable
+	std::shared_ptr<const Version> version;
+
+	std::FILE* log = nullptr;
+	uint64_t log_sequence = 0;
+	uint64_t next_run_id = 1;
+
+	/* Serializes flushes and merges, they publish versions one after the other */
+	std::mutex compaction_mutex;
+
+	std::mutex background_mutex;
+	std::condition_variable background_cv;
+	std::atomic<bool> stopping{ false };
+	bool pending = false;
+	std::thread background_thread;
+};
+
+
+#endif /* TRK_LSMSTORE_H */
@@ -0,0 +1,120 @@
+/*
+ *	mappedfile.cpp
+ *
+ *	Tintirek's read-only memory-mapped files
+ */
+
+
+#include "mappedfile.h"
+
+#include <filesystem>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+TrkMappedFile::~TrkMappedFile()
+{
+	Close();
+}
+
+#ifdef _WIN32
+
+bool TrkMappedFile::Open(const TrkString& Path)
+{
+	Close();
+
+	const std::wstring path = std::filesystem::u8path(Path.c_str()).wstring();
+	HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file);
+	if (mapping == NULL)
+	{
+		return false;
+	}
+
+	// The view keeps the mapping object alive
+	void* address = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (address == NULL)
+	{
+		return false;
+	}
+
+	data = static_cast<const uint8_t*>(address);
+	size = static_cast<size_t>(file_size.QuadPart);
+	return true;
+}
+
+void TrkMappedFile::Close()
+{
+	if (data != nullptr)
+	{
+		UnmapViewOfFile(data);
+	}
+	data = nullptr;
+	size = 0;
+}
+
+#else
+
+bool TrkMappedFile::Open(const TrkString& Path)
+{
+	Close();
+
+	const int file_descriptor = open(Path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (file_descriptor < 0)
+	{
+		return false;
+	}
+
+	struct stat info;
+	if (fstat(file_descriptor, &info) != 0 || info.st_size == 0)
+	{
+		close(file_descriptor);
+		return false;
+	}
+
+	// The mapping stays valid after the descriptor is closed
+	void* address = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, file_descriptor, 0);
+	close(file_descriptor);
+	if (address == MAP_FAILED)
+	{
+		return false;
+	}
+
+	data = static_cast<const uint8_t*>(address);
+	size = static_cast<size_t>(info.st_size);
+	return true;
+}
+
+void TrkMappedFile::Close()
+{
+	if (data != nullptr)
+	{
+		munmap(const_cast<uint8_t*>(data), size);
+	}
+	data = nullptr;
+	size = 0;
+}
+
+#endif
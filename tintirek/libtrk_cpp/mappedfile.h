@@ -0,0 +1,52 @@
+/*
+ *	mappedfile.h
+ *
+ *	Tintirek's read-only memory-mapped files
+ */
+
+#ifndef TRK_MAPPEDFILE_H
+#define TRK_MAPPEDFILE_H
+
+#include "trk_types.h"
+#include "trkstring.h"
+#include <cstddef>
+#include <cstdint>
+
+
+/*
+ *	Read-only file mapping
+ *
+ *	Maps a whole file once; the mapping outlives the file handle, so
+ *	the file can be renamed or unlinked while it is mapped (on Windows
+ *	the file is opened with FILE_SHARE_DELETE for this). The contents
+ *	must not change while mapped, only immutable files are mapped.
+ */
+class TrkMappedFile
+{
+public:
+	TrkMappedFile() = default;
+	~TrkMappedFile();
+
+	/* Disables copy */
+	TrkMappedFile(const TrkMappedFile&) = delete;
+	TrkMappedFile& operator=(const TrkMappedFile&) = delete;
+
+	/* Maps given file, returns false if it can not be opened, is empty or can not be mapped */
+	bool Open(const TrkString& Path);
+	/* Unmaps the file */
+	void Close();
+
+	/* Returns true while a file is mapped */
+	bool IsOpen() const { return data != nullptr; }
+	/* Returns the first byte of the mapping */
+	const uint8_t* GetData() const { return data; }
+	/* Returns the size of the mapping */
+	size_t GetSize() const { return size; }
+
+private:
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+};
+
+
+#endif /* TRK_MAPPEDFILE_H */
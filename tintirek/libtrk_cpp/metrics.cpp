@@ -0,0 +1,186 @@
+/*
+ *	metrics.cpp
+ *
+ *	Tintirek's lightweight metric primitives
+ */
+
+
+#include "metrics.h"
+
+#include <cmath>
+
+#ifdef _WIN32
+#include <Windows.h>
+#elif __linux__
+#include <sched.h>
+#endif
+
+
+/* log2 of TRK_HISTOGRAM_SUB_BUCKETS */
+static constexpr int sub_bucket_bits = 5;
+static_assert((1 << sub_bucket_bits) == TRK_HISTOGRAM_SUB_BUCKETS, "sub_bucket_bits must match TRK_HISTOGRAM_SUB_BUCKETS");
+
+
+/* Returns the index of the most significant bit */
+static inline int GetHighestBit(uint64_t Value)
+{
+	int bit = 0;
+	while (Value >>= 1)
+	{
+		bit++;
+	}
+	return bit;
+}
+
+
+size_t TrkGetMetricsShard()
+{
+#ifdef _WIN32
+	return GetCurrentProcessorNumber() % TRK_METRICS_SHARDS;
+#elif __linux__
+	const int cpu = sched_getcpu();
+	if (cpu >= 0)
+	{
+		return static_cast<size_t>(cpu) % TRK_METRICS_SHARDS;
+	}
+#endif
+	static std::atomic<size_t> next_shard(0);
+	thread_local size_t shard = next_shard.fetch_add(1, std::memory_order_relaxed) % TRK_METRICS_SHARDS;
+	return shard;
+}
+
+
+TrkCounter::TrkCounter()
+{
+	for (Shard& shard : shards)
+	{
+		shard.value.store(0, std::memory_order_relaxed);
+	}
+}
+
+int64_t TrkCounter::Get() const
+{
+	int64_t total = 0;
+	for (const Shard& shard : shards)
+	{
+		total += shard.value.load(std::memory_order_relaxed);
+	}
+	return total;
+}
+
+
+uint64_t TrkHistogramSnapshot::GetPercentile(double Percentile) const
+{
+	if (count == 0)
+	{
+		return 0;
+	}
+
+	uint64_t rank = static_cast<uint64_t>(std::ceil((Percentile / 100.0) * count));
+	if (rank == 0)
+	{
+		rank = 1;
+	}
+
+	uint64_t seen = 0;
+	for (size_t i = 0; i < buckets.size(); i++)
+	{
+		seen += buckets[i];
+		if (seen >= rank)
+		{
+			// The last bucket also collects everything above the covered range
+			if (i == buckets.size() - 1)
+			{
+				return max;
+			}
+
+			const uint64_t value = TrkHistogram::GetBucketHighestValue(i);
+			return value < max ? value : max;
+		}
+	}
+
+	return max;
+}
+
+
+TrkHistogram::TrkHistogram()
+	: shards(new Shard[TRK_METRICS_SHARDS])
+{
+	for (size_t s = 0; s < TRK_METRICS_SHARDS; s++)
+	{
+		shards[s].count.store(0, std::memory_order_relaxed);
+		shards[s].sum.store(0, std::memory_order_relaxed);
+		shards[s].max.store(0, std::memory_order_relaxed);
+		for (size_t i = 0; i < bucket_count; i++)
+		{
+			shards[s].buckets[i].store(0, std::memory_order_relaxed);
+		}
+	}
+}
+
+TrkHistogram::~TrkHistogram()
+{
+	delete[] shards;
+}
+
+void TrkHistogram::Record(uint64_t Value)
+{
+	Shard& shard = shards[TrkGetMetricsShard()];
+	shard.buckets[GetBucketIndex(Value)].fetch_add(1, std::memory_order_relaxed);
+	shard.count.fetch_add(1, std::memory_order_relaxed);
+	shard.sum.fetch_add(Value, std::memory_order_relaxed);
+
+	uint64_t current = shard.max.load(std::memory_order_relaxed);
+	while (Value > current && !shard.max.compare_exchange_weak(current, Value, std::memory_order_relaxed))
+	{
+	}
+}
+
+TrkHistogramSnapshot TrkHistogram::Snapshot() const
+{
+	TrkHistogramSnapshot snapshot;
+	snapshot.buckets.assign(bucket_count, 0);
+
+	for (size_t s = 0; s < TRK_METRICS_SHARDS; s++)
+	{
+		snapshot.count += shards[s].count.load(std::memory_order_relaxed);
+		snapshot.sum += shards[s].sum.load(std::memory_order_relaxed);
+
+		const uint64_t shard_max = shards[s].max.load(std::memory_order_relaxed);
+		if (shard_max > snapshot.max)
+		{
+			snapshot.max = shard_max;
+		}
+
+		for (size_t i = 0; i < bucket_count; i++)
+		{
+			snapshot.buckets[i] += shards[s].buckets[i].load(std::memory_order_relaxed);
+		}
+	}
+
+	return snapshot;
+}
+
+size_t TrkHistogram::GetBucketIndex(uint64_t Value)
+{
+	if (Value < 2 * TRK_HISTOGRAM_SUB_BUCKETS)
+	{
+		return static_cast<size_t>(Value);
+	}
+
+	const int exponent = GetHighestBit(Value) - sub_bucket_bits;
+	const size_t index = static_cast<size_t>(exponent) * TRK_HISTOGRAM_SUB_BUCKETS + static_cast<size_t>(Value >> exponent);
+	return index < bucket_count ? index : bucket_count - 1;
+}
+
+uint64_t TrkHistogram::GetBucketHighestValue(size_t Index)
+{
+	if (Index < 2 * TRK_HISTOGRAM_SUB_BUCKETS)
+	{
+		return Index;
+	}
+
+	const size_t exponent = Index / TRK_HISTOGRAM_SUB_BUCKETS - 1;
+	const uint64_t mantissa = Index - exponent * TRK_HISTOGRAM_SUB_BUCKETS;
+	return ((mantissa + 1) << exponent) - 1;
+}
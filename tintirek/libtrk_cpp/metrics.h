@@ -0,0 +1,146 @@
+/*
+ *	metrics.h
+ *
+ *	Tintirek's lightweight metric primitives
+ */
+
+#ifndef TRK_METRICS_H
+#define TRK_METRICS_H
+
+#include "trk_types.h"
+#include "trkstring.h"
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+
+/* Number of shards used by counters and histograms */
+#define TRK_METRICS_SHARDS 8
+
+/* Values below this are recorded exactly, above it with 1/32 relative precision */
+#define TRK_HISTOGRAM_SUB_BUCKETS 32
+
+/* Number of power-of-two ranges a histogram covers above the exact range */
+#define TRK_HISTOGRAM_MAGNITUDES 32
+
+
+/* Returns the shard index of the calling thread, based on the current CPU when available */
+size_t TrkGetMetricsShard();
+
+/* Returns elapsed microseconds between two points of the steady clock */
+inline uint64_t TrkElapsedMicroseconds(std::chrono::steady_clock::time_point Start, std::chrono::steady_clock::time_point End = std::chrono::steady_clock::now())
+{
+	if (End <= Start)
+	{
+		return 0;
+	}
+
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(End - Start).count());
+}
+
+
+/*
+ *	Sharded counter
+ *
+ *	Every shard lives on its own cache line, so threads running on
+ *	different cores never write to the same line while recording.
+ *	Reading sums all shards and is meant for the rare reporting path.
+ */
+class TrkCounter
+{
+public:
+	TrkCounter();
+
+	/* Disables copy */
+	TrkCounter(const TrkCounter&) = delete;
+	TrkCounter& operator=(const TrkCounter&) = delete;
+
+	/* Adds the value to the shard of the calling thread */
+	void Add(int64_t Value)
+	{
+		shards[TrkGetMetricsShard()].value.fetch_add(Value, std::memory_order_relaxed);
+	}
+	/* Adds one */
+	void Increment() { Add(1); }
+	/* Subtracts one */
+	void Decrement() { Add(-1); }
+
+	/* Returns the sum of all shards */
+	int64_t Get() const;
+
+private:
+	struct alignas(64) Shard
+	{
+		std::atomic<int64_t> value;
+	};
+
+	Shard shards[TRK_METRICS_SHARDS];
+};
+
+
+/* Point-in-time copy of a histogram */
+class TrkHistogramSnapshot
+{
+public:
+	/* Returns the highest value equivalent to the given percentile (0-100) */
+	uint64_t GetPercentile(double Percentile) const;
+	/* Returns the mean of recorded values */
+	double GetMean() const { return count > 0 ? static_cast<double>(sum) / count : 0.0; }
+
+	/* Number of recorded values */
+	uint64_t count = 0;
+	/* Sum of recorded values */
+	uint64_t sum = 0;
+	/* Largest recorded value */
+	uint64_t max = 0;
+	/* Counts of each bucket */
+	std::vector<uint64_t> buckets;
+};
+
+
+/*
+ *	HDR-style histogram
+ *
+ *	Buckets are log-linear: every power-of-two range is split into
+ *	TRK_HISTOGRAM_SUB_BUCKETS / 2 linear buckets, which keeps the
+ *	relative error of reported percentiles near 3% over the whole
+ *	range while recording is a few bit operations and one relaxed
+ *	atomic increment on the shard of the calling thread.
+ */
+class TrkHistogram
+{
+public:
+	TrkHistogram();
+	~TrkHistogram();
+
+	/* Disables copy */
+	TrkHistogram(const TrkHistogram&) = delete;
+	TrkHistogram& operator=(const TrkHistogram&) = delete;
+
+	/* Record a value */
+	void Record(uint64_t Value);
+	/* Merge all shards into a snapshot */
+	TrkHistogramSnapshot Snapshot() const;
+
+	/* Returns the bucket index of given value */
+	static size_t GetBucketIndex(uint64_t Value);
+	/* Returns the highest value that falls into given bucket */
+	static uint64_t GetBucketHighestValue(size_t Index);
+
+	/* Total number of buckets */
+	static constexpr size_t bucket_count = TRK_HISTOGRAM_SUB_BUCKETS * (TRK_HISTOGRAM_MAGNITUDES + 1);
+
+private:
+	struct alignas(64) Shard
+	{
+		std::atomic<uint64_t> count;
+		std::atomic<uint64_t> sum;
+		std::atomic<uint64_t> max;
+		std::atomic<uint64_t> buckets[bucket_count];
+	};
+
+	Shard* shards;
+};
+
+
+#endif /* TRK_METRICS_H */
@@ -0,0 +1,1156 @@
+/*
+ *	objectstore.cpp
+ *
+ *	Tintirek's content-addressable object store
+ */
+
+
+#include "objectstore.h"
+#include "chunker.h"
+#include "delta.h"
+#include "mappedfile.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <system_error>
+#include <unordered_set>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+
+/* Directory of the store for objects being written */
+#define TRK_OBJECT_TEMP_DIRECTORY "tmp"
+
+/* Directory of the store for packs */
+#define TRK_OBJECT_PACK_DIRECTORY "pack"
+
+/* Magic bytes at the start of a chunk list */
+#define TRK_OBJECT_CHUNK_LIST_MAGIC "TRKLIST1"
+
+/* Extension of a chunk list after the digest of its object */
+#define TRK_OBJECT_CHUNK_LIST_EXTENSION ".chunks"
+
+
+/* Header of a chunk list, followed by its chunks */
+struct TrkChunkListHeader
+{
+	char magic[8];
+	uint64_t size;		// Bytes of the object
+	uint64_t count;
+};
+
+
+/* Returns the filesystem path of a UTF-8 path */
+static fs::path GetFilePath(const TrkString& Path)
+{
+#ifdef _WIN32
+	return fs::u8path(Path.c_str());
+#else
+	return fs::path(Path.c_str());
+#endif
+}
+
+/* Opens a file with a fopen mode */
+static std::FILE* OpenFile(const fs::path& Path, const char* Mode, const wchar_t* WideMode)
+{
+#ifdef _WIN32
+	(void)Mode;
+	return _wfopen(Path.wstring().c_str(), WideMode);
+#else
+	(void)WideMode;
+	return std::fopen(Path.string().c_str(), Mode);
+#endif
+}
+
+/* Flushes a file to disk, returns false if it could not be synced */
+static bool SyncFile(std::FILE* File)
+{
+	if (std::fflush(File) != 0)
+	{
+		return false;
+	}
+#ifdef _WIN32
+	return _commit(_fileno(File)) == 0;
+#else
+	return fsync(fileno(File)) == 0;
+#endif
+}
+
+
+TrkObjectWriter::~TrkObjectWriter()
+{
+	Abort();
+}
+
+bool TrkObjectWriter::Write(const void* Data, size_t Length)
+{
+	if (file == nullptr || failed)
+	{
+		return false;
+	}
+	if (Length == 0)
+	{
+		return true;
+	}
+
+	if (std::fwrite(Data, 1, Length, file) != Length || !hash.Update(Data, Length))
+	{
+		failed = true;
+		return false;
+	}
+
+	size += Length;
+	return true;
+}
+
+bool TrkObjectWriter::Commit(TrkString& Digest, const TrkString& ExpectedDigest)
+{
+	if (file == nullptr || failed)
+	{
+		Abort();
+		return false;
+	}
+
+	const bool synced = SyncFile(file);
+	std::fclose(file);
+	file = nullptr;
+
+	const TrkString digest = hash.Final();
+	if (!synced || digest == "" || (ExpectedDigest != "" && digest != ExpectedDigest))
+	{
+		Abort();
+		return false;
+	}
+
+	std::error_code error;
+	const fs::path temp = GetFilePath(temp_path);
+	const fs::path path = GetFilePath(store->GetObjectPath(digest));
+
+	if (store->Contains(digest))
+	{
+		fs::remove(temp, error);
+		store->objects_deduplicated.Increment();
+		store->bytes_deduplicated.Add(static_cast<int64_t>(size));
+	}
+	else
+	{
+		fs::create_directories(path.parent_path(), error);
+		fs::rename(temp, path, error);
+		if (error)
+		{
+			Abort();
+			return false;
+		}
+		store->objects_written.Increment();
+		store->bytes_written.Add(static_cast<int64_t>(size));
+	}
+
+	temp_path = "";
+	store = nullptr;
+	Digest = digest;
+	return true;
+}
+
+void TrkObjectWriter::Abort()
+{
+	if (file != nullptr)
+	{
+		std::fclose(file);
+		file = nullptr;
+	}
+	if (temp_path != "")
+	{
+		std::error_code error;
+		fs::remove(GetFilePath(temp_path), error);
+		temp_path = "";
+	}
+	store = nullptr;
+	failed = false;
+	size = 0;
+}
+
+
+TrkObjectReader::~TrkObjectReader()
+{
+	Close();
+}
+
+size_t TrkObjectReader::Read(void* Buffer, size_t Length)
+{
+	if (list_store != nullptr)
+	{
+		size_t total = 0;
+		while (total < Length)
+		{
+			const size_t read = chunk != nullptr ? chunk->Read(static_cast<char*>(Buffer) + total, Length - total) : 0;
+			if (read > 0)
+			{
+				total += read;
+				continue;
+			}
+			if (next_chunk >= chunks.size())
+			{
+				break;
+			}
+
+			if (chunk == nullptr)
+			{
+				chunk = std::make_unique<TrkObjectReader>();
+			}
+			if (!list_store->OpenStored(TrkPackFile::FormatDigest(chunks[next_chunk].digest), *chunk))
+			{
+				next_chunk = chunks.size();
+				break;
+			}
+			next_chunk++;
+		}
+		return total;
+	}
+	if (file != nullptr)
+	{
+		return std::fread(Buffer, 1, Length, file);
+	}
+	if (contents != nullptr)
+	{
+		const size_t length = remaining < Length ? static_cast<size_t>(remaining) : Length;
+		std::memcpy(Buffer, contents->data() + offset, length);
+		offset += length;
+		remaining -= length;
+		return length;
+	}
+	if (pack == nullptr)
+	{
+		return 0;
+	}
+
+	const size_t read = pack->Read(offset, Buffer, remaining < Length ? static_cast<size_t>(remaining) : Length);
+	offset += read;
+	remaining -= read;
+	return read;
+}
+
+void TrkObjectReader::Close()
+{
+	if (file != nullptr)
+	{
+		std::fclose(file);
+		file = nullptr;
+	}
+	pack.reset();
+	contents.reset();
+	list_store = nullptr;
+	chunks.clear();
+	next_chunk = 0;
+	chunk.reset();
+	offset = 0;
+	remaining = 0;
+	size = 0;
+}
+
+
+bool TrkObjectStore::Open(const TrkString& Root)
+{
+	std::error_code error;
+	const fs::path temp = GetFilePath(Root) / TRK_OBJECT_TEMP_DIRECTORY;
+	const fs::path pack_directory = GetFilePath(Root) / TRK_OBJECT_PACK_DIRECTORY;
+
+	// Objects that were being written when the last run stopped are never committed
+	fs::remove_all(temp, error);
+	fs::create_directories(temp, error);
+	if (error)
+	{
+		return false;
+	}
+	fs::create_directories(pack_directory, error);
+	if (error)
+	{
+		return false;
+	}
+
+	// A pack is only complete once its index is in place
+	std::vector<std::shared_ptr<const TrkPackFile>> opened;
+	std::vector<fs::path> incomplete;
+	std::error_code exists_error;
+	for (fs::directory_iterator it(pack_directory, error), end; !error && it != end; it.increment(error))
+	{
+		const fs::path& path = it->path();
+		if (path.extension() == ".idx")
+		{
+			auto pack = std::make_shared<TrkPackFile>();
+			if (pack->Open((pack_directory / path.stem()).u8string().c_str()))
+			{
+				opened.push_back(pack);
+			}
+		}
+		else if (path.extension() == ".tmp" || (path.extension() == ".pack" && !fs::exists(fs::path(path).replace_extension(".idx"), exists_error)))
+		{
+			incomplete.push_back(path);
+		}
+	}
+	for (const fs::path& path : incomplete)
+	{
+		fs::remove(path, error);
+	}
+
+	{
+		std::unique_lock<std::shared_mutex> lock(pack_mutex);
+		packs = std::move(opened);
+	}
+
+	root = Root;
+	return true;
+}
+
+bool TrkObjectStore::BeginWrite(TrkObjectWriter& Writer)
+{
+	Writer.Abort();
+	if (root == "")
+	{
+		return false;
+	}
+
+	const TrkString temp_path = GetTempPath();
+	if (temp_path == "")
+	{
+		return false;
+	}
+
+	Writer.file = OpenFile(GetFilePath(temp_path), "wb", L"wb");
+	if (Writer.file == nullptr || !Writer.hash.Init())
+	{
+		Writer.Abort();
+		return false;
+	}
+
+	Writer.temp_path = temp_path;
+	Writer.store = this;
+	return true;
+}
+
+bool TrkObjectStore::Put(std::istream& Input, TrkString& Digest)
+{
+	TrkObjectWriter writer;
+	if (!BeginWrite(writer))
+	{
+		return false;
+	}
+
+	char buffer[TRK_OBJECT_BUFFER_SIZE];
+	while (Input)
+	{
+		Input.read(buffer, sizeof(buffer));
+		if (!writer.Write(buffer, static_cast<size_t>(Input.gcount())))
+		{
+			return false;
+		}
+	}
+
+	return Input.eof() && writer.Commit(Digest);
+}
+
+bool TrkObjectStore::PutFile(const TrkString& Path, TrkString& Digest)
+{
+	std::error_code error;
+	const uintmax_t size = fs::file_size(GetFilePath(Path), error);
+	std::ifstream input(GetFilePath(Path), std::ios::binary);
+	if (!input.is_open())
+	{
+		return false;
+	}
+	return !error && size >= TRK_OBJECT_CHUNKED_MIN_SIZE ? PutChunked(input, Digest) : Put(input, Digest);
+}
+
+bool TrkObjectStore::PutChunked(std::istream& Input, TrkString& Digest)
+{
+	TrkSHA256Stream hash;
+	if (root == "" || !hash.Init())
+	{
+		return false;
+	}
+
+	// A maximum chunk is kept ahead of every cut, so chunks end where TrkChunker would cut the whole file
+	std::vector<uint8_t> buffer(TRK_CHUNK_MAX_SIZE * 2);
+	std::vector<TrkObjectChunk> chunks;
+	size_t start = 0, filled = 0;
+	uint64_t size = 0;
+	bool end = false;
+	while (true)
+	{
+		if (!end && filled - start < TRK_CHUNK_MAX_SIZE)
+		{
+			std::memmove(buffer.data(), buffer.data() + start, filled - start);
+			filled -= start;
+			start = 0;
+
+			Input.read(reinterpret_cast<char*>(buffer.data()) + filled, static_cast<std::streamsize>(buffer.size() - filled));
+			filled += static_cast<size_t>(Input.gcount());
+			if (!Input)
+			{
+				if (!Input.eof())
+				{
+					return false;
+				}
+				end = true;
+			}
+			continue;
+		}
+		if (start == filled)
+		{
+			break;
+		}
+
+		const size_t length = TrkChunker::Cut(buffer.data() + start, filled - start);
+		TrkObjectWriter writer;
+		TrkString chunk_digest;
+		TrkObjectChunk chunk;
+		if (!BeginWrite(writer) || !writer.Write(buffer.data() + start, length) || !writer.Commit(chunk_digest)
+			|| !hash.Update(buffer.data() + start, length) || !TrkPackFile::ParseDigest(chunk_digest, chunk.digest))
+		{
+			return false;
+		}
+
+		chunk.size = length;
+		chunks.push_back(chunk);
+		size += length;
+		start += length;
+	}
+
+	const TrkString digest = hash.Final();
+	if (digest == "" || (!Contains(digest) && !WriteChunkList(digest, chunks, size)))
+	{
+		return false;
+	}
+
+	Digest = digest;
+	return true;
+}
+
+bool TrkObjectStore::PutChunkList(const std::vector<TrkString>& Chunks, const TrkString& ExpectedDigest)
+{
+	if (!IsValidDigest(ExpectedDigest) || root == "")
+	{
+		return false;
+	}
+	if (Contains(ExpectedDigest))
+	{
+		return true;
+	}
+
+	// The list names its object, so the chunks are read back and hashed before it is stored
+	TrkSHA256Stream hash;
+	if (!hash.Init())
+	{
+		return false;
+	}
+
+	std::vector<TrkObjectChunk> chunks;
+	std::vector<char> buffer(TRK_OBJECT_BUFFER_SIZE);
+	uint64_t size = 0;
+	for (const TrkString& digest : Chunks)
+	{
+		TrkObjectReader reader;
+		TrkObjectChunk chunk;
+		if (!OpenStored(digest, reader) || !TrkPackFile::ParseDigest(digest, chunk.digest))
+		{
+			return false;
+		}
+
+		chunk.size = 0;
+		size_t read;
+		while ((read = reader.Read(buffer.data(), buffer.size())) > 0)
+		{
+			if (!hash.Update(buffer.data(), read))
+			{
+				return false;
+			}
+			chunk.size += read;
+		}
+		if (chunk.size != reader.GetSize())
+		{
+			return false;
+		}
+
+		chunks.push_back(chunk);
+		size += chunk.size;
+	}
+
+	return hash.Final() == ExpectedDigest && WriteChunkList(ExpectedDigest, chunks, size);
+}
+
+bool TrkObjectStore::Open(const TrkString& Digest, TrkObjectReader& Reader) const
+{
+	if (OpenStored(Digest, Reader))
+	{
+		return true;
+	}
+
+	uint64_t size;
+	if (!IsValidDigest(Digest) || root == "" || !ReadChunkList(Digest, size, &Reader.chunks))
+	{
+		Reader.Close();
+		return false;
+	}
+
+	Reader.list_store = this;
+	Reader.size = size;
+	return true;
+}
+
+bool TrkObjectStore::OpenStored(const TrkString& Digest, TrkObjectReader& Reader) const
+{
+	Reader.Close();
+	if (!IsValidDigest(Digest) || root == "")
+	{
+		return false;
+	}
+
+	// A repack may remove the loose file between the two lookups, the pack has the object by then
+	std::error_code error;
+	const fs::path path = GetFilePath(GetObjectPath(Digest));
+	Reader.file = OpenFile(path, "rb", L"rb");
+	if (Reader.file != nullptr)
+	{
+		const uintmax_t size = fs::file_size(path, error);
+		Reader.size = error ? 0 : static_cast<uint64_t>(size);
+		return true;
+	}
+
+	uint8_t digest[TRK_PACK_DIGEST_SIZE];
+	TrkPackEntry entry;
+	if (!TrkPackFile::ParseDigest(Digest, digest) || !FindPacked(digest, Reader.pack, entry))
+	{
+		Reader.Close();
+		return false;
+	}
+
+	if (entry.codec == static_cast<uint32_t>(TrkPackCodec::DELTA))
+	{
+		Reader.pack.reset();
+		if (!Load(digest, Reader.contents))
+		{
+			Reader.Close();
+			return false;
+		}
+		Reader.offset = 0;
+		Reader.remaining = Reader.contents->size();
+		Reader.size = Reader.contents->size();
+		return true;
+	}
+	if (entry.codec != static_cast<uint32_t>(TrkPackCodec::STORED))
+	{
+		Reader.Close();
+		return false;
+	}
+
+	Reader.offset = entry.offset;
+	Reader.remaining = entry.length;
+	Reader.size = entry.size;
+	return true;
+}
+
+bool TrkObjectStore::Contains(const TrkString& Digest) const
+{
+	uint64_t size;
+	return GetSize(Digest, size);
+}
+
+bool TrkObjectStore::GetSize(const TrkString& Digest, uint64_t& Size) const
+{
+	if (!IsValidDigest(Digest) || root == "")
+	{
+		return false;
+	}
+
+	std::error_code error;
+	const uintmax_t size = fs::file_size(GetFilePath(GetObjectPath(Digest)), error);
+	if (!error)
+	{
+		Size = static_cast<uint64_t>(size);
+		return true;
+	}
+
+	uint8_t digest[TRK_PACK_DIGEST_SIZE];
+	std::shared_ptr<const TrkPackFile> pack;
+	TrkPackEntry entry;
+	if (TrkPackFile::ParseDigest(Digest, digest) && FindPacked(digest, pack, entry))
+	{
+		Size = entry.size;
+		return true;
+	}
+
+	return ReadChunkList(Digest, Size, nullptr);
+}
+
+bool TrkObjectStore::Remove(const TrkString& Digest)
+{
+	if (!IsValidDigest(Digest) || root == "")
+	{
+		return false;
+	}
+
+	std::error_code error;
+	const fs::path path = GetFilePath(GetObjectPath(Digest));
+	return fs::remove(path, error) || fs::remove(fs::path(path).concat(TRK_OBJECT_CHUNK_LIST_EXTENSION), error);
+}
+
+void TrkObjectStore::SetDeltaBase(const TrkString& Digest, const TrkString& BaseDigest)
+{
+	if (IsValidDigest(Digest) && IsValidDigest(BaseDigest) && Digest != BaseDigest)
+	{
+		std::lock_guard<std::mutex> lock(delta_mutex);
+		delta_bases[Digest.c_str()] = BaseDigest.c_str();
+	}
+}
+
+void TrkObjectStore::SetCacheSize(size_t Bytes)
+{
+	std::lock_guard<std::mutex> lock(cache_mutex);
+	cache_capacity = Bytes;
+	while (cache_bytes > cache_capacity && !cache.empty())
+	{
+		cache_bytes -= cache.back().second->size();
+		cache_index.erase(cache.back().first);
+		cache.pop_back();
+	}
+}
+
+bool TrkObjectStore::Repack(uint64_t MaxObjectSize, size_t MaxPacks)
+{
+	std::lock_guard<std::mutex> repack_lock(repack_mutex);
+	if (root == "")
+	{
+		return false;
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+
+	// Bases stay set until a repack succeeds, then they are dropped whether their objects became deltas or not
+	std::unordered_map<std::string, std::string> bases;
+	{
+		std::lock_guard<std::mutex> lock(delta_mutex);
+		bases = delta_bases;
+	}
+	auto drop_bases = [this, &bases]()
+	{
+		std::lock_guard<std::mutex> lock(delta_mutex);
+		for (const auto& [digest, base_digest] : bases)
+		{
+			const auto current = delta_bases.find(digest);
+			if (current != delta_bases.end() && current->second == base_digest)
+			{
+				delta_bases.erase(current);
+			}
+		}
+	};
+
+	// Loose objects are the files two fan-out directories below the root
+	std::vector<fs::path> loose;
+	std::error_code error;
+	for (fs::recursive_directory_iterator it(GetFilePath(root), error), end; !error && it != end; it.increment(error))
+	{
+		if (it.depth() == 0 && (it->path().filename() == TRK_OBJECT_TEMP_DIRECTORY || it->path().filename() == TRK_OBJECT_PACK_DIRECTORY))
+		{
+			it.disable_recursion_pending();
+		}
+		else if (it.depth() == 2 && IsValidDigest(it->path().filename().u8string().c_str()))
+		{
+			std::error_code size_error;
+			const uintmax_t size = it->file_size(size_error);
+			if (!size_error && (size <= MaxObjectSize || (size <= TRK_OBJECT_DELTA_MAX_SIZE && bases.count(it->path().filename().u8string()) > 0)))
+			{
+				loose.push_back(it->path());
+			}
+		}
+	}
+
+	std::vector<std::shared_ptr<const TrkPackFile>> merged;
+	{
+		std::shared_lock<std::shared_mutex> lock(pack_mutex);
+		if (packs.size() >= MaxPacks && packs.size() > 1)
+		{
+			merged = packs;
+		}
+	}
+	if (loose.empty() && merged.empty())
+	{
+		drop_bases();
+		return true;
+	}
+
+	const TrkString temp_path = GetTempPath();
+	TrkPackWriter writer;
+	if (temp_path == "" || !writer.Open(temp_path))
+	{
+		return false;
+	}
+
+	std::vector<char> buffer(TRK_OBJECT_BUFFER_SIZE);
+	for (const std::shared_ptr<const TrkPackFile>& pack : merged)
+	{
+		for (uint64_t i = 0; i < pack->GetCount(); i++)
+		{
+			const TrkPackEntry& entry = pack->GetEntry(i);
+			if (!writer.BeginObject(entry.digest, entry.size, static_cast<TrkPackCodec>(entry.codec), entry.depth))
+			{
+				return false;
+			}
+			for (uint64_t copied = 0; copied < entry.length;)
+			{
+				const size_t length = entry.length - copied < buffer.size() ? static_cast<size_t>(entry.length - copied) : buffer.size();
+				if (pack->Read(entry.offset + copied, buffer.data(), length) != length || !writer.Write(buffer.data(), length))
+				{
+					return false;
+				}
+				copied += length;
+			}
+			if (!writer.EndObject())
+			{
+				return false;
+			}
+		}
+	}
+
+	// Bases are written before the deltas against them, so every delta knows its depth
+	std::unordered_map<std::string, fs::path> loose_names;
+	for (const fs::path& path : loose)
+	{
+		loose_names.emplace(path.filename().u8string(), path);
+	}
+	std::vector<fs::path> ordered;
+	std::unordered_set<std::string> visited;
+	for (const fs::path& path : loose)
+	{
+		std::vector<fs::path> chain;
+		std::string name = path.filename().u8string();
+		while (visited.insert(name).second)
+		{
+			chain.push_back(loose_names[name]);
+			const auto base = bases.find(name);
+			if (base == bases.end() || loose_names.count(base->second) == 0)
+			{
+				break;
+			}
+			name = base->second;
+		}
+		ordered.insert(ordered.end(), chain.rbegin(), chain.rend());
+	}
+
+	// Loose copies of packed objects are removed along with the ones packed now
+	std::vector<fs::path> packed;
+	size_t packed_count = 0;
+	DeltaLinks written;
+	for (const fs::path& path : ordered)
+	{
+		const std::string name = path.filename().u8string();
+		uint8_t digest[TRK_PACK_DIGEST_SIZE];
+		std::shared_ptr<const TrkPackFile> pack;
+		TrkPackEntry entry;
+		TrkPackFile::ParseDigest(name.c_str(), digest);
+		if (FindPacked(digest, pack, entry))
+		{
+			packed.push_back(path);
+			continue;
+		}
+
+		std::error_code size_error;
+		const uintmax_t size = fs::file_size(path, size_error);
+		if (size_error)
+		{
+			continue;
+		}
+
+		// The object and its base are both read whole to encode the delta
+		const auto base = bases.find(name);
+		uint32_t base_depth = 0;
+		uint64_t base_size = 0;
+		if (base != bases.end() && size > TRK_PACK_DIGEST_SIZE * 2 && size <= TRK_OBJECT_DELTA_MAX_SIZE
+			&& GetSize(base->second.c_str(), base_size) && base_size <= TRK_OBJECT_DELTA_MAX_SIZE
+			&& GetBaseDepth(base->second, name, written, base_depth) && base_depth < TRK_OBJECT_MAX_DELTA_DEPTH)
+		{
+			uint8_t base_digest[TRK_PACK_DIGEST_SIZE];
+			std::shared_ptr<const std::string> base_contents;
+			TrkMappedFile target;
+			std::string delta;
+
+			TrkPackFile::ParseDigest(base->second.c_str(), base_digest);
+			if (Load(base_digest, base_contents) && target.Open(path.u8string().c_str())
+				&& TrkDelta::Encode(*base_contents, std::string_view(reinterpret_cast<const char*>(target.GetData()), target.GetSize()), delta, target.GetSize() / 2 - TRK_PACK_DIGEST_SIZE))
+			{
+				if (!writer.BeginObject(digest, target.GetSize(), TrkPackCodec::DELTA, base_depth + 1)
+					|| !writer.Write(base_digest, sizeof(base_digest))
+					|| !writer.Write(delta.data(), delta.size())
+					|| !writer.EndObject())
+				{
+					return false;
+				}
+
+				written[name] = DeltaLink{ base->second, base_depth + 1 };
+				packed.push_back(path);
+				packed_count++;
+				objects_deltified.Increment();
+				delta_bytes_saved.Add(static_cast<int64_t>(target.GetSize() - sizeof(base_digest) - delta.size()));
+				continue;
+			}
+		}
+
+		// Too large for a pack, the object stays loose as the whole copy deltas start from
+		if (size > MaxObjectSize)
+		{
+			continue;
+		}
+
+		std::FILE* file = OpenFile(path, "rb", L"rb");
+		if (file == nullptr)
+		{
+			continue;
+		}
+
+		bool copied = writer.BeginObject(digest, static_cast<uint64_t>(size));
+		size_t read;
+		while (copied && (read = std::fread(buffer.data(), 1, buffer.size(), file)) > 0)
+		{
+			copied = writer.Write(buffer.data(), read);
+		}
+		copied = copied && !std::ferror(file) && writer.EndObject();
+		std::fclose(file);
+		if (!copied)
+		{
+			return false;
+		}
+
+		packed.push_back(path);
+		packed_count++;
+	}
+
+	TrkString pack_path;
+	auto pack = std::make_shared<TrkPackFile>();
+	if (writer.GetCount() > 0)
+	{
+		if (!writer.Finish((std::string(root.c_str()) + "/" TRK_OBJECT_PACK_DIRECTORY).c_str(), pack_path) || !pack->Open(pack_path))
+		{
+			return false;
+		}
+
+		std::unique_lock<std::shared_mutex> lock(pack_mutex);
+		std::vector<std::shared_ptr<const TrkPackFile>> current;
+		for (const std::shared_ptr<const TrkPackFile>& existing : packs)
+		{
+			if (existing->GetPath() != pack_path && std::find(merged.begin(), merged.end(), existing) == merged.end())
+			{
+				current.push_back(existing);
+			}
+		}
+		current.push_back(pack);
+		packs = std::move(current);
+	}
+
+	// Readers that opened them before keep reading the removed files
+	for (const fs::path& path : packed)
+	{
+		fs::remove(path, error);
+	}
+	for (const std::shared_ptr<const TrkPackFile>& old : merged)
+	{
+		if (old->GetPath() != pack_path)
+		{
+			fs::remove(GetFilePath((std::string(old->GetPath().c_str()) + ".idx").c_str()), error);
+			fs::remove(GetFilePath((std::string(old->GetPath().c_str()) + ".pack").c_str()), error);
+		}
+	}
+
+	drop_bases();
+
+	if (pack_path == "")
+	{
+		return true;
+	}
+
+	repacks.Increment();
+	objects_packed.Add(static_cast<int64_t>(packed_count));
+	repack_time.Record(TrkElapsedMicroseconds(start));
+	return true;
+}
+
+size_t TrkObjectStore::GetPackCount() const
+{
+	std::shared_lock<std::shared_mutex> lock(pack_mutex);
+	return packs.size();
+}
+
+bool TrkObjectStore::IsValidDigest(const TrkString& Digest)
+{
+	uint8_t digest[TRK_PACK_DIGEST_SIZE];
+	return TrkPackFile::ParseDigest(Digest, digest);
+}
+
+TrkString TrkObjectStore::GetTempPath() const
+{
+	unsigned char random[16];
+	char name[sizeof(random) * 2 + 1];
+	if (!TrkCryptoHelper::RandomBytes(random, sizeof(random)))
+	{
+		return "";
+	}
+	TrkCryptoHelper::HexEncode(random, sizeof(random), name);
+	name[sizeof(random) * 2] = '\0';
+
+	return (std::string(root.c_str()) + "/" TRK_OBJECT_TEMP_DIRECTORY "/" + name).c_str();
+}
+
+bool TrkObjectStore::FindPacked(const uint8_t* Digest, std::shared_ptr<const TrkPackFile>& Pack, TrkPackEntry& Entry) const
+{
+	std::shared_lock<std::shared_mutex> lock(pack_mutex);
+
+	// The newest pack is the most likely to hold a recent object
+	for (auto it = packs.rbegin(); it != packs.rend(); ++it)
+	{
+		if ((*it)->Find(Digest, Entry))
+		{
+			Pack = *it;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool TrkObjectStore::GetBaseDepth(const std::string& Base, const std::string& Digest, const DeltaLinks& Written, uint32_t& Depth) const
+{
+	std::string current = Base;
+	for (uint32_t step = 0; step <= TRK_OBJECT_MAX_DELTA_DEPTH + 1; step++)
+	{
+		if (current == Digest)
+		{
+			return false;
+		}
+
+		const auto link = Written.find(current);
+		if (link != Written.end())
+		{
+			Depth = step == 0 ? link->second.depth : Depth;
+			current = link->second.base;
+			continue;
+		}
+
+		uint8_t digest[TRK_PACK_DIGEST_SIZE];
+		std::shared_ptr<const TrkPackFile> pack;
+		TrkPackEntry entry;
+		if (!TrkPackFile::ParseDigest(current.c_str(), digest))
+		{
+			return false;
+		}
+		if (FindPacked(digest, pack, entry))
+		{
+			Depth = step == 0 ? entry.depth : Depth;
+			if (entry.codec != static_cast<uint32_t>(TrkPackCodec::DELTA))
+			{
+				return true;
+			}
+
+			uint8_t base[TRK_PACK_DIGEST_SIZE];
+			if (entry.length < sizeof(base) || pack->Read(entry.offset, base, sizeof(base)) != sizeof(base))
+			{
+				return false;
+			}
+			current = TrkPackFile::FormatDigest(base).c_str();
+			continue;
+		}
+
+		std::error_code error;
+		if (fs::is_regular_file(GetFilePath(GetObjectPath(current.c_str())), error))
+		{
+			Depth = step == 0 ? 0 : Depth;
+			return true;
+		}
+		return false;
+	}
+	return false;
+}
+
+bool TrkObjectStore::Load(const uint8_t* Digest, std::shared_ptr<const std::string>& Contents, uint32_t Depth) const
+{
+	const std::string key(reinterpret_cast<const char*>(Digest), TRK_PACK_DIGEST_SIZE);
+	{
+		std::lock_guard<std::mutex> lock(cache_mutex);
+		const auto cached = cache_index.find(key);
+		if (cached != cache_index.end())
+		{
+			cache.splice(cache.begin(), cache, cached->second);
+			Contents = cached->second->second;
+			cache_hits.Increment();
+			return true;
+		}
+	}
+	cache_misses.Increment();
+
+	// A corrupt store could chain deltas in a circle
+	if (Depth > TRK_OBJECT_MAX_DELTA_DEPTH * 2)
+	{
+		return false;
+	}
+
+	std::string data;
+	const fs::path path = GetFilePath(GetObjectPath(TrkPackFile::FormatDigest(Digest)));
+	std::FILE* file = OpenFile(path, "rb", L"rb");
+	if (file != nullptr)
+	{
+		char buffer[TRK_OBJECT_BUFFER_SIZE];
+		size_t read;
+		while ((read = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
+		{
+			data.append(buffer, read);
+		}
+		const bool failed = std::ferror(file) != 0;
+		std::fclose(file);
+		if (failed)
+		{
+			return false;
+		}
+	}
+	else
+	{
+		std::shared_ptr<const TrkPackFile> pack;
+		TrkPackEntry entry;
+		if (!FindPacked(Digest, pack, entry))
+		{
+			return false;
+		}
+
+		std::string stored(static_cast<size_t>(entry.length), '\0');
+		if (pack->Read(entry.offset, &stored[0], stored.size()) != stored.size())
+		{
+			return false;
+		}
+
+		if (entry.codec == static_cast<uint32_t>(TrkPackCodec::STORED))
+		{
+			data = std::move(stored);
+		}
+		else
+		{
+			std::shared_ptr<const std::string> base;
+			if (entry.codec != static_cast<uint32_t>(TrkPackCodec::DELTA) || stored.size() < TRK_PACK_DIGEST_SIZE
+				|| !Load(reinterpret_cast<const uint8_t*>(stored.data()), base, Depth + 1)
+				|| !TrkDelta::Apply(*base, std::string_view(stored).substr(TRK_PACK_DIGEST_SIZE), data)
+				|| data.size() != entry.size)
+			{
+				return false;
+			}
+		}
+	}
+
+	Contents = std::make_shared<const std::string>(std::move(data));
+
+	// An object larger than a quarter of the cache would push out everything else
+	std::lock_guard<std::mutex> lock(cache_mutex);
+	if (Contents->size() <= cache_capacity / 4 && cache_index.count(key) == 0)
+	{
+		cache.emplace_front(key, Contents);
+		cache_index.emplace(key, cache.begin());
+		cache_bytes += Contents->size();
+		while (cache_bytes > cache_capacity && !cache.empty())
+		{
+			cache_bytes -= cache.back().second->size();
+			cache_index.erase(cache.back().first);
+			cache.pop_back();
+		}
+	}
+	return true;
+}
+
+bool TrkObjectStore::ReadChunkList(const TrkString& Digest, uint64_t& Size, std::vector<TrkObjectChunk>* Chunks) const
+{
+	const fs::path path = GetFilePath(GetObjectPath(Digest)).concat(TRK_OBJECT_CHUNK_LIST_EXTENSION);
+	std::error_code error;
+	const uintmax_t file_size = fs::file_size(path, error);
+	std::FILE* file = error ? nullptr : OpenFile(path, "rb", L"rb");
+	if (file == nullptr)
+	{
+		return false;
+	}
+
+	TrkChunkListHeader header;
+	bool valid = std::fread(&header, sizeof(header), 1, file) == 1
+		&& std::memcmp(header.magic, TRK_OBJECT_CHUNK_LIST_MAGIC, sizeof(header.magic)) == 0
+		&& (file_size - sizeof(header)) % sizeof(TrkObjectChunk) == 0
+		&& (file_size - sizeof(header)) / sizeof(TrkObjectChunk) == header.count;
+
+	if (valid && Chunks != nullptr)
+	{
+		Chunks->resize(static_cast<size_t>(header.count));
+		valid = std::fread(Chunks->data(), sizeof(TrkObjectChunk), Chunks->size(), file) == Chunks->size();
+
+		uint64_t size = 0;
+		for (size_t i = 0; valid && i < Chunks->size(); i++)
+		{
+			size += (*Chunks)[i].size;
+		}
+		valid = valid && size == header.size;
+	}
+	std::fclose(file);
+
+	if (!valid)
+	{
+		if (Chunks != nullptr)
+		{
+			Chunks->clear();
+		}
+		return false;
+	}
+
+	Size = header.size;
+	return true;
+}
+
+bool TrkObjectStore::WriteChunkList(const TrkString& Digest, const std::vector<TrkObjectChunk>& Chunks, uint64_t Size)
+{
+	const TrkString temp_path = GetTempPath();
+	std::FILE* file = temp_path != "" ? OpenFile(GetFilePath(temp_path), "wb", L"wb") : nullptr;
+	if (file == nullptr)
+	{
+		return false;
+	}
+
+	TrkChunkListHeader header;
+	std::memcpy(header.magic, TRK_OBJECT_CHUNK_LIST_MAGIC, sizeof(header.magic));
+	header.size = Size;
+	header.count = Chunks.size();
+
+	const bool written = std::fwrite(&header, sizeof(header), 1, file) == 1
+		&& std::fwrite(Chunks.data(), sizeof(TrkObjectChunk), Chunks.size(), file) == Chunks.size()
+		&& SyncFile(file);
+	std::fclose(file);
+
+	std::error_code error;
+	const fs::path temp = GetFilePath(temp_path);
+	const fs::path path = GetFilePath(GetObjectPath(Digest)).concat(TRK_OBJECT_CHUNK_LIST_EXTENSION);
+	if (written)
+	{
+		fs::create_directories(path.parent_path(), error);
+		fs::rename(temp, path, error);
+	}
+	if (!written || error)
+	{
+		fs::remove(temp, error);
+		return false;
+	}
+
+	chunk_lists_written.Increment();
+	return true;
+}
+
+TrkString TrkObjectStore::GetObjectPath(const TrkString& Digest) const
+{
+	const std::string digest = Digest.c_str();
+	const std::string path = std::string(root.c_str()) + "/" + digest.substr(0, 2) + "/" + digest.substr(2, 2) + "/" + digest;
+	return path.c_str();
+}
@@ -0,0 +1,304 @@
+/*
+ *	objectstore.h
+ *
+ *	Tintirek's content-addressable object store
+ */
+
+#ifndef TRK_OBJECTSTORE_H
+#define TRK_OBJECTSTORE_H
+
+#include "crypto.h"
+#include "metrics.h"
+#include "packfile.h"
+#include "trkstring.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <istream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+/* Bytes read from or written to an object file at a time by the stream helpers */
+#define TRK_OBJECT_BUFFER_SIZE 65536
+
+/* Loose objects up to this size are rolled into packs by a repack */
+#define TRK_OBJECT_PACK_MAX_SIZE (1024 * 1024)
+
+/* Packs a store may have before a repack merges them into one */
+#define TRK_OBJECT_MAX_PACKS 16
+
+/* Deltas between an object and a stored copy, a repack stores the next revision whole */
+#define TRK_OBJECT_MAX_DELTA_DEPTH 10
+
+/* Default bytes of reconstructed objects kept in memory */
+#define TRK_OBJECT_CACHE_SIZE (64 * 1024 * 1024)
+
+/* Files from this size on are stored as lists of content-defined chunks */
+#define TRK_OBJECT_CHUNKED_MIN_SIZE (4 * 1024 * 1024)
+
+/* Largest object packed as a delta and largest base of one, both are held whole while a delta is encoded or applied */
+#define TRK_OBJECT_DELTA_MAX_SIZE (4 * 1024 * 1024)
+
+
+class TrkObjectStore;
+
+/* Chunk of an object stored as a chunk list */
+struct TrkObjectChunk
+{
+	uint8_t digest[TRK_PACK_DIGEST_SIZE];
+	uint64_t size;
+};
+
+/*
+ *	Object writer
+ *
+ *	Streams the contents of one object into a temporary file of the
+ *	store while hashing them. Commit() names the object by its digest:
+ *	the file is renamed into its fan-out directory, or dropped if the
+ *	store already holds the same contents. A writer that is destroyed
+ *	before Commit() removes its temporary file.
+ */
+class TrkObjectWriter
+{
+public:
+	TrkObjectWriter() = default;
+	~TrkObjectWriter();
+
+	/* Disables copy */
+	TrkObjectWriter(const TrkObjectWriter&) = delete;
+	TrkObjectWriter& operator=(const TrkObjectWriter&) = delete;
+
+	/* Appends the next piece of the contents, returns false if it could not be written */
+	bool Write(const void* Data, size_t Length);
+	/* Stores the object, returns false if it could not be stored or its digest is not the expected one */
+	bool Commit(TrkString& Digest, const TrkString& ExpectedDigest = "");
+	/* Drops the contents written so far */
+	void Abort();
+
+	/* Returns the number of bytes written */
+	uint64_t GetSize() const { return size; }
+
+private:
+	friend class TrkObjectStore;
+
+	TrkObjectStore* store = nullptr;
+	std::FILE* file = nullptr;
+	TrkString temp_path;
+	TrkSHA256Stream hash;
+	uint64_t size = 0;
+	bool failed = false;
+};
+
+/* Reads the contents of one object */
+class TrkObjectReader
+{
+public:
+	TrkObjectReader() = default;
+	~TrkObjectReader();
+
+	/* Disables copy */
+	TrkObjectReader(const TrkObjectReader&) = delete;
+	TrkObjectReader& operator=(const TrkObjectReader&) = delete;
+
+	/* Reads up to Length bytes, returns the number read, 0 at the end or on failure */
+	size_t Read(void* Buffer, size_t Length);
+	/* Closes the object */
+	void Close();
+
+	/* Returns true while an object is open */
+	bool IsOpen() const { return file != nullptr || pack != nullptr || contents != nullptr || list_store != nullptr; }
+	/* Returns the size of the object */
+	uint64_t GetSize() const { return size; }
+
+private:
+	friend class TrkObjectStore;
+
+	/* Loose object */
+	std::FILE* file = nullptr;
+	/* Packed object, the pack stays open while it is read */
+	std::shared_ptr<const TrkPackFile> pack;
+	/* Object reconstructed from deltas */
+	std::shared_ptr<const std::string> contents;
+	uint64_t offset = 0;
+	uint64_t remaining = 0;
+
+	/* Chunk list, its chunks are opened one after the other */
+	const TrkObjectStore* list_store = nullptr;
+	std::vector<TrkObjectChunk> chunks;
+	size_t next_chunk = 0;
+	std::unique_ptr<TrkObjectReader> chunk;
+
+	uint64_t size = 0;
+};
+
+
+/*
+ *	Object store
+ *
+ *	Keeps file contents under their SHA-256 digest, one file per
+ *	object in "<root>/ab/cd/abcd...", so no directory grows past a few
+ *	thousand entries. Identical contents are stored once no matter how
+ *	many revisions or branches refer to them. Objects are written to
+ *	"<root>/tmp" and renamed into place only when complete, so a
+ *	stored object is never partial; an object is never modified after
+ *	it is stored.
+ *
+ *	Contents pass through the store in pieces; only deltas, which are
+ *	limited to TRK_OBJECT_DELTA_MAX_SIZE, are encoded and read back
+ *	whole in memory.
+ *
+ *	A repack rolls small loose objects into a pack in "<root>/pack"
+ *	and removes their files, so a depot of many small revisions does
+ *	not use one inode per revision. Lookups try the loose object first
+ *	and the packs after it. Once there are too many packs, a repack
+ *	merges them all with the loose objects into a single pack.
+ *
+ *	An object with a delta base, usually the previous revision of the
+ *	same file, is packed as a TrkDelta against it whatever MaxObjectSize
+ *	is, if the delta is less than half of the object and neither the
+ *	object nor the base is larger than TRK_OBJECT_DELTA_MAX_SIZE. A chain of deltas is
+ *	at most TRK_OBJECT_MAX_DELTA_DEPTH long; the object after that is
+ *	stored whole and starts the next chain. Reconstructed objects are
+ *	kept in an LRU cache, so reading the revisions of a chain one after
+ *	the other applies each delta once.
+ *
+ *	A large file is stored as a list of chunks cut by TrkChunker, in
+ *	"<root>/ab/cd/abcd....chunks" next to where the whole object would
+ *	be. Its chunks are ordinary objects: a file edited in one place
+ *	shares all other chunks with its previous revision, and the small
+ *	chunks end up in packs. Clients upload the chunks the store lacks
+ *	one by one and then the list, which is only accepted once every
+ *	chunk is in place and their contents hash to the digest of the file.
+ */
+class TrkObjectStore
+{
+public:
+	TrkObjectStore() = default;
+
+	/* Disables copy */
+	TrkObjectStore(const TrkObjectStore&) = delete;
+	TrkObjectStore& operator=(const TrkObjectStore&) = delete;
+
+	/* Opens or creates a store in given directory and removes the temporary files left by an earlier run */
+	bool Open(const TrkString& Root);
+	/* Returns the root directory */
+	const TrkString& GetRoot() const { return root; }
+
+	/* Starts writing a new object, returns false if its temporary file could not be created */
+	bool BeginWrite(TrkObjectWriter& Writer);
+	/* Stores the contents of a stream, returns false if they could not be stored */
+	bool Put(std::istream& Input, TrkString& Digest);
+	/* Stores the contents of a file, as a chunk list from TRK_OBJECT_CHUNKED_MIN_SIZE on, returns false if it could not be read or stored */
+	bool PutFile(const TrkString& Path, TrkString& Digest);
+	/* Stores the contents of a stream as a chunk list, returns false if they could not be stored */
+	bool PutChunked(std::istream& Input, TrkString& Digest);
+	/* Stores a list of stored chunks, returns false if one is missing or their contents are not the expected object */
+	bool PutChunkList(const std::vector<TrkString>& Chunks, const TrkString& ExpectedDigest);
+
+	/* Opens an object for reading, returns false if it is not in the store */
+	bool Open(const TrkString& Digest, TrkObjectReader& Reader) const;
+	/* Returns true if the object is in the store */
+	bool Contains(const TrkString& Digest) const;
+	/* Finds the size of an object, returns false if it is not in the store */
+	bool GetSize(const TrkString& Digest, uint64_t& Size) const;
+	/* Removes a loose object or chunk list, returns false if it was not loose in the store, packed objects stay; deltas and lists using it are not checked */
+	bool Remove(const TrkString& Digest);
+
+	/* Sets the object the next repack stores given object as a delta against */
+	void SetDeltaBase(const TrkString& Digest, const TrkString& BaseDigest);
+	/* Sets the bytes of reconstructed objects kept in memory */
+	void SetCacheSize(size_t Bytes);
+
+	/* Rolls the loose objects up to MaxObjectSize into a new pack, merging every pack once there are MaxPacks */
+	bool Repack(uint64_t MaxObjectSize = TRK_OBJECT_PACK_MAX_SIZE, size_t MaxPacks = TRK_OBJECT_MAX_PACKS);
+	/* Returns the number of packs */
+	size_t GetPackCount() const;
+
+	/* Returns true if given string is a digest of the store, 64 lowercase hex digits */
+	static bool IsValidDigest(const TrkString& Digest);
+
+	/* Objects stored */
+	TrkCounter objects_written;
+	/* Objects not stored because the store held the same contents */
+	TrkCounter objects_deduplicated;
+	/* Bytes of stored objects */
+	TrkCounter bytes_written;
+	/* Bytes not stored because the store held the same contents */
+	TrkCounter bytes_deduplicated;
+	/* Repacks that wrote a pack */
+	TrkCounter repacks;
+	/* Loose objects rolled into packs */
+	TrkCounter objects_packed;
+	/* Time of each repack that wrote a pack, in microseconds */
+	TrkHistogram repack_time;
+	/* Objects packed as deltas */
+	TrkCounter objects_deltified;
+	/* Bytes deltas saved against storing their objects whole */
+	TrkCounter delta_bytes_saved;
+	/* Objects stored as chunk lists */
+	TrkCounter chunk_lists_written;
+	/* Reconstructed objects found in the cache */
+	mutable TrkCounter cache_hits;
+	/* Objects read and reconstructed for the cache */
+	mutable TrkCounter cache_misses;
+
+private:
+	friend class TrkObjectWriter;
+	friend class TrkObjectReader;
+
+	/* Returns the path of an object */
+	TrkString GetObjectPath(const TrkString& Digest) const;
+	/* Opens a loose or packed object, not a chunk list */
+	bool OpenStored(const TrkString& Digest, TrkObjectReader& Reader) const;
+	/* Reads the chunk list of an object, returns false if it has none or it is malformed */
+	bool ReadChunkList(const TrkString& Digest, uint64_t& Size, std::vector<TrkObjectChunk>* Chunks) const;
+	/* Writes the chunk list of an object */
+	bool WriteChunkList(const TrkString& Digest, const std::vector<TrkObjectChunk>& Chunks, uint64_t Size);
+	/* Returns a new path in the temporary directory, empty on failure */
+	TrkString GetTempPath() const;
+	/* Finds the pack holding an object */
+	bool FindPacked(const uint8_t* Digest, std::shared_ptr<const TrkPackFile>& Pack, TrkPackEntry& Entry) const;
+
+	/* Delta written by a repack before its pack is in place */
+	struct DeltaLink
+	{
+		std::string base;
+		uint32_t depth;
+	};
+	using DeltaLinks = std::unordered_map<std::string, DeltaLink>;
+
+	/* Finds the delta depth of a base, returns false if it is missing or Digest is in its chain */
+	bool GetBaseDepth(const std::string& Base, const std::string& Digest, const DeltaLinks& Written, uint32_t& Depth) const;
+	/* Reads a whole object through the cache, applying its deltas */
+	bool Load(const uint8_t* Digest, std::shared_ptr<const std::string>& Contents, uint32_t Depth = 0) const;
+
+	TrkString root;
+
+	/* Guards the packs, a repack replaces them while readers look up */
+	mutable std::shared_mutex pack_mutex;
+	std::vector<std::shared_ptr<const TrkPackFile>> packs;
+
+	/* Serializes repacks */
+	std::mutex repack_mutex;
+
+	/* Delta bases for the next repack, by digest */
+	std::mutex delta_mutex;
+	std::unordered_map<std::string, std::string> delta_bases;
+
+	/* Reconstructed objects, the most recently used first */
+	using CacheList = std::list<std::pair<std::string, std::shared_ptr<const std::string>>>;
+	mutable std::mutex cache_mutex;
+	mutable CacheList cache;
+	mutable std::unordered_map<std::string, CacheList::iterator> cache_index;
+	mutable size_t cache_bytes = 0;
+	size_t cache_capacity = TRK_OBJECT_CACHE_SIZE;
+};
+
+
+#endif /* TRK_OBJECTSTORE_H */
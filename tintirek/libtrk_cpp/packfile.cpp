@@ -0,0 +1,482 @@
+/*
+ *	packfile.cpp
+ *
+ *	Tintirek's pack files of small objects
+ */
+
+
+#include "packfile.h"
+#include "crypto.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <system_error>
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+
+/* Returns the filesystem path of a UTF-8 path */
+static fs::path GetFilePath(const std::string& Path)
+{
+#ifdef _WIN32
+	return fs::u8path(Path);
+#else
+	return fs::path(Path);
+#endif
+}
+
+/* Creates a file for writing */
+static std::FILE* CreateOutputFile(const std::string& Path)
+{
+#ifdef _WIN32
+	return _wfopen(GetFilePath(Path).wstring().c_str(), L"wb");
+#else
+	return std::fopen(Path.c_str(), "wb");
+#endif
+}
+
+/* Flushes a file to disk and closes it, returns false if anything failed */
+static bool SyncAndClose(std::FILE* File)
+{
+	bool synced = std::fflush(File) == 0;
+#ifdef _WIN32
+	synced = synced && _commit(_fileno(File)) == 0;
+#else
+	synced = synced && fsync(fileno(File)) == 0;
+#endif
+	return std::fclose(File) == 0 && synced;
+}
+
+/* Orders entries by digest */
+static bool CompareEntries(const TrkPackEntry& First, const TrkPackEntry& Second)
+{
+	return std::memcmp(First.digest, Second.digest, TRK_PACK_DIGEST_SIZE) < 0;
+}
+
+
+TrkPackWriter::~TrkPackWriter()
+{
+	Abort();
+}
+
+bool TrkPackWriter::Open(const TrkString& TempPath)
+{
+	Abort();
+
+	file = CreateOutputFile(TempPath.c_str());
+	if (file == nullptr)
+	{
+		return false;
+	}
+	temp_path = TempPath;
+
+	// The object count is filled in by Finish()
+	TrkPackHeader header;
+	std::memset(&header, 0, sizeof(header));
+	failed = std::fwrite(&header, sizeof(header), 1, file) != 1;
+	offset = sizeof(header);
+	return !failed;
+}
+
+bool TrkPackWriter::BeginObject(const uint8_t* Digest, uint64_t Size, TrkPackCodec Codec, uint32_t Depth)
+{
+	if (file == nullptr || failed || in_object)
+	{
+		return false;
+	}
+
+	std::memset(&current, 0, sizeof(current));
+	std::memcpy(current.digest, Digest, TRK_PACK_DIGEST_SIZE);
+	current.offset = offset;
+	current.size = Size;
+	current.codec = static_cast<uint32_t>(Codec);
+	current.depth = Depth;
+	in_object = true;
+	return true;
+}
+
+bool TrkPackWriter::Write(const void* Data, size_t Length)
+{
+	if (!in_object || failed)
+	{
+		return false;
+	}
+	if (Length > 0 && std::fwrite(Data, 1, Length, file) != Length)
+	{
+		failed = true;
+		return false;
+	}
+
+	offset += Length;
+	return true;
+}
+
+bool TrkPackWriter::EndObject()
+{
+	if (!in_object || failed)
+	{
+		return false;
+	}
+
+	current.length = offset - current.offset;
+	entries.push_back(current);
+	in_object = false;
+	return true;
+}
+
+bool TrkPackWriter::Finish(const TrkString& Directory, TrkString& Path)
+{
+	if (file == nullptr || failed || in_object || entries.empty())
+	{
+		Abort();
+		return false;
+	}
+
+	// A digest added twice keeps its first copy, the other bytes stay unreferenced
+	std::stable_sort(entries.begin(), entries.end(), CompareEntries);
+	entries.erase(std::unique(entries.begin(), entries.end(), [](const TrkPackEntry& First, const TrkPackEntry& Second)
+	{
+		return std::memcmp(First.digest, Second.digest, TRK_PACK_DIGEST_SIZE) == 0;
+	}), entries.end());
+
+	TrkPackHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, TRK_PACK_MAGIC, sizeof(header.magic));
+	header.version = TRK_PACK_VERSION;
+	header.object_count = entries.size();
+
+	const bool written = std::fseek(file, 0, SEEK_SET) == 0 && std::fwrite(&header, sizeof(header), 1, file) == 1;
+	const bool closed = SyncAndClose(file);
+	file = nullptr;
+	if (!written || !closed)
+	{
+		Abort();
+		return false;
+	}
+
+	TrkSHA256Stream hash;
+	for (const TrkPackEntry& entry : entries)
+	{
+		hash.Update(entry.digest, TRK_PACK_DIGEST_SIZE);
+	}
+	const TrkString name = hash.Final();
+	if (name == "")
+	{
+		Abort();
+		return false;
+	}
+
+	const std::string path = std::string(Directory.c_str()) + "/pack-" + name.c_str();
+
+	std::error_code error;
+	if (fs::exists(GetFilePath(path + ".idx"), error))
+	{
+		// The same objects are packed already, that pack stays as it is
+		Abort();
+		Path = path.c_str();
+		return true;
+	}
+
+	fs::rename(GetFilePath(temp_path.c_str()), GetFilePath(path + ".pack"), error);
+	if (error)
+	{
+		Abort();
+		return false;
+	}
+	temp_path = "";
+
+	TrkPackIndexHeader index_header;
+	std::memset(&index_header, 0, sizeof(index_header));
+	std::memcpy(index_header.magic, TRK_PACK_INDEX_MAGIC, sizeof(index_header.magic));
+	index_header.version = TRK_PACK_VERSION;
+	index_header.object_count = entries.size();
+
+	uint32_t fanout[TRK_PACK_FANOUT_SIZE] = { 0 };
+	for (const TrkPackEntry& entry : entries)
+	{
+		fanout[entry.digest[0]]++;
+	}
+	for (size_t i = 1; i < TRK_PACK_FANOUT_SIZE; i++)
+	{
+		fanout[i] += fanout[i - 1];
+	}
+
+	const std::string partial = path + ".idx.tmp";
+	std::FILE* index = CreateOutputFile(partial);
+	bool index_written = index != nullptr
+		&& std::fwrite(&index_header, sizeof(index_header), 1, index) == 1
+		&& std::fwrite(fanout, sizeof(fanout), 1, index) == 1
+		&& std::fwrite(entries.data(), sizeof(TrkPackEntry), entries.size(), index) == entries.size();
+	if (index != nullptr)
+	{
+		index_written = SyncAndClose(index) && index_written;
+	}
+	if (index_written)
+	{
+		fs::rename(GetFilePath(partial), GetFilePath(path + ".idx"), error);
+	}
+
+	if (!index_written || error)
+	{
+		fs::remove(GetFilePath(partial), error);
+		fs::remove(GetFilePath(path + ".pack"), error);
+		Abort();
+		return false;
+	}
+
+	entries.clear();
+	Path = path.c_str();
+	return true;
+}
+
+void TrkPackWriter::Abort()
+{
+	if (file != nullptr)
+	{
+		std::fclose(file);
+		file = nullptr;
+	}
+	if (temp_path != "")
+	{
+		std::error_code error;
+		fs::remove(GetFilePath(temp_path.c_str()), error);
+		temp_path = "";
+	}
+	entries.clear();
+	offset = 0;
+	in_object = false;
+	failed = false;
+}
+
+
+TrkPackFile::~TrkPackFile()
+{
+	Close();
+}
+
+bool TrkPackFile::Open(const TrkString& Path)
+{
+	Close();
+
+	const std::string pack_path = std::string(Path.c_str()) + ".pack";
+	const std::string index_path = std::string(Path.c_str()) + ".idx";
+	if (!index.Open(index_path.c_str()) || index.GetSize() < sizeof(TrkPackIndexHeader) + TRK_PACK_FANOUT_SIZE * sizeof(uint32_t))
+	{
+		Close();
+		return false;
+	}
+
+	TrkPackIndexHeader header;
+	std::memcpy(&header, index.GetData(), sizeof(header));
+	fanout = reinterpret_cast<const uint32_t*>(index.GetData() + sizeof(header));
+	entries = reinterpret_cast<const TrkPackEntry*>(index.GetData() + sizeof(header) + TRK_PACK_FANOUT_SIZE * sizeof(uint32_t));
+	count = header.object_count;
+
+	const uint64_t entries_size = index.GetSize() - sizeof(header) - TRK_PACK_FANOUT_SIZE * sizeof(uint32_t);
+	bool valid = std::memcmp(header.magic, TRK_PACK_INDEX_MAGIC, sizeof(header.magic)) == 0
+		&& header.version == TRK_PACK_VERSION
+		&& entries_size % sizeof(TrkPackEntry) == 0
+		&& count == entries_size / sizeof(TrkPackEntry)
+		&& fanout[TRK_PACK_FANOUT_SIZE - 1] == count;
+
+	for (size_t i = 1; valid && i < TRK_PACK_FANOUT_SIZE; i++)
+	{
+		valid = fanout[i - 1] <= fanout[i];
+	}
+	if (!valid)
+	{
+		Close();
+		return false;
+	}
+
+	uint64_t pack_size = 0;
+#ifdef _WIN32
+	const std::wstring wide_path = fs::u8path(pack_path).wstring();
+	handle = CreateFileW(wide_path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		handle = nullptr;
+		Close();
+		return false;
+	}
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(handle, &file_size))
+	{
+		Close();
+		return false;
+	}
+	pack_size = static_cast<uint64_t>(file_size.QuadPart);
+#else
+	file_descriptor = open(pack_path.c_str(), O_RDONLY | O_CLOEXEC);
+	struct stat info;
+	if (file_descriptor < 0 || fstat(file_descriptor, &info) != 0)
+	{
+		Close();
+		return false;
+	}
+	pack_size = static_cast<uint64_t>(info.st_size);
+#endif
+
+	// Every entry is checked once here, lookups trust the index after that
+	for (uint64_t i = 0; valid && i < count; i++)
+	{
+		const TrkPackEntry& entry = entries[i];
+		valid = entry.offset >= sizeof(TrkPackHeader)
+			&& entry.offset <= pack_size
+			&& entry.length <= pack_size - entry.offset
+			&& (i == 0 || CompareEntries(entries[i - 1], entry))
+			&& fanout[entry.digest[0]] > i
+			&& (entry.digest[0] == 0 || fanout[entry.digest[0] - 1] <= i);
+	}
+	if (!valid)
+	{
+		Close();
+		return false;
+	}
+
+	path = Path;
+	return true;
+}
+
+void TrkPackFile::Close()
+{
+	index.Close();
+	fanout = nullptr;
+	entries = nullptr;
+	count = 0;
+	path = "";
+
+#ifdef _WIN32
+	if (handle != nullptr)
+	{
+		CloseHandle(handle);
+		handle = nullptr;
+	}
+#else
+	if (file_descriptor >= 0)
+	{
+		close(file_descriptor);
+		file_descriptor = -1;
+	}
+#endif
+}
+
+bool TrkPackFile::Find(const uint8_t* Digest, TrkPackEntry& Entry) const
+{
+	if (entries == nullptr)
+	{
+		return false;
+	}
+
+	uint64_t low = Digest[0] == 0 ? 0 : fanout[Digest[0] - 1];
+	uint64_t high = fanout[Digest[0]];
+	while (low < high)
+	{
+		const uint64_t middle = low + (high - low) / 2;
+		const int order = std::memcmp(entries[middle].digest, Digest, TRK_PACK_DIGEST_SIZE);
+		if (order == 0)
+		{
+			Entry = entries[middle];
+			return true;
+		}
+		if (order < 0)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+	return false;
+}
+
+size_t TrkPackFile::Read(uint64_t Offset, void* Buffer, size_t Length) const
+{
+	size_t total = 0;
+	while (total < Length)
+	{
+#ifdef _WIN32
+		if (handle == nullptr)
+		{
+			break;
+		}
+
+		OVERLAPPED overlapped;
+		std::memset(&overlapped, 0, sizeof(overlapped));
+		overlapped.Offset = static_cast<DWORD>(Offset & 0xFFFFFFFFu);
+		overlapped.OffsetHigh = static_cast<DWORD>(Offset >> 32);
+
+		const DWORD chunk = static_cast<DWORD>(std::min<size_t>(Length - total, 0x40000000u));
+		DWORD read = 0;
+		if (!ReadFile(handle, static_cast<char*>(Buffer) + total, chunk, &read, &overlapped) || read == 0)
+		{
+			break;
+		}
+#else
+		if (file_descriptor < 0)
+		{
+			break;
+		}
+
+		const ssize_t read = pread(file_descriptor, static_cast<char*>(Buffer) + total, Length - total, static_cast<off_t>(Offset));
+		if (read <= 0)
+		{
+			break;
+		}
+#endif
+		total += static_cast<size_t>(read);
+		Offset += static_cast<uint64_t>(read);
+	}
+	return total;
+}
+
+bool TrkPackFile::ParseDigest(const TrkString& Hex, uint8_t* Digest)
+{
+	if (Hex.size() != TRK_PACK_DIGEST_SIZE * 2)
+	{
+		return false;
+	}
+
+	const char* digits = Hex.c_str();
+	for (size_t i = 0; i < TRK_PACK_DIGEST_SIZE * 2; i++)
+	{
+		const char digit = digits[i];
+		uint8_t value;
+		if (digit >= '0' && digit <= '9')
+		{
+			value = static_cast<uint8_t>(digit - '0');
+		}
+		else if (digit >= 'a' && digit <= 'f')
+		{
+			value = static_cast<uint8_t>(digit - 'a' + 10);
+		}
+		else
+		{
+			return false;
+		}
+
+		Digest[i / 2] = static_cast<uint8_t>(i % 2 == 0 ? value << 4 : Digest[i / 2] | value);
+	}
+	return true;
+}
+
+TrkString TrkPackFile::FormatDigest(const uint8_t* Digest)
+{
+	char hex[TRK_PACK_DIGEST_SIZE * 2 + 1];
+	TrkCryptoHelper::HexEncode(Digest, TRK_PACK_DIGEST_SIZE, hex);
+	hex[TRK_PACK_DIGEST_SIZE * 2] = '\0';
+	return TrkString(hex);
+}
@@ -0,0 +1,172 @@
+/*
+ *	packfile.h
+ *
+ *	Tintirek's pack files of small objects
+ */
+
+#ifndef TRK_PACKFILE_H
+#define TRK_PACKFILE_H
+
+#include "mappedfile.h"
+#include "trkstring.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+
+/* Magic bytes at the start of a pack and of its index */
+#define TRK_PACK_MAGIC "TRKPACK1"
+#define TRK_PACK_INDEX_MAGIC "TRKIDX01"
+
+/* Layout version of packs and their indexes */
+#define TRK_PACK_VERSION 1
+
+/* Bytes of a digest in a pack index */
+#define TRK_PACK_DIGEST_SIZE 32
+
+/* Entries of the fanout table, one per first byte of a digest */
+#define TRK_PACK_FANOUT_SIZE 256
+
+
+/* How the bytes of an object are kept in a pack */
+enum class TrkPackCodec : uint32_t
+{
+	STORED = 0,		// As they are
+	DELTA = 1,		// Digest of the base object followed by a TrkDelta against it
+};
+
+/* Header of a pack file, followed by the bytes of its objects */
+struct TrkPackHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t object_count;
+};
+
+/* Header of a pack index, followed by the fanout table and the entries */
+struct TrkPackIndexHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t object_count;
+};
+
+/* Object of a pack index, entries are sorted by digest */
+struct TrkPackEntry
+{
+	uint8_t digest[TRK_PACK_DIGEST_SIZE];
+	uint64_t offset;	// In the pack file
+	uint64_t length;	// Bytes kept in the pack
+	uint64_t size;		// Bytes of the object
+	uint32_t codec;
+	uint32_t depth;		// Deltas between the object and a stored base, 0 when stored
+};
+
+
+/*
+ *	Pack writer
+ *
+ *	Appends objects to a temporary pack file one after the other.
+ *	Finish() names the pack by the SHA-256 of its sorted digests,
+ *	renames it into the pack directory and then writes its index;
+ *	a pack without an index is never read, so a crash in between
+ *	leaves nothing half-visible.
+ */
+class TrkPackWriter
+{
+public:
+	TrkPackWriter() = default;
+	~TrkPackWriter();
+
+	/* Disables copy */
+	TrkPackWriter(const TrkPackWriter&) = delete;
+	TrkPackWriter& operator=(const TrkPackWriter&) = delete;
+
+	/* Starts a pack in given temporary file, returns false if it could not be created */
+	bool Open(const TrkString& TempPath);
+	/* Starts the next object, Size is the size of the object once its bytes are decoded */
+	bool BeginObject(const uint8_t* Digest, uint64_t Size, TrkPackCodec Codec = TrkPackCodec::STORED, uint32_t Depth = 0);
+	/* Appends bytes of the current object */
+	bool Write(const void* Data, size_t Length);
+	/* Ends the current object */
+	bool EndObject();
+	/* Moves the pack into given directory with its index, Path is its path without extension */
+	bool Finish(const TrkString& Directory, TrkString& Path);
+	/* Drops the pack */
+	void Abort();
+
+	/* Returns the number of objects ended */
+	size_t GetCount() const { return entries.size(); }
+
+private:
+	std::FILE* file = nullptr;
+	TrkString temp_path;
+	std::vector<TrkPackEntry> entries;
+	TrkPackEntry current;
+	uint64_t offset = 0;
+	bool in_object = false;
+	bool failed = false;
+};
+
+
+/*
+ *	Pack file
+ *
+ *	A pack's index is memory-mapped: a fanout table gives the range
+ *	of entries starting with each first byte of a digest, so a lookup
+ *	is one binary search within that range. Object bytes are read
+ *	from the pack with positioned reads that share one descriptor
+ *	between threads. Both files are opened so they can be removed
+ *	while a reader still uses them.
+ */
+class TrkPackFile
+{
+public:
+	TrkPackFile() = default;
+	~TrkPackFile();
+
+	/* Disables copy */
+	TrkPackFile(const TrkPackFile&) = delete;
+	TrkPackFile& operator=(const TrkPackFile&) = delete;
+
+	/* Opens a pack by its path without extension, returns false if it or its index is missing or malformed */
+	bool Open(const TrkString& Path);
+	/* Closes the pack */
+	void Close();
+
+	/* Finds the entry of a digest, returns false if the pack does not hold it */
+	bool Find(const uint8_t* Digest, TrkPackEntry& Entry) const;
+	/* Reads pack bytes at given offset, returns the number read */
+	size_t Read(uint64_t Offset, void* Buffer, size_t Length) const;
+
+	/* Returns the path without extension */
+	const TrkString& GetPath() const { return path; }
+	/* Returns the number of objects */
+	uint64_t GetCount() const { return count; }
+	/* Returns an entry by its position in digest order */
+	const TrkPackEntry& GetEntry(uint64_t Index) const { return entries[Index]; }
+
+	/* Decodes 64 hex digits into a digest, returns false if they are not a digest */
+	static bool ParseDigest(const TrkString& Hex, uint8_t* Digest);
+	/* Returns the 64 hex digits of a digest */
+	static TrkString FormatDigest(const uint8_t* Digest);
+
+private:
+	TrkString path;
+	TrkMappedFile index;
+	const uint32_t* fanout = nullptr;
+	const TrkPackEntry* entries = nullptr;
+	uint64_t count = 0;
+
+#ifdef _WIN32
+	void* handle = nullptr;
+#else
+	int file_descriptor = -1;
+#endif
+};
+
+
+#endif /* TRK_PACKFILE_H */
@@ -0,0 +1,406 @@
+/*
+ *	sortedtable.cpp
+ *
+ *	Tintirek's immutable sorted table files
+ */
+
+
+#include "sortedtable.h"
+
+#include <cstring>
+#include <filesystem>
+#include <system_error>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+
+/* Appends an unsigned LEB128 number */
+static void AppendVarint(std::string& Output, uint64_t Value)
+{
+	while (Value >= 0x80)
+	{
+		Output.push_back(static_cast<char>((Value & 0x7F) | 0x80));
+		Value >>= 7;
+	}
+	Output.push_back(static_cast<char>(Value));
+}
+
+/* Reads an unsigned LEB128 number, returns null if it runs past the end */
+static const uint8_t* ReadVarint(const uint8_t* Position, const uint8_t* End, uint64_t& Value)
+{
+	Value = 0;
+	for (int shift = 0; Position < End && shift < 64; shift += 7)
+	{
+		const uint8_t byte = *Position++;
+		Value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0)
+		{
+			return Position;
+		}
+	}
+	return nullptr;
+}
+
+/* Returns the path a writer uses next to its table */
+static std::filesystem::path GetPartialPath(const TrkString& Path, const char* Suffix)
+{
+	return std::filesystem::path(std::string(Path.c_str()) + Suffix);
+}
+
+/* Opens a file with a fopen mode */
+static std::FILE* OpenFile(const std::filesystem::path& Path, const char* Mode, const wchar_t* WideMode)
+{
+#ifdef _WIN32
+	(void)Mode;
+	return _wfopen(Path.wstring().c_str(), WideMode);
+#else
+	(void)WideMode;
+	return std::fopen(Path.string().c_str(), Mode);
+#endif
+}
+
+/* Flushes a file to disk, returns false if it could not be synced */
+static bool SyncFile(std::FILE* File)
+{
+	if (std::fflush(File) != 0)
+	{
+		return false;
+	}
+#ifdef _WIN32
+	return _commit(_fileno(File)) == 0;
+#else
+	return fsync(fileno(File)) == 0;
+#endif
+}
+
+/* Returns the padding that aligns an offset to eight bytes */
+static size_t GetPadding(size_t Offset)
+{
+	return (8 - Offset % 8) % 8;
+}
+
+
+TrkSortedTableWriter::TrkSortedTableWriter(const TrkString& Path, size_t ValueSize, uint32_t BlockKeys)
+	: path(Path)
+	, value_size(ValueSize)
+	, block_keys(BlockKeys > 0 ? BlockKeys : 1)
+{
+	table_file = OpenFile(GetPartialPath(path, ".tmp"), "wb", L"wb");
+	keys_file = OpenFile(GetPartialPath(path, ".keys.tmp"), "w+b", L"w+b");
+
+	// The header is written last, once the sizes are known
+	TrkSortedTableHeader header;
+	std::memset(&header, 0, sizeof(header));
+	failed = table_file == nullptr || keys_file == nullptr || std::fwrite(&header, sizeof(header), 1, table_file) != 1;
+}
+
+TrkSortedTableWriter::~TrkSortedTableWriter()
+{
+	Abort();
+}
+
+bool TrkSortedTableWriter::Add(std::string_view Key, const void* Value)
+{
+	if (failed || (record_count > 0 && Key <= std::string_view(last_key)))
+	{
+		return false;
+	}
+
+	// Every block starts with a whole key, the others share a prefix with the key before them
+	size_t shared = 0;
+	if (record_count % block_keys == 0)
+	{
+		block_offsets.push_back(keys_size);
+	}
+	else
+	{
+		const size_t limit = Key.size() < last_key.size() ? Key.size() : last_key.size();
+		while (shared < limit && Key[shared] == last_key[shared])
+		{
+			shared++;
+		}
+	}
+
+	const size_t length = keys.size();
+	AppendVarint(keys, shared);
+	AppendVarint(keys, Key.size() - shared);
+	keys.append(Key.data() + shared, Key.size() - shared);
+	keys_size += keys.size() - length;
+	values.append(static_cast<const char*>(Value), value_size);
+
+	last_key.assign(Key.data(), Key.size());
+	record_count++;
+
+	if (keys.size() >= TRK_SORTED_TABLE_WRITE_BUFFER || values.size() >= TRK_SORTED_TABLE_WRITE_BUFFER)
+	{
+		failed = !FlushBuffers();
+	}
+	return !failed;
+}
+
+bool TrkSortedTableWriter::Commit()
+{
+	if (failed || !FlushBuffers())
+	{
+		Abort();
+		return false;
+	}
+
+	TrkSortedTableHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, TRK_SORTED_TABLE_MAGIC, sizeof(header.magic));
+	header.version = TRK_SORTED_TABLE_VERSION;
+	header.value_size = static_cast<uint32_t>(value_size);
+	header.block_keys = block_keys;
+	header.record_count = record_count;
+	header.block_count = block_offsets.size();
+	header.values_offset = sizeof(header);
+	header.keys_offset = header.values_offset + record_count * value_size;
+	header.keys_size = keys_size;
+	header.index_offset = header.keys_offset + keys_size + GetPadding(header.keys_offset + keys_size);
+
+	// Keys follow the values, then the index aligned to eight bytes
+	bool written = std::fflush(keys_file) == 0 && std::fseek(keys_file, 0, SEEK_SET) == 0;
+	char buffer[64 * 1024];
+	size_t read;
+	while (written && (read = std::fread(buffer, 1, sizeof(buffer), keys_file)) > 0)
+	{
+		written = std::fwrite(buffer, 1, read, table_file) == read;
+	}
+
+	const char padding[8] = { 0 };
+	const size_t padding_size = static_cast<size_t>(header.index_offset - header.keys_offset - keys_size);
+	written = written && !std::ferror(keys_file)
+		&& (padding_size == 0 || std::fwrite(padding, 1, padding_size, table_file) == padding_size)
+		&& (block_offsets.empty() || std::fwrite(block_offsets.data(), sizeof(uint64_t), block_offsets.size(), table_file) == block_offsets.size())
+		&& std::fseek(table_file, 0, SEEK_SET) == 0
+		&& std::fwrite(&header, sizeof(header), 1, table_file) == 1
+		&& SyncFile(table_file);
+
+	written = std::fclose(table_file) == 0 && written;
+	table_file = nullptr;
+	std::fclose(keys_file);
+	keys_file = nullptr;
+	failed = true;
+
+	std::error_code error;
+	std::filesystem::remove(GetPartialPath(path, ".keys.tmp"), error);
+	error.clear();
+	if (written)
+	{
+		std::filesystem::rename(GetPartialPath(path, ".tmp"), std::filesystem::path(path.c_str()), error);
+	}
+	if (!written || error)
+	{
+		std::filesystem::remove(GetPartialPath(path, ".tmp"), error);
+		return false;
+	}
+	return true;
+}
+
+void TrkSortedTableWriter::Abort()
+{
+	std::error_code error;
+	if (table_file != nullptr)
+	{
+		std::fclose(table_file);
+		table_file = nullptr;
+		std::filesystem::remove(GetPartialPath(path, ".tmp"), error);
+	}
+	if (keys_file != nullptr)
+	{
+		std::fclose(keys_file);
+		keys_file = nullptr;
+		std::filesystem::remove(GetPartialPath(path, ".keys.tmp"), error);
+	}
+	failed = true;
+}
+
+bool TrkSortedTableWriter::FlushBuffers()
+{
+	if ((!values.empty() && std::fwrite(values.data(), 1, values.size(), table_file) != values.size())
+		|| (!keys.empty() && std::fwrite(keys.data(), 1, keys.size(), keys_file) != keys.size()))
+	{
+		return false;
+	}
+	values.clear();
+	keys.clear();
+	return true;
+}
+
+
+void TrkSortedTable::Iterator::Next()
+{
+	if (!Valid())
+	{
+		return;
+	}
+
+	if (++record < table->record_count)
+	{
+		Decode();
+	}
+}
+
+void TrkSortedTable::Iterator::Decode()
+{
+	uint64_t shared, length;
+	const uint8_t* next = ReadVarint(position, table->keys_end, shared);
+	if (next != nullptr)
+	{
+		next = ReadVarint(next, table->keys_end, length);
+	}
+
+	if (next == nullptr || shared > key.size() || length > static_cast<uint64_t>(table->keys_end - next))
+	{
+		// Malformed key, the iterator ends here
+		record = table->record_count;
+		return;
+	}
+
+	key.resize(shared);
+	key.append(reinterpret_cast<const char*>(next), length);
+	position = next + length;
+}
+
+bool TrkSortedTable::Open(const TrkString& Path)
+{
+	Close();
+	if (!file.Open(Path) || file.GetSize() < sizeof(TrkSortedTableHeader))
+	{
+		file.Close();
+		return false;
+	}
+
+	TrkSortedTableHeader header;
+	std::memcpy(&header, file.GetData(), sizeof(header));
+
+	const uint64_t size = file.GetSize();
+	const bool valid = std::memcmp(header.magic, TRK_SORTED_TABLE_MAGIC, sizeof(header.magic)) == 0
+		&& header.version == TRK_SORTED_TABLE_VERSION
+		&& header.block_keys > 0
+		&& header.block_count == (header.record_count + header.block_keys - 1) / header.block_keys
+		&& header.values_offset == sizeof(header)
+		&& header.value_size > 0
+		&& header.record_count <= (size - header.values_offset) / header.value_size
+		&& header.keys_offset == header.values_offset + header.record_count * header.value_size
+		&& header.keys_size <= size - header.keys_offset
+		&& header.index_offset >= header.keys_offset + header.keys_size
+		&& header.index_offset <= size
+		&& header.block_count <= (size - header.index_offset) / sizeof(uint64_t);
+
+	if (!valid)
+	{
+		file.Close();
+		return false;
+	}
+
+	record_count = header.record_count;
+	block_count = header.block_count;
+	value_size = header.value_size;
+	block_keys = header.block_keys;
+	values = file.GetData() + header.values_offset;
+	keys = file.GetData() + header.keys_offset;
+	keys_end = keys + header.keys_size;
+	index = file.GetData() + header.index_offset;
+	return true;
+}
+
+void TrkSortedTable::Close()
+{
+	file.Close();
+	record_count = 0;
+	block_count = 0;
+	values = nullptr;
+	keys = nullptr;
+	keys_end = nullptr;
+	index = nullptr;
+}
+
+const void* TrkSortedTable::Find(std::string_view Key) const
+{
+	const Iterator it = Seek(Key);
+	return it.Valid() && it.Key() == Key ? it.Value() : nullptr;
+}
+
+TrkSortedTable::Iterator TrkSortedTable::Seek(std::string_view Key) const
+{
+	if (block_count == 0)
+	{
+		return Iterator();
+	}
+
+	// Last block whose first key is not greater than the key
+	uint64_t low = 0, high = block_count;
+	while (high - low > 1)
+	{
+		const uint64_t middle = low + (high - low) / 2;
+		if (GetFirstKey(middle) <= Key)
+		{
+			low = middle;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+
+	Iterator it = BlockStart(low);
+	while (it.Valid() && it.Key() < Key)
+	{
+		it.Next();
+	}
+	return it;
+}
+
+TrkSortedTable::Iterator TrkSortedTable::Begin() const
+{
+	return block_count > 0 ? BlockStart(0) : Iterator();
+}
+
+TrkSortedTable::Iterator TrkSortedTable::BlockStart(uint64_t Block) const
+{
+	uint64_t offset;
+	std::memcpy(&offset, index + Block * sizeof(uint64_t), sizeof(offset));
+
+	Iterator it;
+	it.table = this;
+	it.record = Block * block_keys;
+	if (offset >= static_cast<uint64_t>(keys_end - keys))
+	{
+		it.record = record_count;
+		return it;
+	}
+
+	it.position = keys + offset;
+	it.Decode();
+	return it;
+}
+
+std::string_view TrkSortedTable::GetFirstKey(uint64_t Block) const
+{
+	uint64_t offset;
+	std::memcpy(&offset, index + Block * sizeof(uint64_t), sizeof(offset));
+	if (offset >= static_cast<uint64_t>(keys_end - keys))
+	{
+		return std::string_view();
+	}
+
+	// First key of a block shares nothing, it is read in place
+	uint64_t shared, length;
+	const uint8_t* next = ReadVarint(keys + offset, keys_end, shared);
+	if (next != nullptr)
+	{
+		next = ReadVarint(next, keys_end, length);
+	}
+	if (next == nullptr || shared != 0 || length > static_cast<uint64_t>(keys_end - next))
+	{
+		return std::string_view();
+	}
+
+	return std::string_view(reinterpret_cast<const char*>(next), length);
+}
@@ -0,0 +1,183 @@
+/*
+ *	sortedtable.h
+ *
+ *	Tintirek's immutable sorted table files
+ */
+
+#ifndef TRK_SORTEDTABLE_H
+#define TRK_SORTEDTABLE_H
+
+#include "mappedfile.h"
+#include "trk_types.h"
+#include "trkstring.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+/* Magic bytes at the start of a sorted table */
+#define TRK_SORTED_TABLE_MAGIC "TRKSST01"
+
+/* Layout version of the sorted table */
+#define TRK_SORTED_TABLE_VERSION 1
+
+/* Default number of keys front-coded against each other, one index entry per block */
+#define TRK_SORTED_TABLE_BLOCK_KEYS 16
+
+/* Bytes of keys or values a writer buffers before writing them out */
+#define TRK_SORTED_TABLE_WRITE_BUFFER (1024 * 1024)
+
+
+/* Header of a sorted table file */
+struct TrkSortedTableHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t value_size;
+	uint32_t block_keys;
+	uint32_t reserved;
+	uint64_t record_count;
+	uint64_t block_count;
+	uint64_t values_offset;		// Fixed width values, one per record in key order
+	uint64_t keys_offset;		// Front-coded keys
+	uint64_t keys_size;
+	uint64_t index_offset;		// Offset of every block in the keys, relative to keys_offset
+};
+
+
+/*
+ *	Sorted table writer
+ *
+ *	Takes records in ascending byte order of their keys and writes them
+ *	as a sorted table: fixed width values in key order, keys front-coded
+ *	in blocks of block_keys, every block starting with a whole key, and
+ *	a sparse index of block offsets. Values and keys are written next to
+ *	the path as they come, in buffers of TRK_SORTED_TABLE_WRITE_BUFFER
+ *	bytes, so only the index of one offset per block stays in memory.
+ *	Commit syncs the table and renames it into place; a writer that is
+ *	not committed removes what it wrote.
+ */
+class TrkSortedTableWriter
+{
+public:
+	TrkSortedTableWriter(const TrkString& Path, size_t ValueSize, uint32_t BlockKeys = TRK_SORTED_TABLE_BLOCK_KEYS);
+	~TrkSortedTableWriter();
+
+	/* Disables copy */
+	TrkSortedTableWriter(const TrkSortedTableWriter&) = delete;
+	TrkSortedTableWriter& operator=(const TrkSortedTableWriter&) = delete;
+
+	/* Appends a record of value_size bytes, returns false if the key is not greater than the last one or it could not be written */
+	bool Add(std::string_view Key, const void* Value);
+	/* Completes the table, syncs it to disk and renames it into place, returns false if it could not be written */
+	bool Commit();
+	/* Removes the partial files of a writer that is not committed */
+	void Abort();
+
+	/* Returns the number of records added */
+	uint64_t GetRecordCount() const { return record_count; }
+
+private:
+	/* Writes the buffered values and keys to their files */
+	bool FlushBuffers();
+
+	TrkString path;
+	size_t value_size;
+	uint32_t block_keys;
+	uint64_t record_count = 0;
+	bool failed = false;
+
+	std::FILE* table_file = nullptr;		// Header placeholder followed by the values
+	std::FILE* keys_file = nullptr;			// Front-coded keys, copied after the values on commit
+	uint64_t keys_size = 0;					// Bytes of keys written and buffered
+
+	std::string keys;						// Keys not written yet
+	std::string values;						// Values not written yet
+	std::vector<uint64_t> block_offsets;	// Offset of every block in the keys
+	std::string last_key;
+};
+
+
+/*
+ *	Sorted table
+ *
+ *	Memory-mapped reader of a sorted table file. A lookup binary
+ *	searches the first keys of the blocks and decodes at most one
+ *	block; reads take no locks and copy nothing but the key being
+ *	decoded, so any number of threads can share one table.
+ */
+class TrkSortedTable
+{
+public:
+	/* Position in the table, decodes keys one after the other */
+	class Iterator
+	{
+	public:
+		/* True while the iterator is at a record */
+		bool Valid() const { return table != nullptr && record < table->record_count; }
+		/* Key of the record, valid until the iterator moves */
+		std::string_view Key() const { return key; }
+		/* Value of the record, value_size bytes that may not be aligned */
+		const void* Value() const { return table->values + record * table->value_size; }
+		/* Moves to the next record */
+		void Next();
+
+	private:
+		friend class TrkSortedTable;
+
+		/* Decodes the key at position, invalidates the iterator on a malformed key */
+		void Decode();
+
+		const TrkSortedTable* table = nullptr;
+		uint64_t record = 0;
+		const uint8_t* position = nullptr;	// Next encoded key
+		std::string key;
+	};
+
+	TrkSortedTable() = default;
+
+	/* Disables copy */
+	TrkSortedTable(const TrkSortedTable&) = delete;
+	TrkSortedTable& operator=(const TrkSortedTable&) = delete;
+
+	/* Maps and validates a table, returns false if it is missing or malformed */
+	bool Open(const TrkString& Path);
+	/* Unmaps the table */
+	void Close();
+	/* Returns true while a table is mapped */
+	bool IsOpen() const { return file.IsOpen(); }
+
+	/* Returns the value of a key, null if it is not in the table */
+	const void* Find(std::string_view Key) const;
+	/* Returns an iterator at the first key not less than given key */
+	Iterator Seek(std::string_view Key) const;
+	/* Returns an iterator at the first key */
+	Iterator Begin() const;
+
+	/* Returns the number of records */
+	uint64_t GetRecordCount() const { return record_count; }
+	/* Returns the size of a value */
+	size_t GetValueSize() const { return value_size; }
+
+private:
+	/* Returns an iterator at the first record of a block */
+	Iterator BlockStart(uint64_t Block) const;
+	/* Returns the first key of a block */
+	std::string_view GetFirstKey(uint64_t Block) const;
+
+	TrkMappedFile file;
+	uint64_t record_count = 0;
+	uint64_t block_count = 0;
+	size_t value_size = 0;
+	uint32_t block_keys = 0;
+	const uint8_t* values = nullptr;
+	const uint8_t* keys = nullptr;
+	const uint8_t* keys_end = nullptr;
+	const uint8_t* index = nullptr;		// block_count offsets, read with memcpy
+};
+
+
+#endif /* TRK_SORTEDTABLE_H */
@@ -5,9 +5,11 @@
  */
 
 
+#include <chrono>
 #include <iostream>
 #include <string.h>
 #include "sqlite3.h"
+#include "metrics.h"
 #include <../../deps/sqlite-amalgamation/sqlite3.h>
 
 TrkString TrkSqlite::GetLibVersion()
@@ -47,19 +49,17 @@ TrkSqlite::TrkDatabase::TrkDatabase(const TrkString Filename, const int Flags)
 	{
 		throw TrkSqlite::TrkDatabaseException(handle, ret);
 	}
-}
 
-void TrkSqlite::TrkDatabase::Deleter::operator()(sqlite3* SQLite)
-{
-	const int ret = sqlite3_close(SQLite);
+	statement_cache.reset(new TrkStatementCache(*this, TrkSqlite::DEFAULT_STATEMENT_CACHE_SIZE));
+}
 
-	// Avoid unreferenced variable warning when build in release mode
-	(void)ret;
+TrkSqlite::TrkDatabase::~TrkDatabase() = default;
 
-	if (TrkSqlite::OK != ret)
-	{
-		throw TrkSqlite::TrkDatabaseException("Database is locked", ret);
-	}
+void TrkSqlite::TrkDatabase::Deleter::operator()(sqlite3* SQLite) noexcept
+{
+	// Runs in destructors, so it must not throw. Unlike sqlite3_close(), close_v2 never
+	// fails with SQLITE_BUSY: a connection with live statements is closed after the last one
+	(void)sqlite3_close_v2(SQLite);
 }
 
 int TrkSqlite::TrkDatabase::Execute(TrkString Queries)
@@ -79,12 +79,32 @@ int TrkSqlite::TrkDatabase::TryExecute(TrkString Queries)
 	return sqlite3_exec(sqlite_db.get(), Queries, nullptr, nullptr, nullptr);
 }
 
+TrkSqlite::TrkStatementLease TrkSqlite::TrkDatabase::Prepare(const TrkString Query) const
+{
+	return statement_cache->Acquire(Query);
+}
+
+void TrkSqlite::TrkDatabase::SetStatementCacheSize(size_t Size)
+{
+	statement_cache->SetCapacity(Size);
+}
+
+int64_t TrkSqlite::TrkDatabase::GetStatementCacheHits() const
+{
+	return statement_cache->GetHits();
+}
+
+int64_t TrkSqlite::TrkDatabase::GetStatementCacheMisses() const
+{
+	return statement_cache->GetMisses();
+}
+
 bool TrkSqlite::TrkDatabase::TableExists(TrkString TableName) const
 {
-	TrkStatement query(*this, "SELECT count(*) FROM sqlite_master WHERE type='table' AND name=?");
-	query.Bind(1, TableName);
-	(void)query.ExecuteStep();
-	return query.GetColumn(0).GetInt() == 1;
+	TrkStatementLease query = Prepare("SELECT count(*) FROM sqlite_master WHERE type='table' AND name=?");
+	query->Bind(1, TableName);
+	(void)query->ExecuteStep();
+	return query->GetColumnView(0).GetInt() == 1;
 }
 
 int64_t TrkSqlite::TrkDatabase::GetLastInsertRowID() const
@@ -107,11 +127,108 @@ int TrkSqlite::TrkDatabase::GetErrorCode() const
 	return sqlite3_errcode(sqlite_db.get());
 }
 
+bool TrkSqlite::TrkDatabase::InTransaction() const
+{
+	return sqlite3_get_autocommit(sqlite_db.get()) == 0;
+}
+
+int TrkSqlite::TrkDatabase::GetParameterLimit() const
+{
+	return sqlite3_limit(sqlite_db.get(), SQLITE_LIMIT_VARIABLE_NUMBER, -1);
+}
+
+TrkSqlite::TrkCheckpointResult TrkSqlite::TrkDatabase::Checkpoint(const int Mode)
+{
+	TrkCheckpointResult result;
+	result.code = sqlite3_wal_checkpoint_v2(sqlite_db.get(), nullptr, Mode, &result.log_frames, &result.checkpointed_frames);
+	return result;
+}
+
+void TrkSqlite::TrkDatabase::SetBusyTimeout(const int Milliseconds)
+{
+	busy_timeout = Milliseconds;
+	const int ret = sqlite3_busy_handler(sqlite_db.get(), Milliseconds > 0 ? &TrkDatabase::BusyHandler : nullptr, this);
+
+	if (SQLITE_OK != ret)
+	{
+		throw TrkDatabaseException(sqlite_db.get(), ret);
+	}
+}
+
+int TrkSqlite::TrkDatabase::BusyHandler(void* Database, int Count)
+{
+	// Same schedule as sqlite3_busy_timeout(): short sleeps first, then 100 ms each
+	static const int delays[] = { 1, 2, 5, 10, 15, 20, 25, 25, 25, 50, 50, 100 };
+	static const int totals[] = { 0, 1, 3, 8, 18, 33, 53, 78, 103, 128, 178, 228 };
+	static const int steps = sizeof(delays) / sizeof(delays[0]);
+
+	const int timeout = static_cast<TrkDatabase*>(Database)->busy_timeout;
+	int delay = Count < steps ? delays[Count] : delays[steps - 1];
+	const int slept = Count < steps ? totals[Count] : totals[steps - 1] + delay * (Count - (steps - 1));
+
+	if (slept + delay > timeout)
+	{
+		delay = timeout - slept;
+		if (delay <= 0)
+		{
+			return 0;
+		}
+	}
+
+	TrkStatementProfiler::Get().CountBusyRetry();
+	sqlite3_sleep(delay);
+	return 1;
+}
+
 int TrkSqlite::TrkDatabase::GetExtendedErrorCode() const
 {
 	return sqlite3_extended_errcode(sqlite_db.get());
 }
 
+int TrkSqlite::TrkColumn::GetType() const
+{
+	return sqlite3_column_type(statement, index);
+}
+
+int32_t TrkSqlite::TrkColumn::GetInt() const
+{
+	return sqlite3_column_int(statement, index);
+}
+
+int64_t TrkSqlite::TrkColumn::GetInt64() const
+{
+	return sqlite3_column_int64(statement, index);
+}
+
+double TrkSqlite::TrkColumn::GetDouble() const
+{
+	return sqlite3_column_double(statement, index);
+}
+
+std::string_view TrkSqlite::TrkColumn::GetStringView() const
+{
+	// Text first, the byte count is only valid for the converted value
+	auto text = reinterpret_cast<const char*>(sqlite3_column_text(statement, index));
+	if (text == nullptr)
+	{
+		return std::string_view();
+	}
+	return std::string_view(text, static_cast<size_t>(sqlite3_column_bytes(statement, index)));
+}
+
+TrkSqlite::TrkBlobView TrkSqlite::TrkColumn::GetBlobView() const
+{
+	TrkBlobView view;
+	view.data = static_cast<const unsigned char*>(sqlite3_column_blob(statement, index));
+	view.size = view.data != nullptr ? static_cast<size_t>(sqlite3_column_bytes(statement, index)) : 0;
+	return view;
+}
+
+int TrkSqlite::TrkColumn::GetBytes() const
+{
+	return sqlite3_column_bytes(statement, index);
+}
+
 TrkSqlite::TrkValue::TrkValue(const TrkStatement::TrkSharedStatementPtr& StatementPtr, int Index)
 	: statement_ptr(StatementPtr)
 	, index(Index)
@@ -163,17 +280,136 @@ const void* TrkSqlite::TrkValue::GetBlob() const
 	return sqlite3_column_blob(statement_ptr.get(), index);
 }
 
+std::string_view TrkSqlite::TrkValue::GetStringView() const
+{
+	return TrkColumn(statement_ptr.get(), index).GetStringView();
+}
+
+TrkSqlite::TrkBlobView TrkSqlite::TrkValue::GetBlobView() const
+{
+	return TrkColumn(statement_ptr.get(), index).GetBlobView();
+}
+
 int TrkSqlite::TrkValue::GetBytes() const
 {
 	return sqlite3_column_bytes(statement_ptr.get(), index);
 }
 
+/* FNV-1a hash of a column name */
+static uint32_t HashColumnName(std::string_view Name)
+{
+	uint32_t hash = 2166136261u;
+	for (const char c : Name)
+	{
+		hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+	}
+	return hash;
+}
+
+void TrkSqlite::TrkColumnNameIndex::Build(sqlite3_stmt* Statement, int Count)
+{
+	names.clear();
+	slots.clear();
+	if (Count <= 0)
+	{
+		return;
+	}
+
+	size_t capacity = 4;
+	while (capacity < static_cast<size_t>(Count) * 2)
+	{
+		capacity *= 2;
+	}
+	slots.assign(capacity, Slot{ 0, 0, 0, -1 });
+
+	for (int i = 0; i < Count; i++)
+	{
+		const char* column_name = sqlite3_column_name(Statement, i);
+		const std::string_view name = column_name != nullptr ? column_name : "";
+		const uint32_t hash = HashColumnName(name);
+
+		size_t position = hash & (capacity - 1);
+		while (slots[position].index >= 0)
+		{
+			const Slot& slot = slots[position];
+			if (slot.hash == hash && std::string_view(names.data() + slot.offset, slot.length) == name)
+			{
+				break;
+			}
+			position = (position + 1) & (capacity - 1);
+		}
+
+		if (slots[position].index < 0)
+		{
+			slots[position] = Slot{ hash, static_cast<uint32_t>(names.size()), static_cast<uint32_t>(name.size()), i };
+			names.append(name.data(), name.size());
+		}
+		else
+		{
+			slots[position].index = i;
+		}
+	}
+}
+
+int TrkSqlite::TrkColumnNameIndex::Find(std::string_view Name) const
+{
+	if (slots.empty())
+	{
+		return -1;
+	}
+
+	const uint32_t hash = HashColumnName(Name);
+	const size_t mask = slots.size() - 1;
+	for (size_t position = hash & mask; slots[position].index >= 0; position = (position + 1) & mask)
+	{
+		const Slot& slot = slots[position];
+		if (slot.hash == hash && std::string_view(names.data() + slot.offset, slot.length) == Name)
+		{
+			return slot.index;
+		}
+	}
+	return -1;
+}
+
 TrkSqlite::TrkStatement::TrkStatement(const TrkDatabase& Database, TrkString Query)
 	: query(Query)
 	, sqlite_db(Database.sqlite_db.get())
 	, prepared_statement(PrepareStatement())
 {
 	column_count = sqlite3_column_count(prepared_statement.get());
+	column_names.Build(prepared_statement.get(), column_count);
+	stats = TrkStatementProfiler::Get().Register(query);
+}
+
+TrkSqlite::TrkStatement::~TrkStatement()
+{
+	EndExecution();
+}
+
+void TrkSqlite::TrkStatement::EndExecution() noexcept
+{
+	if (!executing)
+	{
+		return;
+	}
+
+	executing = false;
+	try
+	{
+		TrkStatementProfiler& profiler = TrkStatementProfiler::Get();
+		if (profiler.RecordExecution(stats, execution_time, execution_rows))
+		{
+			// Bound values carry tickets and password hashes, only the SQL text is kept
+			profiler.RecordSlow(execution_time, query);
+		}
+	}
+	catch (...)
+	{
+		// A slow statement that could not be kept is not worth failing the query
+	}
+
+	execution_time = 0;
+	execution_rows = 0;
 }
 
 bool TrkSqlite::TrkStatement::ExecuteStep()
@@ -202,15 +438,32 @@ int TrkSqlite::TrkStatement::TryExecuteStep()
 		return SQLITE_MISUSE;
 	}
 
+	if (stats == nullptr)
+	{
+		const int ret = sqlite3_step(prepared_statement.get());
+		has_row = SQLITE_ROW == ret;
+		done = SQLITE_DONE == ret;
+		return ret;
+	}
+
+	// Busy waits inside the step are charged to this query
+	TrkStatementStats* previous = TrkStatementProfiler::SetCurrent(stats);
+	const auto start = std::chrono::steady_clock::now();
 	const int ret = sqlite3_step(prepared_statement.get());
+	execution_time += static_cast<int64_t>(TrkElapsedMicroseconds(start));
+	TrkStatementProfiler::SetCurrent(previous);
+
+	executing = true;
 	if (SQLITE_ROW == ret)
 	{
 		has_row = true;
+		execution_rows++;
 	}
 	else
 	{
 		has_row = false;
 		done = SQLITE_DONE == ret;
+		EndExecution();
 	}
 
 	return ret;
@@ -238,6 +491,26 @@ int TrkSqlite::TrkStatement::Execute()
 	return sqlite3_changes(sqlite_db);
 }
 
+TrkSqlite::TrkResult<bool> TrkSqlite::TrkStatement::TryStep() noexcept
+{
+	const int ret = TryExecuteStep();
+	if (SQLITE_ROW != ret && SQLITE_DONE != ret)
+	{
+		return TrkResult<bool>::Error(ret);
+	}
+	return has_row;
+}
+
+TrkSqlite::TrkResult<int> TrkSqlite::TrkStatement::TryExecute() noexcept
+{
+	const int ret = TryExecuteStep();
+	if (SQLITE_DONE != ret)
+	{
+		return TrkResult<int>::Error(SQLITE_ROW == ret ? SQLITE_MISUSE : ret);
+	}
+	return sqlite3_changes(sqlite_db);
+}
+
 void TrkSqlite::TrkStatement::Reset()
 {
 	const int ret = TryReset();
@@ -250,6 +523,8 @@ void TrkSqlite::TrkStatement::Reset()
 
 int TrkSqlite::TrkStatement::TryReset()
 {
+	// Ends an execution whose rows were not all fetched
+	EndExecution();
 	has_row = false;
 	done = false;
 	return sqlite3_reset(prepared_statement.get());
@@ -293,7 +568,7 @@ const TrkString TrkSqlite::TrkStatement::GetQuery() const
 const TrkString TrkSqlite::TrkStatement::GetExpandedQuery() const
 {
 	auto expanded = sqlite3_expanded_sql(GetPreparedStatement());
-	TrkString expandedStr(expanded);
+	TrkString expandedStr(expanded != nullptr ? expanded : "");
 	sqlite3_free(expanded);
 	return expandedStr;
 }
@@ -358,6 +633,21 @@ void TrkSqlite::TrkStatement::Bind(const int Index, const void* Value, const int
 	}
 }
 
+void TrkSqlite::TrkStatement::BindText(const int Index, const char* Value, const int Size)
+{
+	const int ret = sqlite3_bind_text(GetPreparedStatement(), Index, Value, Size, SQLITE_TRANSIENT);
+
+	if (SQLITE_OK != ret)
+	{
+		throw TrkDatabaseException(sqlite_db, ret);
+	}
+}
+
+int TrkSqlite::TrkStatement::GetParameterCount() const
+{
+	return sqlite3_bind_parameter_count(GetPreparedStatement());
+}
+
 void TrkSqlite::TrkStatement::Bind(const int Index)
 {
 	const int ret = sqlite3_bind_null(GetPreparedStatement(), Index);
@@ -375,13 +665,53 @@ TrkSqlite::TrkValue TrkSqlite::TrkStatement::GetColumn(const int Index) const
 	return TrkValue(prepared_statement, Index);
 }
 
-TrkSqlite::TrkValue TrkSqlite::TrkStatement::GetColumn(const TrkString Name) const
+TrkSqlite::TrkValue TrkSqlite::TrkStatement::GetColumn(const TrkColumnName Name) const
 {
 	CheckRow();
 	const int index = GetColumnIndex(Name);
 	return TrkValue(prepared_statement, index);
 }
 
+TrkSqlite::TrkColumn TrkSqlite::TrkStatement::GetColumnView(const int Index) const
+{
+	CheckRow();
+	CheckIndex(Index);
+	return TrkColumn(prepared_statement.get(), Index);
+}
+
+TrkSqlite::TrkColumn TrkSqlite::TrkStatement::GetColumnView(const TrkColumnName Name) const
+{
+	CheckRow();
+	return TrkColumn(prepared_statement.get(), GetColumnIndex(Name));
+}
+
+TrkSqlite::TrkResult<TrkSqlite::TrkColumn> TrkSqlite::TrkStatement::TryGetColumn(const int Index) const noexcept
+{
+	if (!has_row)
+	{
+		return TrkResult<TrkColumn>::Error(SQLITE_MISUSE);
+	}
+	if (Index < 0 || Index >= column_count)
+	{
+		return TrkResult<TrkColumn>::Error(SQLITE_RANGE);
+	}
+	return TrkColumn(prepared_statement.get(), Index);
+}
+
+TrkSqlite::TrkResult<TrkSqlite::TrkColumn> TrkSqlite::TrkStatement::TryGetColumn(const TrkColumnName Name) const noexcept
+{
+	if (!has_row)
+	{
+		return TrkResult<TrkColumn>::Error(SQLITE_MISUSE);
+	}
+	const int index = column_names.Find(Name.Get());
+	if (index < 0)
+	{
+		return TrkResult<TrkColumn>::Error(SQLITE_RANGE);
+	}
+	return TrkColumn(prepared_statement.get(), index);
+}
+
 TrkString TrkSqlite::TrkStatement::GetColumnName(const int Index) const
 {
 	CheckIndex(Index);
@@ -395,7 +725,7 @@ bool TrkSqlite::TrkStatement::IsColumnNull(const int Index) const
 	return SQLITE_NULL == sqlite3_column_type(GetPreparedStatement(), Index);
 }
 
-bool TrkSqlite::TrkStatement::IsColumnNull(const TrkString Name) const
+bool TrkSqlite::TrkStatement::IsColumnNull(const TrkColumnName Name) const
 {
 	CheckRow();
 	const int index = GetColumnIndex(Name);
@@ -407,26 +737,18 @@ int TrkSqlite::TrkStatement::GetColumnCount() const
 	return column_count;
 }
 
-int TrkSqlite::TrkStatement::GetColumnIndex(const TrkString Name) const
+int TrkSqlite::TrkStatement::GetColumnIndex(const TrkColumnName Name) const
 {
-	if (column_names.empty())
-	{
-		for (int i = 0; i < column_count; i++)
-		{
-			const TrkString ColumnName = sqlite3_column_name(GetPreparedStatement(), i);
-			column_names[ColumnName] = i;
-		}
-	}
-
-	const auto Elem = column_names.find(Name);
-	if (Elem == column_names.end())
+	const int index = column_names.Find(Name.Get());
+	if (index < 0)
 	{
 		throw TrkDatabaseException("Unknown column name.");
 	}
 
-	return Elem->second;
+	return index;
 }
 
+
 int TrkSqlite::TrkStatement::GetErrorCode() const
 {
 	return sqlite3_errcode(sqlite_db);
@@ -453,6 +775,16 @@ void TrkSqlite::TrkStatement::CheckIndex(const int Index) const
 	}
 }
 
+void TrkSqlite::TrkStatement::CheckColumnCount(const int Count) const
+{
+	if (Count != column_count)
+	{
+		TrkString message = "Row has ";
+		message << Count << " columns, the result has " << column_count << ".";
+		throw TrkSqlite::TrkDatabaseException(message);
+	}
+}
+
 TrkSqlite::TrkStatement::TrkSharedStatementPtr TrkSqlite::TrkStatement::PrepareStatement()
 {
 	sqlite3_stmt* statement;
@@ -477,6 +809,154 @@ sqlite3_stmt* TrkSqlite::TrkStatement::GetPreparedStatement() const
 	throw TrkDatabaseException("Statement was not prepared.");
 }
 
+TrkSqlite::TrkStatementLease::TrkStatementLease(TrkStatementCache* Cache, std::unique_ptr<TrkStatement> Statement)
+	: cache(Cache)
+	, statement(std::move(Statement))
+{ }
+
+TrkSqlite::TrkStatementLease::~TrkStatementLease()
+{
+	if (cache != nullptr && statement)
+	{
+		cache->Release(std::move(statement));
+	}
+}
+
+TrkSqlite::TrkStatementLease::TrkStatementLease(TrkStatementLease&& Other) noexcept
+	: cache(Other.cache)
+	, statement(std::move(Other.statement))
+{
+	Other.cache = nullptr;
+}
+
+TrkSqlite::TrkStatementCache::TrkStatementCache(const TrkDatabase& Database, size_t Capacity)
+	: database(Database)
+	, capacity(Capacity)
+{ }
+
+TrkSqlite::TrkStatementLease TrkSqlite::TrkStatementCache::Acquire(const TrkString Query)
+{
+	const std::string key(Query.c_str(), Query.size());
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = index.find(key);
+		if (it != index.end())
+		{
+			std::unique_ptr<TrkStatement> statement = std::move(it->second->statement);
+			entries.erase(it->second);
+			index.erase(it);
+			hits++;
+			return TrkStatementLease(this, std::move(statement));
+		}
+		misses++;
+	}
+
+	// Prepare outside of the lock, other queries can still be leased meanwhile
+	return TrkStatementLease(this, std::unique_ptr<TrkStatement>(new TrkStatement(database, Query)));
+}
+
+void TrkSqlite::TrkStatementCache::Release(std::unique_ptr<TrkStatement> Statement) noexcept
+{
+	// Result code of reset repeats the error of the last step, the statement is usable either way
+	(void)Statement->TryReset();
+	if (SQLITE_OK != sqlite3_clear_bindings(Statement->prepared_statement.get()))
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (capacity == 0)
+	{
+		return;
+	}
+
+	const std::string key(Statement->query.c_str(), Statement->query.size());
+	entries.push_front(Entry{ key, std::move(Statement) });
+	index.emplace(key, entries.begin());
+	Trim();
+}
+
+void TrkSqlite::TrkStatementCache::SetCapacity(size_t Capacity)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	capacity = Capacity;
+	Trim();
+}
+
+size_t TrkSqlite::TrkStatementCache::GetSize() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return entries.size();
+}
+
+int64_t TrkSqlite::TrkStatementCache::GetHits() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return hits;
+}
+
+int64_t TrkSqlite::TrkStatementCache::GetMisses() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return misses;
+}
+
+void TrkSqlite::TrkStatementCache::Trim()
+{
+	while (entries.size() > capacity)
+	{
+		auto last = std::prev(entries.end());
+		auto range = index.equal_range(last->query);
+		for (auto it = range.first; it != range.second; ++it)
+		{
+			if (it->second == last)
+			{
+				index.erase(it);
+				break;
+			}
+		}
+		entries.erase(last);
+	}
+}
+
+TrkSqlite::TrkBackup::TrkBackup(TrkDatabase& Destination, TrkDatabase& Source)
+	: destination_db(Destination.sqlite_db.get())
+{
+	backup.reset(sqlite3_backup_init(Destination.sqlite_db.get(), "main", Source.sqlite_db.get(), "main"));
+	if (backup == nullptr)
+	{
+		throw TrkDatabaseException(destination_db);
+	}
+}
+
+TrkSqlite::TrkBackup::~TrkBackup() = default;
+
+void TrkSqlite::TrkBackup::Deleter::operator()(sqlite3_backup* Backup) noexcept
+{
+	(void)sqlite3_backup_finish(Backup);
+}
+
+int TrkSqlite::TrkBackup::ExecuteStep(const int Pages)
+{
+	const int ret = sqlite3_backup_step(backup.get(), Pages);
+	if (SQLITE_OK != ret && SQLITE_DONE != ret && SQLITE_BUSY != ret && SQLITE_LOCKED != ret)
+	{
+		throw TrkDatabaseException(destination_db, ret);
+	}
+	return ret;
+}
+
+int TrkSqlite::TrkBackup::GetRemainingPages() const
+{
+	return sqlite3_backup_remaining(backup.get());
+}
+
+int TrkSqlite::TrkBackup::GetTotalPages() const
+{
+	return sqlite3_backup_pagecount(backup.get());
+}
+
 TrkSqlite::TrkTransaction::TrkTransaction(TrkDatabase& Database)
 	: database(Database)
 	, Commited(false)
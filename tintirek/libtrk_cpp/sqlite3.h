@@ -9,14 +9,27 @@
 
 #include "trk_types.h"
 #include "trkstring.h"
+#include "statementprofiler.h"
+#include <cstddef>
+#include <iterator>
+#include <list>
 #include <memory>
-#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 /* Forward declarations to avoid inclusion of sqlite3 in this header */
 struct sqlite3;
 struct sqlite3_stmt;
 struct sqlite3_context;
 struct sqlite3_value;
+struct sqlite3_backup;
 
 
 namespace TrkSqlite
@@ -35,10 +48,18 @@ namespace TrkSqlite
 
 	const int ROW = 100;
 	const int DONE = 101;
+	const int BUSY = 5;
+	const int LOCKED = 6;
+
+	const int CHECKPOINT_PASSIVE = 0;
+	const int CHECKPOINT_FULL = 1;
+	const int CHECKPOINT_RESTART = 2;
+	const int CHECKPOINT_TRUNCATE = 3;
 
 	const int CODE_ERROR = 1;
 	const int CODE_CONSTRAINT = 19;
 	const int CODE_CONSTRAINT_PRIMARYKEY = (CODE_CONSTRAINT | (6 << 8));
+	const int CODE_MISUSE = 21;
 	const int CODE_RANGE = 25;
 
 	const int INTEGER = 1;
@@ -47,6 +68,9 @@ namespace TrkSqlite
 	const int BLOB = 4;
 	const int Null = 5;
 
+	/* Number of idle prepared statements a database keeps by default */
+	const size_t DEFAULT_STATEMENT_CACHE_SIZE = 64;
+
 	/* Returns SQLite version string */
 	TrkString GetLibVersion();
 	/* Returns SQLite version string */
@@ -74,14 +98,177 @@ namespace TrkSqlite
 		int errextndcode;
 	};
 
+	/*
+	 *	Tintirek's Result Class
+	 *
+	 *	Returned by the no-throw API: either a value or the SQLite result
+	 *	code of the failure. Expected failures such as a missing row can
+	 *	be handled without building an exception; Value() still throws
+	 *	when it is called on an error, like the throwing API would have.
+	 */
+	template <typename T>
+	class TrkResult
+	{
+	public:
+		TrkResult(T Value) : value(std::move(Value)), code(OK) {}
+
+		/* Returns a failed result with the given result code */
+		static TrkResult Error(int Code) { return TrkResult(Code, 0); }
+
+		/* True when the result holds a value */
+		bool HasValue() const { return value.has_value(); }
+		explicit operator bool() const
+		{
+			// "if (Statement.TryStep())" would be true when the query is done, test HasValue() or the value instead
+			static_assert(!std::is_same<T, bool>::value, "TrkResult<bool> has no bool conversion, use HasValue() or Value()");
+			return HasValue();
+		}
+
+		/* Returns the value, throws TrkDatabaseException on an error */
+		T& Value() { CheckValue(); return *value; }
+		const T& Value() const { CheckValue(); return *value; }
+		T& operator*() { return Value(); }
+		const T& operator*() const { return Value(); }
+		T* operator->() { return &Value(); }
+		const T* operator->() const { return &Value(); }
+
+		/* Returns the value, or the default on an error */
+		T ValueOr(T Default) const { return HasValue() ? *value : std::move(Default); }
+		/* Returns the result code, OK when the result holds a value */
+		int GetErrorCode() const { return code; }
+
+	private:
+		TrkResult(int Code, int) : code(Code) {}
+
+		void CheckValue() const
+		{
+			if (!value.has_value())
+			{
+				throw TrkDatabaseException("Result has no value.", code);
+			}
+		}
+
+		std::optional<T> value;		// Value, empty on an error
+		int code;					// OK or the result code of the failure
+	};
+
+	/* Column name argument, views a literal or a TrkString so a lookup by name does not allocate */
+	class TrkColumnName
+	{
+	public:
+		TrkColumnName(const char* Name) : name(Name != nullptr ? Name : "") {}
+		TrkColumnName(const TrkString& Name) : name(Name.c_str(), Name.size()) {}
+
+		std::string_view Get() const { return name; }
+
+	private:
+		std::string_view name;
+	};
+
+	/*
+	 *	Tintirek's Column Name Index Class
+	 *
+	 *	Flat open addressing table from the result column names of a
+	 *	statement to their indexes. It is built once when the statement
+	 *	is prepared and only read afterwards, so a cached statement
+	 *	shares it across every lease and concurrent lookups are safe.
+	 *	When names repeat, the last column wins.
+	 */
+	class TrkColumnNameIndex
+	{
+	public:
+		/* Indexes the result columns of a prepared statement */
+		void Build(sqlite3_stmt* Statement, int Count);
+		/* Returns the index of the column name, -1 if there is no such column */
+		int Find(std::string_view Name) const;
+
+	private:
+		struct Slot
+		{
+			uint32_t hash;
+			uint32_t offset;	// Offset of the name in names
+			uint32_t length;
+			int index;			// Column index, -1 for an empty slot
+		};
+
+		std::string names;			// Column names, back to back
+		std::vector<Slot> slots;	// Power of two sized, at most half full
+	};
+
+	class TrkStatementCache;
+	class TrkStatementLease;
+	template <typename Row, typename... Types> class TrkRowRange;
+
+	/* Read-only view of a blob column, valid until the statement steps, resets or is destroyed */
+	struct TrkBlobView
+	{
+		const unsigned char* data = nullptr;
+		size_t size = 0;
+
+		const unsigned char* begin() const { return data; }
+		const unsigned char* end() const { return data + size; }
+		bool empty() const { return size == 0; }
+	};
+
+	/*
+	 *	Tintirek's Column Class
+	 *
+	 *	Handle of a column in the current row. Unlike TrkValue it does not
+	 *	share ownership of the statement, so creating one costs no atomic
+	 *	reference count, and its views point into SQLite's own buffers
+	 *	instead of copying them. It must not outlive the row it was taken
+	 *	from: stepping, resetting or destroying the statement invalidates
+	 *	the handle and every view taken from it.
+	 */
+	class TrkColumn
+	{
+	public:
+		TrkColumn(sqlite3_stmt* Statement, int Index) : statement(Statement), index(Index) {}
+
+		/* Return the type of the value */
+		int GetType() const;
+		/* Check if the value is null */
+		bool IsNull() const { return TrkSqlite::Null == GetType(); }
+
+		/* Return the 32 bits signed integer value of the column */
+		int32_t GetInt() const;
+		/* Return the 64 bits integer value of the column */
+		int64_t GetInt64() const;
+		/* Return the 64 bits float value of the column */
+		double GetDouble() const;
+		/* Return the text of the column without copying it */
+		std::string_view GetStringView() const;
+		/* Return the blob of the column and its size without copying it */
+		TrkBlobView GetBlobView() const;
+		/* Return the number of bytes of the text or blob value */
+		int GetBytes() const;
+
+	private:
+		sqlite3_stmt* statement;	// Statement the row belongs to, not owned
+		int index;					// Index of the column in the row
+	};
+
+	/* Outcome of a WAL checkpoint */
+	struct TrkCheckpointResult
+	{
+		/* Result code, BUSY when readers or writers kept it from finishing */
+		int code = OK;
+		/* Frames in the WAL file, -1 when the database is not in WAL mode */
+		int log_frames = -1;
+		/* Frames of the WAL written back into the database */
+		int checkpointed_frames = -1;
+	};
+
 	/* Tintirek's Database Class */
 	class TrkDatabase
 	{
 		friend class TrkStatement;
+		friend class TrkBackup;
 
 	public:
 		/* Opens the database from provided filename */
 		TrkDatabase(const TrkString Filename, const int Flags = TrkSqlite::OPEN_READONLY);
+		~TrkDatabase();
 
 		/* Disables copy and move */
 		TrkDatabase(const TrkDatabase&) = delete;
@@ -92,7 +279,7 @@ namespace TrkSqlite
 		/* Deleter functor to use with smart pointers to close the SQLite database connection */
 		struct Deleter
 		{
-			void operator()(sqlite3* SQLite);
+			void operator()(sqlite3* SQLite) noexcept;
 		};
 
 		
@@ -101,6 +288,15 @@ namespace TrkSqlite
 		/* Try to execute statements, returning the sqlite result code */
 		int TryExecute(TrkString Queries);
 
+		/* Leases a prepared statement of given query from the statement cache, it is returned when the lease goes out of scope */
+		TrkStatementLease Prepare(const TrkString Query) const;
+		/* Sets the maximum number of idle statements kept in the statement cache */
+		void SetStatementCacheSize(size_t Size);
+		/* Returns the number of leases served from the statement cache */
+		int64_t GetStatementCacheHits() const;
+		/* Returns the number of leases that had to prepare a new statement */
+		int64_t GetStatementCacheMisses() const;
+
 
 		/* Returns true if a table exists */
 		bool TableExists(TrkString TableName) const;
@@ -114,18 +310,36 @@ namespace TrkSqlite
 		int GetErrorCode() const;
 		/* Get the extended numeric result of error code (if any) */
 		int GetExtendedErrorCode() const;
+		/* True when a transaction is open on the connection */
+		bool InTransaction() const;
+		/* Returns the maximum number of parameters a statement can have */
+		int GetParameterLimit() const;
+		/* Runs a WAL checkpoint of given mode, never throws */
+		TrkCheckpointResult Checkpoint(const int Mode = CHECKPOINT_PASSIVE);
+		/* Waits up to given milliseconds for a locked database, every wait is counted by the statement profiler */
+		void SetBusyTimeout(const int Milliseconds);
 
 	private:
+		/* Busy handler of the connection, sleeps like sqlite3_busy_timeout() */
+		static int BusyHandler(void* Database, int Count);
+
 		/* Pointer to SQLite database connection */
 		std::unique_ptr<sqlite3, Deleter> sqlite_db;
+		/* Idle prepared statements, destroyed before the connection is closed */
+		std::unique_ptr<TrkStatementCache> statement_cache;
+		/* Milliseconds the busy handler waits in total */
+		int busy_timeout = 0;
 	};
 
 	/* Tintirek's Database Statement Class */
 	class TrkStatement
 	{
+		friend class TrkStatementCache;
+		template <typename Row, typename... Types> friend class TrkRowRange;
+
 	public:
 		TrkStatement(const TrkDatabase& Database, TrkString Query);
-		~TrkStatement() = default;
+		~TrkStatement();
 
 		/* Disables copy and move */
 		TrkStatement(const TrkStatement&) = delete;
@@ -137,6 +351,10 @@ namespace TrkSqlite
 		bool ExecuteStep();
 		/* Try to execute a step of the prepared query to fetch one row of results */
 		int TryExecuteStep();
+		/* Execute a step without throwing, true when a row was fetched and false when the query is done */
+		TrkResult<bool> TryStep() noexcept;
+		/* Execute a one-step query with no expected result without throwing, returns the number of changes */
+		TrkResult<int> TryExecute() noexcept;
 		/* Execute a one-step query with no expected result and return the number of changes */
 		int Execute();
 		/* Reset the statement to make it ready for a new execution */
@@ -173,6 +391,14 @@ namespace TrkSqlite
 		void Bind(const int Index, const void* Value, const int Size);
 		/* Bind a null value to a parameter */
 		void Bind(const int Index);
+		/* Bind a text of the given size in bytes to a parameter, a negative size reads up to the terminator */
+		void BindText(const int Index, const char* Value, const int Size);
+
+		/* Bind the values to the parameters in order, the count must match the parameters of the query */
+		template <typename... Args>
+		void BindAll(const Args&... Values);
+		/* Returns the number of parameters of the query */
+		int GetParameterCount() const;
 
 		/* Bind an 32 bits signed int value to a named parameter */
 		void Bind(const TrkString Name, const int32_t Value) { Bind(GetIndex(Name), Value); }
@@ -192,17 +418,38 @@ namespace TrkSqlite
 		/* Return a copy of the column data specified by its index */
 		class TrkValue GetColumn(const int Index) const;
 		/* Return a copy of the column data specified by its column name */
-		class TrkValue GetColumn(const TrkString Name) const;
+		class TrkValue GetColumn(const TrkColumnName Name) const;
+		/* Return a non-owning handle of the column specified by its index, valid until the next step */
+		TrkColumn GetColumnView(const int Index) const;
+		/* Return a non-owning handle of the column specified by its column name, valid until the next step */
+		TrkColumn GetColumnView(const TrkColumnName Name) const;
+		/* Same as GetColumnView() without throwing, CODE_MISUSE without a row and CODE_RANGE for an unknown column */
+		TrkResult<TrkColumn> TryGetColumn(const int Index) const noexcept;
+		/* Same as GetColumnView() without throwing, CODE_MISUSE without a row and CODE_RANGE for an unknown column */
+		TrkResult<TrkColumn> TryGetColumn(const TrkColumnName Name) const noexcept;
 		/* Returns name of the specified result column */
 		TrkString GetColumnName(const int Index) const;
 		/* Checks if the column value is NULL */
 		bool IsColumnNull(const int Index) const;
 		/* Checks if the column value is NULL */
-		bool IsColumnNull(const TrkString Name) const;
+		bool IsColumnNull(const TrkColumnName Name) const;
 		/* Returns the number of columns in the result set */
 		int GetColumnCount() const;
-		/* Returns the index of specified column name */
-		int GetColumnIndex(const TrkString Name) const;
+		/* Returns the index of specified column name, resolve it once to read many rows by index */
+		int GetColumnIndex(const TrkColumnName Name) const;
+
+		/* Return the current row decoded into a tuple, one type per column */
+		template <typename... Types>
+		std::tuple<Types...> GetRow() const;
+		/* Same as GetRow() without throwing, CODE_MISUSE without a row and CODE_RANGE for a wrong column count */
+		template <typename... Types>
+		TrkResult<std::tuple<Types...>> TryGetRow() const;
+		/* Return an input range which steps the statement and decodes every row into a tuple, one type per column */
+		template <typename... Types>
+		TrkRowRange<std::tuple<Types...>, Types...> Rows();
+		/* Same as Rows(), every row is built as Row{ column values... } */
+		template <typename Row, typename... Types>
+		TrkRowRange<Row, Types...> RowsAs();
 
 		/* Get the numeric result of error code (if any) */
 		int GetErrorCode() const;
@@ -216,6 +463,34 @@ namespace TrkSqlite
 		void CheckRow() const;
 		/* Check if there is a value index is in ther ange of columns in the result */
 		void CheckIndex(const int Index) const;
+		/* Check if the number of decoded types is the number of columns in the result */
+		void CheckColumnCount(const int Count) const;
+
+		/* Bind one value of BindAll() */
+		void BindValue(const int Index, const int32_t Value) { Bind(Index, Value); }
+		void BindValue(const int Index, const uint32_t Value) { Bind(Index, Value); }
+		void BindValue(const int Index, const int64_t Value) { Bind(Index, Value); }
+		void BindValue(const int Index, const double Value) { Bind(Index, Value); }
+		void BindValue(const int Index, const TrkString& Value) { Bind(Index, Value); }
+		void BindValue(const int Index, const char* Value) { BindText(Index, Value, -1); }
+		void BindValue(const int Index, std::string_view Value) { BindText(Index, Value.data(), static_cast<int>(Value.size())); }
+		void BindValue(const int Index, const TrkBlobView& Value) { Bind(Index, Value.data, static_cast<int>(Value.size)); }
+		void BindValue(const int Index, std::nullptr_t) { Bind(Index); }
+		template <typename T>
+		void BindValue(const int Index, const std::optional<T>& Value)
+		{
+			if (Value.has_value())
+			{
+				BindValue(Index, *Value);
+			}
+			else
+			{
+				Bind(Index);
+			}
+		}
+
+		/* Hands a finished or abandoned execution to the statement profiler */
+		void EndExecution() noexcept;
 
 		/* Prepare a statement object */
 		TrkSharedStatementPtr PrepareStatement();
@@ -229,7 +504,85 @@ namespace TrkSqlite
 		int column_count = 0;							// Number of columns in the result of the prepared statement
 		bool has_row = false;							// True when a row has been fetched with ExecuteStep()
 		bool done = false;								// True when the last ExecuteStep() had no more row to fetch
-		mutable std::map<TrkString, int> column_names;	// Map of columns index by name
+		TrkColumnNameIndex column_names;				// Index of columns by name, built when prepared
+		TrkStatementStats* stats = nullptr;				// Profiler counters of the query, null when not profiled
+		bool executing = false;							// True between the first step and the end of an execution
+		int64_t execution_time = 0;						// Step time of the running execution, in microseconds
+		int64_t execution_rows = 0;						// Rows fetched by the running execution
+	};
+
+	/* Lease of a cached prepared statement, hands it back reset and cleared on destruction */
+	class TrkStatementLease
+	{
+	public:
+		TrkStatementLease(TrkStatementCache* Cache, std::unique_ptr<TrkStatement> Statement);
+		~TrkStatementLease();
+
+		/* Disables copy, allows move */
+		TrkStatementLease(const TrkStatementLease&) = delete;
+		TrkStatementLease& operator=(const TrkStatementLease&) = delete;
+		TrkStatementLease(TrkStatementLease&& Other) noexcept;
+		TrkStatementLease& operator=(TrkStatementLease&& Other) = delete;
+
+		/* Access to the leased statement */
+		TrkStatement* operator->() const { return statement.get(); }
+		TrkStatement& operator*() const { return *statement; }
+
+	private:
+		TrkStatementCache* cache;					// Cache the statement goes back to
+		std::unique_ptr<TrkStatement> statement;	// Leased statement
+	};
+
+	/*
+	 *	Tintirek's Statement Cache Class
+	 *
+	 *	Keeps idle prepared statements keyed by their SQL text, so the
+	 *	same query is not compiled again for every request. A statement
+	 *	is used by one lease at a time; when every cached copy of a query
+	 *	is leased a new one is prepared. Idle statements are bounded and
+	 *	the least recently returned one is finalized first.
+	 */
+	class TrkStatementCache
+	{
+	public:
+		TrkStatementCache(const TrkDatabase& Database, size_t Capacity);
+
+		/* Disables copy */
+		TrkStatementCache(const TrkStatementCache&) = delete;
+		TrkStatementCache& operator=(const TrkStatementCache&) = delete;
+
+		/* Leases an idle statement of given query, preparing one if there is none */
+		TrkStatementLease Acquire(const TrkString Query);
+		/* Resets, clears and keeps a statement returned by a lease */
+		void Release(std::unique_ptr<TrkStatement> Statement) noexcept;
+
+		/* Sets the maximum number of idle statements, finalizing the extra ones */
+		void SetCapacity(size_t Capacity);
+		/* Returns the number of idle statements */
+		size_t GetSize() const;
+		/* Returns the number of leases served from the cache */
+		int64_t GetHits() const;
+		/* Returns the number of leases that prepared a new statement */
+		int64_t GetMisses() const;
+
+	private:
+		/* An idle statement */
+		struct Entry
+		{
+			std::string query;
+			std::unique_ptr<TrkStatement> statement;
+		};
+
+		/* Finalizes least recently used statements over the capacity, lock must be held */
+		void Trim();
+
+		const TrkDatabase& database;
+		mutable std::mutex mutex;
+		std::list<Entry> entries;	// Most recently returned first
+		std::unordered_multimap<std::string, std::list<Entry>::iterator> index;
+		size_t capacity;
+		int64_t hits = 0;
+		int64_t misses = 0;
 	};
 
 	/* Tintirek's Value Class */
@@ -256,6 +609,10 @@ namespace TrkSqlite
 		TrkString GetString() const;
 		/* Return the binary blob value of the column */
 		const void* GetBlob() const;
+		/* Return the text of the column without copying it, valid until the statement steps */
+		std::string_view GetStringView() const;
+		/* Return the blob of the column and its size without copying it, valid until the statement steps */
+		TrkBlobView GetBlobView() const;
 
 		/* Check if the value is an integer type value */
 		bool IsInt() const { return TrkSqlite::INTEGER == GetType(); }
@@ -327,6 +684,42 @@ namespace TrkSqlite
 		int index;
 	};
 
+	/*
+	 *	Tintirek's Backup Class
+	 *
+	 *	Online copy of a database into another with sqlite3_backup, a
+	 *	number of pages per step. The source connection can be used
+	 *	between steps: changes written through it are carried into the
+	 *	copy, changes written by other connections restart it. Source
+	 *	and destination must not be used by another thread during a step.
+	 */
+	class TrkBackup
+	{
+	public:
+		TrkBackup(TrkDatabase& Destination, TrkDatabase& Source);
+		~TrkBackup();
+
+		/* Disables copy and move */
+		TrkBackup(const TrkBackup&) = delete;
+		TrkBackup& operator=(const TrkBackup&) = delete;
+
+		/* Copies up to given pages, -1 copies all. Returns OK, DONE, BUSY or LOCKED and throws on other errors */
+		int ExecuteStep(const int Pages = -1);
+		/* Returns the number of pages left to copy after the last step */
+		int GetRemainingPages() const;
+		/* Returns the number of pages of the source at the last step */
+		int GetTotalPages() const;
+
+	private:
+		struct Deleter
+		{
+			void operator()(sqlite3_backup* Backup) noexcept;
+		};
+
+		std::unique_ptr<sqlite3_backup, Deleter> backup;
+		sqlite3* destination_db;	// Destination connection, for its error messages
+	};
+
 	/* Tintirek's Database Transaction Class */
 	class TrkTransaction
 	{
@@ -347,6 +740,194 @@ namespace TrkSqlite
 		TrkDatabase& database;	// Reference to the SQLite database connection
 		bool Commited;			// True when commit has been called
 	};
+
+	/*
+	 *	Decodes a column of the current row, specialized for every type
+	 *	GetRow() and Rows() accept, so an unsupported type fails to compile
+	 *	instead of converting at runtime. std::string_view and TrkBlobView
+	 *	point into the row and die with the next step; std::optional is
+	 *	empty for NULL, the other types read NULL as zero or empty.
+	 */
+	template <typename T>
+	struct TrkColumnReader
+	{
+		static_assert(sizeof(T) == 0, "Unsupported column type");
+	};
+
+	template <> struct TrkColumnReader<int32_t>
+	{
+		static int32_t Read(const TrkColumn& Column) { return Column.GetInt(); }
+	};
+
+	template <> struct TrkColumnReader<int64_t>
+	{
+		static int64_t Read(const TrkColumn& Column) { return Column.GetInt64(); }
+	};
+
+	template <> struct TrkColumnReader<bool>
+	{
+		static bool Read(const TrkColumn& Column) { return Column.GetInt() != 0; }
+	};
+
+	template <> struct TrkColumnReader<double>
+	{
+		static double Read(const TrkColumn& Column) { return Column.GetDouble(); }
+	};
+
+	template <> struct TrkColumnReader<std::string_view>
+	{
+		static std::string_view Read(const TrkColumn& Column) { return Column.GetStringView(); }
+	};
+
+	template <> struct TrkColumnReader<TrkBlobView>
+	{
+		static TrkBlobView Read(const TrkColumn& Column) { return Column.GetBlobView(); }
+	};
+
+	template <> struct TrkColumnReader<TrkString>
+	{
+		static TrkString Read(const TrkColumn& Column)
+		{
+			const std::string_view view = Column.GetStringView();
+			return view.empty() ? TrkString("") : TrkString(view.data(), view.data() + view.size());
+		}
+	};
+
+	template <typename T> struct TrkColumnReader<std::optional<T>>
+	{
+		static std::optional<T> Read(const TrkColumn& Column)
+		{
+			if (Column.IsNull())
+			{
+				return std::nullopt;
+			}
+			return TrkColumnReader<T>::Read(Column);
+		}
+	};
+
+	/*
+	 *	Tintirek's Row Range Class
+	 *
+	 *	Input range over the remaining rows of a statement, returned by
+	 *	TrkStatement::Rows() and RowsAs(). Every increment steps the
+	 *	statement and decodes the row straight from SQLite, with no
+	 *	TrkValue and no column bound checks per value. It can be iterated
+	 *	once; reset the statement to run it again.
+	 */
+	template <typename Row, typename... Types>
+	class TrkRowRange
+	{
+	public:
+		class Iterator
+		{
+		public:
+			using iterator_category = std::input_iterator_tag;
+			using value_type = Row;
+			using difference_type = std::ptrdiff_t;
+			using pointer = const Row*;
+			using reference = const Row&;
+
+			Iterator() = default;
+			explicit Iterator(TrkStatement* Statement) : statement(Statement) { Next(); }
+
+			reference operator*() const { return *row; }
+			pointer operator->() const { return &*row; }
+			Iterator& operator++() { Next(); return *this; }
+			void operator++(int) { Next(); }
+
+			bool operator==(const Iterator& Other) const { return statement == Other.statement; }
+			bool operator!=(const Iterator& Other) const { return statement != Other.statement; }
+
+		private:
+			/* Steps the statement, the iterator becomes the end one when there is no more row */
+			void Next()
+			{
+				if (statement->ExecuteStep())
+				{
+					row.emplace(Decode(statement->GetPreparedStatement()));
+				}
+				else
+				{
+					statement = nullptr;
+					row.reset();
+				}
+			}
+
+			TrkStatement* statement = nullptr;	// Stepped statement, null at the end
+			std::optional<Row> row;				// Current decoded row
+		};
+
+		explicit TrkRowRange(TrkStatement& Statement) : statement(&Statement) {}
+
+		/* Fetches the first row */
+		Iterator begin() { return Iterator(statement); }
+		Iterator end() { return Iterator(); }
+
+		/* Decodes the current row of a statement */
+		static Row Decode(sqlite3_stmt* Statement)
+		{
+			return Decode(Statement, std::index_sequence_for<Types...>());
+		}
+
+	private:
+		template <size_t... Indexes>
+		static Row Decode(sqlite3_stmt* Statement, std::index_sequence<Indexes...>)
+		{
+			return Row{ TrkColumnReader<Types>::Read(TrkColumn(Statement, static_cast<int>(Indexes)))... };
+		}
+
+		TrkStatement* statement;
+	};
+
+	template <typename... Args>
+	void TrkStatement::BindAll(const Args&... Values)
+	{
+		if (static_cast<int>(sizeof...(Args)) != GetParameterCount())
+		{
+			TrkString message = "BindAll got ";
+			message << static_cast<int>(sizeof...(Args)) << " values for " << GetParameterCount() << " parameters";
+			throw TrkDatabaseException(message);
+		}
+
+		int index = 1;
+		(BindValue(index++, Values), ...);
+		(void)index;
+	}
+
+	template <typename... Types>
+	std::tuple<Types...> TrkStatement::GetRow() const
+	{
+		CheckRow();
+		CheckColumnCount(static_cast<int>(sizeof...(Types)));
+		return TrkRowRange<std::tuple<Types...>, Types...>::Decode(GetPreparedStatement());
+	}
+
+	template <typename... Types>
+	TrkResult<std::tuple<Types...>> TrkStatement::TryGetRow() const
+	{
+		if (!has_row)
+		{
+			return TrkResult<std::tuple<Types...>>::Error(CODE_MISUSE);
+		}
+		if (static_cast<int>(sizeof...(Types)) != column_count)
+		{
+			return TrkResult<std::tuple<Types...>>::Error(CODE_RANGE);
+		}
+		return TrkRowRange<std::tuple<Types...>, Types...>::Decode(prepared_statement.get());
+	}
+
+	template <typename... Types>
+	TrkRowRange<std::tuple<Types...>, Types...> TrkStatement::Rows()
+	{
+		return RowsAs<std::tuple<Types...>, Types...>();
+	}
+
+	template <typename Row, typename... Types>
+	TrkRowRange<Row, Types...> TrkStatement::RowsAs()
+	{
+		CheckColumnCount(static_cast<int>(sizeof...(Types)));
+		return TrkRowRange<Row, Types...>(*this);
+	}
 }
 
 #endif /* TRK_SQLITE3_H */
\ No newline at end of file
@@ -0,0 +1,189 @@
+/*
+ *	statementprofiler.cpp
+ *
+ *	Tintirek's per-statement SQLite timing
+ */
+
+
+#include "statementprofiler.h"
+
+#include <chrono>
+
+
+/* Counters the busy handler of this thread charges, set while a profiled statement steps */
+thread_local TrkSqlite::TrkStatementStats* current_statement = nullptr;
+
+/* Key of the entry shared by the SQL texts beyond the profiler size */
+static const char* OVERFLOW_QUERY = "(other statements)";
+
+
+/* Raises an atomic maximum */
+static void UpdateMax(std::atomic<int64_t>& Max, int64_t Value)
+{
+	int64_t current = Max.load(std::memory_order_relaxed);
+	while (current < Value && !Max.compare_exchange_weak(current, Value, std::memory_order_relaxed)) { }
+}
+
+
+TrkSqlite::TrkStatementProfiler& TrkSqlite::TrkStatementProfiler::Get()
+{
+	static TrkStatementProfiler profiler;
+	return profiler;
+}
+
+void TrkSqlite::TrkStatementProfiler::SetSlowStatementHandler(std::function<void(const TrkSlowStatement&)> Handler)
+{
+	std::lock_guard<std::mutex> lock(slow_mutex);
+	slow_handler = std::move(Handler);
+}
+
+TrkSqlite::TrkStatementStats* TrkSqlite::TrkStatementProfiler::Register(const TrkString& Query)
+{
+	if (!IsEnabled())
+	{
+		return nullptr;
+	}
+
+	const std::string key(Query.c_str(), Query.size());
+
+	{
+		std::shared_lock<std::shared_mutex> lock(stats_mutex);
+		auto it = stats.find(key);
+		if (it != stats.end())
+		{
+			return it->second.get();
+		}
+	}
+
+	std::unique_lock<std::shared_mutex> lock(stats_mutex);
+	auto it = stats.find(key);
+	if (it != stats.end())
+	{
+		return it->second.get();
+	}
+	if (stats.size() >= TRK_STATEMENT_PROFILER_SIZE)
+	{
+		return &overflow;
+	}
+	return stats.emplace(key, std::unique_ptr<TrkStatementStats>(new TrkStatementStats())).first->second.get();
+}
+
+bool TrkSqlite::TrkStatementProfiler::RecordExecution(TrkStatementStats* Stats, int64_t Microseconds, int64_t Rows)
+{
+	Stats->calls.fetch_add(1, std::memory_order_relaxed);
+	Stats->rows.fetch_add(Rows, std::memory_order_relaxed);
+	Stats->total_time.fetch_add(Microseconds, std::memory_order_relaxed);
+	UpdateMax(Stats->max_time, Microseconds);
+
+	const int64_t threshold = GetSlowThreshold();
+	if (threshold > 0 && Microseconds >= threshold)
+	{
+		Stats->slow.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+	return false;
+}
+
+void TrkSqlite::TrkStatementProfiler::RecordSlow(int64_t Microseconds, const TrkString& Query)
+{
+	TrkSlowStatement statement;
+	statement.timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	statement.duration = Microseconds;
+	statement.query = Query;
+
+	std::function<void(const TrkSlowStatement&)> handler;
+	{
+		std::lock_guard<std::mutex> lock(slow_mutex);
+		if (slow_statements.size() >= TRK_SLOW_STATEMENT_LOG_SIZE)
+		{
+			slow_statements.pop_front();
+		}
+		slow_statements.push_back(statement);
+		handler = slow_handler;
+	}
+
+	if (handler)
+	{
+		handler(statement);
+	}
+}
+
+TrkSqlite::TrkStatementStats* TrkSqlite::TrkStatementProfiler::SetCurrent(TrkStatementStats* Stats)
+{
+	TrkStatementStats* previous = current_statement;
+	current_statement = Stats;
+	return previous;
+}
+
+void TrkSqlite::TrkStatementProfiler::CountBusyRetry()
+{
+	busy_retries.fetch_add(1, std::memory_order_relaxed);
+	if (current_statement != nullptr)
+	{
+		current_statement->busy_retries.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+std::vector<TrkSqlite::TrkStatementStatsSnapshot> TrkSqlite::TrkStatementProfiler::Snapshot() const
+{
+	auto copy = [](const char* Query, const TrkStatementStats& Stats)
+	{
+		return TrkStatementStatsSnapshot{
+			Query,
+			Stats.calls.load(std::memory_order_relaxed),
+			Stats.rows.load(std::memory_order_relaxed),
+			Stats.total_time.load(std::memory_order_relaxed),
+			Stats.max_time.load(std::memory_order_relaxed),
+			Stats.busy_retries.load(std::memory_order_relaxed),
+			Stats.slow.load(std::memory_order_relaxed),
+		};
+	};
+
+	std::vector<TrkStatementStatsSnapshot> snapshots;
+	std::shared_lock<std::shared_mutex> lock(stats_mutex);
+	snapshots.reserve(stats.size() + 1);
+
+	for (const auto& entry : stats)
+	{
+		snapshots.push_back(copy(entry.first.c_str(), *entry.second));
+	}
+	if (overflow.calls.load(std::memory_order_relaxed) > 0)
+	{
+		snapshots.push_back(copy(OVERFLOW_QUERY, overflow));
+	}
+	return snapshots;
+}
+
+std::vector<TrkSqlite::TrkSlowStatement> TrkSqlite::TrkStatementProfiler::GetSlowStatements() const
+{
+	std::lock_guard<std::mutex> lock(slow_mutex);
+	return std::vector<TrkSlowStatement>(slow_statements.begin(), slow_statements.end());
+}
+
+void TrkSqlite::TrkStatementProfiler::Reset()
+{
+	auto zero = [](TrkStatementStats& Stats)
+	{
+		Stats.calls.store(0, std::memory_order_relaxed);
+		Stats.rows.store(0, std::memory_order_relaxed);
+		Stats.total_time.store(0, std::memory_order_relaxed);
+		Stats.max_time.store(0, std::memory_order_relaxed);
+		Stats.busy_retries.store(0, std::memory_order_relaxed);
+		Stats.slow.store(0, std::memory_order_relaxed);
+	};
+
+	{
+		// Statements keep pointers to their counters, entries are zeroed instead of removed
+		std::shared_lock<std::shared_mutex> lock(stats_mutex);
+		for (auto& entry : stats)
+		{
+			zero(*entry.second);
+		}
+		zero(overflow);
+	}
+
+	busy_retries.store(0, std::memory_order_relaxed);
+
+	std::lock_guard<std::mutex> lock(slow_mutex);
+	slow_statements.clear();
+}
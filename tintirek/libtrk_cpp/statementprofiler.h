@@ -0,0 +1,141 @@
+/*
+ *	statementprofiler.h
+ *
+ *	Tintirek's per-statement SQLite timing
+ */
+
+#ifndef TRK_STATEMENTPROFILER_H
+#define TRK_STATEMENTPROFILER_H
+
+#include "trk_types.h"
+#include "trkstring.h"
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+/* Maximum number of distinct SQL texts counted on their own, the rest share one entry */
+#define TRK_STATEMENT_PROFILER_SIZE 1024
+
+/* Number of slow statements kept, older ones are dropped */
+#define TRK_SLOW_STATEMENT_LOG_SIZE 128
+
+
+namespace TrkSqlite
+{
+	/* Counters of one SQL text, shared by every prepared copy of it */
+	struct TrkStatementStats
+	{
+		/* Executions, counted when they are done or reset */
+		std::atomic<int64_t> calls{ 0 };
+		/* Rows fetched */
+		std::atomic<int64_t> rows{ 0 };
+		/* Time spent in sqlite3_step, in microseconds */
+		std::atomic<int64_t> total_time{ 0 };
+		/* Longest execution, in microseconds */
+		std::atomic<int64_t> max_time{ 0 };
+		/* Times the busy handler waited for a lock */
+		std::atomic<int64_t> busy_retries{ 0 };
+		/* Executions at or above the slow threshold */
+		std::atomic<int64_t> slow{ 0 };
+	};
+
+	/* Copy of the counters of one SQL text */
+	struct TrkStatementStatsSnapshot
+	{
+		TrkString query;
+		int64_t calls;
+		int64_t rows;
+		int64_t total_time;
+		int64_t max_time;
+		int64_t busy_retries;
+		int64_t slow;
+	};
+
+	/* An execution at or above the slow threshold */
+	struct TrkSlowStatement
+	{
+		/* Unix time in milliseconds at the end of the execution */
+		int64_t timestamp;
+		/* Time spent in sqlite3_step, in microseconds */
+		int64_t duration;
+		/* SQL text as it was prepared, without the values bound to it */
+		TrkString query;
+	};
+
+	/*
+	 *	Tintirek's Statement Profiler Class
+	 *
+	 *	Counts executions, rows, step time and busy waits of every SQL
+	 *	text. A statement looks its counters up once when it is prepared,
+	 *	afterwards an execution costs two clock reads per step and a few
+	 *	relaxed atomic adds when it ends. Executions slower than the
+	 *	threshold are kept with their expanded SQL and handed to the slow
+	 *	statement handler, on the thread that ran them.
+	 */
+	class TrkStatementProfiler
+	{
+	public:
+		/* Returns the process-wide profiler */
+		static TrkStatementProfiler& Get();
+
+		/* Disables copy and move */
+		TrkStatementProfiler(const TrkStatementProfiler&) = delete;
+		TrkStatementProfiler& operator=(const TrkStatementProfiler&) = delete;
+
+		/* Statements prepared while disabled are not counted, disabled by default */
+		void SetEnabled(bool Enabled) { enabled.store(Enabled, std::memory_order_relaxed); }
+		bool IsEnabled() const { return enabled.load(std::memory_order_relaxed); }
+
+		/* Sets the slow statement threshold in microseconds, 0 disables the slow statement log */
+		void SetSlowThreshold(int64_t Microseconds) { slow_threshold.store(Microseconds, std::memory_order_relaxed); }
+		int64_t GetSlowThreshold() const { return slow_threshold.load(std::memory_order_relaxed); }
+		/* Sets the function called with every slow statement */
+		void SetSlowStatementHandler(std::function<void(const TrkSlowStatement&)> Handler);
+
+		/* Returns the counters of given SQL text, null while disabled. The pointer stays valid for the process */
+		TrkStatementStats* Register(const TrkString& Query);
+		/* Ends an execution of given counters, returns true when it reached the slow threshold */
+		bool RecordExecution(TrkStatementStats* Stats, int64_t Microseconds, int64_t Rows);
+		/* Keeps a slow execution and passes it to the handler */
+		void RecordSlow(int64_t Microseconds, const TrkString& Query);
+
+		/* Sets the counters the busy handler of this thread charges, returns the previous ones */
+		static TrkStatementStats* SetCurrent(TrkStatementStats* Stats);
+		/* Counts a wait of the busy handler */
+		void CountBusyRetry();
+
+		/* Returns the counters of every SQL text */
+		std::vector<TrkStatementStatsSnapshot> Snapshot() const;
+		/* Returns the kept slow statements, oldest first */
+		std::vector<TrkSlowStatement> GetSlowStatements() const;
+		/* Zeroes all counters and drops the slow statements */
+		void Reset();
+
+		/* Busy handler waits of all statements, also those not profiled */
+		std::atomic<int64_t> busy_retries{ 0 };
+
+	private:
+		TrkStatementProfiler() = default;
+
+		std::atomic<bool> enabled{ false };
+		std::atomic<int64_t> slow_threshold{ 0 };
+
+		mutable std::shared_mutex stats_mutex;
+		std::unordered_map<std::string, std::unique_ptr<TrkStatementStats>> stats;
+		/* Shared by the SQL texts beyond TRK_STATEMENT_PROFILER_SIZE */
+		TrkStatementStats overflow;
+
+		mutable std::mutex slow_mutex;
+		std::deque<TrkSlowStatement> slow_statements;
+		std::function<void(const TrkSlowStatement&)> slow_handler;
+	};
+}
+
+#endif /* TRK_STATEMENTPROFILER_H */
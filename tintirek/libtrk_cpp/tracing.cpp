@@ -0,0 +1,257 @@
+/*
+ *	tracing.cpp
+ *
+ *	Tintirek's lightweight span tracing
+ */
+
+
+#include "tracing.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <sstream>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <unistd.h>
+#endif
+
+
+/* Index mask of a trace buffer */
+static constexpr uint64_t buffer_mask = TRK_TRACE_BUFFER_SIZE - 1;
+static_assert((TRK_TRACE_BUFFER_SIZE & buffer_mask) == 0, "TRK_TRACE_BUFFER_SIZE must be a power of two");
+
+/* Request ID of the calling thread */
+thread_local uint64_t current_request_id = 0;
+
+
+/* Returns the buffer to the tracer when its thread exits */
+class TrkTraceBufferLease
+{
+public:
+	~TrkTraceBufferLease()
+	{
+		if (buffer != nullptr)
+		{
+			TrkTracer::Get().ReleaseBuffer(buffer);
+		}
+	}
+
+	TrkTraceBuffer* buffer = nullptr;
+};
+
+thread_local TrkTraceBufferLease thread_buffer;
+
+
+/* Returns the identifier of this process */
+static unsigned long GetTraceProcessId()
+{
+#ifdef _WIN32
+	return static_cast<unsigned long>(GetCurrentProcessId());
+#else
+	return static_cast<unsigned long>(getpid());
+#endif
+}
+
+
+void TrkTraceBuffer::Append(const char* Name, const char* Detail, uint64_t RequestId, int64_t StartUs, int64_t DurationUs)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	TrkTraceEvent& event = events[written & buffer_mask];
+	event.name = Name;
+	event.detail = Detail;
+	event.request_id = RequestId;
+	event.start_us = StartUs;
+	event.duration_us = DurationUs;
+	event.thread_id = id;
+	written++;
+}
+
+void TrkTraceBuffer::CopyTo(std::vector<TrkTraceEvent>& Events) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	const uint64_t count = std::min<uint64_t>(written, TRK_TRACE_BUFFER_SIZE);
+	for (uint64_t i = written - count; i < written; i++)
+	{
+		Events.push_back(events[i & buffer_mask]);
+	}
+}
+
+
+TrkTracer& TrkTracer::Get()
+{
+	static TrkTracer tracer;
+	return tracer;
+}
+
+TrkTracer::TrkTracer()
+	: enabled(false)
+	, epoch(std::chrono::steady_clock::now())
+	, process_name("tintirek")
+{ }
+
+void TrkTracer::SetProcessName(const TrkString& Name)
+{
+	std::lock_guard<std::mutex> lock(buffers_mutex);
+	process_name = Name;
+}
+
+void TrkTracer::Record(const char* Name, std::chrono::steady_clock::time_point Start, std::chrono::steady_clock::time_point End, const char* Detail)
+{
+	const int64_t start_us = std::chrono::duration_cast<std::chrono::microseconds>(Start - epoch).count();
+	const int64_t duration_us = End > Start ? std::chrono::duration_cast<std::chrono::microseconds>(End - Start).count() : 0;
+	GetThreadBuffer()->Append(Name, Detail, current_request_id, start_us, duration_us);
+}
+
+TrkTraceBuffer* TrkTracer::GetThreadBuffer()
+{
+	if (thread_buffer.buffer != nullptr)
+	{
+		return thread_buffer.buffer;
+	}
+
+	std::lock_guard<std::mutex> lock(buffers_mutex);
+	if (!free_buffers.empty())
+	{
+		thread_buffer.buffer = free_buffers.back();
+		free_buffers.pop_back();
+	}
+	else
+	{
+		buffers.push_back(std::make_unique<TrkTraceBuffer>(static_cast<uint32_t>(buffers.size() + 1)));
+		thread_buffer.buffer = buffers.back().get();
+	}
+
+	return thread_buffer.buffer;
+}
+
+void TrkTracer::ReleaseBuffer(TrkTraceBuffer* Buffer)
+{
+	std::lock_guard<std::mutex> lock(buffers_mutex);
+	free_buffers.push_back(Buffer);
+}
+
+TrkString TrkTracer::DumpChromeJson(size_t Limit) const
+{
+	std::vector<TrkTraceEvent> events;
+	std::string name;
+	{
+		std::lock_guard<std::mutex> lock(buffers_mutex);
+		for (const auto& buffer : buffers)
+		{
+			buffer->CopyTo(events);
+		}
+		name = process_name.c_str();
+	}
+
+	std::sort(events.begin(), events.end(), [](const TrkTraceEvent& a, const TrkTraceEvent& b) {
+		return a.start_us < b.start_us;
+	});
+
+	size_t first = 0;
+	if (Limit > 0 && events.size() > Limit)
+	{
+		first = events.size() - Limit;
+	}
+
+	const unsigned long pid = GetTraceProcessId();
+	std::stringstream ss;
+	ss << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	ss << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"args\":{\"name\":\"" << name << "\"}}";
+
+	for (size_t i = first; i < events.size(); i++)
+	{
+		const TrkTraceEvent& event = events[i];
+		ss << ",{\"name\":\"" << event.name << "\",\"cat\":\"" << name << "\",\"ph\":\"X\""
+			<< ",\"ts\":" << event.start_us
+			<< ",\"dur\":" << event.duration_us
+			<< ",\"pid\":" << pid
+			<< ",\"tid\":" << event.thread_id;
+
+		if (event.request_id != 0 || event.detail != nullptr)
+		{
+			ss << ",\"args\":{";
+			if (event.request_id != 0)
+			{
+				ss << "\"request\":\"" << FormatRequestId(event.request_id) << "\"" << (event.detail != nullptr ? "," : "");
+			}
+			if (event.detail != nullptr)
+			{
+				ss << "\"detail\":\"" << event.detail << "\"";
+			}
+			ss << "}";
+		}
+
+		ss << "}";
+	}
+
+	ss << "]}";
+	return TrkString(ss.str().c_str());
+}
+
+bool TrkTracer::WriteChromeJson(const TrkString& Path) const
+{
+	std::ofstream file(Path.c_str(), std::ios::trunc);
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	file << DumpChromeJson();
+	return file.good();
+}
+
+uint64_t TrkTracer::NewRequestId()
+{
+	static std::atomic<uint64_t> next_id([]() {
+		std::random_device random;
+		return (static_cast<uint64_t>(random()) << 32) ^ random() ^ static_cast<uint64_t>(std::chrono::system_clock::now().time_since_epoch().count());
+	}());
+
+	// Weyl sequence, unique within the process and unlikely to collide with other processes
+	uint64_t id = next_id.fetch_add(0x9E3779B97F4A7C15ULL, std::memory_order_relaxed);
+	return id != 0 ? id : next_id.fetch_add(0x9E3779B97F4A7C15ULL, std::memory_order_relaxed);
+}
+
+void TrkTracer::SetCurrentRequest(uint64_t RequestId)
+{
+	current_request_id = RequestId;
+}
+
+uint64_t TrkTracer::GetCurrentRequest()
+{
+	return current_request_id;
+}
+
+TrkString TrkTracer::FormatRequestId(uint64_t RequestId)
+{
+	char hex[17];
+	std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(RequestId));
+	return TrkString(hex);
+}
+
+uint64_t TrkTracer::ParseRequestId(const TrkString& Value)
+{
+	if (Value.size() == 0 || Value.size() > 16)
+	{
+		return 0;
+	}
+
+	uint64_t id = 0;
+	for (const char* c = Value.c_str(); *c != '\0'; c++)
+	{
+		if (!std::isxdigit(static_cast<unsigned char>(*c)))
+		{
+			return 0;
+		}
+
+		id = (id << 4) | static_cast<uint64_t>(std::isdigit(static_cast<unsigned char>(*c)) ? *c - '0' : (std::tolower(static_cast<unsigned char>(*c)) - 'a' + 10));
+	}
+
+	return id;
+}
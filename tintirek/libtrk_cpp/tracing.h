@@ -0,0 +1,187 @@
+/*
+ *	tracing.h
+ *
+ *	Tintirek's lightweight span tracing
+ */
+
+#ifndef TRK_TRACING_H
+#define TRK_TRACING_H
+
+#include "trk_types.h"
+#include "trkstring.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+/* Number of spans kept per thread buffer, older spans are overwritten */
+#define TRK_TRACE_BUFFER_SIZE 4096
+
+
+/* A finished span */
+struct TrkTraceEvent
+{
+	/* Name of the span, always a string literal */
+	const char* name;
+	/* Optional detail of the span, a string literal or null */
+	const char* detail;
+	/* Request the span belongs to, zero if none */
+	uint64_t request_id;
+	/* Start time in microseconds since the tracer was created */
+	int64_t start_us;
+	/* Duration in microseconds */
+	int64_t duration_us;
+	/* Identifier of the buffer (thread slot) that recorded the span */
+	uint32_t thread_id;
+};
+
+
+/*
+ *	Span buffer of a single thread
+ *
+ *	Only its owner thread appends, so the mutex is uncontended except
+ *	while a dump copies the buffer. When the owner exits the buffer is
+ *	handed over to the next new thread, keeping its recorded spans.
+ */
+class TrkTraceBuffer
+{
+public:
+	TrkTraceBuffer(uint32_t Id)
+		: id(Id)
+	{ }
+
+	/* Appends an event, overwriting the oldest one when full */
+	void Append(const char* Name, const char* Detail, uint64_t RequestId, int64_t StartUs, int64_t DurationUs);
+	/* Copies recorded events into given list */
+	void CopyTo(std::vector<TrkTraceEvent>& Events) const;
+
+	/* Identifier of this buffer */
+	const uint32_t id;
+
+private:
+	mutable std::mutex mutex;
+	TrkTraceEvent events[TRK_TRACE_BUFFER_SIZE];
+	uint64_t written = 0;
+};
+
+
+/*
+ *	Process-wide tracer
+ *
+ *	Spans are recorded into per-thread ring buffers and can be dumped
+ *	on demand as Chrome trace-event JSON, which trace viewers such as
+ *	chrome://tracing and Perfetto open directly. Every span carries
+ *	the request ID of the calling thread, the client sends its own ID
+ *	while authenticating so both sides of a request can be matched.
+ */
+class TrkTracer
+{
+public:
+	/* Returns the process-wide tracer */
+	static TrkTracer& Get();
+
+	/* Enables or disables recording, disabled spans cost a single load */
+	void SetEnabled(bool Enabled) { enabled.store(Enabled, std::memory_order_relaxed); }
+	/* Returns true if spans are recorded */
+	bool IsEnabled() const { return enabled.load(std::memory_order_relaxed); }
+	/* Sets the process name shown in trace viewers */
+	void SetProcessName(const TrkString& Name);
+
+	/* Records a finished span for the request of the calling thread */
+	void Record(const char* Name, std::chrono::steady_clock::time_point Start, std::chrono::steady_clock::time_point End, const char* Detail = nullptr);
+
+	/* Builds Chrome trace-event JSON from the most recent spans, all spans if Limit is zero */
+	TrkString DumpChromeJson(size_t Limit = 0) const;
+	/* Writes Chrome trace-event JSON into given file */
+	bool WriteChromeJson(const TrkString& Path) const;
+
+	/* Returns a new process-unique request ID */
+	static uint64_t NewRequestId();
+	/* Sets the request ID of the calling thread */
+	static void SetCurrentRequest(uint64_t RequestId);
+	/* Returns the request ID of the calling thread */
+	static uint64_t GetCurrentRequest();
+
+	/* Formats a request ID as 16 hex digits */
+	static TrkString FormatRequestId(uint64_t RequestId);
+	/* Parses a request ID, returns zero if it is not valid */
+	static uint64_t ParseRequestId(const TrkString& Value);
+
+	/* Hands the buffer of an exiting thread over to the next thread */
+	void ReleaseBuffer(TrkTraceBuffer* Buffer);
+
+private:
+	TrkTracer();
+
+	/* Returns the buffer of the calling thread */
+	TrkTraceBuffer* GetThreadBuffer();
+
+	std::atomic<bool> enabled;
+	/* Time point all span timestamps are relative to */
+	const std::chrono::steady_clock::time_point epoch;
+
+	mutable std::mutex buffers_mutex;
+	std::vector<std::unique_ptr<TrkTraceBuffer>> buffers;
+	std::vector<TrkTraceBuffer*> free_buffers;
+	TrkString process_name;
+};
+
+
+/* Records the lifetime of this object as a span */
+class TrkTraceSpan
+{
+public:
+	TrkTraceSpan(const char* Name, const char* Detail = nullptr)
+		: name(Name)
+		, detail(Detail)
+		, enabled(TrkTracer::Get().IsEnabled())
+	{
+		if (enabled)
+		{
+			start = std::chrono::steady_clock::now();
+		}
+	}
+
+	~TrkTraceSpan()
+	{
+		if (enabled)
+		{
+			TrkTracer::Get().Record(name, start, std::chrono::steady_clock::now(), detail);
+		}
+	}
+
+	/* Disables copy */
+	TrkTraceSpan(const TrkTraceSpan&) = delete;
+	TrkTraceSpan& operator=(const TrkTraceSpan&) = delete;
+
+private:
+	const char* name;
+	const char* detail;
+	const bool enabled;
+	std::chrono::steady_clock::time_point start;
+};
+
+
+/* Sets the request ID of the calling thread for the lifetime of this object */
+class TrkTraceRequestScope
+{
+public:
+	TrkTraceRequestScope(uint64_t RequestId = TrkTracer::NewRequestId())
+		: previous(TrkTracer::GetCurrentRequest())
+	{
+		TrkTracer::SetCurrentRequest(RequestId);
+	}
+
+	~TrkTraceRequestScope()
+	{
+		TrkTracer::SetCurrentRequest(previous);
+	}
+
+private:
+	const uint64_t previous;
+};
+
+
+#endif /* TRK_TRACING_H */
@@ -12,20 +12,24 @@
 
 /* Includes of all commands */
 #include "commands/add.h"
+#include "commands/admin.h"
 #include "commands/edit.h"
 #include "commands/info.h"
 #include "commands/login.h"
 #include "commands/logout.h"
 #include "commands/trust.h"
+#include "commands/upload.h"
 
 
 /* All commands are generated here */
 TrkCliCommand* trkAddCommand = new TrkCliAddCommand;
+TrkCliCommand* trkAdminCommand = new TrkCliAdminCommand;
 TrkCliCommand* trkEditCommand = new TrkCliEditCommand;
 TrkCliCommand* trkInfoCommand = new TrkCliInfoCommand;
 TrkCliCommand* trkLoginCommand = new TrkCliLoginCommand;
 TrkCliCommand* trkLogoutCommand = new TrkCliLogoutCommand;
 TrkCliCommand* trkTrustCommand = new TrkCliTrustCommand;
+TrkCliCommand* trkUploadCommand = new TrkCliUploadCommand;
 
 
 
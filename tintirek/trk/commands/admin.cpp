@@ -0,0 +1,337 @@
+/*
+ *	admin.cpp
+ *
+ *	Tintirek's admin command source file
+ */
+
+
+#include "admin.h"
+
+#include <cctype>
+#include <ctime>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <utility>
+
+#include "connect.h"
+
+
+/* Splits "key=value;" formatted server output into pairs */
+static std::vector<std::pair<std::string, std::string>> ParseKeyValues(const TrkString& Data)
+{
+	std::vector<std::pair<std::string, std::string>> values;
+	std::string data(Data);
+	size_t pos = 0;
+	size_t semicolonPos;
+
+	if (!data.empty() && data.back() != ';')
+	{
+		data += ';';
+	}
+
+	while ((semicolonPos = data.find(';', pos)) != std::string::npos)
+	{
+		std::string param = data.substr(pos, semicolonPos - pos);
+		size_t equalSignPos = param.find('=');
+		if (equalSignPos != std::string::npos)
+		{
+			values.emplace_back(param.substr(0, equalSignPos), param.substr(equalSignPos + 1));
+		}
+		pos = semicolonPos + 1;
+	}
+
+	return values;
+}
+
+/* Prints the output of GetStatistics command */
+static bool PrintStatistics(TrkCliClientOptionResults* ClientResults)
+{
+	TrkString returned, errmsg;
+	if (!TrkConnectHelper::SendCommand(*ClientResults, "GetStatistics", errmsg, returned))
+	{
+		std::cerr << errmsg << std::endl;
+		return true;
+	}
+
+	std::vector<std::pair<std::string, std::string>> commands;
+	for (const auto& value : ParseKeyValues(returned))
+	{
+		if (value.first.rfind("command.", 0) == 0)
+		{
+			commands.emplace_back(value.first.substr(8), value.second);
+		}
+		else
+		{
+			std::cout << std::left << std::setw(24) << value.first << value.second << std::endl;
+		}
+	}
+
+	if (commands.empty())
+	{
+		return true;
+	}
+
+	std::cout << std::endl << std::left
+		<< std::setw(20) << "Command"
+		<< std::setw(10) << "Phase"
+		<< std::right
+		<< std::setw(10) << "Count"
+		<< std::setw(12) << "p50(us)"
+		<< std::setw(12) << "p99(us)"
+		<< std::setw(12) << "p999(us)"
+		<< std::setw(12) << "max(us)" << std::endl;
+
+	for (const auto& command : commands)
+	{
+		// <command>.<phase>=count,p50,p99,p999,max
+		size_t dotPos = command.first.rfind('.');
+		std::cout << std::left
+			<< std::setw(20) << command.first.substr(0, dotPos)
+			<< std::setw(10) << command.first.substr(dotPos + 1)
+			<< std::right;
+
+		size_t pos = 0, commaPos, column = 0;
+		std::string fields = command.second + ",";
+		while ((commaPos = fields.find(',', pos)) != std::string::npos)
+		{
+			std::cout << std::setw(column == 0 ? 10 : 12) << fields.substr(pos, commaPos - pos);
+			pos = commaPos + 1;
+			column++;
+		}
+		std::cout << std::endl;
+	}
+
+	return true;
+}
+
+
+/* Prints spans of the server as Chrome trace-event JSON */
+static bool PrintTrace(TrkCliClientOptionResults* ClientResults)
+{
+	TrkString returned, errmsg;
+	if (!TrkConnectHelper::SendCommand(*ClientResults, "GetTrace", errmsg, returned))
+	{
+		std::cerr << errmsg << std::endl;
+		return true;
+	}
+
+	std::cout << returned << std::endl;
+	return true;
+}
+
+
+/* Splits tab separated lines of server output into their fields */
+static std::vector<std::vector<std::string>> ParseLines(const TrkString& Data)
+{
+	std::vector<std::vector<std::string>> lines;
+	std::stringstream ss{ std::string(Data) };
+	std::string line;
+
+	while (std::getline(ss, line))
+	{
+		if (line.empty())
+		{
+			continue;
+		}
+
+		std::vector<std::string> fields;
+		size_t pos = 0, tabPos;
+		while ((tabPos = line.find('\t', pos)) != std::string::npos)
+		{
+			fields.push_back(line.substr(pos, tabPos - pos));
+			pos = tabPos + 1;
+		}
+		fields.push_back(line.substr(pos));
+		lines.push_back(fields);
+	}
+
+	return lines;
+}
+
+/* Prints the statements that took the most database time */
+static bool PrintStatements(TrkCliClientOptionResults* ClientResults)
+{
+	TrkString returned, errmsg;
+	if (!TrkConnectHelper::SendCommand(*ClientResults, "GetStatementStats", errmsg, returned))
+	{
+		std::cerr << errmsg << std::endl;
+		return true;
+	}
+
+	std::cout << std::right
+		<< std::setw(10) << "Calls"
+		<< std::setw(10) << "Rows"
+		<< std::setw(14) << "Total(us)"
+		<< std::setw(12) << "Max(us)"
+		<< std::setw(8) << "Busy"
+		<< std::setw(8) << "Slow"
+		<< "  Statement" << std::endl;
+
+	for (const auto& fields : ParseLines(returned))
+	{
+		// calls, rows, total, max, busy, slow, statement
+		if (fields.size() < 7)
+		{
+			continue;
+		}
+
+		std::cout << std::right
+			<< std::setw(10) << fields[0]
+			<< std::setw(10) << fields[1]
+			<< std::setw(14) << fields[2]
+			<< std::setw(12) << fields[3]
+			<< std::setw(8) << fields[4]
+			<< std::setw(8) << fields[5]
+			<< "  " << fields[6] << std::endl;
+	}
+	return true;
+}
+
+/* Prints the last slow statements of the server */
+static bool PrintSlowStatements(TrkCliClientOptionResults* ClientResults)
+{
+	TrkString returned, errmsg;
+	if (!TrkConnectHelper::SendCommand(*ClientResults, "GetSlowStatements", errmsg, returned))
+	{
+		std::cerr << errmsg << std::endl;
+		return true;
+	}
+
+	std::cout << std::left << std::setw(21) << "Time" << std::right << std::setw(12) << "Took(ms)" << "  Statement" << std::endl;
+
+	for (const auto& fields : ParseLines(returned))
+	{
+		// unix time in ms, duration in us, statement
+		if (fields.size() < 3)
+		{
+			continue;
+		}
+
+		const std::time_t time = static_cast<std::time_t>(std::stoll(fields[0]) / 1000);
+		char timestamp[32];
+		std::strftime(timestamp, sizeof(timestamp), "%Y/%m/%d %H:%M:%S", std::localtime(&time));
+
+		std::cout << std::left << std::setw(21) << timestamp
+			<< std::right << std::setw(12) << std::fixed << std::setprecision(1) << std::stoll(fields[1]) / 1000.0
+			<< "  " << fields[2] << std::endl;
+	}
+	return true;
+}
+
+/* Starts an online backup of the server databases */
+static bool StartBackup(TrkCliClientOptionResults* ClientResults)
+{
+	TrkString returned, errmsg;
+	if (!TrkConnectHelper::SendCommand(*ClientResults, "Backup", errmsg, returned))
+	{
+		std::cerr << errmsg << std::endl;
+		return true;
+	}
+
+	std::string started, remaining, total;
+	for (const auto& value : ParseKeyValues(returned))
+	{
+		if (value.first == "started") started = value.second;
+		else if (value.first == "remaining") remaining = value.second;
+		else if (value.first == "total") total = value.second;
+	}
+
+	if (started == "1")
+	{
+		std::cout << "Backup started." << std::endl;
+	}
+	else
+	{
+		std::cout << "A backup is already running, " << remaining << " of " << total << " pages left." << std::endl;
+	}
+	return true;
+}
+
+/* Checkpoints the server databases, "checkpoint-<mode>" picks a mode other than passive */
+static bool RunCheckpoint(TrkCliClientOptionResults* ClientResults, const std::string& Subcommand)
+{
+	std::string command = "Checkpoint";
+	const size_t dashPos = Subcommand.find('-');
+	if (dashPos != std::string::npos)
+	{
+		std::string mode = Subcommand.substr(dashPos + 1);
+		for (char& c : mode)
+		{
+			c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+		}
+		command += "?" + mode;
+	}
+
+	TrkString returned, errmsg;
+	if (!TrkConnectHelper::SendCommand(*ClientResults, command.c_str(), errmsg, returned))
+	{
+		std::cerr << errmsg << std::endl;
+		return true;
+	}
+
+	std::cout << std::left
+		<< std::setw(12) << "Database"
+		<< std::right
+		<< std::setw(8) << "Result"
+		<< std::setw(12) << "Log"
+		<< std::setw(14) << "Checkpointed" << std::endl;
+
+	for (const auto& value : ParseKeyValues(returned))
+	{
+		// <database>=code,log frames,checkpointed frames
+		std::cout << std::left << std::setw(12) << value.first << std::right;
+
+		size_t pos = 0, commaPos, column = 0;
+		std::string fields = value.second + ",";
+		while ((commaPos = fields.find(',', pos)) != std::string::npos)
+		{
+			std::cout << std::setw(column == 0 ? 8 : column == 1 ? 12 : 14) << fields.substr(pos, commaPos - pos);
+			pos = commaPos + 1;
+			column++;
+		}
+		std::cout << std::endl;
+	}
+	return true;
+}
+
+
+bool TrkCliAdminCommand::CallCommand_Implementation(const TrkCliOption* Options, TrkCliOptionResults* Results)
+{
+	TrkCliClientOptionResults* ClientResults = static_cast<TrkCliClientOptionResults*>(Results);
+
+	if (Results->command_parameter == "stats")
+	{
+		return PrintStatistics(ClientResults);
+	}
+	else if (Results->command_parameter == "trace")
+	{
+		return PrintTrace(ClientResults);
+	}
+	else if (Results->command_parameter == "statements")
+	{
+		return PrintStatements(ClientResults);
+	}
+	else if (Results->command_parameter == "slow")
+	{
+		return PrintSlowStatements(ClientResults);
+	}
+	else if (Results->command_parameter == "backup")
+	{
+		return StartBackup(ClientResults);
+	}
+	else if (std::string(Results->command_parameter).rfind("checkpoint", 0) == 0)
+	{
+		return RunCheckpoint(ClientResults, std::string(Results->command_parameter));
+	}
+
+	std::cerr << "Unknown admin command \"" << Results->command_parameter << "\"." << std::endl << std::endl;
+	return false;
+}
+
+bool TrkCliAdminCommand::CheckCommandFlags_Implementation(const char Flag)
+{
+	return false;
+}
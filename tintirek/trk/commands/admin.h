@@ -0,0 +1,19 @@
+/*
+ *	admin.h
+ *
+ *	Tintirek's admin command header file
+ */
+
+#ifndef TRK_ADMIN_COMMAND_H
+#define TRK_ADMIN_COMMAND_H
+
+#include "cmdline.h"
+
+class TrkCliAdminCommand : public TrkCliCommand
+{
+	virtual bool CallCommand_Implementation(const TrkCliOption* Options, TrkCliOptionResults* Result) override;
+
+	virtual bool CheckCommandFlags_Implementation(const char Flag) override;
+};
+
+#endif /* TRK_ADMIN_COMMAND_H */
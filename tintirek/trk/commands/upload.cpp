@@ -0,0 +1,55 @@
+/*
+ *	upload.cpp
+ *
+ *	Tintirek's upload command source file
+ */
+
+
+#include "upload.h"
+
+#include <iostream>
+#include <filesystem>
+
+#include "chunkupload.h"
+
+namespace fs = std::filesystem;
+
+
+bool TrkCliUploadCommand::CallCommand_Implementation(const TrkCliOption* Options, TrkCliOptionResults* Results)
+{
+	TrkCliClientOptionResults* ClientResults = static_cast<TrkCliClientOptionResults*>(Results);
+
+	fs::path targetPath;
+	try
+	{
+		targetPath = fs::canonical(fs::current_path() / (const char*)Results->command_parameter);
+	}
+	catch (const fs::filesystem_error& e) {
+		std::cerr << "Error: " << e.code().message() << " (errno: " << e.code().value() << ")" << std::endl << std::endl;
+		return false;
+	}
+
+	if (!fs::is_regular_file(targetPath))
+	{
+		std::cerr << targetPath.string() << " is not a file." << std::endl << std::endl;
+		return false;
+	}
+
+	TrkUploadResult result;
+	TrkString errmsg;
+	if (!TrkUploadHelper::UploadFile(*ClientResults, targetPath.string().c_str(), result, errmsg))
+	{
+		std::cerr << errmsg << std::endl << std::endl;
+		return false;
+	}
+
+	std::cout << targetPath.string() << " -- uploaded as " << result.digest << std::endl
+		<< "Sent " << result.chunks_sent << " of " << result.chunks << " chunks, "
+		<< result.bytes_sent << " of " << result.size << " bytes" << std::endl;
+	return true;
+}
+
+bool TrkCliUploadCommand::CheckCommandFlags_Implementation(const char Flag)
+{
+	return false;
+}
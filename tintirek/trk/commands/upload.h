@@ -0,0 +1,19 @@
+/*
+ *	upload.h
+ *
+ *	Tintirek's upload command header file
+ */
+
+#ifndef TRK_UPLOAD_COMMAND_H
+#define TRK_UPLOAD_COMMAND_H
+
+#include "cmdline.h"
+
+class TrkCliUploadCommand : public TrkCliCommand
+{
+	virtual bool CallCommand_Implementation(const TrkCliOption* Options, TrkCliOptionResults* Result) override;
+
+	virtual bool CheckCommandFlags_Implementation(const char Flag) override;
+};
+
+#endif /* TRK_UPLOAD_COMMAND_H */
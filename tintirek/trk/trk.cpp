@@ -22,6 +22,7 @@
 #include "commandline.h"
 #include "connect.h"
 #include "config.h"
+#include "tracing.h"
 
 
 
@@ -31,6 +32,7 @@ const TrkCliOption trk_cli_options[] =
 	TrkCliOption("version", nullptr, "Displays version information about Tintirek.", TrkCliRequiredOption::NOT_ALLOWED),
 	TrkCliOption("help", nullptr, "Displays help information about Tintirek.", TrkCliRequiredOption::NO_REQUIRED, "command"),
 	TrkCliOption("info", trkInfoCommand, "Displays connection, status and other information about Tintirek", TrkCliRequiredOption::NOT_ALLOWED),
+	TrkCliOption("admin", trkAdminCommand, "Runs server administration commands. (stats, trace, statements, slow, backup, checkpoint[-full|-restart|-truncate])", TrkCliRequiredOption::REQUIRED, "subcommand"),
 
 	TrkCliOption("trust", trkTrustCommand, "Establish trust with the server by verifying its identity and certificate", TrkCliRequiredOption::NOT_ALLOWED),
 	TrkCliOption("login", trkLoginCommand, "Performs the login process with the server", new TrkCliOptionFlag[1] { TRK_CLI_FLAG_STATUS }, 1, TrkCliRequiredOption::NO_REQUIRED, "user"),
@@ -38,6 +40,7 @@ const TrkCliOption trk_cli_options[] =
 
 	TrkCliOption("add", trkAddCommand, "Open a new file to add it to the repository.", new TrkCliOptionFlag[3] { TRK_CLI_FLAG_IGNORE, TRK_CLI_FLAG_PREVIEW, TRK_CLI_FLAG_TYPE }, 3, TrkCliRequiredOption::REQUIRED, "file/dir"),
 	TrkCliOption("edit", trkEditCommand, "Open an existing file for edit.", new TrkCliOptionFlag[2] { TRK_CLI_FLAG_PREVIEW, TRK_CLI_FLAG_TYPE }, 2, TrkCliRequiredOption::REQUIRED, "file/dir"),
+	TrkCliOption("upload", trkUploadCommand, "Upload the contents of a file, sending only the chunks the server does not have.", TrkCliRequiredOption::REQUIRED, "file"),
 	TrkCliOption("delete", trkAddCommand, "Open an existing file for deletion from the repository.", new TrkCliOptionFlag[1] { TRK_CLI_FLAG_PREVIEW }, 1, TrkCliRequiredOption::REQUIRED, "file/dir"),
 	TrkCliOption("revert", trkAddCommand, "Discard changed from an opened file.", new TrkCliOptionFlag[2] { TRK_CLI_FLAG_ADD, TRK_CLI_FLAG_PREVIEW }, 2, TrkCliRequiredOption::REQUIRED, "file/dir"),
 	TrkCliOption("submit", trkAddCommand, "Submit open files to the remote.", new TrkCliOptionFlag[2] { TRK_CLI_FLAG_DESCRIPTION, TRK_CLI_FLAG_REOPEN }, 2, TrkCliRequiredOption::REQUIRED, "file/dir"),
@@ -331,9 +334,22 @@ int main(int argc, char** argv)
 		}
 	}
 
+	if (opt_result.trace_path != "")
+	{
+		TrkTracer::Get().SetProcessName("trk");
+		TrkTracer::Get().SetEnabled(true);
+	}
+
 	std::chrono::milliseconds sleeptime(100);
 	std::this_thread::sleep_for(sleeptime);
-	if (!opt_result.requested_command->cmd_util->CallCommand(opt_result.requested_command, &opt_result))
+	const bool result = opt_result.requested_command->cmd_util->CallCommand(opt_result.requested_command, &opt_result);
+
+	if (opt_result.trace_path != "" && !TrkTracer::Get().WriteChromeJson(opt_result.trace_path))
+	{
+		std::cerr << "Trace could not be written to \"" << opt_result.trace_path << "\"." << std::endl;
+	}
+
+	if (!result)
 	{
 		print_help(argv[1]);
 		return EXIT_FAILURE;
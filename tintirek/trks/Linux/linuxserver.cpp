@@ -17,6 +17,8 @@
 
 #include "../server.h"
 #include "../logger.h"
+#include "../statistics.h"
+#include "tracing.h"
 
 
 static fd_set* master;
@@ -168,9 +170,11 @@ bool TrkLinuxServer::Run(TrkString& ErrorStr)
 					TrkSSL* ssl = nullptr;
 					if (ssl_active)
 					{
+						TrkTraceSpan span("AcceptTLS");
 						ssl = TrkSSLHelper::CreateClient(ssl_ctx, clientSocket);
 						if (TrkSSLHelper::AcceptClient(ssl) <= 0)
 						{
+							TrkServerStatistics::Get().tls_failures.Increment();
 							if (TrkSSLHelper::GetError(ssl) == 6)
 							{
 								ErrorStr << "Client disconnected during SSL (errno: 6)";
@@ -185,6 +189,7 @@ bool TrkLinuxServer::Run(TrkString& ErrorStr)
 							close(clientSocket);
 							continue;
 						}
+						TrkServerStatistics::Get().tls_handshakes.Increment();
 					}
 
 					TrkClientInfo* client = new TrkClientInfo(&clientAddr, clientSocket, ssl, ss);
@@ -5,6 +5,7 @@
  */
 
 #include "../service.h"
+#include "../logger.h"
 
 
 #ifdef __linux__
@@ -54,6 +55,10 @@ bool TrkLinuxService::ServiceStart()
 {
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunused-result"
+	// Only the forking thread survives in the child, so the log writer
+	// thread is stopped here and started again in the daemon process.
+	TrkLogger::Get().Stop();
+
 	pid_t pid = fork();
 	if (pid < 0)
 	{
@@ -89,6 +94,8 @@ bool TrkLinuxService::ServiceStart()
 		exit(EXIT_SUCCESS);
 	}
 
+	TrkLogger::Get().Start();
+
 	umask(0);
 
 	chdir("/");
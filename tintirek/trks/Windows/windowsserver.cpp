@@ -16,6 +16,8 @@
 #include "trk_version.h"
 #include "../server.h"
 #include "../logger.h"
+#include "../statistics.h"
+#include "tracing.h"
 
 
 TrkWindowsServer::TrkWindowsServer(int Port, TrkCliServerOptionResults* Options)
@@ -218,9 +220,11 @@ bool TrkWindowsServer::Run(TrkString& ErrorStr)
 					TrkSSL* ssl = nullptr;
 					if (ssl_active)
 					{
+						TrkTraceSpan span("AcceptTLS");
 						ssl = TrkSSLHelper::CreateClient(ssl_ctx, clientSocket);
 						if (TrkSSLHelper::AcceptClient(ssl) <= 0)
 						{
+							TrkServerStatistics::Get().tls_failures.Increment();
 							TrkSSLHelper::RefreshErrors();
 							if (TrkSSLHelper::GetError(ssl) == 6)
 							{
@@ -236,6 +240,7 @@ bool TrkWindowsServer::Run(TrkString& ErrorStr)
 							closesocket(clientSocket);
 							continue;
 						}
+						TrkServerStatistics::Get().tls_handshakes.Increment();
 					}
 
 					TrkClientInfo* client = new TrkClientInfo(&clientAddr, clientSocket, ssl, ss);
@@ -0,0 +1,162 @@
+/*
+ *	authexecutor.cpp
+ *
+ *	Password verification executor of Tintirek's server
+ */
+
+
+#include "authexecutor.h"
+
+#include "crypto.h"
+#include "tracing.h"
+
+
+TrkAuthExecutor& TrkAuthExecutor::Get()
+{
+	static TrkAuthExecutor executor;
+	return executor;
+}
+
+TrkAuthExecutor::TrkAuthExecutor()
+	: max_queue_depth(0)
+{
+	// Leave at least half of the cores to the connection threads
+	const unsigned int cores = std::thread::hardware_concurrency();
+	const unsigned int worker_count = cores > 2 ? cores / 2 : 1;
+
+	for (unsigned int i = 0; i < worker_count; i++)
+	{
+		workers.emplace_back(&TrkAuthExecutor::WorkerLoop, this);
+	}
+}
+
+TrkAuthExecutor::~TrkAuthExecutor()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		running = false;
+	}
+	task_cv.notify_all();
+
+	for (std::thread& worker : workers)
+	{
+		if (worker.joinable())
+		{
+			worker.join();
+		}
+	}
+}
+
+TrkAuthResult TrkAuthExecutor::Verify(const TrkString& Source, const TrkString& Password, const TrkString& Salt, int Iterations, const TrkString& Expected)
+{
+	std::future<TrkAuthResult> result;
+
+	{
+		const std::string source(Source.c_str());
+		std::lock_guard<std::mutex> lock(mutex);
+
+		if (queue_depth >= TRK_AUTH_QUEUE_SIZE)
+		{
+			rejected_queue.Increment();
+			return TrkAuthResult::REJECTED;
+		}
+
+		int& source_in_flight = in_flight[source];
+		if (source_in_flight >= TRK_AUTH_SOURCE_LIMIT)
+		{
+			rejected_source.Increment();
+			return TrkAuthResult::REJECTED;
+		}
+
+		std::deque<Task>& source_queue = queues[source];
+		if (source_queue.empty())
+		{
+			ready_sources.push_back(source);
+		}
+
+		source_queue.push_back(Task{ source, Password, Salt, Iterations, Expected, TrkTracer::GetCurrentRequest(), std::chrono::steady_clock::now(), std::promise<TrkAuthResult>() });
+		result = source_queue.back().result.get_future();
+		source_in_flight++;
+		queue_depth++;
+
+		if (queue_depth > max_queue_depth.load(std::memory_order_relaxed))
+		{
+			max_queue_depth.store(queue_depth, std::memory_order_relaxed);
+		}
+	}
+
+	task_cv.notify_one();
+
+	TrkTraceSpan span("AuthWait");
+	return result.get();
+}
+
+int64_t TrkAuthExecutor::GetQueueDepth() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return queue_depth;
+}
+
+void TrkAuthExecutor::WorkerLoop()
+{
+	while (true)
+	{
+		Task task;
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			task_cv.wait(lock, [this]() { return !running || !ready_sources.empty(); });
+
+			if (ready_sources.empty())
+			{
+				// Stopped and nothing left to do
+				return;
+			}
+
+			// Serve sources round-robin, one task at a time
+			const std::string source = ready_sources.front();
+			ready_sources.pop_front();
+
+			auto it = queues.find(source);
+			task = std::move(it->second.front());
+			it->second.pop_front();
+
+			if (it->second.empty())
+			{
+				queues.erase(it);
+			}
+			else
+			{
+				ready_sources.push_back(source);
+			}
+
+			queue_depth--;
+		}
+
+		const auto start = std::chrono::steady_clock::now();
+		wait_time.Record(TrkElapsedMicroseconds(task.queued_at, start));
+
+		TrkAuthResult result;
+		{
+			TrkTraceRequestScope request_scope(task.request_id);
+			TrkTraceSpan span("AuthHash");
+			result = TrkCryptoHelper::SHA256Chain(task.password, task.salt, task.iterations) == task.expected
+				? TrkAuthResult::MATCH
+				: TrkAuthResult::MISMATCH;
+		}
+
+		hash_time.Record(TrkElapsedMicroseconds(start));
+		completed.Increment();
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto it = in_flight.find(task.source);
+			if (it != in_flight.end() && --it->second <= 0)
+			{
+				in_flight.erase(it);
+			}
+		}
+
+		task.result.set_value(result);
+	}
+}
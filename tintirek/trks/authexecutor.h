@@ -0,0 +1,116 @@
+/*
+ *	authexecutor.h
+ *
+ *	Password verification executor of Tintirek's server
+ */
+
+#ifndef TRK_AUTHEXECUTOR_H
+#define TRK_AUTHEXECUTOR_H
+
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "metrics.h"
+
+
+/* Maximum number of verifications waiting in the queue */
+#define TRK_AUTH_QUEUE_SIZE 256
+
+/* Maximum number of verifications a single source address may have queued or running */
+#define TRK_AUTH_SOURCE_LIMIT 4
+
+
+/* Result of a password verification */
+enum class TrkAuthResult : uint8_t
+{
+	/* Password matches */
+	MATCH = 0,
+	/* Password does not match */
+	MISMATCH,
+	/* Verification was not run, the queue or the source limit is full */
+	REJECTED,
+};
+
+
+/*
+ *	Authentication executor
+ *
+ *	Runs the iterated password hash on a small, fixed set of worker
+ *	threads, so a burst of logins can not take the CPU away from the
+ *	threads serving ticketed commands. Waiting verifications are
+ *	taken round-robin by source address and every address has a limit
+ *	of queued and running verifications, one client can not starve
+ *	the others.
+ */
+class TrkAuthExecutor
+{
+public:
+	/* Returns the process-wide executor, workers are started on first use */
+	static TrkAuthExecutor& Get();
+
+	~TrkAuthExecutor();
+
+	/* Verifies a password on a worker and waits for the result */
+	TrkAuthResult Verify(const TrkString& Source, const TrkString& Password, const TrkString& Salt, int Iterations, const TrkString& Expected);
+
+	/* Returns the number of verifications waiting in the queue */
+	int64_t GetQueueDepth() const;
+
+	/* Highest queue depth seen */
+	std::atomic<int64_t> max_queue_depth;
+	/* Verifications completed */
+	TrkCounter completed;
+	/* Verifications rejected because the queue was full */
+	TrkCounter rejected_queue;
+	/* Verifications rejected because the source had too many in flight */
+	TrkCounter rejected_source;
+	/* Time spent waiting in the queue, in microseconds */
+	TrkHistogram wait_time;
+	/* Time spent hashing, in microseconds */
+	TrkHistogram hash_time;
+
+private:
+	TrkAuthExecutor();
+
+	/* A queued verification */
+	struct Task
+	{
+		std::string source;
+		TrkString password;
+		TrkString salt;
+		int iterations;
+		TrkString expected;
+		uint64_t request_id;
+		std::chrono::steady_clock::time_point queued_at;
+		std::promise<TrkAuthResult> result;
+	};
+
+	/* Worker thread loop */
+	void WorkerLoop();
+
+	mutable std::mutex mutex;
+	std::condition_variable task_cv;
+	bool running = true;
+
+	/* Waiting tasks of every source address */
+	std::unordered_map<std::string, std::deque<Task>> queues;
+	/* Source addresses with waiting tasks, in the order they are served */
+	std::deque<std::string> ready_sources;
+	/* Queued and running verifications of every source address */
+	std::unordered_map<std::string, int> in_flight;
+	/* Number of waiting tasks */
+	int64_t queue_depth = 0;
+
+	std::vector<std::thread> workers;
+};
+
+
+#endif /* TRK_AUTHEXECUTOR_H */
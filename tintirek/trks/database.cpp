@@ -5,12 +5,26 @@
  */
 
 #include "database.h"
+#include "headindex.h"
+#include "logger.h"
+#include "statistics.h"
+#include "ticketcache.h"
+#include "tracing.h"
 
 #include <chrono>
+#include <string>
 
 
 /* All databases */
-TrkSqlite::TrkDatabase* userDB = nullptr;
+TrkSqlite::TrkDatabasePool* userDB = nullptr;
+TrkSqlite::TrkDatabasePool* depotDB = nullptr;
+
+/* Write executors of databases */
+TrkSqlite::TrkDatabaseWriter* userDBWriter = nullptr;
+TrkSqlite::TrkDatabaseWriter* depotDBWriter = nullptr;
+
+/* Contents of depot files */
+TrkObjectStore* objectStore = nullptr;
 
 
 /* Database schemes */
@@ -28,78 +42,470 @@ TrkSqlite::TrkDatabase* userDB = nullptr;
                                      "updated_at DATETIME NOT NULL DEFAULT CURRENT_TIMESTAMP" \
                                      ");")
 
+/*
+ * Depot tables are keyed by path first, without rowid, so the rows of a
+ * directory are adjacent in the b-tree and "//depot/x/..." is a range scan.
+ * Secondary indexes carry every column their queries read.
+ */
+#define DB_DEPOT_SCHEME TrkString("CREATE TABLE IF NOT EXISTS file (" \
+                                      "path TEXT NOT NULL PRIMARY KEY," \
+                                      "head_revision INTEGER NOT NULL," \
+                                      "head_change INTEGER NOT NULL," \
+                                      "head_action INTEGER NOT NULL" \
+                                      ") WITHOUT ROWID;" \
+                                  "CREATE TABLE IF NOT EXISTS revision (" \
+                                      "path TEXT NOT NULL," \
+                                      "revision INTEGER NOT NULL," \
+                                      "change INTEGER NOT NULL," \
+                                      "action INTEGER NOT NULL," \
+                                      "digest TEXT NULL," \
+                                      "size INTEGER NOT NULL DEFAULT 0," \
+                                      "PRIMARY KEY (path, revision)" \
+                                      ") WITHOUT ROWID;" \
+                                  "CREATE INDEX IF NOT EXISTS revision_change ON revision (change, path, revision, action);" \
+                                  "CREATE TABLE IF NOT EXISTS changelist (" \
+                                      "change INTEGER PRIMARY KEY AUTOINCREMENT," \
+                                      "username TEXT NOT NULL," \
+                                      "workspace TEXT NOT NULL," \
+                                      "status INTEGER NOT NULL DEFAULT 0," \
+                                      "description TEXT NOT NULL DEFAULT ''," \
+                                      "created_at DATETIME NOT NULL DEFAULT CURRENT_TIMESTAMP," \
+                                      "submitted_at DATETIME NULL" \
+                                      ");" \
+                                  "CREATE INDEX IF NOT EXISTS changelist_workspace ON changelist (workspace, status, change);" \
+                                  "CREATE TABLE IF NOT EXISTS opened (" \
+                                      "workspace TEXT NOT NULL," \
+                                      "path TEXT NOT NULL," \
+                                      "username TEXT NOT NULL," \
+                                      "change INTEGER NOT NULL," \
+                                      "action INTEGER NOT NULL," \
+                                      "base_revision INTEGER NOT NULL," \
+                                      "PRIMARY KEY (workspace, path)" \
+                                      ") WITHOUT ROWID;" \
+                                  "CREATE INDEX IF NOT EXISTS opened_user ON opened (username, path, change, action, base_revision);" \
+                                  "CREATE INDEX IF NOT EXISTS opened_path ON opened (path, action);")
+
+/* Status of a changelist */
+#define CHANGELIST_PENDING 0
+#define CHANGELIST_SUBMITTED 1
+
+
+/* Returns the pragmas of the server's database settings */
+static TrkSqlite::TrkDatabasePragmas GetDatabasePragmas(const TrkCliServerOptionResults& options)
+{
+    TrkSqlite::TrkDatabasePragmas pragmas;
+    pragmas.journal_mode = options.db_journal_mode;
+    pragmas.synchronous = options.db_synchronous;
+    pragmas.mmap_size = options.db_mmap_size;
+    pragmas.cache_size = options.db_cache_size;
+    pragmas.busy_timeout = options.db_busy_timeout;
+    return pragmas;
+}
+
+void InitDatabases(TrkString rootDir, const TrkCliServerOptionResults& options)
+{
+    const TrkSqlite::TrkDatabasePragmas pragmas = GetDatabasePragmas(options);
 
-void InitDatabases(TrkString rootDir)
+    // Statements are profiled for the whole run, slow ones also go to the log
+    TrkSqlite::TrkStatementProfiler& profiler = TrkSqlite::TrkStatementProfiler::Get();
+    profiler.SetEnabled(true);
+    profiler.SetSlowThreshold(static_cast<int64_t>(options.db_slow_query) * 1000);
+    profiler.SetSlowStatementHandler([](const TrkSqlite::TrkSlowStatement& Statement)
+    {
+        LOG_OUT("Slow statement, " << Statement.duration / 1000 << " ms: " << Statement.query);
+    });
+
+    // The pools are closed again, no connection is carried over the daemon fork
+    TrkSqlite::TrkDatabasePool(rootDir + "user.db", pragmas, 1).Writer()->Execute(DB_USER_SCHEME);
+    TrkSqlite::TrkDatabasePool(rootDir + "depot.db", pragmas, 1).Writer()->Execute(DB_DEPOT_SCHEME);
+}
+
+void OpenDatabases(TrkString rootDir, const TrkCliServerOptionResults& options)
 {
-    userDB = new TrkSqlite::TrkDatabase(rootDir + "user.db", TrkSqlite::OPEN_READWRITE | TrkSqlite::OPEN_CREATE);
-    userDB->Execute(DB_USER_SCHEME);
+    const TrkSqlite::TrkDatabasePragmas pragmas = GetDatabasePragmas(options);
+
+    userDB = new TrkSqlite::TrkDatabasePool(rootDir + "user.db", pragmas, options.db_readers);
+    userDBWriter = new TrkSqlite::TrkDatabaseWriter(*userDB, std::chrono::microseconds(options.db_commit_window));
+
+    depotDB = new TrkSqlite::TrkDatabasePool(rootDir + "depot.db", pragmas, options.db_readers);
+    depotDBWriter = new TrkSqlite::TrkDatabaseWriter(*depotDB, std::chrono::microseconds(options.db_commit_window));
+}
+
+bool InitObjectStore(TrkString rootDir)
+{
+    TrkObjectStore* store = new TrkObjectStore();
+    if (!store->Open(rootDir + "objects"))
+    {
+        delete store;
+        return false;
+    }
+
+    objectStore = store;
+    return true;
 }
 
 bool GetUserPasswdFromDB(TrkString username, TrkString& passwd, TrkString& salt, int& iteration)
 {
-    TrkSqlite::TrkStatement Query(*userDB, "SELECT password_hash, salt, iteration FROM user WHERE username = ?");
-    Query.Bind(1, username);
+    TrkScopedDatabaseTimer timer;
+    TrkTraceSpan span("Database", __func__);
+    TrkSqlite::TrkDatabasePool::Lease Database = userDB->Reader();
+    TrkSqlite::TrkStatementLease Query = Database->Prepare("SELECT password_hash, salt, iteration FROM user WHERE username = ?");
+    Query->Bind(1, username);
 
-    try
+    // Unknown users are a common case on failed logins, no exception for them
+    if (!Query->TryStep().ValueOr(false))
     {
-        Query.ExecuteStep();
-        passwd = Query.GetColumn(0);
-        salt = Query.GetColumn(1);
-        iteration = Query.GetColumn(2);
+        return false;
+    }
 
-        return true;
+    const auto row = Query->TryGetRow<TrkString, TrkString, int>();
+    if (!row)
+    {
+        return false;
     }
-    catch (TrkSqlite::TrkDatabaseException&) { }
 
-    return false;
+    std::tie(passwd, salt, iteration) = *row;
+    return true;
 }
 
 bool GetUserTicketFromDB(TrkString username, TrkString& ticket, int64_t& endtimeunix)
 {
-    TrkSqlite::TrkStatement Query(*userDB, "SELECT ticket, ticket_end FROM user WHERE username = ?");
-    Query.Bind(1, username);
+    TrkTicketCache& cache = TrkTicketCache::Get();
+    if (cache.Find(username, ticket, endtimeunix))
+    {
+        return true;
+    }
 
-    try
+    TrkScopedDatabaseTimer timer;
+    TrkTraceSpan span("Database", __func__);
+    const uint64_t generation = cache.BeginFill(username);
+    TrkSqlite::TrkDatabasePool::Lease Database = userDB->Reader();
+    TrkSqlite::TrkStatementLease Query = Database->Prepare("SELECT ticket, ticket_end FROM user WHERE username = ?");
+    Query->Bind(1, username);
+
+    if (!Query->TryStep().ValueOr(false))
     {
-        Query.ExecuteStep();
-        ticket = Query.GetColumn(0);
-        endtimeunix = Query.GetColumn(1);
+        return false;
+    }
 
-        return true;
+    const auto row = Query->TryGetRow<TrkString, int64_t>();
+    if (!row)
+    {
+        return false;
     }
-    catch (TrkSqlite::TrkDatabaseException&) {}
 
-    return false;
+    std::tie(ticket, endtimeunix) = *row;
+    cache.Fill(username, generation, ticket, endtimeunix);
+    return true;
 }
 
 bool ResetUserTicketDB(TrkString username)
 {
-    TrkSqlite::TrkStatement Query(*userDB, "UPDATE user SET ticket = NULL, ticket_end = NULL WHERE username = ?");
-    Query.Bind(1, username);
+    TrkScopedDatabaseTimer timer;
+    TrkTraceSpan span("Database", __func__);
 
     try
     {
-        return Query.Execute() > 0;
+        uint64_t sequence = 0;
+        const int changes = userDBWriter->Execute([&username, &sequence](TrkSqlite::TrkDatabase& Database)
+        {
+            TrkSqlite::TrkStatementLease Query = Database.Prepare("UPDATE user SET ticket = NULL, ticket_end = NULL WHERE username = ?");
+            Query->Bind(1, username);
+            sequence = TrkTicketCache::Get().NextWriteSequence();
+            return Query->TryExecute().ValueOr(0);
+        });
+
+        if (changes > 0)
+        {
+            TrkTicketCache::Get().Store(username, "", 0, sequence);
+            return true;
+        }
     }
     catch (TrkSqlite::TrkDatabaseException& ex) {}
 
+    TrkTicketCache::Get().Invalidate(username);
     return false;
 }
 
 bool UpdateUserTicketDB(TrkString username, TrkString ticket)
 {
+    TrkScopedDatabaseTimer timer;
+    TrkTraceSpan span("Database", __func__);
     int64_t unix_ticket_end = static_cast<int64_t>(std::chrono::system_clock::to_time_t(std::chrono::system_clock::now() + std::chrono::hours(24)));
 
-    TrkSqlite::TrkStatement Query(*userDB, TrkString("UPDATE user SET ticket_end = ?, ticket = ? WHERE username = ?"));
-    Query.Bind(1, unix_ticket_end);
-    Query.Bind(2, ticket);
-    Query.Bind(3, username);
-
     try
     {
-        return Query.Execute() > 0;
+        uint64_t sequence = 0;
+        const int changes = userDBWriter->Execute([&username, &ticket, unix_ticket_end, &sequence](TrkSqlite::TrkDatabase& Database)
+        {
+            TrkSqlite::TrkStatementLease Query = Database.Prepare("UPDATE user SET ticket_end = ?, ticket = ? WHERE username = ?");
+            Query->BindAll(unix_ticket_end, ticket, username);
+            // Mutations run one by one in commit order, so does the sequence
+            sequence = TrkTicketCache::Get().NextWriteSequence();
+            return Query->TryExecute().ValueOr(0);
+        });
+
+        if (changes > 0)
+        {
+            TrkTicketCache::Get().Store(username, ticket, unix_ticket_end, sequence);
+            return true;
+        }
     }
     catch (TrkSqlite::TrkDatabaseException& ex) { }
 
+    TrkTicketCache::Get().Invalidate(username);
     return false;
+}
+
+TrkString GetDepotPath(TrkString clientPath)
+{
+    std::string path(clientPath.c_str(), clientPath.size());
+    for (char& c : path)
+    {
+        if (c == '\\')
+        {
+            c = '/';
+        }
+    }
+
+    // Drop the drive of a Windows path and the leading slashes
+    if (path.size() >= 2 && path[1] == ':')
+    {
+        path.erase(0, 2);
+    }
+    const size_t start = path.find_first_not_of('/');
+    path.erase(0, start != std::string::npos ? start : path.size());
+
+    TrkString depot_path = "//depot/";
+    depot_path << path.c_str();
+    return depot_path;
+}
+
+const char* GetFileActionName(TrkFileAction action)
+{
+    switch (action)
+    {
+    case TrkFileAction::ADD: return "add";
+    case TrkFileAction::EDIT: return "edit";
+    case TrkFileAction::DELETE: return "delete";
+    default: return "none";
+    }
+}
+
+TrkOpenFileResult OpenFileDB(TrkString username, TrkString workspace, TrkString depotPath, TrkFileAction action, TrkFileAction& openedAction)
+{
+    TrkScopedDatabaseTimer timer;
+    TrkTraceSpan span("Database", __func__);
+
+    TrkOpenFileResult result = TrkOpenFileResult::FAILED;
+    openedAction = TrkFileAction::NONE;
+
+    try
+    {
+        // Every check and write below runs in one savepoint of the depot writer
+        depotDBWriter->Execute([&](TrkSqlite::TrkDatabase& Database)
+        {
+            {
+                TrkSqlite::TrkStatementLease Query = Database.Prepare("SELECT action FROM opened WHERE workspace = ? AND path = ?");
+                Query->BindAll(workspace, depotPath);
+                if (Query->TryStep().ValueOr(false))
+                {
+                    openedAction = static_cast<TrkFileAction>(Query->GetColumnView(0).GetInt());
+                    result = TrkOpenFileResult::ALREADY_OPENED;
+                    return 0;
+                }
+            }
+
+            trk_revision_number_t head_revision = 0;
+            {
+                TrkSqlite::TrkStatementLease Query = Database.Prepare("SELECT head_revision, head_action FROM file WHERE path = ?");
+                Query->Bind(1, depotPath);
+                if (Query->TryStep().ValueOr(false) && static_cast<TrkFileAction>(Query->GetColumnView(1).GetInt()) != TrkFileAction::DELETE)
+                {
+                    head_revision = static_cast<trk_revision_number_t>(Query->GetColumnView(0).GetInt64());
+                }
+            }
+
+            if (action == TrkFileAction::ADD && head_revision > 0)
+            {
+                result = TrkOpenFileResult::ALREADY_IN_DEPOT;
+                return 0;
+            }
+            if (action == TrkFileAction::EDIT && head_revision == 0)
+            {
+                result = TrkOpenFileResult::NOT_IN_DEPOT;
+                return 0;
+            }
+
+            trk_commit_number_t change = TRK_INVALID_COMMITNUM;
+            {
+                TrkSqlite::TrkStatementLease Query = Database.Prepare("SELECT change FROM changelist WHERE workspace = ? AND status = ? ORDER BY change LIMIT 1");
+                Query->BindAll(workspace, CHANGELIST_PENDING);
+                if (Query->TryStep().ValueOr(false))
+                {
+                    change = Query->GetColumnView(0).GetInt64();
+                }
+            }
+            if (change == TRK_INVALID_COMMITNUM)
+            {
+                TrkSqlite::TrkStatementLease Query = Database.Prepare("INSERT INTO changelist (username, workspace, status) VALUES (?, ?, ?)");
+                Query->BindAll(username, workspace, CHANGELIST_PENDING);
+                Query->Execute();
+                change = Database.GetLastInsertRowID();
+            }
+
+            TrkSqlite::TrkStatementLease Query = Database.Prepare("INSERT INTO opened (workspace, path, username, change, action, base_revision) VALUES (?, ?, ?, ?, ?, ?)");
+            Query->BindAll(workspace, depotPath, username, static_cast<int64_t>(change), static_cast<int>(action), static_cast<int64_t>(head_revision));
+            const int changes = Query->Execute();
+
+            openedAction = action;
+            result = TrkOpenFileResult::OPENED;
+            return changes;
+        });
+    }
+    catch (TrkSqlite::TrkDatabaseException&)
+    {
+        openedAction = TrkFileAction::NONE;
+        result = TrkOpenFileResult::FAILED;
+    }
+
+    return result;
+}
+
+bool GetDepotFilesDB(TrkString pathPrefix, std::vector<TrkDepotFileInfo>& files)
+{
+    // The head snapshot answers without SQLite once it is built
+    if (TrkHeadIndex::Get().List(pathPrefix, files))
+    {
+        return true;
+    }
+
+    TrkScopedDatabaseTimer timer;
+    TrkTraceSpan span("Database", __func__);
+
+    // Paths under the prefix sort below the prefix with its last byte incremented, 0xFF bytes carry into the byte before them
+    std::string upper(pathPrefix.c_str(), pathPrefix.size());
+    while (!upper.empty() && static_cast<unsigned char>(upper.back()) == 0xFF)
+    {
+        upper.pop_back();
+    }
+
+    const bool bounded = !upper.empty();
+    if (bounded)
+    {
+        upper.back() = static_cast<char>(upper.back() + 1);
+    }
+
+    try
+    {
+        TrkSqlite::TrkDatabasePool::Lease Database = depotDB->Reader();
+        TrkSqlite::TrkStatementLease Query = bounded
+            ? Database->Prepare("SELECT path, head_revision, head_change, head_action FROM file WHERE path >= ? AND path < ? ORDER BY path")
+            : Database->Prepare("SELECT path, head_revision, head_change, head_action FROM file WHERE path >= ? ORDER BY path");
+        Query->Bind(1, pathPrefix);
+        if (bounded)
+        {
+            Query->BindText(2, upper.data(), static_cast<int>(upper.size()));
+        }
+
+        for (const auto& [path, revision, change, action] : Query->Rows<TrkString, int64_t, int64_t, int>())
+        {
+            files.push_back(TrkDepotFileInfo{ path, static_cast<trk_revision_number_t>(revision), change, static_cast<TrkFileAction>(action) });
+        }
+        return true;
+    }
+    catch (TrkSqlite::TrkDatabaseException&) { }
+
+    return false;
+}
+
+bool GetOpenedFilesDB(TrkString username, std::vector<TrkOpenedFileInfo>& files)
+{
+    TrkScopedDatabaseTimer timer;
+    TrkTraceSpan span("Database", __func__);
+
+    try
+    {
+        TrkSqlite::TrkDatabasePool::Lease Database = depotDB->Reader();
+        TrkSqlite::TrkStatementLease Query = Database->Prepare("SELECT path, workspace, change, action, base_revision FROM opened WHERE username = ? ORDER BY path");
+        Query->Bind(1, username);
+
+        for (const auto& [path, workspace, change, action, base_revision] : Query->Rows<TrkString, TrkString, int64_t, int, int64_t>())
+        {
+            files.push_back(TrkOpenedFileInfo{ path, workspace, change, static_cast<TrkFileAction>(action), static_cast<trk_revision_number_t>(base_revision) });
+        }
+        return true;
+    }
+    catch (TrkSqlite::TrkDatabaseException&) { }
+
+    return false;
+}
+
+bool GetRevisionDeltaBasesDB(int64_t& lastChange, std::vector<std::pair<TrkString, TrkString>>& bases)
+{
+    TrkScopedDatabaseTimer timer;
+    TrkTraceSpan span("Database", __func__);
+
+    try
+    {
+        // New revisions are found through the change index, their previous revision by the primary key
+        TrkSqlite::TrkDatabasePool::Lease Database = depotDB->Reader();
+        TrkSqlite::TrkStatementLease Query = Database->Prepare("SELECT r.change, r.digest, p.digest FROM revision r "
+                                                               "JOIN revision p ON p.path = r.path AND p.revision = r.revision - 1 "
+                                                               "WHERE r.change > ? AND r.digest IS NOT NULL AND p.digest IS NOT NULL AND r.digest != p.digest");
+        Query->Bind(1, lastChange);
+
+        int64_t newest = lastChange;
+        for (const auto& [change, digest, base] : Query->Rows<int64_t, TrkString, TrkString>())
+        {
+            bases.emplace_back(digest, base);
+            newest = change > newest ? change : newest;
+        }
+        lastChange = newest;
+        return true;
+    }
+    catch (TrkSqlite::TrkDatabaseException&) { }
+
+    return false;
+}
+
+void GetStatementCacheStatistics(int64_t& hits, int64_t& misses)
+{
+    hits = userDB != nullptr ? userDB->GetStatementCacheHits() : 0;
+    misses = userDB != nullptr ? userDB->GetStatementCacheMisses() : 0;
+
+    if (depotDB != nullptr)
+    {
+        hits += depotDB->GetStatementCacheHits();
+        misses += depotDB->GetStatementCacheMisses();
+    }
+}
+
+TrkSqlite::TrkDatabaseWriter* GetUserDatabaseWriter()
+{
+    return userDBWriter;
+}
+
+TrkSqlite::TrkDatabasePool* GetDepotDatabase()
+{
+    return depotDB;
+}
+
+TrkObjectStore* GetObjectStore()
+{
+    return objectStore;
+}
+
+std::vector<TrkNamedDatabase> GetDatabases()
+{
+    std::vector<TrkNamedDatabase> databases;
+    if (userDB != nullptr)
+    {
+        databases.push_back(TrkNamedDatabase{ "user", userDB });
+    }
+    if (depotDB != nullptr)
+    {
+        databases.push_back(TrkNamedDatabase{ "depot", depotDB });
+    }
+    return databases;
 }
\ No newline at end of file
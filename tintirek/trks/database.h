@@ -7,11 +7,71 @@
 #ifndef TRK_DATABASE_H
 #define TRK_DATABASE_H
 
-#include "sqlite3.h"
+#include "cmdline.h"
+#include "databasepool.h"
+#include "databasewriter.h"
+#include "objectstore.h"
+#include "trk_types.h"
 
+#include <utility>
+#include <vector>
 
-/* Initialization function for databases */
-void InitDatabases(TrkString rootDir);
+
+/* Action a file is opened or submitted with, stored as integer in depot database */
+enum class TrkFileAction
+{
+	NONE = 0,
+	ADD = 1,
+	EDIT = 2,
+	DELETE = 3,
+};
+
+/* Result of opening a file in a changelist */
+enum class TrkOpenFileResult
+{
+	OPENED,
+	ALREADY_OPENED,
+	NOT_IN_DEPOT,
+	ALREADY_IN_DEPOT,
+	FAILED,
+};
+
+/* Depot file with its head revision */
+struct TrkDepotFileInfo
+{
+	TrkString path;
+	trk_revision_number_t head_revision;
+	trk_commit_number_t head_change;
+	TrkFileAction head_action;
+};
+
+/* File opened in a workspace */
+struct TrkOpenedFileInfo
+{
+	TrkString path;
+	TrkString workspace;
+	trk_commit_number_t change;
+	TrkFileAction action;
+	trk_revision_number_t base_revision;
+};
+
+
+/* A database of the server with its name, used by backups and checkpoints */
+struct TrkNamedDatabase
+{
+	const char* name;
+	TrkSqlite::TrkDatabasePool* pool;
+};
+
+
+/* Initialization function for databases, creates their schemes with the server's database settings and closes them again */
+void InitDatabases(TrkString rootDir, const TrkCliServerOptionResults& options);
+
+/* Opens the connection pools and write executors of databases, after the daemon fork as neither survives it */
+void OpenDatabases(TrkString rootDir, const TrkCliServerOptionResults& options);
+
+/* Initialization function for the object store of file contents, under "objects" of root directory */
+bool InitObjectStore(TrkString rootDir);
 
 /* Get user password information from database */
 bool GetUserPasswdFromDB(TrkString username, TrkString& passwd, TrkString& salt, int& iteration);
@@ -25,5 +85,38 @@ bool ResetUserTicketDB(TrkString username);
 /* Update user ticket also with ticket time */
 bool UpdateUserTicketDB(TrkString username, TrkString ticket);
 
+/* Returns the depot path of a client path, until workspace mappings exist every client path maps under //depot/ */
+TrkString GetDepotPath(TrkString clientPath);
+
+/* Returns the name of a file action */
+const char* GetFileActionName(TrkFileAction action);
+
+/* Opens a depot file for add or edit in the pending changelist of the workspace, in one transaction */
+TrkOpenFileResult OpenFileDB(TrkString username, TrkString workspace, TrkString depotPath, TrkFileAction action, TrkFileAction& openedAction);
+
+/* Lists the depot files under a path prefix, from the head snapshot when it is built and a range scan of the file table otherwise */
+bool GetDepotFilesDB(TrkString pathPrefix, std::vector<TrkDepotFileInfo>& files);
+
+/* Lists the files opened by a user, a range scan of its covering index */
+bool GetOpenedFilesDB(TrkString username, std::vector<TrkOpenedFileInfo>& files);
+
+/* Lists the digests of revisions submitted after a change with the digest of the revision before them, LastChange moves to the newest change read */
+bool GetRevisionDeltaBasesDB(int64_t& lastChange, std::vector<std::pair<TrkString, TrkString>>& bases);
+
+/* Get prepared statement cache hits and misses of databases */
+void GetStatementCacheStatistics(int64_t& hits, int64_t& misses);
+
+/* Get the write executor of user database, null before OpenDatabases */
+TrkSqlite::TrkDatabaseWriter* GetUserDatabaseWriter();
+
+/* Get the connection pool of depot database, null before OpenDatabases */
+TrkSqlite::TrkDatabasePool* GetDepotDatabase();
+
+/* Get the object store of file contents, null before InitObjectStore */
+TrkObjectStore* GetObjectStore();
+
+/* Get the opened databases of the server, empty before OpenDatabases */
+std::vector<TrkNamedDatabase> GetDatabases();
+
 
 #endif /* TRK_DATABASE_H */
\ No newline at end of file
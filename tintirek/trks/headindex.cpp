@@ -0,0 +1,294 @@
+/*
+ *	headindex.cpp
+ *
+ *	Memory-mapped head revision snapshot of Tintirek's depot
+ */
+
+
+#include "headindex.h"
+
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <system_error>
+
+#include "logger.h"
+#include "tracing.h"
+
+namespace fs = std::filesystem;
+
+
+/* Returns true if the file name is a snapshot of the head index, complete or partial */
+static bool IsSnapshotFile(const std::string& Filename)
+{
+	return Filename.rfind("head-", 0) == 0 && Filename.find(".sst") != std::string::npos;
+}
+
+/* Returns the depot file of a snapshot record */
+static TrkDepotFileInfo ToFileInfo(std::string_view Path, const TrkHeadRecord& Record)
+{
+	return TrkDepotFileInfo{ TrkString(Path.data(), Path.data() + Path.size()),
+		static_cast<trk_revision_number_t>(Record.head_revision),
+		Record.head_change,
+		static_cast<TrkFileAction>(Record.head_action) };
+}
+
+
+TrkHeadIndex& TrkHeadIndex::Get()
+{
+	static TrkHeadIndex index;
+	return index;
+}
+
+TrkHeadIndex::TrkHeadIndex()
+	: records(0)
+	, snapshot_change(0)
+	, overlay_size(0)
+	, enabled(false)
+{ }
+
+TrkHeadIndex::Snapshot::~Snapshot()
+{
+	table.Close();
+
+	std::error_code error;
+	fs::remove(path.c_str(), error);
+}
+
+void TrkHeadIndex::Init(const TrkString& Directory)
+{
+	std::lock_guard<std::mutex> lock(build_mutex);
+	directory = Directory;
+
+	std::error_code error;
+	fs::create_directories(directory.c_str(), error);
+	for (const fs::directory_entry& entry : fs::directory_iterator(directory.c_str(), error))
+	{
+		if (IsSnapshotFile(entry.path().filename().string()))
+		{
+			fs::remove(entry.path(), error);
+		}
+	}
+
+	enabled = true;
+}
+
+bool TrkHeadIndex::Build(TrkSqlite::TrkDatabasePool& Pool)
+{
+	TrkTraceSpan span("HeadIndex", __func__);
+	std::lock_guard<std::mutex> lock(build_mutex);
+	const auto start = std::chrono::steady_clock::now();
+
+	std::shared_ptr<Snapshot> built = std::make_shared<Snapshot>();
+	built->path = TrkString((fs::path(directory.c_str()) / ("head-" + std::to_string(++generation) + ".sst")).string().c_str());
+
+	TrkSortedTableWriter writer(built->path, sizeof(TrkHeadRecord));
+	trk_commit_number_t change = 0;
+
+	try
+	{
+		// One statement reads one consistent state of the file table
+		TrkSqlite::TrkDatabasePool::Lease Database = Pool.Reader();
+		TrkSqlite::TrkStatementLease Query = Database->Prepare("SELECT path, head_revision, head_change, head_action FROM file ORDER BY path");
+
+		for (const auto& [path, revision, head_change, action] : Query->Rows<TrkString, int64_t, int64_t, int>())
+		{
+			TrkHeadRecord record;
+			std::memset(&record, 0, sizeof(record));
+			record.head_revision = revision;
+			record.head_change = head_change;
+			record.head_action = action;
+
+			if (!writer.Add(std::string_view(path.c_str(), path.size()), &record))
+			{
+				LOG_ERR("Head snapshot build failed, depot paths are not in byte order or could not be written at " << path);
+				builds_failed.Increment();
+				return false;
+			}
+			if (head_change > change)
+			{
+				change = head_change;
+			}
+		}
+	}
+	catch (const TrkSqlite::TrkDatabaseException& ex)
+	{
+		LOG_ERR("Head snapshot build failed: " << ex.what());
+		builds_failed.Increment();
+		return false;
+	}
+
+	built->change = change;
+
+	if (!writer.Commit() || !built->table.Open(built->path))
+	{
+		LOG_ERR("Head snapshot build failed, could not write " << built->path);
+		builds_failed.Increment();
+		return false;
+	}
+
+	{
+		std::unique_lock<std::shared_mutex> swap_lock(mutex);
+
+		// Overlay entries the snapshot has caught up with are dropped, revisions of a path only grow
+		for (auto it = overlay.begin(); it != overlay.end();)
+		{
+			const void* value = built->table.Find(it->first);
+			TrkHeadRecord record;
+			if (value != nullptr)
+			{
+				std::memcpy(&record, value, sizeof(record));
+			}
+
+			if (value != nullptr && record.head_revision >= it->second.head_revision)
+			{
+				it = overlay.erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+
+		// Readers of the old snapshot keep it until they release it
+		snapshot = built;
+		overlay_size = static_cast<int64_t>(overlay.size());
+	}
+
+	records = static_cast<int64_t>(writer.GetRecordCount());
+	snapshot_change = change;
+	builds.Increment();
+	build_time.Record(TrkElapsedMicroseconds(start));
+	return true;
+}
+
+void TrkHeadIndex::Reset()
+{
+	enabled = false;
+
+	std::shared_ptr<const Snapshot> released;
+	{
+		std::unique_lock<std::shared_mutex> lock(mutex);
+		released.swap(snapshot);
+		overlay.clear();
+		overlay_size = 0;
+	}
+	records = 0;
+	snapshot_change = 0;
+}
+
+bool TrkHeadIndex::IsReady() const
+{
+	std::shared_lock<std::shared_mutex> lock(mutex);
+	return snapshot != nullptr;
+}
+
+bool TrkHeadIndex::Find(const TrkString& Path, TrkDepotFileInfo& File) const
+{
+	const std::string path(Path.c_str(), Path.size());
+	std::shared_ptr<const Snapshot> current;
+	{
+		std::shared_lock<std::shared_mutex> lock(mutex);
+		if (snapshot == nullptr)
+		{
+			return false;
+		}
+
+		const auto it = overlay.find(path);
+		if (it != overlay.end())
+		{
+			File = ToFileInfo(path, it->second);
+			lookups.Increment();
+			return true;
+		}
+		current = snapshot;
+	}
+
+	lookups.Increment();
+	const void* value = current->table.Find(path);
+	if (value == nullptr)
+	{
+		return false;
+	}
+
+	TrkHeadRecord record;
+	std::memcpy(&record, value, sizeof(record));
+	File = ToFileInfo(path, record);
+	return true;
+}
+
+bool TrkHeadIndex::List(const TrkString& PathPrefix, std::vector<TrkDepotFileInfo>& Files) const
+{
+	const std::string prefix(PathPrefix.c_str(), PathPrefix.size());
+	std::map<std::string, TrkHeadRecord> changed;
+	const std::shared_ptr<const Snapshot> current = Acquire(prefix, changed);
+	if (current == nullptr)
+	{
+		return false;
+	}
+
+	lookups.Increment();
+
+	// Both sides are in path order, an overlay entry replaces the snapshot record of its path
+	auto next_changed = changed.begin();
+	TrkSortedTable::Iterator it = current->table.Seek(prefix);
+	while (it.Valid() && it.Key().compare(0, prefix.size(), prefix) == 0)
+	{
+		for (; next_changed != changed.end() && next_changed->first < it.Key(); ++next_changed)
+		{
+			Files.push_back(ToFileInfo(next_changed->first, next_changed->second));
+		}
+
+		if (next_changed != changed.end() && next_changed->first == it.Key())
+		{
+			Files.push_back(ToFileInfo(next_changed->first, next_changed->second));
+			++next_changed;
+		}
+		else
+		{
+			TrkHeadRecord record;
+			std::memcpy(&record, it.Value(), sizeof(record));
+			Files.push_back(ToFileInfo(it.Key(), record));
+		}
+		it.Next();
+	}
+
+	for (; next_changed != changed.end(); ++next_changed)
+	{
+		Files.push_back(ToFileInfo(next_changed->first, next_changed->second));
+	}
+	return true;
+}
+
+void TrkHeadIndex::RecordHeadChange(const TrkDepotFileInfo& File)
+{
+	if (!enabled)
+	{
+		return;
+	}
+
+	TrkHeadRecord record;
+	std::memset(&record, 0, sizeof(record));
+	record.head_revision = File.head_revision;
+	record.head_change = File.head_change;
+	record.head_action = static_cast<int32_t>(File.head_action);
+
+	// Kept even before the first snapshot, a build running now may have read the file table before this commit
+	std::unique_lock<std::shared_mutex> lock(mutex);
+	TrkHeadRecord& entry = overlay[std::string(File.path.c_str(), File.path.size())];
+	if (entry.head_revision <= record.head_revision)
+	{
+		entry = record;
+	}
+	overlay_size = static_cast<int64_t>(overlay.size());
+}
+
+std::shared_ptr<const TrkHeadIndex::Snapshot> TrkHeadIndex::Acquire(const std::string& PathPrefix, std::map<std::string, TrkHeadRecord>& Overlay) const
+{
+	std::shared_lock<std::shared_mutex> lock(mutex);
+	for (auto it = overlay.lower_bound(PathPrefix); it != overlay.end() && it->first.compare(0, PathPrefix.size(), PathPrefix) == 0; ++it)
+	{
+		Overlay.insert(Overlay.end(), *it);
+	}
+	return snapshot;
+}
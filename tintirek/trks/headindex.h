@@ -0,0 +1,118 @@
+/*
+ *	headindex.h
+ *
+ *	Memory-mapped head revision snapshot of Tintirek's depot
+ */
+
+#ifndef TRK_HEADINDEX_H
+#define TRK_HEADINDEX_H
+
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+#include "database.h"
+#include "metrics.h"
+#include "sortedtable.h"
+
+
+/* Record of a depot file in the snapshot, fixed width and read with memcpy */
+struct TrkHeadRecord
+{
+	int64_t head_revision;
+	int64_t head_change;
+	int32_t head_action;
+	int32_t reserved;
+};
+
+
+/*
+ *	Head index
+ *
+ *	Answers head revision lookups of depot files without SQLite. The
+ *	file table is periodically written to an immutable sorted table
+ *	under "<root>/snapshot", memory-mapped and swapped in for the old
+ *	one; readers holding the old snapshot keep it mapped until they are
+ *	done, its file is removed with the last of them.
+ *
+ *	Head changes committed after a snapshot was read are kept in a
+ *	small overlay that takes precedence over the snapshot. A rebuild
+ *	drops the overlay entries its snapshot already contains. Until the
+ *	first snapshot is built the index is not ready and callers read the
+ *	database instead.
+ */
+class TrkHeadIndex
+{
+public:
+	/* Returns the process-wide index */
+	static TrkHeadIndex& Get();
+
+	/* Enables the index with the directory of its snapshot files, removes the ones left by an earlier run */
+	void Init(const TrkString& Directory);
+	/* Reads the file table of the depot database and swaps in a new snapshot, returns false if it failed */
+	bool Build(TrkSqlite::TrkDatabasePool& Pool);
+	/* Disables the index and drops the snapshot and the overlay, lookups go to the database again */
+	void Reset();
+
+	/* Returns true once a snapshot is in place */
+	bool IsReady() const;
+	/* Finds the head of a depot file, returns false if it is not in the depot */
+	bool Find(const TrkString& Path, TrkDepotFileInfo& File) const;
+	/* Lists the depot files under a path prefix in path order, returns false if the index is not ready */
+	bool List(const TrkString& PathPrefix, std::vector<TrkDepotFileInfo>& Files) const;
+
+	/* Records a head change committed to the file table, called after its transaction commits */
+	void RecordHeadChange(const TrkDepotFileInfo& File);
+
+	/* Snapshots built */
+	TrkCounter builds;
+	/* Snapshot builds failed */
+	TrkCounter builds_failed;
+	/* Time of each snapshot build, in microseconds */
+	TrkHistogram build_time;
+	/* Lookups and listings answered by the index */
+	mutable TrkCounter lookups;
+	/* Records of the current snapshot */
+	std::atomic<int64_t> records;
+	/* Change the current snapshot was built at */
+	std::atomic<int64_t> snapshot_change;
+	/* Entries of the overlay */
+	std::atomic<int64_t> overlay_size;
+
+private:
+	TrkHeadIndex();
+
+	/* A mapped snapshot file, removed once the last reader releases it */
+	struct Snapshot
+	{
+		~Snapshot();
+
+		TrkSortedTable table;
+		TrkString path;
+		trk_commit_number_t change = 0;
+	};
+
+	/* Returns the current snapshot and copies the overlay entries under a prefix, null if not ready */
+	std::shared_ptr<const Snapshot> Acquire(const std::string& PathPrefix, std::map<std::string, TrkHeadRecord>& Overlay) const;
+
+	/* Set by Init(), head changes are only kept while snapshots are built */
+	std::atomic<bool> enabled;
+
+	/* Serializes builds */
+	std::mutex build_mutex;
+	TrkString directory;
+	uint64_t generation = 0;
+
+	mutable std::shared_mutex mutex;
+	std::shared_ptr<const Snapshot> snapshot;
+	std::map<std::string, TrkHeadRecord> overlay;
+};
+
+
+#endif /* TRK_HEADINDEX_H */
@@ -0,0 +1,361 @@
+/*
+ *	logger.cpp
+ *
+ *	Asynchronous logger of Tintirek's server
+ */
+
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#include "logger.h"
+
+
+/* Index mask of the ring buffer */
+static constexpr size_t queue_mask = TRK_LOG_QUEUE_SIZE - 1;
+static_assert((TRK_LOG_QUEUE_SIZE & queue_mask) == 0, "TRK_LOG_QUEUE_SIZE must be a power of two");
+
+/* Maximum number of records written in one batch */
+static constexpr int batch_records = 1024;
+
+
+/* Output buffer flushed into a stream with a single write */
+class TrkLogBatch
+{
+public:
+	TrkLogBatch(FILE* Target)
+		: target(Target)
+	{ }
+
+	/* Appends characters, writes the buffer out if there is no room */
+	void Append(const char* Data, size_t Length)
+	{
+		if (length + Length > sizeof(data))
+		{
+			Write();
+		}
+
+		if (Length > sizeof(data))
+		{
+			fwrite(Data, 1, Length, target);
+			return;
+		}
+
+		std::memcpy(data + length, Data, Length);
+		length += Length;
+	}
+
+	/* Appends a single character */
+	void Append(char Character)
+	{
+		Append(&Character, 1);
+	}
+
+	/* Writes pending characters without flushing the stream */
+	void Write()
+	{
+		if (length > 0)
+		{
+			fwrite(data, 1, length, target);
+			length = 0;
+			pending = true;
+		}
+	}
+
+	/* Writes pending characters and flushes the stream once */
+	void Flush()
+	{
+		Write();
+		if (pending)
+		{
+			fflush(target);
+			pending = false;
+		}
+	}
+
+private:
+	FILE* target;
+	char data[64 * 1024];
+	size_t length = 0;
+	bool pending = false;
+};
+
+
+/* Returns a small sequential identifier for the calling thread */
+static uint32_t GetLogThreadId()
+{
+	static std::atomic<uint32_t> next_id(1);
+	thread_local uint32_t id = next_id.fetch_add(1, std::memory_order_relaxed);
+	return id;
+}
+
+
+TrkLogLine::TrkLogLine(TrkLogLevel Level)
+	: std::ostream(nullptr)
+	, streambuf(buffer, sizeof(buffer))
+	, level(Level)
+{
+	rdbuf(&streambuf);
+}
+
+TrkLogLine::~TrkLogLine()
+{
+	size_t length = streambuf.GetLength();
+	if (streambuf.IsTruncated() && length >= 3)
+	{
+		std::memcpy(buffer + length - 3, "...", 3);
+	}
+
+	TrkLogger::Get().Push(level, buffer, length);
+}
+
+
+TrkLogger& TrkLogger::Get()
+{
+	static TrkLogger logger;
+	return logger;
+}
+
+TrkLogger::TrkLogger()
+	: cells(new Cell[TRK_LOG_QUEUE_SIZE])
+	, enqueue_pos(0)
+	, dequeue_pos(0)
+	, running(false)
+	, writer_waiting(false)
+	, format(TrkLogFormat::TEXT)
+	, dropped(0)
+{
+	for (size_t i = 0; i < TRK_LOG_QUEUE_SIZE; i++)
+	{
+		cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	Start();
+}
+
+TrkLogger::~TrkLogger()
+{
+	Stop();
+	delete[] cells;
+}
+
+void TrkLogger::Push(TrkLogLevel Level, const char* Message, size_t Length)
+{
+	Cell* cell;
+	size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+
+	while (true)
+	{
+		cell = &cells[pos & queue_mask];
+		const size_t seq = cell->sequence.load(std::memory_order_acquire);
+		const intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+
+		if (diff == 0)
+		{
+			if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+			{
+				break;
+			}
+		}
+		else if (diff < 0)
+		{
+			// Queue is full, the writer can not keep up. Never block the caller.
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		else
+		{
+			pos = enqueue_pos.load(std::memory_order_relaxed);
+		}
+	}
+
+	if (Length > TRK_LOG_MESSAGE_SIZE)
+	{
+		Length = TRK_LOG_MESSAGE_SIZE;
+	}
+
+	TrkLogRecord& record = cell->record;
+	record.timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	record.thread_id = GetLogThreadId();
+	record.length = static_cast<uint16_t>(Length);
+	record.level = Level;
+	std::memcpy(record.message, Message, Length);
+
+	cell->sequence.store(pos + 1, std::memory_order_release);
+
+	if (writer_waiting.load(std::memory_order_relaxed) && writer_waiting.exchange(false))
+	{
+		std::lock_guard<std::mutex> lock(wait_mutex);
+		wait_cv.notify_one();
+	}
+}
+
+void TrkLogger::Start()
+{
+	if (running.exchange(true))
+	{
+		return;
+	}
+
+	writer = std::thread(&TrkLogger::WriterLoop, this);
+}
+
+void TrkLogger::Stop()
+{
+	if (!running.exchange(false))
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(wait_mutex);
+		wait_cv.notify_one();
+	}
+
+	if (writer.joinable())
+	{
+		writer.join();
+	}
+}
+
+bool TrkLogger::Pop(TrkLogRecord& Record)
+{
+	Cell& cell = cells[dequeue_pos & queue_mask];
+	const size_t seq = cell.sequence.load(std::memory_order_acquire);
+
+	if (seq != dequeue_pos + 1)
+	{
+		return false;
+	}
+
+	Record.timestamp_us = cell.record.timestamp_us;
+	Record.thread_id = cell.record.thread_id;
+	Record.length = cell.record.length;
+	Record.level = cell.record.level;
+	std::memcpy(Record.message, cell.record.message, cell.record.length);
+
+	cell.sequence.store(dequeue_pos + TRK_LOG_QUEUE_SIZE, std::memory_order_release);
+	dequeue_pos++;
+	return true;
+}
+
+void TrkLogger::WriterLoop()
+{
+	TrkLogBatch out(stdout), err(stderr);
+	TrkLogRecord record;
+
+	while (true)
+	{
+		int count = 0;
+		while (count < batch_records && Pop(record))
+		{
+			FormatRecord(record, record.level == TrkLogLevel::ERR ? err : out);
+			count++;
+		}
+
+		const uint64_t dropped_now = dropped.load(std::memory_order_relaxed);
+		if (dropped_now != reported_dropped)
+		{
+			char notice[96];
+			int length = std::snprintf(notice, sizeof(notice), "Logger queue was full, %llu log line(s) dropped",
+				static_cast<unsigned long long>(dropped_now - reported_dropped));
+			reported_dropped = dropped_now;
+
+			record.timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+			record.thread_id = 0;
+			record.level = TrkLogLevel::ERR;
+			record.length = static_cast<uint16_t>(length);
+			std::memcpy(record.message, notice, length);
+			FormatRecord(record, err);
+		}
+
+		out.Flush();
+		err.Flush();
+
+		if (count > 0)
+		{
+			continue;
+		}
+
+		if (!running.load(std::memory_order_acquire))
+		{
+			// Queue is drained and nobody wants us anymore
+			break;
+		}
+
+		std::unique_lock<std::mutex> lock(wait_mutex);
+		writer_waiting.store(true);
+		if (cells[dequeue_pos & queue_mask].sequence.load(std::memory_order_acquire) != dequeue_pos + 1 && running.load())
+		{
+			wait_cv.wait_for(lock, std::chrono::milliseconds(100));
+		}
+		writer_waiting.store(false);
+	}
+}
+
+void TrkLogger::FormatRecord(const TrkLogRecord& Record, TrkLogBatch& Batch)
+{
+	size_t timestamp_length;
+	const char* timestamp = GetCachedTimestamp(Record.timestamp_us / 1000000, timestamp_length);
+
+	if (format.load(std::memory_order_relaxed) == TrkLogFormat::TEXT)
+	{
+		Batch.Append('[');
+		Batch.Append(timestamp, timestamp_length);
+		Batch.Append(Record.level == TrkLogLevel::ERR ? "] ERROR: " : "] ", Record.level == TrkLogLevel::ERR ? 9 : 2);
+		Batch.Append(Record.message, Record.length);
+		Batch.Append('\n');
+		return;
+	}
+
+	char header[96];
+	int length = std::snprintf(header, sizeof(header), "{\"time\":\"%.*s.%06d\",\"level\":\"%s\",\"thread\":%u,\"message\":\"",
+		static_cast<int>(timestamp_length), timestamp,
+		static_cast<int>(Record.timestamp_us % 1000000),
+		Record.level == TrkLogLevel::ERR ? "error" : "info",
+		Record.thread_id);
+	Batch.Append(header, length);
+
+	for (uint16_t i = 0; i < Record.length; i++)
+	{
+		const unsigned char c = static_cast<unsigned char>(Record.message[i]);
+		if (c == '"' || c == '\\')
+		{
+			Batch.Append('\\');
+			Batch.Append(static_cast<char>(c));
+		}
+		else if (c < 0x20)
+		{
+			char escaped[8];
+			std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+			Batch.Append(escaped, 6);
+		}
+		else
+		{
+			Batch.Append(static_cast<char>(c));
+		}
+	}
+
+	Batch.Append("\"}\n", 3);
+}
+
+const char* TrkLogger::GetCachedTimestamp(int64_t Seconds, size_t& Length)
+{
+	if (Seconds != cached_second)
+	{
+		std::time_t now = static_cast<std::time_t>(Seconds);
+		std::tm local;
+#ifdef _WIN32
+		localtime_s(&local, &now);
+#else
+		localtime_r(&now, &local);
+#endif
+		cached_timestamp_length = std::strftime(cached_timestamp, sizeof(cached_timestamp), "%Y.%m.%d-%H.%M.%S", &local);
+		cached_second = Seconds;
+	}
+
+	Length = cached_timestamp_length;
+	return cached_timestamp;
+}
@@ -1,6 +1,6 @@
 /*
  *	logger.h
- * 
+ *
  *	Logger helper functions
  */
 
@@ -9,8 +9,13 @@
 
 
 #include <iostream>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 #include "trk_types.h"
+#include "trkstring.h"
 
 
 /* Return a formatted timestamp */
@@ -23,6 +28,168 @@ static TrkString GetTimestamp(TrkString format)
 }
 
 
+/* Maximum length of a single log message, longer messages are truncated */
+#define TRK_LOG_MESSAGE_SIZE 480
+
+/* Number of log records the ring buffer can hold, must be a power of two */
+#define TRK_LOG_QUEUE_SIZE 4096
+
+
+/* Severity of a log record */
+enum class TrkLogLevel : uint8_t
+{
+	/* Informational output, written to stdout */
+	OUT = 0,
+	/* Error output, written to stderr */
+	ERR,
+};
+
+/* Output format of the log writer */
+enum class TrkLogFormat : uint8_t
+{
+	/* Human readable lines prefixed with timestamp */
+	TEXT = 0,
+	/* One JSON object per line */
+	STRUCTURED,
+};
+
+
+/* Fixed size log record passed from request threads to the writer thread */
+struct TrkLogRecord
+{
+	/* Wall clock time of the record in microseconds since epoch */
+	int64_t timestamp_us;
+	/* Small sequential identifier of the producing thread */
+	uint32_t thread_id;
+	/* Length of the message */
+	uint16_t length;
+	/* Severity of the record */
+	TrkLogLevel level;
+	/* Message characters, not null-terminated */
+	char message[TRK_LOG_MESSAGE_SIZE];
+};
+
+
+/* Stream buffer formatting into a fixed character array, truncates on overflow */
+class TrkLogStreamBuf : public std::streambuf
+{
+public:
+	TrkLogStreamBuf(char* Buffer, size_t Size)
+	{
+		setp(Buffer, Buffer + Size);
+	}
+
+	/* Returns the number of characters written */
+	size_t GetLength() const { return pptr() - pbase(); }
+	/* True if some characters were dropped */
+	bool IsTruncated() const { return truncated; }
+
+protected:
+	virtual int_type overflow(int_type Character) override
+	{
+		truncated = true;
+		return traits_type::not_eof(Character);
+	}
+
+private:
+	bool truncated = false;
+};
+
+
+/*
+ *	Single log line
+ *
+ *	Formats the streamed values into a stack buffer and hands the
+ *	finished record to the logger when it goes out of scope.
+ */
+class TrkLogLine : public std::ostream
+{
+public:
+	TrkLogLine(TrkLogLevel Level);
+	~TrkLogLine();
+
+private:
+	char buffer[TRK_LOG_MESSAGE_SIZE];
+	TrkLogStreamBuf streambuf;
+	TrkLogLevel level;
+};
+
+
+/*
+ *	Asynchronous logger
+ *
+ *	Request threads push fixed size records into a lock-free bounded
+ *	multi-producer ring buffer. A background thread drains it, formats
+ *	timestamps once per second and writes the lines in batches. When the
+ *	buffer is full records are dropped and counted instead of blocking.
+ */
+class TrkLogger
+{
+public:
+	/* Returns the process-wide logger */
+	static TrkLogger& Get();
+
+	/* Push a message into the queue, never blocks */
+	void Push(TrkLogLevel Level, const char* Message, size_t Length);
+
+	/* Starts the writer thread if it is not running */
+	void Start();
+	/* Writes all queued records and stops the writer thread */
+	void Stop();
+
+	/* Sets the output format */
+	void SetFormat(TrkLogFormat Format) { format.store(Format, std::memory_order_relaxed); }
+	/* Returns the number of records dropped because the queue was full */
+	uint64_t GetDroppedCount() const { return dropped.load(std::memory_order_relaxed); }
+
+	/* Disables copy and move */
+	TrkLogger(const TrkLogger&) = delete;
+	TrkLogger& operator=(const TrkLogger&) = delete;
+
+private:
+	TrkLogger();
+	~TrkLogger();
+
+	/* Ring buffer cell, the sequence number tells who owns the record */
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		TrkLogRecord record;
+	};
+
+	/* Try to take the next record from the queue (single consumer) */
+	bool Pop(TrkLogRecord& Record);
+	/* Writer thread loop */
+	void WriterLoop();
+	/* Appends formatted record into given output buffer */
+	void FormatRecord(const TrkLogRecord& Record, class TrkLogBatch& Batch);
+	/* Returns the cached "[%Y.%m.%d-%H.%M.%S]" string for given second */
+	const char* GetCachedTimestamp(int64_t Seconds, size_t& Length);
+
+	/* Queue storage */
+	Cell* cells;
+	/* Alignment keeps producer and consumer positions on separate cache lines */
+	alignas(64) std::atomic<size_t> enqueue_pos;
+	alignas(64) size_t dequeue_pos;
+
+	/* Writer thread state */
+	std::thread writer;
+	std::atomic<bool> running;
+	std::atomic<bool> writer_waiting;
+	std::mutex wait_mutex;
+	std::condition_variable wait_cv;
+
+	std::atomic<TrkLogFormat> format;
+	std::atomic<uint64_t> dropped;
+	uint64_t reported_dropped = 0;
+
+	/* Timestamp cache, only touched by the writer thread */
+	int64_t cached_second = -1;
+	char cached_timestamp[32];
+	size_t cached_timestamp_length = 0;
+};
+
+
 /*
  * Log Functions.
  *
@@ -30,9 +197,9 @@ static TrkString GetTimestamp(TrkString format)
  * We use these for our daemon system and they also help us convert
  * strings in a user-friendly manner.
  */
-#define LOG_OUT(str) std::cout << GetTimestamp("[%Y.%m.%d-%H.%M.%S]") << " " << str << std::endl;
-#define LOG_ERR(str) std::cerr << GetTimestamp("[%Y.%m.%d-%H.%M.%S]") << " ERROR: " << str << std::endl;
+#define LOG_OUT(str) { TrkLogLine trk_log_line(TrkLogLevel::OUT); trk_log_line << str; }
+#define LOG_ERR(str) { TrkLogLine trk_log_line(TrkLogLevel::ERR); trk_log_line << str; }
 
 
 
-#endif /* LOGGER_H */
\ No newline at end of file
+#endif /* LOGGER_H */
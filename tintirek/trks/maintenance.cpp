@@ -0,0 +1,466 @@
+/*
+ *	maintenance.cpp
+ *
+ *	Background database maintenance of Tintirek's server
+ */
+
+
+#include "maintenance.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "database.h"
+#include "headindex.h"
+#include "logger.h"
+#include "tracing.h"
+
+namespace fs = std::filesystem;
+
+
+/* Returns true if the file name is "<Name>-YYYYmmdd-HHMMSS.db" as written by RunBackup */
+static bool IsBackupFileName(const std::string& FileName, const char* Name)
+{
+	const size_t name_length = std::strlen(Name);
+	const char* stamp = "00000000-000000";
+	const size_t stamp_length = std::strlen(stamp);
+
+	if (FileName.size() != name_length + 1 + stamp_length + 3
+		|| FileName.compare(0, name_length, Name) != 0 || FileName[name_length] != '-'
+		|| FileName.compare(FileName.size() - 3, 3, ".db") != 0)
+	{
+		return false;
+	}
+
+	for (size_t i = 0; i < stamp_length; i++)
+	{
+		const char c = FileName[name_length + 1 + i];
+		if (stamp[i] == '-' ? c != '-' : !std::isdigit(static_cast<unsigned char>(c)))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+
+TrkDatabaseMaintenance& TrkDatabaseMaintenance::Get()
+{
+	static TrkDatabaseMaintenance maintenance;
+	return maintenance;
+}
+
+TrkDatabaseMaintenance::TrkDatabaseMaintenance()
+	: backup_running(false)
+	, backup_remaining_pages(0)
+	, backup_total_pages(0)
+	, log_frames(0)
+	, stopping(false)
+{ }
+
+TrkDatabaseMaintenance::~TrkDatabaseMaintenance()
+{
+	Stop();
+}
+
+void TrkDatabaseMaintenance::Start(const TrkCliServerOptionResults& Options)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (running)
+	{
+		return;
+	}
+
+	checkpoint_interval = std::chrono::seconds(Options.db_checkpoint_interval > 0 ? Options.db_checkpoint_interval : 0);
+	backup_interval = std::chrono::seconds(Options.db_backup_interval > 0 ? Options.db_backup_interval : 0);
+	backup_dir = Options.db_backup_dir != "" ? Options.db_backup_dir : TrkString((fs::path(Options.running_root.c_str()) / "backup").string().c_str());
+	backup_pages = Options.db_backup_pages > 0 ? Options.db_backup_pages : 1;
+	backup_pause = std::chrono::milliseconds(Options.db_backup_pause > 0 ? Options.db_backup_pause : 0);
+	backup_keep = Options.db_backup_keep > 0 ? Options.db_backup_keep : 0;
+	head_snapshot_interval = std::chrono::seconds(Options.db_head_snapshot_interval > 0 ? Options.db_head_snapshot_interval : 0);
+	repack_interval = std::chrono::seconds(Options.object_repack_interval > 0 ? Options.object_repack_interval : 0);
+
+	if (head_snapshot_interval.count() > 0)
+	{
+		TrkHeadIndex::Get().Init(TrkString((fs::path(Options.running_root.c_str()) / "snapshot").string().c_str()));
+	}
+
+	running = true;
+	stopping = false;
+	scheduler_thread = std::thread(&TrkDatabaseMaintenance::SchedulerLoop, this);
+}
+
+void TrkDatabaseMaintenance::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		running = false;
+		stopping = true;
+	}
+	scheduler_cv.notify_all();
+
+	if (scheduler_thread.joinable())
+	{
+		scheduler_thread.join();
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (backup_thread.joinable())
+	{
+		backup_thread.join();
+	}
+
+	TrkHeadIndex::Get().Reset();
+}
+
+bool TrkDatabaseMaintenance::StartBackup()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (stopping || backup_running)
+	{
+		return false;
+	}
+
+	// The previous backup has finished, only its thread is left to join
+	if (backup_thread.joinable())
+	{
+		backup_thread.join();
+	}
+
+	backup_running = true;
+	backup_thread = std::thread(&TrkDatabaseMaintenance::RunBackup, this);
+	return true;
+}
+
+TrkString TrkDatabaseMaintenance::Checkpoint(const int Mode)
+{
+	TrkTraceSpan span("Checkpoint");
+	std::lock_guard<std::mutex> lock(checkpoint_mutex);
+
+	TrkString results;
+	int64_t frames = 0;
+
+	for (const TrkNamedDatabase& database : GetDatabases())
+	{
+		const auto start = std::chrono::steady_clock::now();
+
+		TrkSqlite::TrkCheckpointResult result;
+		try
+		{
+			result = CheckpointDatabase(*database.pool, Mode);
+		}
+		catch (const TrkSqlite::TrkDatabaseException& ex)
+		{
+			LOG_ERR("Checkpoint of " << database.name << " database failed: " << ex.what());
+			result.code = ex.GetErrorCode();
+		}
+
+		checkpoints.Increment();
+		checkpoint_time.Record(TrkElapsedMicroseconds(start));
+		if (result.code == TrkSqlite::BUSY)
+		{
+			checkpoints_busy.Increment();
+		}
+		if (result.log_frames > 0)
+		{
+			frames += result.log_frames;
+		}
+
+		results << database.name << "=" << result.code << "," << result.log_frames << "," << result.checkpointed_frames << ";";
+	}
+
+	log_frames = frames;
+	return results;
+}
+
+bool TrkDatabaseMaintenance::BuildHeadSnapshot()
+{
+	TrkSqlite::TrkDatabasePool* depot = GetDepotDatabase();
+	if (head_snapshot_interval.count() == 0 || depot == nullptr)
+	{
+		return false;
+	}
+	return TrkHeadIndex::Get().Build(*depot);
+}
+
+bool TrkDatabaseMaintenance::RepackObjects()
+{
+	TrkObjectStore* store = GetObjectStore();
+	if (repack_interval.count() == 0 || store == nullptr)
+	{
+		return false;
+	}
+
+	TrkTraceSpan span("Repack");
+
+	// Each revision is stored as a delta against the one before it, the changes are read again after a failed repack
+	int64_t last_change = delta_change;
+	std::vector<std::pair<TrkString, TrkString>> bases;
+	if (GetRevisionDeltaBasesDB(last_change, bases))
+	{
+		for (const auto& [digest, base] : bases)
+		{
+			store->SetDeltaBase(digest, base);
+		}
+	}
+
+	if (!store->Repack())
+	{
+		LOG_ERR("Repack of object store failed");
+		return false;
+	}
+	delta_change = last_change;
+	return true;
+}
+
+void TrkDatabaseMaintenance::SchedulerLoop()
+{
+	auto next_checkpoint = std::chrono::steady_clock::now() + checkpoint_interval;
+	auto next_backup = std::chrono::steady_clock::now() + backup_interval;
+
+	// Lookups read the database until the first snapshot is in place
+	BuildHeadSnapshot();
+	auto next_head_snapshot = std::chrono::steady_clock::now() + head_snapshot_interval;
+	auto next_repack = std::chrono::steady_clock::now() + repack_interval;
+
+	std::unique_lock<std::mutex> lock(mutex);
+	while (running)
+	{
+		if (checkpoint_interval.count() == 0 && backup_interval.count() == 0 && head_snapshot_interval.count() == 0 && repack_interval.count() == 0)
+		{
+			scheduler_cv.wait(lock, [this]() { return !running; });
+			break;
+		}
+
+		auto wake = std::chrono::steady_clock::time_point::max();
+		if (checkpoint_interval.count() > 0 && next_checkpoint < wake)
+		{
+			wake = next_checkpoint;
+		}
+		if (backup_interval.count() > 0 && next_backup < wake)
+		{
+			wake = next_backup;
+		}
+		if (head_snapshot_interval.count() > 0 && next_head_snapshot < wake)
+		{
+			wake = next_head_snapshot;
+		}
+		if (repack_interval.count() > 0 && next_repack < wake)
+		{
+			wake = next_repack;
+		}
+
+		if (scheduler_cv.wait_until(lock, wake, [this]() { return !running; }))
+		{
+			break;
+		}
+
+		lock.unlock();
+
+		const auto now = std::chrono::steady_clock::now();
+		if (checkpoint_interval.count() > 0 && now >= next_checkpoint)
+		{
+			Checkpoint(TrkSqlite::CHECKPOINT_PASSIVE);
+			next_checkpoint = std::chrono::steady_clock::now() + checkpoint_interval;
+		}
+		if (backup_interval.count() > 0 && now >= next_backup)
+		{
+			// A backup still running from the last interval is left alone
+			StartBackup();
+			next_backup = std::chrono::steady_clock::now() + backup_interval;
+		}
+		if (head_snapshot_interval.count() > 0 && now >= next_head_snapshot)
+		{
+			BuildHeadSnapshot();
+			next_head_snapshot = std::chrono::steady_clock::now() + head_snapshot_interval;
+		}
+		if (repack_interval.count() > 0 && now >= next_repack)
+		{
+			RepackObjects();
+			next_repack = std::chrono::steady_clock::now() + repack_interval;
+		}
+
+		lock.lock();
+	}
+}
+
+void TrkDatabaseMaintenance::RunBackup()
+{
+	TrkTraceSpan span("Backup");
+	const auto start = std::chrono::steady_clock::now();
+	const TrkString timestamp = GetTimestamp("%Y%m%d-%H%M%S");
+
+	std::error_code error;
+	fs::create_directories(backup_dir.c_str(), error);
+
+	bool succeeded = !error;
+	if (error)
+	{
+		LOG_ERR("Failed to create backup directory " << backup_dir << ": " << error.message().c_str());
+	}
+
+	for (const TrkNamedDatabase& database : GetDatabases())
+	{
+		if (!succeeded)
+		{
+			break;
+		}
+
+		TrkString filename;
+		filename << database.name << "-" << timestamp << ".db";
+		const fs::path destination = fs::path(backup_dir.c_str()) / filename.c_str();
+		const fs::path partial = destination.string() + ".tmp";
+
+		succeeded = BackupDatabase(database.name, *database.pool, partial.string().c_str());
+		if (succeeded)
+		{
+			fs::rename(partial, destination, error);
+			succeeded = !error;
+		}
+		if (!succeeded)
+		{
+			fs::remove(partial, error);
+			break;
+		}
+
+		LOG_OUT("Backed up " << database.name << " database to " << destination.string().c_str());
+		RemoveOldBackups(database.name);
+	}
+
+	if (succeeded)
+	{
+		backups_completed.Increment();
+		backup_time.Record(TrkElapsedMicroseconds(start));
+	}
+	else
+	{
+		backups_failed.Increment();
+	}
+
+	backup_remaining_pages = 0;
+	backup_total_pages = 0;
+	backup_running = false;
+}
+
+void TrkDatabaseMaintenance::RemoveOldBackups(const char* Name)
+{
+	if (backup_keep == 0)
+	{
+		return;
+	}
+
+	std::error_code error;
+	std::vector<fs::path> backups;
+	for (fs::directory_iterator it(backup_dir.c_str(), error), end; !error && it != end; it.increment(error))
+	{
+		if (IsBackupFileName(it->path().filename().string(), Name))
+		{
+			backups.push_back(it->path());
+		}
+	}
+
+	if (backups.size() <= static_cast<size_t>(backup_keep))
+	{
+		return;
+	}
+
+	// Timestamps sort in name order, the oldest copies come first
+	std::sort(backups.begin(), backups.end());
+	for (size_t i = 0; i + backup_keep < backups.size(); i++)
+	{
+		if (fs::remove(backups[i], error))
+		{
+			LOG_OUT("Removed old backup " << backups[i].string().c_str());
+		}
+	}
+}
+
+bool TrkDatabaseMaintenance::BackupDatabase(const char* Name, TrkSqlite::TrkDatabasePool& Pool, const TrkString& Destination)
+{
+	std::unique_ptr<TrkSqlite::TrkBackup> backup;
+
+	// The backup reads through the writer, it must only be finished while the writer is held
+	auto finish = [&Pool, &backup]()
+	{
+		if (backup != nullptr)
+		{
+			TrkSqlite::TrkDatabasePool::Lease source = Pool.Writer();
+			backup.reset();
+		}
+	};
+
+	try
+	{
+		TrkSqlite::TrkDatabase destination(Destination, TrkSqlite::OPEN_READWRITE | TrkSqlite::OPEN_CREATE);
+
+		int ret = TrkSqlite::OK;
+		while (ret != TrkSqlite::DONE)
+		{
+			if (stopping)
+			{
+				LOG_ERR("Backup of " << Name << " database abandoned, server is stopping");
+				finish();
+				return false;
+			}
+
+			{
+				TrkSqlite::TrkDatabasePool::Lease source = Pool.Writer();
+				if (backup == nullptr)
+				{
+					backup.reset(new TrkSqlite::TrkBackup(destination, *source));
+				}
+				ret = backup->ExecuteStep(backup_pages);
+			}
+
+			backup_remaining_pages = backup->GetRemainingPages();
+			backup_total_pages = backup->GetTotalPages();
+
+			if (ret == TrkSqlite::BUSY || ret == TrkSqlite::LOCKED)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(TRK_BACKUP_RETRY_PAUSE));
+			}
+			else if (ret != TrkSqlite::DONE)
+			{
+				std::this_thread::sleep_for(backup_pause);
+			}
+		}
+
+		finish();
+		return true;
+	}
+	catch (const TrkSqlite::TrkDatabaseException& ex)
+	{
+		LOG_ERR("Backup of " << Name << " database failed: " << ex.what());
+		finish();
+	}
+
+	return false;
+}
+
+TrkSqlite::TrkCheckpointResult TrkDatabaseMaintenance::CheckpointDatabase(TrkSqlite::TrkDatabasePool& Pool, const int Mode)
+{
+	// A connection of its own, a checkpoint never holds up the writer or the readers of the pool
+	TrkSqlite::TrkDatabase database(Pool.GetFilename(), TrkSqlite::OPEN_READWRITE);
+
+	database.SetBusyTimeout(TRK_CHECKPOINT_BUSY_TIMEOUT);
+
+	// The log is opened with the first read of the connection
+	database.Execute("SELECT count(*) FROM sqlite_master");
+
+	TrkSqlite::TrkCheckpointResult result = database.Checkpoint(Mode);
+	if (Mode == TrkSqlite::CHECKPOINT_PASSIVE && result.code == TrkSqlite::OK
+		&& result.log_frames >= TRK_CHECKPOINT_ESCALATE_FRAMES && result.checkpointed_frames < result.log_frames)
+	{
+		// Readers kept a large part of the log, wait for them so the log can start over
+		checkpoints_escalated.Increment();
+		result = database.Checkpoint(TrkSqlite::CHECKPOINT_RESTART);
+	}
+
+	return result;
+}
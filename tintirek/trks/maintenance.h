@@ -0,0 +1,136 @@
+/*
+ *	maintenance.h
+ *
+ *	Background database maintenance of Tintirek's server
+ */
+
+#ifndef TRK_MAINTENANCE_H
+#define TRK_MAINTENANCE_H
+
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "cmdline.h"
+#include "metrics.h"
+#include "databasepool.h"
+
+
+/* WAL frames a passive checkpoint may leave behind before it is retried as RESTART */
+#define TRK_CHECKPOINT_ESCALATE_FRAMES 4096
+
+/* Milliseconds an escalated checkpoint waits for readers and writers */
+#define TRK_CHECKPOINT_BUSY_TIMEOUT 1000
+
+/* Milliseconds a backup step waits before retrying a busy or locked database */
+#define TRK_BACKUP_RETRY_PAUSE 100
+
+
+/*
+ *	Database maintenance
+ *
+ *	Runs WAL checkpoints and online backups of the server databases on
+ *	a background thread. A scheduled checkpoint is PASSIVE and never
+ *	waits; only when readers kept more than TRK_CHECKPOINT_ESCALATE_FRAMES
+ *	frames in the log it is retried as RESTART, so the log starts over
+ *	instead of growing. TRUNCATE is only run when it is asked for.
+ *
+ *	A backup copies every database with sqlite3_backup a few pages at a
+ *	time through the writer of its pool, sleeping between steps so
+ *	commits keep going while it runs. Copies are written next to their
+ *	final name and renamed once complete. After a complete backup only
+ *	the newest copies of each database are kept, so scheduled and
+ *	requested backups do not fill the disk.
+ *
+ *	The head snapshot of the depot is built once the scheduler starts
+ *	and rebuilt every interval after that. Small loose objects of the
+ *	object store are rolled into packs every repack interval.
+ */
+class TrkDatabaseMaintenance
+{
+public:
+	/* Returns the process-wide maintenance */
+	static TrkDatabaseMaintenance& Get();
+
+	~TrkDatabaseMaintenance();
+
+	/* Starts the scheduler thread with the server's database settings */
+	void Start(const TrkCliServerOptionResults& Options);
+	/* Stops the scheduler, a running backup is abandoned at its next step */
+	void Stop();
+
+	/* Starts a backup in the background, returns false if one is already running */
+	bool StartBackup();
+	/* Checkpoints every database now with given mode, returns "<name>=code,log,checkpointed;" per database */
+	TrkString Checkpoint(const int Mode);
+	/* Rebuilds the head snapshot of the depot now, returns false if it is disabled or failed */
+	bool BuildHeadSnapshot();
+	/* Rolls small loose objects into a pack now, returns false if it is disabled or failed */
+	bool RepackObjects();
+
+	/* A backup is running */
+	std::atomic<bool> backup_running;
+	/* Pages left to copy and total pages of the database being copied */
+	std::atomic<int64_t> backup_remaining_pages;
+	std::atomic<int64_t> backup_total_pages;
+	/* Frames in the logs of all databases at the last checkpoint */
+	std::atomic<int64_t> log_frames;
+
+	/* Backups completed */
+	TrkCounter backups_completed;
+	/* Backups failed or abandoned */
+	TrkCounter backups_failed;
+	/* Time of each completed backup, in microseconds */
+	TrkHistogram backup_time;
+	/* Checkpoints run, escalated ones count once */
+	TrkCounter checkpoints;
+	/* Passive checkpoints retried as RESTART */
+	TrkCounter checkpoints_escalated;
+	/* Checkpoints that could not finish because the database was busy */
+	TrkCounter checkpoints_busy;
+	/* Time of each checkpoint, in microseconds */
+	TrkHistogram checkpoint_time;
+
+private:
+	TrkDatabaseMaintenance();
+
+	/* Scheduler thread loop */
+	void SchedulerLoop();
+	/* Backup thread, copies every database */
+	void RunBackup();
+	/* Removes all but the newest backup_keep copies of a database from the backup directory */
+	void RemoveOldBackups(const char* Name);
+	/* Copies one database to given file, returns false if it failed or was abandoned */
+	bool BackupDatabase(const char* Name, TrkSqlite::TrkDatabasePool& Pool, const TrkString& Destination);
+	/* Checkpoints one database, escalating a passive checkpoint when the log keeps growing */
+	TrkSqlite::TrkCheckpointResult CheckpointDatabase(TrkSqlite::TrkDatabasePool& Pool, const int Mode);
+
+	std::chrono::seconds checkpoint_interval{ 0 };
+	std::chrono::seconds backup_interval{ 0 };
+	std::chrono::seconds head_snapshot_interval{ 0 };
+	std::chrono::seconds repack_interval{ 0 };
+	/* Newest change whose revisions were given to the object store as delta bases */
+	int64_t delta_change = 0;
+	TrkString backup_dir;
+	int backup_pages = 64;
+	std::chrono::milliseconds backup_pause{ 10 };
+	int backup_keep = 7;
+
+	std::mutex mutex;
+	std::condition_variable scheduler_cv;
+	bool running = false;
+	/* Set by Stop(), a running backup gives up at its next step */
+	std::atomic<bool> stopping;
+
+	/* Serializes checkpoints of the scheduler and the Checkpoint command */
+	std::mutex checkpoint_mutex;
+
+	std::thread scheduler_thread;
+	std::thread backup_thread;
+};
+
+
+#endif /* TRK_MAINTENANCE_H */
@@ -5,12 +5,14 @@
  */
 
 
+#include <algorithm>
 #include <sstream>
 #include <iomanip>
 #include <vector>
 #include <chrono>
 #include <thread>
 #include <regex>
+#include <cstring>
 
 #ifdef _WIN32
 #include <WinSock2.h>
@@ -25,40 +27,90 @@
 #endif
 
 #include "trk_version.h"
+#include "authexecutor.h"
 #include "database.h"
 #include "logger.h"
+#include "maintenance.h"
 #include "server.h"
+#include "statistics.h"
+#include "ticketsigner.h"
+#include "tracing.h"
+
+
+/* Maximum number of spans returned by GetTrace command when no limit is given */
+static constexpr size_t trace_dump_limit = 4096;
+
+/* Default number of statements GetStatementStats returns, the slowest in total first */
+static constexpr size_t statement_stats_limit = 50;
+
+
+/* Appends a statement to a tab separated line, its own tabs and line breaks become spaces */
+static void AppendStatementText(TrkString& Output, const TrkString& Query)
+{
+	std::string text(Query.c_str(), Query.size());
+	for (char& c : text)
+	{
+		if (c == '\t' || c == '\r' || c == '\n')
+		{
+			c = ' ';
+		}
+	}
+	Output << text.c_str() << "\n";
+}
 
 
 
 void TrkServer::HandleConnection(TrkClientInfo* client_info)
 {
+	TrkTraceRequestScope request_scope;
+	TrkTraceSpan span("HandleConnection");
+
+	TrkServerStatistics& statistics = TrkServerStatistics::Get();
+	const auto handle_start = std::chrono::steady_clock::now();
+	if (TrkTracer::Get().IsEnabled())
+	{
+		TrkTracer::Get().Record("Queue", client_info->accepted_at, handle_start);
+	}
+	const uint64_t queue_time = TrkElapsedMicroseconds(client_info->accepted_at, handle_start);
+	statistics.active_connections.Increment();
+	statistics.total_connections.Increment();
+
 	TrkString error_str, message;
 	client_info->mutex = std::make_unique<std::mutex>();
 
 	if (!Authenticate(client_info, error_str))
 	{
-		LOG_OUT("Error in authentication (" << client_info->client_connection_info << "): " << error_str);
+		statistics.auth_failures.Increment();
+		LOG_OUT("Error in authentication (" << client_info->client_connection_info << ", request " << TrkTracer::FormatRequestId(TrkTracer::GetCurrentRequest()) << "): " << error_str);
 		Disconnect(client_info);
 		return;
 	}
 
+	const uint64_t auth_time = TrkElapsedMicroseconds(handle_start);
+
 	if (!ReceivePacket(client_info, message, error_str))
 	{
 		Disconnect(client_info);
 		return;
 	}
 
+	const int command_index = TrkServerStatistics::GetCommandIndex(message);
+	statistics.RecordPhase(command_index, TrkStatPhase::QUEUE, queue_time);
+	statistics.RecordPhase(command_index, TrkStatPhase::AUTH, auth_time);
+
 	if (message != "Close")
 	{
 		TrkString returned;
+		TrkServerStatistics::TakeDatabaseTime();
 		HandleCommand(client_info, message, returned);
+		statistics.RecordPhase(command_index, TrkStatPhase::DATABASE, TrkServerStatistics::TakeDatabaseTime());
 
-		int errcode;
+		const auto send_start = std::chrono::steady_clock::now();
 		if (!SendPacket(client_info, returned, error_str))
 		{
-			LOG_ERR("Error with " << client_info->client_connection_info << ": " << error_str);
+			LOG_ERR("Error with " << client_info->client_connection_info << " (request " << TrkTracer::FormatRequestId(TrkTracer::GetCurrentRequest()) << "): " << error_str);
 		}
+		statistics.RecordPhase(command_index, TrkStatPhase::SEND, TrkElapsedMicroseconds(send_start));
 	}
 
 	Disconnect(client_info);
@@ -76,11 +128,14 @@ void TrkServer::Disconnect(TrkClientInfo* client_info)
 	close(client_info->client_socket);
 #endif
 	LOG_OUT("Connection closed: " << client_info->client_connection_info);
+	TrkServerStatistics::Get().active_connections.Decrement();
 	RemoveFromList(client_info);
 }
 
 bool TrkServer::Authenticate(TrkClientInfo* client_info, TrkString& error_msg, bool retry)
 {
+	TrkTraceSpan span("Authenticate");
+
 	TrkString error_str, message, username, passwd;
 	bool ticketauth = false;
 	if (!ReceivePacket(client_info, message, error_str))
@@ -117,6 +172,15 @@ bool TrkServer::Authenticate(TrkClientInfo* client_info, TrkString& error_msg, b
 				passwd = value;
 				ticketauth = true;
 			}
+			else if (key == "Request")
+			{
+				// Continue with the request ID of the client, so traces of both sides match
+				const uint64_t request_id = TrkTracer::ParseRequestId(value);
+				if (request_id != 0)
+				{
+					TrkTracer::SetCurrentRequest(request_id);
+				}
+			}
 		}
 		message.erase(0, pos + 1);
 	}
@@ -131,14 +195,32 @@ bool TrkServer::Authenticate(TrkClientInfo* client_info, TrkString& error_msg, b
 			TrkString db_passwd, db_salt;
 			if (GetUserPasswdFromDB(username, db_passwd, db_salt, db_itr))
 			{
-				TrkString val = passwd;
-				for (int i = 0; i < db_itr; i++)
+				// Hashing runs on the auth executor, expensive logins can not take over connection threads
+				const char* connection = client_info->client_connection_info.c_str();
+				const char* port_pos = std::strrchr(connection, ':');
+				const TrkString source = port_pos != nullptr ? TrkString(connection, port_pos) : TrkString(connection);
+
+				const TrkAuthResult result = TrkAuthExecutor::Get().Verify(source, passwd, db_salt, db_itr, db_passwd);
+				if (result == TrkAuthResult::REJECTED)
 				{
-					val = TrkCryptoHelper::SHA256(val + "::" + db_salt);
+					error_msg << "Too many pending authentications. (Username: " << username << ")";
+					TrkString str = "ERROR\nServer is busy, please try again later.", empty;
+					SendPacket(client_info, str, empty);
+					return false;
 				}
 
-				if (val == db_passwd)
+				if (result == TrkAuthResult::MATCH)
 				{
+					TrkTicketSigner& signer = TrkTicketSigner::Get();
+					if (signer.IsEnabled())
+					{
+						// Signed tickets are validated without the database, nothing to store
+						const int64_t ticket_end = static_cast<int64_t>(std::chrono::system_clock::to_time_t(std::chrono::system_clock::now() + std::chrono::hours(24)));
+						TrkString str = "OK\n";
+						str << signer.Issue(username, ticket_end);
+						return SendPacket(client_info, str, error_msg);
+					}
+
 					TrkString newTicket = "Tintirek::";
 					newTicket << TRK_VERSION << "::";
 					newTicket << static_cast<int64_t>(std::chrono::system_clock::to_time_t(std::chrono::system_clock::now())) << "::";
@@ -164,22 +246,35 @@ bool TrkServer::Authenticate(TrkClientInfo* client_info, TrkString& error_msg, b
 		}
 		else
 		{
-			int64_t db_ticket_endtime;
-			TrkString db_ticket;
-			if (GetUserTicketFromDB(username, db_ticket, db_ticket_endtime))
+			bool known_ticket = false, valid_ticket = false;
+			if (TrkTicketSigner::IsSignedTicket(passwd))
+			{
+				known_ticket = true;
+				valid_ticket = TrkTicketSigner::Get().Validate(username, passwd);
+			}
+			else
 			{
-				if (db_ticket == passwd)
+				int64_t db_ticket_endtime;
+				TrkString db_ticket;
+				if (GetUserTicketFromDB(username, db_ticket, db_ticket_endtime))
 				{
 					int64_t unix_ticket_end = static_cast<int64_t>(std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()));
-					if (unix_ticket_end < db_ticket_endtime)
+					known_ticket = true;
+					valid_ticket = db_ticket == passwd && unix_ticket_end < db_ticket_endtime;
+				}
+			}
+
+			if (known_ticket)
+			{
+				if (valid_ticket)
+				{
+					client_info->ticket = passwd;
+					TrkString str = "OK\n";
+					if (!SendPacket(client_info, str, error_msg))
 					{
-						TrkString str = "OK\n";
-						if (!SendPacket(client_info, str, error_msg))
-						{
-							return false;
-						}
-						return true;
+						return false;
 					}
+					return true;
 				}
 
 				TrkString str = "ERROR\nTicket Invalid";
@@ -214,19 +309,26 @@ bool TrkServer::HandleConnectionMultiple(TrkClientInfo* client_info, TrkString&
 		return false;
 	}
 
+	TrkServerStatistics& statistics = TrkServerStatistics::Get();
+	const int command_index = TrkServerStatistics::GetCommandIndex(message);
+
 	TrkString returned;
+	TrkServerStatistics::TakeDatabaseTime();
 	if (!HandleCommand(client_info, message, returned))
 	{
 		error_str = returned;
 		return false;
 	}
+	statistics.RecordPhase(command_index, TrkStatPhase::DATABASE, TrkServerStatistics::TakeDatabaseTime());
 
 	if (strcmp(returned, "NONE\n") != 0)
 	{
+		const auto send_start = std::chrono::steady_clock::now();
 		if (!SendPacket(client_info, returned, error_str))
 		{
 			return false;
 		}
+		statistics.RecordPhase(command_index, TrkStatPhase::SEND, TrkElapsedMicroseconds(send_start));
 	}
 
 	return true;
@@ -234,6 +336,8 @@ bool TrkServer::HandleConnectionMultiple(TrkClientInfo* client_info, TrkString&
 
 bool TrkServer::HandleCommand(TrkClientInfo* client_info, const TrkString Message, TrkString& Returned)
 {
+	TrkTraceSpan span("HandleCommand", TrkServerStatistics::GetCommandName(TrkServerStatistics::GetCommandIndex(Message)));
+
 	TrkString command;
 	std::vector<TrkString> parameters;
 	size_t pos = Message.find("?");
@@ -244,7 +348,7 @@ bool TrkServer::HandleCommand(TrkClientInfo* client_info, const TrkString Messag
 		size_t current = pos + 1;
 		while ((pos = Message.find("?", current)) != std::string::npos)
 		{
-			parameters.push_back(Message.substr(current, pos));
+			parameters.push_back(Message.substr(current, pos - current));
 			current = pos + 1;
 		}
 
@@ -280,8 +384,137 @@ bool TrkServer::HandleCommand(TrkClientInfo* client_info, const TrkString Messag
 		Returned = ss;
 		return true;
 	}
+	else if (command == "GetStatistics")
+	{
+		if (!CheckAdmin(client_info, Returned))
+		{
+			return false;
+		}
+
+		Returned << "OK\n" << TrkServerStatistics::Get().Format();
+		return true;
+	}
+	else if (command == "GetTrace")
+	{
+		if (!CheckAdmin(client_info, Returned))
+		{
+			return false;
+		}
+
+		size_t limit = trace_dump_limit;
+		if (parameters.size() > 0 && TrkString::stoi(parameters[0]) > 0)
+		{
+			limit = static_cast<size_t>(TrkString::stoi(parameters[0]));
+		}
+
+		Returned << "OK\n" << TrkTracer::Get().DumpChromeJson(limit);
+		return true;
+	}
+	else if (command == "GetStatementStats")
+	{
+		if (!CheckAdmin(client_info, Returned))
+		{
+			return false;
+		}
+
+		// Parameter is the number of statements, or "reset" to zero the counters after this report
+		size_t limit = statement_stats_limit;
+		const bool reset = !parameters.empty() && parameters[0] == "reset";
+		if (!parameters.empty() && TrkString::stoi(parameters[0]) > 0)
+		{
+			limit = static_cast<size_t>(TrkString::stoi(parameters[0]));
+		}
+
+		TrkSqlite::TrkStatementProfiler& profiler = TrkSqlite::TrkStatementProfiler::Get();
+		std::vector<TrkSqlite::TrkStatementStatsSnapshot> statements = profiler.Snapshot();
+		std::sort(statements.begin(), statements.end(), [](const TrkSqlite::TrkStatementStatsSnapshot& A, const TrkSqlite::TrkStatementStatsSnapshot& B)
+		{
+			return A.total_time > B.total_time;
+		});
+
+		// calls, rows, total us, max us, busy retries, slow executions and the statement on every line
+		Returned << "OK\n";
+		for (size_t i = 0; i < statements.size() && i < limit; i++)
+		{
+			const TrkSqlite::TrkStatementStatsSnapshot& statement = statements[i];
+			Returned << statement.calls << "\t" << statement.rows << "\t" << statement.total_time << "\t"
+				<< statement.max_time << "\t" << statement.busy_retries << "\t" << statement.slow << "\t";
+			AppendStatementText(Returned, statement.query);
+		}
+
+		if (reset)
+		{
+			profiler.Reset();
+		}
+		return true;
+	}
+	else if (command == "GetSlowStatements")
+	{
+		if (!CheckAdmin(client_info, Returned))
+		{
+			return false;
+		}
+
+		// Unix time in milliseconds, duration in microseconds and the statement on every line
+		Returned << "OK\n";
+		for (const TrkSqlite::TrkSlowStatement& statement : TrkSqlite::TrkStatementProfiler::Get().GetSlowStatements())
+		{
+			Returned << statement.timestamp << "\t" << statement.duration << "\t";
+			AppendStatementText(Returned, statement.query);
+		}
+		return true;
+	}
+	else if (command == "Backup")
+	{
+		if (!CheckAdmin(client_info, Returned))
+		{
+			return false;
+		}
+
+		TrkDatabaseMaintenance& maintenance = TrkDatabaseMaintenance::Get();
+		const bool started = maintenance.StartBackup();
+
+		Returned << "OK\n"
+			<< "started=" << (started ? 1 : 0) << ";"
+			<< "remaining=" << maintenance.backup_remaining_pages.load() << ";"
+			<< "total=" << maintenance.backup_total_pages.load() << ";";
+		return true;
+	}
+	else if (command == "Checkpoint")
+	{
+		if (!CheckAdmin(client_info, Returned))
+		{
+			return false;
+		}
+
+		int mode = TrkSqlite::CHECKPOINT_PASSIVE;
+		if (!parameters.empty())
+		{
+			if (parameters[0] == "FULL")
+			{
+				mode = TrkSqlite::CHECKPOINT_FULL;
+			}
+			else if (parameters[0] == "RESTART")
+			{
+				mode = TrkSqlite::CHECKPOINT_RESTART;
+			}
+			else if (parameters[0] == "TRUNCATE")
+			{
+				mode = TrkSqlite::CHECKPOINT_TRUNCATE;
+			}
+			else if (parameters[0] != "PASSIVE")
+			{
+				Returned << "ERROR\nUnknown checkpoint mode " << parameters[0];
+				return false;
+			}
+		}
+
+		Returned << "OK\n" << TrkDatabaseMaintenance::Get().Checkpoint(mode);
+		return true;
+	}
 	else if (command == "Logout")
 	{
+		TrkTicketSigner::Get().Revoke(client_info->ticket);
 		ResetUserTicketDB(client_info->username);
 		Returned << "OK\n";
 		return true;
@@ -311,14 +544,152 @@ bool TrkServer::HandleCommand(TrkClientInfo* client_info, const TrkString Messag
 		Returned = "NONE\n";
 		return true;
 	}
-	else if (command == "Add")
+	else if (command == "Add" || command == "Edit")
 	{
-		Returned << "OK\n" << parameters[0] << " -- " << "opened for client";
+		if (parameters.empty())
+		{
+			Returned = "ERROR\nMissing file path";
+			return false;
+		}
+
+		// Until clients send a workspace, every user works in one named after them
+		const TrkFileAction action = command == "Add" ? TrkFileAction::ADD : TrkFileAction::EDIT;
+		const TrkString depot_path = GetDepotPath(parameters[0]);
+		TrkFileAction opened_action;
+
+		switch (OpenFileDB(client_info->username, client_info->username, depot_path, action, opened_action))
+		{
+		case TrkOpenFileResult::OPENED:
+			Returned << "OK\n" << depot_path << " -- opened for " << GetFileActionName(opened_action);
+			return true;
+		case TrkOpenFileResult::ALREADY_OPENED:
+			Returned << "OK\n" << depot_path << " -- already opened for " << GetFileActionName(opened_action);
+			return true;
+		case TrkOpenFileResult::ALREADY_IN_DEPOT:
+			Returned << "OK\n" << depot_path << " -- can't add existing file, use edit";
+			return true;
+		case TrkOpenFileResult::NOT_IN_DEPOT:
+			Returned << "OK\n" << depot_path << " -- file not on server, use add";
+			return true;
+		default:
+			Returned << "ERROR\n" << depot_path << " -- could not be opened";
+			return false;
+		}
+	}
+	else if (command == "Files")
+	{
+		// "//depot/x/..." lists everything under //depot/x/
+		TrkString prefix = parameters.empty() ? TrkString("//depot/") : parameters[0];
+		if (prefix.size() >= 3 && strcmp(prefix.c_str() + prefix.size() - 3, "...") == 0)
+		{
+			prefix = prefix.substr(0, prefix.size() - 3);
+		}
+
+		std::vector<TrkDepotFileInfo> files;
+		if (!GetDepotFilesDB(prefix, files))
+		{
+			Returned = "ERROR\nDepot files could not be listed";
+			return false;
+		}
+
+		Returned << "OK\n";
+		for (const TrkDepotFileInfo& file : files)
+		{
+			Returned << file.path << "#" << static_cast<int64_t>(file.head_revision) << " - " << GetFileActionName(file.head_action) << " change " << static_cast<int64_t>(file.head_change) << "\n";
+		}
 		return true;
 	}
-	else if (command == "Edit")
+	else if (command == "Opened")
 	{
-		Returned << "OK\n" << parameters[0] << " -- " << "already opened for client";
+		std::vector<TrkOpenedFileInfo> files;
+		if (!GetOpenedFilesDB(client_info->username, files))
+		{
+			Returned = "ERROR\nOpened files could not be listed";
+			return false;
+		}
+
+		Returned << "OK\n";
+		for (const TrkOpenedFileInfo& file : files)
+		{
+			Returned << file.path << "#" << static_cast<int64_t>(file.base_revision) << " - " << GetFileActionName(file.action) << " change " << static_cast<int64_t>(file.change) << " (" << file.workspace << ")\n";
+		}
+		return true;
+	}
+	else if (command == "MissingChunks")
+	{
+		TrkObjectStore* store = GetObjectStore();
+		if (store == nullptr)
+		{
+			Returned = "ERROR\nObject store is not available";
+			return false;
+		}
+
+		// Chunks an upload still has to send, one digest per line
+		Returned << "OK\n";
+		for (const TrkString& digest : parameters)
+		{
+			if (!TrkObjectStore::IsValidDigest(digest))
+			{
+				Returned = "ERROR\nInvalid chunk digest";
+				return false;
+			}
+			if (!store->Contains(digest))
+			{
+				Returned << digest << "\n";
+			}
+		}
+		return true;
+	}
+	else if (command == "PutChunk")
+	{
+		TrkObjectStore* store = GetObjectStore();
+		std::string contents;
+		if (store == nullptr)
+		{
+			Returned = "ERROR\nObject store is not available";
+			return false;
+		}
+		if (parameters.size() != 2 || !TrkObjectStore::IsValidDigest(parameters[0])
+			|| !TrkCryptoHelper::Base64Decode(parameters[1], contents) || contents.size() >= TRK_OBJECT_CHUNKED_MIN_SIZE)
+		{
+			Returned = "ERROR\nInvalid chunk";
+			return false;
+		}
+
+		// A chunk, or a whole file below the chunking size; the reply acknowledges it, an interrupted upload starts again after it
+		TrkObjectWriter writer;
+		TrkString digest;
+		if (!store->BeginWrite(writer) || !writer.Write(contents.data(), contents.size()) || !writer.Commit(digest, parameters[0]))
+		{
+			Returned << "ERROR\nChunk " << parameters[0] << " could not be stored";
+			return false;
+		}
+
+		Returned << "OK\n" << digest;
+		return true;
+	}
+	else if (command == "PutChunkList")
+	{
+		TrkObjectStore* store = GetObjectStore();
+		if (store == nullptr)
+		{
+			Returned = "ERROR\nObject store is not available";
+			return false;
+		}
+		if (parameters.empty())
+		{
+			Returned = "ERROR\nMissing file digest";
+			return false;
+		}
+
+		const std::vector<TrkString> chunks(parameters.begin() + 1, parameters.end());
+		if (!store->PutChunkList(chunks, parameters[0]))
+		{
+			Returned << "ERROR\n" << parameters[0] << " -- chunks are missing or do not match the file";
+			return false;
+		}
+
+		Returned << "OK\n" << parameters[0];
 		return true;
 	}
 
@@ -326,36 +697,45 @@ bool TrkServer::HandleCommand(TrkClientInfo* client_info, const TrkString Messag
 	return false;
 }
 
+bool TrkServer::CheckAdmin(TrkClientInfo* client_info, TrkString& Returned)
+{
+	// Admins are listed by name in the server configuration, separated by commas
+	std::stringstream admins(opt_result->admin_users.c_str());
+	std::string admin;
+	while (std::getline(admins, admin, ','))
+	{
+		const size_t first = admin.find_first_not_of(' ');
+		if (first != std::string::npos && client_info->username == admin.substr(first, admin.find_last_not_of(' ') - first + 1).c_str())
+		{
+			return true;
+		}
+	}
+
+	LOG_OUT("Administration command denied for " << client_info->username << " (" << client_info->client_connection_info << ")");
+	Returned = "ERROR\nPermission denied, only server admins can run this command";
+	return false;
+}
+
 bool TrkServer::SendPacket(TrkClientInfo* client_info, const TrkString message, TrkString& error_str)
 {
+	TrkTraceSpan span("SendPacket");
 	int totalSent = 0;
+	// Peers read chunks into 1 KiB buffers, a larger chunk would overrun them
 	int chunkSize = 1024;
 
+	// Chunks go out back to back, each header in the same write as its body
 	while (totalSent < message.size())
 	{
-		std::chrono::milliseconds sleeptime(1);
-		std::this_thread::sleep_for(sleeptime);
 		int remaining = message.size() - totalSent;
 		int sendSize = std::min<int>(chunkSize, remaining);
 
-		TrkString chunkHeader;
 		char hexString[4];
 		std::sprintf(hexString, "%03X", sendSize);
-		chunkHeader << hexString << "\r\n";
-		if (Send(client_info, chunkHeader, chunkHeader.size(), client_info->client_ssl_socket != nullptr) <= 0)
-		{
-			error_str << "Send Failed! (errno: "
-#ifdef _WIN32
-				<< WSAGetLastError()
-#else
-				<< errno
-#endif
-				<< ")";
-			return false;
-		}
+		std::string chunkData = std::string(hexString) + "\r\n";
+		chunkData.append(message.begin() + totalSent, sendSize);
 
-		TrkString chunkBody(message.begin() + totalSent, message.begin() + totalSent + sendSize);
-		if (Send(client_info, chunkBody, chunkBody.size(), client_info->client_ssl_socket != nullptr) <= 0)
+		TrkString chunk(chunkData.data(), chunkData.data() + chunkData.size());
+		if (Send(client_info, chunk, chunk.size(), client_info->client_ssl_socket != nullptr) <= 0)
 		{
 			error_str << "Send Failed! (errno: "
 #ifdef _WIN32
@@ -387,7 +767,10 @@ bool TrkServer::SendPacket(TrkClientInfo* client_info, const TrkString message,
 
 bool TrkServer::ReceivePacket(TrkClientInfo* client_info, TrkString& message, TrkString& error_str)
 {
-	TrkString buffer, receivedData = "";
+	TrkTraceSpan span("ReceivePacket");
+	// Chunks are appended to a std::string, appending to a TrkString copies all of it every time
+	TrkString buffer;
+	std::string receivedData;
 	bool readingChunkHeader = true;
 	int chunkSize = 5, bytesRead;
 
@@ -397,8 +780,6 @@ bool TrkServer::ReceivePacket(TrkClientInfo* client_info, TrkString& message, Tr
 		buffer = "";
 		while (chunkSize > bytesRead)
 		{
-			std::chrono::milliseconds sleeptime(1);
-			std::this_thread::sleep_for(sleeptime);
 			TrkString newBuffer;
 			int newBytesRead = Recv(client_info, newBuffer, chunkSize - bytesRead, client_info->client_ssl_socket != nullptr);
 			if (newBytesRead < 0)
@@ -409,6 +790,9 @@ bool TrkServer::ReceivePacket(TrkClientInfo* client_info, TrkString& message, Tr
 			}
 			else if (newBytesRead == 0)
 			{
+				// Nothing arrived yet, waits a moment before asking again
+				std::chrono::milliseconds sleeptime(1);
+				std::this_thread::sleep_for(sleeptime);
 				continue;
 			}
 			bytesRead += newBytesRead;
@@ -421,14 +805,14 @@ bool TrkServer::ReceivePacket(TrkClientInfo* client_info, TrkString& message, Tr
 			chunkSize = TrkString::stoi(chunkSizeStr, 16);
 			if (chunkSize == 0)
 			{
-				message = receivedData;
+				message = TrkString(receivedData.data(), receivedData.data() + receivedData.size());
 				return true;
 			}
 			readingChunkHeader = false;
 		}
 		else
 		{
-			receivedData << TrkString(buffer.begin(), buffer.begin() + chunkSize);
+			receivedData.append(buffer.begin(), chunkSize);
 			chunkSize = 5;
 			readingChunkHeader = true;
 		}
@@ -439,26 +823,35 @@ bool TrkServer::ReceivePacket(TrkClientInfo* client_info, TrkString& message, Tr
 
 int TrkServer::Send(TrkClientInfo* clientInfo, TrkString buf, int len, bool use_ssl)
 {
+	int bytes_sent;
 	if (use_ssl)
 	{
-		return TrkSSLHelper::Write(clientInfo->client_ssl_socket, buf, len);
+		bytes_sent = TrkSSLHelper::Write(clientInfo->client_ssl_socket, buf, len);
 	}
 	else
 	{
-		return send(clientInfo->client_socket, buf, len, 0);
+		bytes_sent = send(clientInfo->client_socket, buf, len, 0);
 	}
+
+	if (bytes_sent > 0)
+	{
+		TrkServerStatistics::Get().bytes_out.Add(bytes_sent);
+	}
+
+	return bytes_sent;
 }
 
 int TrkServer::Recv(TrkClientInfo* clientInfo, TrkString& buf, int len, bool use_ssl)
 {
+	int bytes_read;
 	if (use_ssl)
 	{
-		return TrkSSLHelper::Read(clientInfo->client_ssl_socket, buf, len);
+		bytes_read = TrkSSLHelper::Read(clientInfo->client_ssl_socket, buf, len);
 	}
 	else
 	{
 		char internal_strings[1024];
-		int bytes_read = recv(clientInfo->client_socket, internal_strings, len, 0);
+		bytes_read = recv(clientInfo->client_socket, internal_strings, len, 0);
 
 		if (bytes_read > 0)
 		{
@@ -468,7 +861,12 @@ int TrkServer::Recv(TrkClientInfo* clientInfo, TrkString& buf, int len, bool use
 		{
 			buf = TrkString("");
 		}
+	}
 
-		return bytes_read;
+	if (bytes_read > 0)
+	{
+		TrkServerStatistics::Get().bytes_in.Add(bytes_read);
 	}
+
+	return bytes_read;
 }
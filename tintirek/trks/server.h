@@ -11,6 +11,7 @@
 #include <iostream>
 #include <memory>
 #include <mutex>
+#include <chrono>
 
 #include "config.h"
 #include "crypto.h"
@@ -24,6 +25,7 @@ public:
 		, client_socket(Socket)
 		, client_ssl_socket(SSLSocket)
 		, client_connection_info(ip_port)
+		, accepted_at(std::chrono::steady_clock::now())
 	{ }
 
 	~TrkClientInfo()
@@ -51,6 +53,10 @@ public:
 	TrkString client_connection_info = "";
 	/*	Client username */
 	TrkString username = "";
+	/*	Ticket the client authenticated with, empty for password logins */
+	TrkString ticket = "";
+	/*	Time the connection was accepted */
+	std::chrono::steady_clock::time_point accepted_at;
 
 protected:
 	/* Linked list's next element */
@@ -135,6 +141,8 @@ public:
 	virtual bool HandleConnectionMultiple(TrkClientInfo* client_info, TrkString& error_str);
 	/*	Handle commands */
 	virtual bool HandleCommand(TrkClientInfo* client_info, const TrkString Message, TrkString& Returned);
+	/*	Returns true if the client's user is one of the server's admins, otherwise sets the error reply */
+	virtual bool CheckAdmin(TrkClientInfo* client_info, TrkString& Returned);
 
 	/*	Sends packet to client as chunked data */
 	virtual bool SendPacket(TrkClientInfo* client_info, const TrkString message, TrkString& error_str);
@@ -0,0 +1,237 @@
+/*
+ *	statistics.cpp
+ *
+ *	Runtime statistics of Tintirek's server
+ */
+
+
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+#include "authexecutor.h"
+#include "database.h"
+#include "logger.h"
+#include "headindex.h"
+#include "maintenance.h"
+#include "statistics.h"
+#include "ticketcache.h"
+#include "ticketsigner.h"
+
+
+/* Commands which have their own histograms, the last one collects unknown commands */
+static const char* command_names[] =
+{
+	"Close",
+	"GetInformation",
+	"GetStatistics",
+	"GetTrace",
+	"Backup",
+	"Checkpoint",
+	"GetStatementStats",
+	"GetSlowStatements",
+	"Logout",
+	"MultipleCommands",
+	"Add",
+	"Edit",
+	"Files",
+	"Opened",
+	"MissingChunks",
+	"PutChunk",
+	"PutChunkList",
+	"Unknown",
+};
+
+/* Number of known commands */
+static constexpr int command_count = sizeof(command_names) / sizeof(command_names[0]);
+
+/* Names of the phases as shown in statistics output */
+static const char* phase_names[] =
+{
+	"queue",
+	"auth",
+	"database",
+	"send",
+};
+
+/* Database time of the request running on this thread */
+thread_local uint64_t request_database_time = 0;
+
+
+/* Appends "<name>=count,p50,p99,p999,max;" with values in microseconds */
+static void FormatHistogram(std::stringstream& ss, const char* Name, const TrkHistogramSnapshot& Snapshot)
+{
+	ss << Name << "="
+		<< Snapshot.count << ","
+		<< Snapshot.GetPercentile(50.0) << ","
+		<< Snapshot.GetPercentile(99.0) << ","
+		<< Snapshot.GetPercentile(99.9) << ","
+		<< Snapshot.max << ";";
+}
+
+
+TrkServerStatistics& TrkServerStatistics::Get()
+{
+	static TrkServerStatistics statistics;
+	return statistics;
+}
+
+TrkServerStatistics::TrkServerStatistics()
+	: commands(new TrkCommandStatistics[command_count])
+{ }
+
+int TrkServerStatistics::GetCommandIndex(const TrkString& Command)
+{
+	const char* command = Command.c_str();
+	size_t length = std::strcspn(command, "?");
+
+	for (int i = 0; i < command_count - 1; i++)
+	{
+		if (std::strlen(command_names[i]) == length && std::strncmp(command_names[i], command, length) == 0)
+		{
+			return i;
+		}
+	}
+
+	return command_count - 1;
+}
+
+const char* TrkServerStatistics::GetCommandName(int CommandIndex)
+{
+	if (CommandIndex < 0 || CommandIndex >= command_count)
+	{
+		CommandIndex = command_count - 1;
+	}
+
+	return command_names[CommandIndex];
+}
+
+void TrkServerStatistics::RecordPhase(int CommandIndex, TrkStatPhase Phase, uint64_t Microseconds)
+{
+	if (CommandIndex < 0 || CommandIndex >= command_count)
+	{
+		CommandIndex = command_count - 1;
+	}
+
+	commands[CommandIndex].phases[static_cast<size_t>(Phase)].Record(Microseconds);
+}
+
+void TrkServerStatistics::AddDatabaseTime(uint64_t Microseconds)
+{
+	request_database_time += Microseconds;
+}
+
+uint64_t TrkServerStatistics::TakeDatabaseTime()
+{
+	uint64_t value = request_database_time;
+	request_database_time = 0;
+	return value;
+}
+
+TrkString TrkServerStatistics::Format() const
+{
+	std::stringstream ss;
+	ss << "connections.active=" << active_connections.Get() << ";"
+		<< "connections.total=" << total_connections.Get() << ";"
+		<< "bytes.in=" << bytes_in.Get() << ";"
+		<< "bytes.out=" << bytes_out.Get() << ";"
+		<< "tls.handshakes=" << tls_handshakes.Get() << ";"
+		<< "tls.failures=" << tls_failures.Get() << ";"
+		<< "auth.failures=" << auth_failures.Get() << ";"
+		<< "log.dropped=" << TrkLogger::Get().GetDroppedCount() << ";";
+
+	const TrkAuthExecutor& auth_executor = TrkAuthExecutor::Get();
+	ss << "auth.queue.depth=" << auth_executor.GetQueueDepth() << ";"
+		<< "auth.queue.max=" << auth_executor.max_queue_depth.load(std::memory_order_relaxed) << ";"
+		<< "auth.completed=" << auth_executor.completed.Get() << ";"
+		<< "auth.rejected.queue=" << auth_executor.rejected_queue.Get() << ";"
+		<< "auth.rejected.source=" << auth_executor.rejected_source.Get() << ";";
+	FormatHistogram(ss, "auth.wait", auth_executor.wait_time.Snapshot());
+	FormatHistogram(ss, "auth.hash", auth_executor.hash_time.Snapshot());
+
+	const TrkTicketCache& ticket_cache = TrkTicketCache::Get();
+	const int64_t cache_hits = ticket_cache.hits.Get();
+	const int64_t cache_lookups = cache_hits + ticket_cache.misses.Get();
+	ss << "ticketcache.hits=" << cache_hits << ";"
+		<< "ticketcache.misses=" << ticket_cache.misses.Get() << ";"
+		<< "ticketcache.hitrate=" << std::fixed << std::setprecision(3) << (cache_lookups > 0 ? static_cast<double>(cache_hits) / cache_lookups : 0.0) << ";";
+
+	int64_t statement_hits, statement_misses;
+	GetStatementCacheStatistics(statement_hits, statement_misses);
+	ss << "statements.hits=" << statement_hits << ";"
+		<< "statements.misses=" << statement_misses << ";"
+		<< "statements.busy.retries=" << TrkSqlite::TrkStatementProfiler::Get().busy_retries.load() << ";";
+
+	const TrkSqlite::TrkDatabaseWriter* database_writer = GetUserDatabaseWriter();
+	if (database_writer != nullptr)
+	{
+		ss << "db.writer.committed=" << database_writer->committed.Get() << ";"
+			<< "db.writer.failed=" << database_writer->failed.Get() << ";";
+		FormatHistogram(ss, "db.writer.batch", database_writer->batch_size.Snapshot());
+		FormatHistogram(ss, "db.writer.commit", database_writer->commit_time.Snapshot());
+		FormatHistogram(ss, "db.writer.wait", database_writer->wait_time.Snapshot());
+	}
+
+	const TrkDatabaseMaintenance& maintenance = TrkDatabaseMaintenance::Get();
+	ss << "db.backup.running=" << (maintenance.backup_running.load() ? 1 : 0) << ";"
+		<< "db.backup.remaining=" << maintenance.backup_remaining_pages.load() << ";"
+		<< "db.backup.total=" << maintenance.backup_total_pages.load() << ";"
+		<< "db.backup.completed=" << maintenance.backups_completed.Get() << ";"
+		<< "db.backup.failed=" << maintenance.backups_failed.Get() << ";";
+	FormatHistogram(ss, "db.backup.time", maintenance.backup_time.Snapshot());
+	ss << "db.checkpoint.runs=" << maintenance.checkpoints.Get() << ";"
+		<< "db.checkpoint.escalated=" << maintenance.checkpoints_escalated.Get() << ";"
+		<< "db.checkpoint.busy=" << maintenance.checkpoints_busy.Get() << ";"
+		<< "db.checkpoint.frames=" << maintenance.log_frames.load() << ";";
+	FormatHistogram(ss, "db.checkpoint.time", maintenance.checkpoint_time.Snapshot());
+
+	const TrkHeadIndex& head_index = TrkHeadIndex::Get();
+	ss << "head.snapshot.builds=" << head_index.builds.Get() << ";"
+		<< "head.snapshot.failed=" << head_index.builds_failed.Get() << ";"
+		<< "head.snapshot.records=" << head_index.records.load() << ";"
+		<< "head.snapshot.change=" << head_index.snapshot_change.load() << ";"
+		<< "head.snapshot.overlay=" << head_index.overlay_size.load() << ";"
+		<< "head.snapshot.lookups=" << head_index.lookups.Get() << ";";
+	FormatHistogram(ss, "head.snapshot.build", head_index.build_time.Snapshot());
+
+	if (const TrkObjectStore* object_store = GetObjectStore())
+	{
+		ss << "objects.written=" << object_store->objects_written.Get() << ";"
+			<< "objects.written.bytes=" << object_store->bytes_written.Get() << ";"
+			<< "objects.deduplicated=" << object_store->objects_deduplicated.Get() << ";"
+			<< "objects.deduplicated.bytes=" << object_store->bytes_deduplicated.Get() << ";"
+			<< "objects.packs=" << object_store->GetPackCount() << ";"
+			<< "objects.packed=" << object_store->objects_packed.Get() << ";"
+			<< "objects.repacks=" << object_store->repacks.Get() << ";"
+			<< "objects.deltified=" << object_store->objects_deltified.Get() << ";"
+			<< "objects.delta.saved=" << object_store->delta_bytes_saved.Get() << ";"
+			<< "objects.chunklists=" << object_store->chunk_lists_written.Get() << ";"
+			<< "objects.cache.hits=" << object_store->cache_hits.Get() << ";"
+			<< "objects.cache.misses=" << object_store->cache_misses.Get() << ";";
+		FormatHistogram(ss, "objects.repack", object_store->repack_time.Snapshot());
+	}
+
+	const TrkTicketSigner& ticket_signer = TrkTicketSigner::Get();
+	ss << "tickets.signed.issued=" << ticket_signer.issued.Get() << ";"
+		<< "tickets.signed.accepted=" << ticket_signer.accepted.Get() << ";"
+		<< "tickets.signed.refused=" << ticket_signer.refused.Get() << ";";
+
+	for (int i = 0; i < command_count; i++)
+	{
+		for (size_t phase = 0; phase < static_cast<size_t>(TrkStatPhase::MAX); phase++)
+		{
+			const TrkHistogramSnapshot snapshot = commands[i].phases[phase].Snapshot();
+			if (snapshot.count == 0)
+			{
+				continue;
+			}
+
+			std::string name = "command.";
+			name.append(command_names[i]).append(".").append(phase_names[phase]);
+			FormatHistogram(ss, name.c_str(), snapshot);
+		}
+	}
+
+	return TrkString(ss.str().c_str());
+}
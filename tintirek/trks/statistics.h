@@ -0,0 +1,108 @@
+/*
+ *	statistics.h
+ *
+ *	Runtime statistics of Tintirek's server
+ */
+
+#ifndef TRK_STATISTICS_H
+#define TRK_STATISTICS_H
+
+
+#include "metrics.h"
+
+
+/* Phases of a request that have their own latency histogram */
+enum class TrkStatPhase : uint8_t
+{
+	/* Waiting between accept and the handler thread picking the connection up */
+	QUEUE = 0,
+	/* Authentication of the connection */
+	AUTH,
+	/* Time spent in database calls while running the command */
+	DATABASE,
+	/* Sending the response back to the client */
+	SEND,
+	/* Number of phases */
+	MAX,
+};
+
+
+/* Latency histograms of a single command, in microseconds */
+class TrkCommandStatistics
+{
+public:
+	TrkHistogram phases[static_cast<size_t>(TrkStatPhase::MAX)];
+};
+
+
+/*
+ *	Server statistics
+ *
+ *	Process-wide counters and per-command latency histograms. Recording
+ *	only touches the shard of the calling CPU, reading is done by the
+ *	GetStatistics command.
+ */
+class TrkServerStatistics
+{
+public:
+	/* Returns the process-wide statistics */
+	static TrkServerStatistics& Get();
+
+	/* Returns the index of given command, unknown commands share one index */
+	static int GetCommandIndex(const TrkString& Command);
+	/* Returns the name of given command index */
+	static const char* GetCommandName(int CommandIndex);
+
+	/* Records the duration of a phase for given command index */
+	void RecordPhase(int CommandIndex, TrkStatPhase Phase, uint64_t Microseconds);
+
+	/* Adds database time to the request running on the calling thread */
+	static void AddDatabaseTime(uint64_t Microseconds);
+	/* Returns and resets database time of the request running on the calling thread */
+	static uint64_t TakeDatabaseTime();
+
+	/* Builds "key=value;" formatted statistics for GetStatistics command */
+	TrkString Format() const;
+
+	/* Bytes received from clients */
+	TrkCounter bytes_in;
+	/* Bytes sent to clients */
+	TrkCounter bytes_out;
+	/* Connections currently being handled */
+	TrkCounter active_connections;
+	/* Connections handled since start */
+	TrkCounter total_connections;
+	/* Completed TLS handshakes */
+	TrkCounter tls_handshakes;
+	/* Failed TLS handshakes */
+	TrkCounter tls_failures;
+	/* Failed authentications */
+	TrkCounter auth_failures;
+
+private:
+	TrkServerStatistics();
+
+	/* Histograms for every known command */
+	TrkCommandStatistics* commands;
+};
+
+
+/* Measures the lifetime of this object as database time of the current request */
+class TrkScopedDatabaseTimer
+{
+public:
+	TrkScopedDatabaseTimer()
+		: start(std::chrono::steady_clock::now())
+	{ }
+
+	~TrkScopedDatabaseTimer()
+	{
+		TrkServerStatistics::AddDatabaseTime(TrkElapsedMicroseconds(start));
+	}
+
+private:
+	std::chrono::steady_clock::time_point start;
+};
+
+
+#endif /* TRK_STATISTICS_H */
@@ -0,0 +1,120 @@
+/*
+ *	ticketcache.cpp
+ *
+ *	In-memory session ticket cache of Tintirek's server
+ */
+
+
+#include "ticketcache.h"
+
+#include <functional>
+
+
+TrkTicketCache& TrkTicketCache::Get()
+{
+	static TrkTicketCache cache;
+	return cache;
+}
+
+TrkTicketCache::Shard& TrkTicketCache::GetShard(const std::string& Username)
+{
+	return shards[std::hash<std::string>()(Username) % TRK_TICKET_CACHE_SHARDS];
+}
+
+const TrkTicketCache::Shard& TrkTicketCache::GetShard(const std::string& Username) const
+{
+	return shards[std::hash<std::string>()(Username) % TRK_TICKET_CACHE_SHARDS];
+}
+
+bool TrkTicketCache::Find(const TrkString& Username, TrkString& Ticket, int64_t& EndTimeUnix)
+{
+	const std::string username(Username.c_str());
+	const Shard& shard = GetShard(username);
+
+	{
+		std::shared_lock<std::shared_mutex> lock(shard.mutex);
+		auto it = shard.entries.find(username);
+		if (it != shard.entries.end())
+		{
+			Ticket = it->second.ticket;
+			EndTimeUnix = it->second.end_time_unix;
+			hits.Increment();
+			return true;
+		}
+	}
+
+	misses.Increment();
+	return false;
+}
+
+uint64_t TrkTicketCache::BeginFill(const TrkString& Username) const
+{
+	const Shard& shard = GetShard(Username.c_str());
+	std::shared_lock<std::shared_mutex> lock(shard.mutex);
+	return shard.generation;
+}
+
+void TrkTicketCache::Fill(const TrkString& Username, uint64_t Generation, const TrkString& Ticket, int64_t EndTimeUnix)
+{
+	const std::string username(Username.c_str());
+	Shard& shard = GetShard(username);
+
+	std::unique_lock<std::shared_mutex> lock(shard.mutex);
+	if (shard.generation != Generation)
+	{
+		// A write happened while the database was read, the value may be outdated
+		return;
+	}
+
+	if (shard.entries.find(username) == shard.entries.end())
+	{
+		Put(shard, username, Ticket, EndTimeUnix);
+	}
+}
+
+void TrkTicketCache::Store(const TrkString& Username, const TrkString& Ticket, int64_t EndTimeUnix, uint64_t Sequence)
+{
+	const std::string username(Username.c_str());
+	Shard& shard = GetShard(username);
+
+	std::unique_lock<std::shared_mutex> lock(shard.mutex);
+	shard.generation++;
+	if (Sequence < shard.last_sequence)
+	{
+		// A later write was stored first, the database may already hold a newer value of this user
+		shard.entries.erase(username);
+		return;
+	}
+
+	shard.last_sequence = Sequence;
+	Put(shard, username, Ticket, EndTimeUnix);
+}
+
+void TrkTicketCache::Invalidate(const TrkString& Username)
+{
+	const std::string username(Username.c_str());
+	Shard& shard = GetShard(username);
+
+	std::unique_lock<std::shared_mutex> lock(shard.mutex);
+	shard.generation++;
+	shard.entries.erase(username);
+}
+
+void TrkTicketCache::Put(Shard& shard, const std::string& Username, const TrkString& Ticket, int64_t EndTimeUnix)
+{
+	auto it = shard.entries.find(Username);
+	if (it != shard.entries.end())
+	{
+		it->second.ticket = Ticket;
+		it->second.end_time_unix = EndTimeUnix;
+		return;
+	}
+
+	if (shard.entries.size() >= TRK_TICKET_CACHE_SHARD_SIZE)
+	{
+		// Dropping any entry is fine, it is loaded again on its next use
+		shard.entries.erase(shard.entries.begin());
+	}
+
+	shard.entries.emplace(Username, Entry{ Ticket, EndTimeUnix });
+}
@@ -0,0 +1,102 @@
+/*
+ *	ticketcache.h
+ *
+ *	In-memory session ticket cache of Tintirek's server
+ */
+
+#ifndef TRK_TICKETCACHE_H
+#define TRK_TICKETCACHE_H
+
+
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+#include "metrics.h"
+
+
+/* Number of independently locked shards */
+#define TRK_TICKET_CACHE_SHARDS 16
+
+/* Maximum number of users kept in a single shard */
+#define TRK_TICKET_CACHE_SHARD_SIZE 4096
+
+
+/*
+ *	Ticket cache
+ *
+ *	Maps usernames to their session ticket and its expiry time. Writes
+ *	to the user database go through this cache, so a cached entry is
+ *	always the current database value and repeat clients authenticate
+ *	without touching SQLite.
+ *
+ *	Stores run after their commit and can arrive out of order, each one
+ *	carries the sequence its write took on the database writer thread.
+ *	A store older than the last one of its shard only drops the entry of
+ *	its user, two concurrent logins can not leave the older ticket cached.
+ *
+ *	Entries loaded after a cache miss are only stored if no write hit
+ *	the same shard while the database was being read, an older value
+ *	can never replace a newer one this way.
+ */
+class TrkTicketCache
+{
+public:
+	/* Returns the process-wide cache */
+	static TrkTicketCache& Get();
+
+	/* Finds the ticket of given user, returns false on a cache miss */
+	bool Find(const TrkString& Username, TrkString& Ticket, int64_t& EndTimeUnix);
+
+	/* Returns the value to pass to Fill before reading the database after a miss */
+	uint64_t BeginFill(const TrkString& Username) const;
+	/* Stores a value read from the database unless it was written meanwhile */
+	void Fill(const TrkString& Username, uint64_t Generation, const TrkString& Ticket, int64_t EndTimeUnix);
+
+	/* Returns the sequence of a write, must be called by the mutation on the database writer thread */
+	uint64_t NextWriteSequence() { return write_sequence.fetch_add(1) + 1; }
+	/* Stores a value written to the database by the write of given sequence */
+	void Store(const TrkString& Username, const TrkString& Ticket, int64_t EndTimeUnix, uint64_t Sequence);
+	/* Drops the entry of given user */
+	void Invalidate(const TrkString& Username);
+
+	/* Lookups answered from memory */
+	TrkCounter hits;
+	/* Lookups that had to read the database */
+	TrkCounter misses;
+
+private:
+	TrkTicketCache() = default;
+
+	struct Entry
+	{
+		TrkString ticket;
+		int64_t end_time_unix;
+	};
+
+	struct Shard
+	{
+		mutable std::shared_mutex mutex;
+		std::unordered_map<std::string, Entry> entries;
+		/* Incremented by every write of this shard */
+		uint64_t generation = 0;
+		/* Sequence of the newest write stored in this shard */
+		uint64_t last_sequence = 0;
+	};
+
+	/* Returns the shard of given user */
+	Shard& GetShard(const std::string& Username);
+	const Shard& GetShard(const std::string& Username) const;
+
+	/* Inserts or replaces an entry, shard must be locked exclusively */
+	static void Put(Shard& shard, const std::string& Username, const TrkString& Ticket, int64_t EndTimeUnix);
+
+	Shard shards[TRK_TICKET_CACHE_SHARDS];
+	/* Sequence of the last database write */
+	std::atomic<uint64_t> write_sequence{ 0 };
+};
+
+
+#endif /* TRK_TICKETCACHE_H */
@@ -0,0 +1,311 @@
+/*
+ *	ticketsigner.cpp
+ *
+ *	Signed session tickets of Tintirek's server
+ */
+
+
+#include "ticketsigner.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "crypto.h"
+
+namespace fs = std::filesystem;
+
+
+/* Returns the current unix time */
+static int64_t GetUnixTime()
+{
+	return static_cast<int64_t>(std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()));
+}
+
+/* Returns hex digits of given string */
+static std::string ToHex(const TrkString& Value)
+{
+	std::string hex(Value.size() * 2, '\0');
+	TrkCryptoHelper::HexEncode(reinterpret_cast<const unsigned char*>(Value.c_str()), Value.size(), &hex[0]);
+	return hex;
+}
+
+/* Decodes hex digits into bytes, returns false on invalid input */
+static bool FromHex(const std::string& Hex, unsigned char* Output, size_t Length)
+{
+	if (Hex.size() != Length * 2)
+	{
+		return false;
+	}
+
+	for (size_t i = 0; i < Length; i++)
+	{
+		unsigned int byte;
+		if (std::sscanf(Hex.c_str() + i * 2, "%2x", &byte) != 1)
+		{
+			return false;
+		}
+		Output[i] = static_cast<unsigned char>(byte);
+	}
+
+	return true;
+}
+
+/* Creates the key file, it is only ever readable by the owner */
+static bool CreateKeyFile(const fs::path& Path, const std::string& Contents)
+{
+#ifdef _WIN32
+	std::ofstream key_file(Path, std::ios::trunc);
+	if (!key_file.is_open())
+	{
+		return false;
+	}
+	key_file << Contents;
+	key_file.close();
+	return !key_file.fail();
+#else
+	// Permissions are set at creation, there is no moment the key is readable by others
+	const int descriptor = open(Path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if (descriptor < 0)
+	{
+		return false;
+	}
+
+	size_t written = 0;
+	while (written < Contents.size())
+	{
+		const ssize_t result = write(descriptor, Contents.data() + written, Contents.size() - written);
+		if (result <= 0)
+		{
+			break;
+		}
+		written += static_cast<size_t>(result);
+	}
+
+	const bool synced = written == Contents.size() && fsync(descriptor) == 0;
+	close(descriptor);
+	if (!synced)
+	{
+		unlink(Path.c_str());
+	}
+	return synced;
+#endif
+}
+
+
+TrkTicketSigner& TrkTicketSigner::Get()
+{
+	static TrkTicketSigner signer;
+	return signer;
+}
+
+bool TrkTicketSigner::Init(const TrkString& RootDir, TrkString& ErrorStr)
+{
+	const fs::path key_path = fs::path(RootDir.c_str()) / TRK_TICKET_KEY_FILE;
+
+	if (fs::exists(key_path))
+	{
+		std::ifstream key_file(key_path);
+		std::string hex;
+		key_file >> hex;
+
+		if (!FromHex(hex, key, TRK_TICKET_KEY_SIZE))
+		{
+			ErrorStr << "Ticket key file is not valid: " << key_path.string();
+			return false;
+		}
+	}
+	else
+	{
+		if (!TrkCryptoHelper::RandomBytes(key, TRK_TICKET_KEY_SIZE))
+		{
+			ErrorStr << "Ticket key could not be generated.";
+			return false;
+		}
+
+		char hex[TRK_TICKET_KEY_SIZE * 2 + 1];
+		TrkCryptoHelper::HexEncode(key, TRK_TICKET_KEY_SIZE, hex);
+		hex[TRK_TICKET_KEY_SIZE * 2] = '\0';
+
+		if (!CreateKeyFile(key_path, std::string(hex) + "\n"))
+		{
+			ErrorStr << "Ticket key file could not be created: " << key_path.string();
+			return false;
+		}
+	}
+
+	// Key id lets us refuse tickets of a replaced key without checking their signature
+	char key_hex[TRK_TICKET_KEY_SIZE * 2 + 1];
+	TrkCryptoHelper::HexEncode(key, TRK_TICKET_KEY_SIZE, key_hex);
+	key_hex[TRK_TICKET_KEY_SIZE * 2] = '\0';
+	key_id = std::string(TrkCryptoHelper::SHA256(key_hex).c_str()).substr(0, 8);
+
+	revoked_path = (fs::path(RootDir.c_str()) / TRK_TICKET_REVOKED_FILE).string();
+	{
+		std::unique_lock<std::shared_mutex> lock(revoked_mutex);
+		const int64_t now = GetUnixTime();
+
+		std::ifstream revoked_file(revoked_path);
+		int64_t end_time;
+		std::string signature;
+		while (revoked_file >> end_time >> signature)
+		{
+			if (end_time > now)
+			{
+				revoked[signature] = end_time;
+			}
+		}
+		revoked_file.close();
+
+		// Rewrite without expired entries, so the file does not grow forever
+		std::ofstream compacted(revoked_path, std::ios::trunc);
+		for (const auto& entry : revoked)
+		{
+			compacted << entry.second << " " << entry.first << "\n";
+		}
+	}
+
+	enabled = true;
+	return true;
+}
+
+bool TrkTicketSigner::IsSignedTicket(const TrkString& Ticket)
+{
+	return Ticket.startswith(TRK_SIGNED_TICKET_PREFIX);
+}
+
+TrkString TrkTicketSigner::Issue(const TrkString& Username, int64_t EndTimeUnix) const
+{
+	std::stringstream body;
+	body << TRK_SIGNED_TICKET_PREFIX << ToHex(Username) << "." << EndTimeUnix << "." << key_id;
+
+	TrkString ticket(body.str().c_str());
+	ticket << "." << Sign(body.str());
+	issued.Increment();
+	return ticket;
+}
+
+bool TrkTicketSigner::Validate(const TrkString& Username, const TrkString& Ticket)
+{
+	Fields fields;
+	if (!enabled || !Parse(Ticket, fields)
+		|| fields.key_id != key_id
+		|| fields.username_hex != ToHex(Username)
+		|| fields.end_time_unix <= GetUnixTime())
+	{
+		refused.Increment();
+		return false;
+	}
+
+	std::stringstream body;
+	body << TRK_SIGNED_TICKET_PREFIX << fields.username_hex << "." << fields.end_time_unix << "." << fields.key_id;
+	if (!TrkCryptoHelper::ConstantTimeEquals(Sign(body.str()), fields.signature.c_str()))
+	{
+		refused.Increment();
+		return false;
+	}
+
+	{
+		std::shared_lock<std::shared_mutex> lock(revoked_mutex);
+		if (revoked.find(fields.signature) != revoked.end())
+		{
+			refused.Increment();
+			return false;
+		}
+	}
+
+	accepted.Increment();
+	return true;
+}
+
+void TrkTicketSigner::Revoke(const TrkString& Ticket)
+{
+	Fields fields;
+	if (!enabled || !Parse(Ticket, fields))
+	{
+		return;
+	}
+
+	const int64_t now = GetUnixTime();
+	if (fields.end_time_unix <= now)
+	{
+		// Already expired, nothing to remember
+		return;
+	}
+
+	std::unique_lock<std::shared_mutex> lock(revoked_mutex);
+	PruneRevoked(now);
+
+	if (revoked.emplace(fields.signature, fields.end_time_unix).second)
+	{
+		std::ofstream revoked_file(revoked_path, std::ios::app);
+		revoked_file << fields.end_time_unix << " " << fields.signature << "\n";
+	}
+}
+
+bool TrkTicketSigner::Parse(const TrkString& Ticket, Fields& Result)
+{
+	if (!IsSignedTicket(Ticket))
+	{
+		return false;
+	}
+
+	// <hex username>.<expiry>.<key id>.<signature>
+	std::string parts[4];
+	std::stringstream stream(std::string(Ticket.c_str()).substr(sizeof(TRK_SIGNED_TICKET_PREFIX) - 1));
+	for (std::string& part : parts)
+	{
+		if (!std::getline(stream, part, '.') || part.empty())
+		{
+			return false;
+		}
+	}
+
+	std::string rest;
+	if (std::getline(stream, rest, '.'))
+	{
+		return false;
+	}
+
+	char* end = nullptr;
+	Result.end_time_unix = std::strtoll(parts[1].c_str(), &end, 10);
+	if (end == nullptr || *end != '\0')
+	{
+		return false;
+	}
+
+	Result.username_hex = parts[0];
+	Result.key_id = parts[2];
+	Result.signature = parts[3];
+	return true;
+}
+
+TrkString TrkTicketSigner::Sign(const std::string& Body) const
+{
+	return TrkCryptoHelper::HMACSHA256(key, TRK_TICKET_KEY_SIZE, Body.c_str());
+}
+
+void TrkTicketSigner::PruneRevoked(int64_t Now)
+{
+	for (auto it = revoked.begin(); it != revoked.end();)
+	{
+		if (it->second <= Now)
+		{
+			it = revoked.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
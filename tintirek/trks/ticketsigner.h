@@ -0,0 +1,101 @@
+/*
+ *	ticketsigner.h
+ *
+ *	Signed session tickets of Tintirek's server
+ */
+
+#ifndef TRK_TICKETSIGNER_H
+#define TRK_TICKETSIGNER_H
+
+
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+#include "metrics.h"
+
+
+/* Prefix of signed tickets, tickets without it are checked against the user database */
+#define TRK_SIGNED_TICKET_PREFIX "trk1."
+
+/* Length of the ticket signing key in bytes */
+#define TRK_TICKET_KEY_SIZE 32
+
+/* Name of the signing key file in the server root */
+#define TRK_TICKET_KEY_FILE "ticket.key"
+
+/* Name of the revoked ticket list in the server root */
+#define TRK_TICKET_REVOKED_FILE "ticket.revoked"
+
+
+/*
+ *	Ticket signer
+ *
+ *	Issues tickets in the form
+ *
+ *		trk1.<hex username>.<expiry>.<key id>.<HMAC-SHA-256>
+ *
+ *	signed with a key kept in the server root. Validating one needs no
+ *	database access, only the small revocation set filled by Logout is
+ *	checked. Revocations are appended to a file, so a restart does not
+ *	make a logged out ticket valid again.
+ */
+class TrkTicketSigner
+{
+public:
+	/* Returns the process-wide signer */
+	static TrkTicketSigner& Get();
+
+	/* Loads or creates the signing key and loads revocations, enables signed tickets */
+	bool Init(const TrkString& RootDir, TrkString& ErrorStr);
+	/* Returns true if signed tickets are issued */
+	bool IsEnabled() const { return enabled; }
+
+	/* Returns true if given ticket is in the signed format */
+	static bool IsSignedTicket(const TrkString& Ticket);
+
+	/* Issues a ticket for given user, valid until given unix time */
+	TrkString Issue(const TrkString& Username, int64_t EndTimeUnix) const;
+	/* Validates signature, owner, expiry and revocation of given ticket */
+	bool Validate(const TrkString& Username, const TrkString& Ticket);
+	/* Revokes given ticket until it expires */
+	void Revoke(const TrkString& Ticket);
+
+	/* Tickets issued */
+	mutable TrkCounter issued;
+	/* Tickets accepted */
+	TrkCounter accepted;
+	/* Tickets refused */
+	TrkCounter refused;
+
+private:
+	TrkTicketSigner() = default;
+
+	/* Parsed fields of a signed ticket */
+	struct Fields
+	{
+		std::string username_hex;
+		int64_t end_time_unix = 0;
+		std::string key_id;
+		std::string signature;
+	};
+
+	/* Splits a signed ticket into its fields */
+	static bool Parse(const TrkString& Ticket, Fields& Result);
+	/* Returns the signature of the ticket body */
+	TrkString Sign(const std::string& Body) const;
+	/* Drops expired revocations, lock must be held exclusively */
+	void PruneRevoked(int64_t Now);
+
+	bool enabled = false;
+	unsigned char key[TRK_TICKET_KEY_SIZE] = { 0 };
+	std::string key_id;
+	std::string revoked_path;
+
+	mutable std::shared_mutex revoked_mutex;
+	/* Signatures of revoked tickets and their expiry */
+	std::unordered_map<std::string, int64_t> revoked;
+};
+
+
+#endif /* TRK_TICKETSIGNER_H */
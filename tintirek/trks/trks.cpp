@@ -30,8 +30,11 @@
 #include "config.h"
 #include "database.h"
 #include "logger.h"
+#include "maintenance.h"
 #include "server.h"
 #include "service.h"
+#include "ticketsigner.h"
+#include "tracing.h"
 
 namespace fs = std::filesystem;
 
@@ -47,9 +50,11 @@ const TrkCliOptionFlag trk_cli_options[] =
 	TrkCliOptionFlag('l', TrkString("Defines log file path")),
 #endif
 
+	TrkCliOptionFlag('j', TrkString("Writes log output as structured JSON lines")),
 	TrkCliOptionFlag('p', TrkString("Sets server running port")),
 	TrkCliOptionFlag('r', TrkString("Sets server root directory")),
-	TrkCliOptionFlag('s', TrkString("Sets SSL path containing the server SSL credential files"), TrkString("Path"))
+	TrkCliOptionFlag('s', TrkString("Sets SSL path containing the server SSL credential files"), TrkString("Path")),
+	TrkCliOptionFlag('t', TrkString("Issues signed session tickets validated without the user database"))
 };
 
 
@@ -69,7 +74,7 @@ void print_help(bool print_legal = false)
 		std::cout << "Tintirek Version Control Software Server Program by TeamCyberless." << std::endl;
 	}
 
-	std::cout << std::endl << "Usage: trk [-d] [-i <pid_file>] [-p <port>] [-r <path>] [-s <ssl files path>]" << std::endl << std::endl;
+	std::cout << std::endl << "Usage: trk [-d] [-i <pid_file>] [-j] [-p <port>] [-r <path>] [-s <ssl files path>] [-t]" << std::endl << std::endl;
 
 	std::cout << "Flags:" << std::endl;
 	for (const auto flag : trk_cli_options)
@@ -167,6 +172,10 @@ int main(int argc, char** argv)
 				}
 				break;
 #endif
+			case 'j':
+				opt_result.structured_log = true;
+				break;
+
 			case 'p':
             {
             	TrkString optarg;
@@ -217,6 +226,10 @@ int main(int argc, char** argv)
 				}
 				break;
 
+			case 't':
+				opt_result.signed_tickets = true;
+				break;
+
 			default:
 				std::cerr << "Unknown parameter [-" << opt << "]" << std::endl;
 				print_help();
@@ -225,6 +238,14 @@ int main(int argc, char** argv)
 		}
 	}
 
+    if (opt_result.structured_log)
+    {
+        TrkLogger::Get().SetFormat(TrkLogFormat::STRUCTURED);
+    }
+
+    TrkTracer::Get().SetProcessName("trks");
+    TrkTracer::Get().SetEnabled(true);
+
     if (opt_result.pid_file == "")
     {
         if (opt_result.log_path != "")
@@ -247,15 +268,42 @@ int main(int argc, char** argv)
         opt_result.running_root << fs::current_path().string() << (char)fs::path::preferred_separator;
 	}
 
+	TrkConfig::LoadConfig(&opt_result);
+
 	{
 		LOG_OUT("Check and generate databases...");
 		auto dbInitStart = std::chrono::high_resolution_clock::now();
 
-        InitDatabases(opt_result.running_root);
+		try
+		{
+			InitDatabases(opt_result.running_root, opt_result);
+		}
+		catch (const TrkSqlite::TrkDatabaseException& ex)
+		{
+			LOG_ERR("Failed to open databases: " << ex.what());
+			return EXIT_FAILURE;
+		}
+
+		if (!InitObjectStore(opt_result.running_root))
+		{
+			LOG_ERR("Failed to open object store in " << opt_result.running_root << "objects");
+			return EXIT_FAILURE;
+		}
 
 		LOG_OUT("Database generation done! Took " << std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::high_resolution_clock::now() - dbInitStart).count() << " seconds.");
 	}
 
+	if (opt_result.signed_tickets)
+	{
+		TrkString ErrorStr;
+		if (!TrkTicketSigner::Get().Init(opt_result.running_root, ErrorStr))
+		{
+			LOG_ERR("Failed to initialize ticket signer: " << ErrorStr);
+			return EXIT_FAILURE;
+		}
+		LOG_OUT("Signed tickets enabled.");
+	}
+
 #ifdef _WIN32
 	TrkWindowsService service;
     TrkWindowsServer server(opt_result.port_number, &opt_result);
@@ -290,6 +338,19 @@ int main(int argc, char** argv)
 
 		LOG_OUT("==========================")
 
+		// After the daemon fork, threads and database connections do not survive it
+		try
+		{
+			OpenDatabases(opt_result.running_root, opt_result);
+		}
+		catch (const TrkSqlite::TrkDatabaseException& ex)
+		{
+			LOG_ERR("Failed to open databases: " << ex.what());
+			service.ServiceNotifyStop();
+			return EXIT_FAILURE;
+		}
+		TrkDatabaseMaintenance::Get().Start(opt_result);
+
 		while (!service.DoesServiceStopping())
 		{
 			service.ServiceRunning();
@@ -310,6 +371,7 @@ int main(int argc, char** argv)
 		}
 
 		LOG_OUT("Stopping Server...")
+		TrkDatabaseMaintenance::Get().Stop();
 		service.ServiceNotifyStop();
 	}
 	else